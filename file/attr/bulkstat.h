@@ -0,0 +1,193 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _BULKSTAT_H_
+#define _BULKSTAT_H_
+
+/*
+ * Field-selective stat.  On Linux, statx() is asked for just the fields
+ * wanted, which lets network and FUSE file systems skip fetching the rest,
+ * and with BS_NOSYNC it may answer from cached attributes.  Elsewhere it
+ * falls back to fstatat() and picks the fields out of the struct stat.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+enum bs_field {
+	BF_SIZE, BF_MTIME, BF_ATIME, BF_CTIME, BF_BTIME, BF_MODE, BF_UID,
+	BF_GID, BF_INO, BF_NLINK, BF_BLOCKS, BF_NFIELDS
+};
+
+#ifdef STATX_BASIC_STATS
+#define BS_STATX	1
+#else
+#define STATX_SIZE	0
+#define STATX_MTIME	0
+#define STATX_ATIME	0
+#define STATX_CTIME	0
+#define STATX_BTIME	0
+#define STATX_MODE	0
+#define STATX_TYPE	0
+#define STATX_UID	0
+#define STATX_GID	0
+#define STATX_INO	0
+#define STATX_NLINK	0
+#define STATX_BLOCKS	0
+#endif
+
+static const struct {
+	const char	*name;
+	unsigned int	mask;		/* statx() bits it needs */
+} bs_fields[BF_NFIELDS] = {
+	{ "size", STATX_SIZE },
+	{ "mtime", STATX_MTIME },
+	{ "atime", STATX_ATIME },
+	{ "ctime", STATX_CTIME },
+	{ "btime", STATX_BTIME },
+	{ "mode", STATX_MODE | STATX_TYPE },
+	{ "uid", STATX_UID },
+	{ "gid", STATX_GID },
+	{ "ino", STATX_INO },
+	{ "nlink", STATX_NLINK },
+	{ "blocks", STATX_BLOCKS },
+};
+
+#define BS_FOLLOW	0x01	/* Follow a final symbolic link */
+#define BS_NOSYNC	0x02	/* Cached attributes will do */
+
+/* What one stat call returned, times in nanoseconds since the Epoch */
+struct bsrec {
+	uint32_t	br_valid;	/* 1 << BF_* for each field filled */
+	uint64_t	br_val[BF_NFIELDS];
+};
+
+/*
+ * Parses a comma separated list of field names into a 1 << BF_* set,
+ * 0 if a name is unknown.
+ */
+static inline uint32_t
+bs_parse(const char *list)
+{
+	char buf[BUF_SIZE], *tok, *save;
+	uint32_t set = 0;
+	int i;
+
+	if (strlen(list) >= sizeof(buf))
+		return 0;
+	strcpy(buf, list);
+	for (tok = strtok_r(buf, ",", &save); tok != NULL;
+		tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < BF_NFIELDS; i++)
+			if (strcmp(tok, bs_fields[i].name) == 0)
+				break;
+		if (i == BF_NFIELDS)
+			return 0;
+		set |= 1U << i;
+	}
+
+	return set;
+}
+
+#define BS_NS(sec, nsec)	((uint64_t)(sec) * 1000000000 + (uint64_t)(nsec))
+
+/* Stats 'path' relative to 'dirfd' for the fields in 'set' */
+static inline int
+bs_stat(int dirfd, const char *path, uint32_t set, int flags,
+	struct bsrec *br)
+{
+#ifdef BS_STATX
+	struct statx stx;
+	unsigned int mask = 0;
+	int i, atflags = AT_NO_AUTOMOUNT;
+
+	for (i = 0; i < BF_NFIELDS; i++)
+		if (set & (1U << i))
+			mask |= bs_fields[i].mask;
+	if (!(flags & BS_FOLLOW))
+		atflags |= AT_SYMLINK_NOFOLLOW;
+	if (flags & BS_NOSYNC)
+		atflags |= AT_STATX_DONT_SYNC;
+	if (statx(dirfd, path, atflags, mask, &stx) == -1)
+		return -1;
+
+	/* A file system may leave out fields it was asked for */
+	br->br_valid = 0;
+	for (i = 0; i < BF_NFIELDS; i++)
+		if ((set & (1U << i)) &&
+			(stx.stx_mask & bs_fields[i].mask) == bs_fields[i].mask)
+			br->br_valid |= 1U << i;
+	br->br_val[BF_SIZE] = stx.stx_size;
+	br->br_val[BF_MTIME] = BS_NS(stx.stx_mtime.tv_sec,
+		stx.stx_mtime.tv_nsec);
+	br->br_val[BF_ATIME] = BS_NS(stx.stx_atime.tv_sec,
+		stx.stx_atime.tv_nsec);
+	br->br_val[BF_CTIME] = BS_NS(stx.stx_ctime.tv_sec,
+		stx.stx_ctime.tv_nsec);
+	br->br_val[BF_BTIME] = BS_NS(stx.stx_btime.tv_sec,
+		stx.stx_btime.tv_nsec);
+	br->br_val[BF_MODE] = stx.stx_mode;
+	br->br_val[BF_UID] = stx.stx_uid;
+	br->br_val[BF_GID] = stx.stx_gid;
+	br->br_val[BF_INO] = stx.stx_ino;
+	br->br_val[BF_NLINK] = stx.stx_nlink;
+	br->br_val[BF_BLOCKS] = stx.stx_blocks;
+#else
+	struct stat st;
+
+	if (fstatat(dirfd, path, &st,
+		(flags & BS_FOLLOW) ? 0 : AT_SYMLINK_NOFOLLOW) == -1)
+		return -1;
+
+	br->br_valid = set;
+	br->br_val[BF_SIZE] = st.st_size;
+	br->br_val[BF_MTIME] = BS_NS(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+	br->br_val[BF_ATIME] = BS_NS(st.st_atim.tv_sec, st.st_atim.tv_nsec);
+	br->br_val[BF_CTIME] = BS_NS(st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+#ifdef __FreeBSD__
+	br->br_val[BF_BTIME] = BS_NS(st.st_birthtim.tv_sec,
+		st.st_birthtim.tv_nsec);
+#else
+	br->br_valid &= ~(1U << BF_BTIME);
+#endif
+	br->br_val[BF_MODE] = st.st_mode;
+	br->br_val[BF_UID] = st.st_uid;
+	br->br_val[BF_GID] = st.st_gid;
+	br->br_val[BF_INO] = st.st_ino;
+	br->br_val[BF_NLINK] = st.st_nlink;
+	br->br_val[BF_BLOCKS] = st.st_blocks;
+#endif
+
+	return 0;
+}
+
+#endif	/* !_BULKSTAT_H_ */
@@ -29,36 +29,390 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* statx() */
+#endif
 #include "unibsd.h"
+#include "benchutil.h"
 #include <sys/types.h>	/* major(), minor() */
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <time.h>	/* ctime() */
+#include "arena.h"
+#include "objpool.h"
+#include "bulkstat.h"
+#include "../dir/treewalk.h"
+
+#define BATCH		512		/* Paths per stdin work item */
+#define OUTBUFSZ	(64 * 1024)
+
+/*
+ * Binary output: a struct gsthdr, then per path a struct gstrec followed
+ * by a uint64_t for each field in gh_fields, lowest BF_* first, and the
+ * path without its NUL, padded to 8 bytes.  gr_valid tells which fields
+ * the file system filled in.
+ */
+#define GST_MAGIC	0x42545347	/* "GSTB" */
+
+struct gsthdr {
+	uint32_t	gh_magic;
+	uint32_t	gh_fields;
+};
+
+struct gstrec {
+	uint32_t	gr_len;		/* Of the whole record */
+	uint32_t	gr_valid;
+};
+
+struct outbuf {
+	char		ob_buf[OUTBUFSZ];
+	size_t		ob_len;
+	uint64_t	ob_nstat;
+	uint64_t	ob_errors;
+} __attribute__((aligned(64)));
+
+/*
+ * A batch of paths read from stdin. The paths are allocated from the batch's
+ * own arena, and go with it in one call once the batch is done.
+ */
+struct batch {
+	char		*b_path[BATCH];
+	int		b_cnt;
+	struct arena	b_arena;
+};
+
+static struct {
+	uint32_t	set;		/* Fields wanted */
+	int		flags;		/* BS_* */
+	bool		binary;
+	struct outbuf	*obufs;
+	pthread_mutex_t	outmtx;
+
+	/* Stdin mode: batches from the reader to the workers */
+	struct batch	**queue;
+	int		qhead;
+	int		qcnt;
+	int		qcap;
+	bool		eof;
+	pthread_mutex_t	qmtx;
+	pthread_cond_t	qcnd;
+	struct objpool	bpool;		/* Of struct batch */
+} g = {
+	.outmtx = PTHREAD_MUTEX_INITIALIZER,
+	.qmtx = PTHREAD_MUTEX_INITIALIZER,
+	.qcnd = PTHREAD_COND_INITIALIZER,
+};
 
 static void display_statinfo(const struct stat *);
 static char * file_perms(mode_t, int);
+static void bulk_stdin(int, char);
+static void *stdin_worker(void *);
+static int walk_entry(struct twent *, void *);
+static void emit(struct outbuf *, int, const char *, const char *);
+static void outflush(struct outbuf *);
+static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
 	struct stat st;
+	struct treewalk tw;
+	struct gsthdr gh;
+	int op, i, nthrs = 1;
+	char delim = '\n';
+	const char *fields = "size,mtime";
+	bool walk = false, verbose = false;
+	uint64_t start, ns, nstat = 0, errors = 0;
+
+	/* The original one-file form: getstat file [-l] */
+	if (argc >= 2 && argc <= 3 && argv[1][0] != '-' &&
+		(argc == 2 || strcmp(argv[2], "-l") == 0)) {
+		if (argc == 2) {
+			if (stat(argv[1], &st) == -1)
+				errmsg_exit1("stat failure, %s\n", ERR_MSG);
+		} else {
+			if (lstat(argv[1], &st) == -1)
+				errmsg_exit1("lstat failure, %s\n", ERR_MSG);
+		}
+
+		display_statinfo(&st);
+		return 0;
+	}
+
+	while ((op = getopt(argc, argv, "f:j:rLdb0v")) != -1) {
+		switch (op) {
+		case 'f':
+			fields = optarg;
+			break;
+		case 'j':
+			nthrs = getint(optarg);
+			break;
+		case 'r':
+			walk = true;
+			break;
+		case 'L':
+			g.flags |= BS_FOLLOW;
+			break;
+		case 'd':
+			g.flags |= BS_NOSYNC;
+			break;
+		case 'b':
+			g.binary = true;
+			break;
+		case '0':
+			delim = '\0';
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if ((g.set = bs_parse(fields)) == 0 || nthrs < 1 ||
+		nthrs > TW_MAXTHRS || (walk && optind == argc) ||
+		(!walk && optind != argc))
+		usage_info(argv[0]);
 
-	if (argc < 2 || argc > 3) {
-		errmsg_exit1("Usage: %s file [-l]\n"
-			"-l = use lstat() instend of stat().\n", argv[0]);
+	g.obufs = xcalloc(nthrs, sizeof(struct outbuf));
+	if (g.binary) {
+		gh.gh_magic = GST_MAGIC;
+		gh.gh_fields = g.set;
+		memcpy(g.obufs[0].ob_buf, &gh, sizeof(gh));
+		g.obufs[0].ob_len = sizeof(gh);
+	} else {
+		g.obufs[0].ob_len = sprintf(g.obufs[0].ob_buf, "path");
+		for (i = 0; i < BF_NFIELDS; i++)
+			if (g.set & (1U << i))
+				g.obufs[0].ob_len += sprintf(g.obufs[0].ob_buf +
+					g.obufs[0].ob_len, ",%s",
+					bs_fields[i].name);
+		g.obufs[0].ob_buf[g.obufs[0].ob_len++] = '\n';
 	}
+	outflush(&g.obufs[0]);
 
-	if (argc == 2) {
-		if (stat(argv[1], &st) == -1)
-			errmsg_exit1("stat failure, %s\n", ERR_MSG);
+	start = bench_nsec();
+	if (walk) {
+		/* Each entry is stat'ed relative to its directory's fd */
+		tw_init(&tw, TW_RECURSE, nthrs, TW_BUFSZ, walk_entry, NULL);
+		tw_run(&tw, argv + optind, argc - optind);
+		for (i = 0; i < nthrs; i++)
+			errors += tw.tw_workers[i].tw_errors;
+		tw_free(&tw);
 	} else {
-		if (lstat(argv[1], &st) == -1)
-			errmsg_exit1("lstat failure, %s\n", ERR_MSG);
+		bulk_stdin(nthrs, delim);
+	}
+	for (i = 0; i < nthrs; i++) {
+		outflush(&g.obufs[i]);
+		nstat += g.obufs[i].ob_nstat;
+		errors += g.obufs[i].ob_errors;
 	}
+	ns = bench_nsec() - start;
 
-	display_statinfo(&st);
-	
-	return 0;
+	if (verbose)
+		fprintf(stderr, "%ju files, %ju errors, %.3f s, %.0f stats/s\n",
+			(uintmax_t)nstat, (uintmax_t)errors, bench_secs(ns),
+			(double)nstat / bench_secs(ns));
+	xfree(g.obufs);
+
+	exit(errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+ * Reads paths from stdin into batches and hands them to 'nthrs' workers
+ * through a bounded queue.
+ */
+static void
+bulk_stdin(int nthrs, char delim)
+{
+	pthread_t *tids;
+	struct batch *b = NULL;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	long i;
+	int r;
+
+	op_init(&g.bpool, sizeof(struct batch), OP_CACHEALIGN);
+	g.qcap = nthrs * 4;
+	g.queue = xcalloc(g.qcap, sizeof(struct batch *));
+	tids = xcalloc(nthrs, sizeof(pthread_t));
+	for (i = 0; i < nthrs; i++)
+		if ((r = pthread_create(&tids[i], NULL, stdin_worker,
+			(void *)i)) != 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+
+	for (;;) {
+		len = getdelim(&line, &cap, delim, stdin);
+		if (len > 0 && line[len - 1] == delim)
+			line[--len] = '\0';
+		if (len > 0) {
+			if (b == NULL) {
+				b = op_alloc(&g.bpool);
+				b->b_cnt = 0;
+				arena_init(&b->b_arena);
+			}
+			b->b_path[b->b_cnt] = arena_alloc(&b->b_arena,
+				len + 1);
+			memcpy(b->b_path[b->b_cnt++], line, len + 1);
+		}
+		if (b != NULL && (b->b_cnt == BATCH || len == -1)) {
+			pthread_mutex_lock(&g.qmtx);
+			while (g.qcnt == g.qcap)
+				pthread_cond_wait(&g.qcnd, &g.qmtx);
+			g.queue[(g.qhead + g.qcnt++) % g.qcap] = b;
+			pthread_cond_broadcast(&g.qcnd);
+			pthread_mutex_unlock(&g.qmtx);
+			b = NULL;
+		}
+		if (len == -1)
+			break;
+	}
+	if (ferror(stdin))
+		errmsg_exit1("reading stdin failed, %s\n", ERR_MSG);
+
+	pthread_mutex_lock(&g.qmtx);
+	g.eof = true;
+	pthread_cond_broadcast(&g.qcnd);
+	pthread_mutex_unlock(&g.qmtx);
+	for (i = 0; i < nthrs; i++)
+		if ((r = pthread_join(tids[i], NULL)) != 0)
+			errmsg_exit1("pthread_join failed, %s\n", strerror(r));
+
+	xfree(line);
+	xfree(tids);
+	xfree(g.queue);
+	op_destroy(&g.bpool);
+}
+
+static void *
+stdin_worker(void *arg)
+{
+	struct outbuf *ob = &g.obufs[(long)arg];
+	struct batch *b;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&g.qmtx);
+		while (g.qcnt == 0 && !g.eof)
+			pthread_cond_wait(&g.qcnd, &g.qmtx);
+		if (g.qcnt == 0) {
+			pthread_mutex_unlock(&g.qmtx);
+			break;
+		}
+		b = g.queue[g.qhead];
+		g.qhead = (g.qhead + 1) % g.qcap;
+		g.qcnt--;
+		pthread_cond_broadcast(&g.qcnd);
+		pthread_mutex_unlock(&g.qmtx);
+
+		for (i = 0; i < b->b_cnt; i++)
+			emit(ob, AT_FDCWD, b->b_path[i], b->b_path[i]);
+		arena_free(&b->b_arena);
+		op_free(&g.bpool, b);
+	}
+
+	return NULL;
+}
+
+static int
+walk_entry(struct twent *te, void *arg)
+{
+	struct outbuf *ob = &g.obufs[te->te_worker];
+
+	(void)arg;
+	emit(ob, te->te_dirfd, te->te_name, te->te_path);
+
+	return 1;
+}
+
+/* Stats 'name' relative to 'dirfd' and appends its record to 'ob' */
+static void
+emit(struct outbuf *ob, int dirfd, const char *name, const char *path)
+{
+	struct bsrec br;
+	struct gstrec gr;
+	size_t len, need, plen;
+	int i;
+	char *p;
+
+	if (bs_stat(dirfd, name, g.set, g.flags, &br) == -1) {
+		fprintf(stderr, "cannot stat '%s', %s\n", path, ERR_MSG);
+		ob->ob_errors++;
+		return;
+	}
+	ob->ob_nstat++;
+
+	plen = strlen(path);
+	need = g.binary ? sizeof(gr) + BF_NFIELDS * 8 + plen + 8 :
+		2 * plen + 3 + BF_NFIELDS * 21 + 1;
+	if (need > OUTBUFSZ)
+		errmsg_exit1("Path too long, %s\n", path);
+	if (OUTBUFSZ - ob->ob_len < need)
+		outflush(ob);
+	p = ob->ob_buf + ob->ob_len;
+
+	if (g.binary) {
+		gr.gr_valid = br.br_valid;
+		len = sizeof(gr);
+		for (i = 0; i < BF_NFIELDS; i++) {
+			if (!(g.set & (1U << i)))
+				continue;
+			memcpy(p + len, &br.br_val[i], sizeof(uint64_t));
+			len += sizeof(uint64_t);
+		}
+		memcpy(p + len, path, plen);
+		len += plen;
+		while (len % 8 != 0)
+			p[len++] = '\0';
+		gr.gr_len = len;
+		memcpy(p, &gr, sizeof(gr));
+	} else {
+		/* Quote paths that would break the CSV */
+		len = 0;
+		if (strpbrk(path, ",\"\n") != NULL) {
+			p[len++] = '"';
+			for (; *path != '\0'; path++) {
+				if (*path == '"')
+					p[len++] = '"';
+				p[len++] = *path;
+			}
+			p[len++] = '"';
+		} else {
+			memcpy(p, path, plen);
+			len = plen;
+		}
+		for (i = 0; i < BF_NFIELDS; i++) {
+			if (!(g.set & (1U << i)))
+				continue;
+			p[len++] = ',';
+			if (br.br_valid & (1U << i))
+				len += sprintf(p + len, "%ju",
+					(uintmax_t)br.br_val[i]);
+		}
+		p[len++] = '\n';
+	}
+	ob->ob_len += len;
+}
+
+static void
+outflush(struct outbuf *ob)
+{
+	size_t off;
+	ssize_t n;
+
+	pthread_mutex_lock(&g.outmtx);
+	for (off = 0; off < ob->ob_len; off += n)
+		if ((n = write(STDOUT_FILENO, ob->ob_buf + off,
+			ob->ob_len - off)) == -1)
+			errmsg_exit1("write failed, %s\n", ERR_MSG);
+	pthread_mutex_unlock(&g.outmtx);
+	ob->ob_len = 0;
 }
 
 static void
@@ -162,3 +516,25 @@ file_perms(mode_t perm, int flags)
 
 	return permstr;
 }
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s file [-l]\n", pname);
+	fprintf(stderr, "       %s [-f fields] [-j threads] [-L] [-d] [-b] [-0] "
+		"[-v] < paths\n", pname);
+	fprintf(stderr, "       %s -r [-f fields] [-j threads] [-L] [-d] [-b] "
+		"[-v] dir...\n", pname);
+	fprintf(stderr, "-l: use lstat() instead of stat().\n");
+	fprintf(stderr, "-f: comma separated fields, from size, mtime, atime, "
+		"ctime, btime, mode, uid, gid, ino, nlink, blocks "
+		"(default size,mtime).\n");
+	fprintf(stderr, "-j: threads making the stat calls (default 1).\n");
+	fprintf(stderr, "-r: stat every entry below each dir.\n");
+	fprintf(stderr, "-L: follow symbolic links.\n");
+	fprintf(stderr, "-d: cached attributes will do (AT_STATX_DONT_SYNC).\n");
+	fprintf(stderr, "-b: binary records instead of CSV.\n");
+	fprintf(stderr, "-0: paths on stdin end with NUL, not newline.\n");
+	fprintf(stderr, "-v: print counts and stats/sec to stderr.\n");
+	exit(EXIT_FAILURE);
+}
@@ -30,58 +30,152 @@
  *
  */
 #include "unibsd.h"
-#include <dirent.h>
+#include "benchutil.h"
+#include <getopt.h>
+#include "treewalk.h"
 
-static void lsfiles(const char *);
+#define OUTBUFSZ	(64 * 1024)
+
+/* Per worker output, written out whole lines at a time */
+struct outbuf {
+	char	ob_buf[OUTBUFSZ];
+	size_t	ob_len;
+} __attribute__((aligned(64)));
+
+static struct outbuf *outbufs;
+static pthread_mutex_t outmtx = PTHREAD_MUTEX_INITIALIZER;
+static bool quiet, showsize;
+
+static int lsentry(struct twent *, void *);
+static void outflush(struct outbuf *);
+static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
-	if (argc < 1)
-		errmsg_exit1("Usage: %s [dir-path...]\n", argv[0]);
+	int op, i, flags = 0, nthrs = 1;
+	size_t bufsz = TW_BUFSZ;
+	bool verbose = false;
+	char *dot[] = { ".", NULL };
+	struct treewalk tw;
+	struct twworker *w;
+	uint64_t start, ns, entries = 0, ndirs = 0, stats = 0, steals = 0;
+	uint64_t errors = 0;
+
+	while ((op = getopt(argc, argv, "rj:b:sqv")) != -1) {
+		switch (op) {
+		case 'r':
+			flags |= TW_RECURSE;
+			break;
+		case 'j':
+			nthrs = getint(optarg);
+			break;
+		case 'b':
+			bufsz = getsize(optarg);
+			break;
+		case 's':
+			showsize = true;
+			flags |= TW_STAT;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (nthrs < 1 || nthrs > TW_MAXTHRS || bufsz < 4096)
+		usage_info(argv[0]);
 
-	if (argc == 1)
-		lsfiles(".");
+	outbufs = xcalloc(nthrs, sizeof(struct outbuf));
+	tw_init(&tw, flags, nthrs, bufsz, lsentry, NULL);
+	start = bench_nsec();
+	if (optind == argc)
+		tw_run(&tw, dot, 1);
 	else
-		for (++argv; *argv; argv++)
-			lsfiles(*argv);
+		tw_run(&tw, argv + optind, argc - optind);
+	for (i = 0; i < nthrs; i++)
+		outflush(&outbufs[i]);
+	ns = bench_nsec() - start;
+
+	for (i = 0; i < nthrs; i++) {
+		w = &tw.tw_workers[i];
+		entries += w->tw_entries;
+		ndirs += w->tw_ndirs;
+		stats += w->tw_stats;
+		steals += w->tw_steals;
+		errors += w->tw_errors;
+	}
+	if (verbose)
+		fprintf(stderr, "%ju entries in %ju directories, %ju stats, "
+			"%ju steals, %.3f s, %.0f entries/s\n", (uintmax_t)entries,
+			(uintmax_t)ndirs, (uintmax_t)stats, (uintmax_t)steals,
+			bench_secs(ns), (double)entries / bench_secs(ns));
+	tw_free(&tw);
+	xfree(outbufs);
 
-	exit(EXIT_SUCCESS);
+	exit(errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
-static void
-lsfiles(const char *dirpath)
+static int
+lsentry(struct twent *te, void *arg)
 {
-	DIR *dirp;
-	struct dirent *dp;
-	bool iscurdir = false;
-
-	iscurdir = strcmp(dirpath, ".") == 0;	/* true if 'dirpath' is "." */
-
-	if ((dirp = opendir(dirpath)) == NULL)
-		errmsg_exit1("opendir failed on '%s', %s\n", dirpath, ERR_MSG);
-
-	/* 
-	 * For each entry in this directory,
-	 * print directory + filename.
-	 */
-	while(1) {
-		errno = 0;	/* To distinguish error from end-of-directory */
-		if ((dp = readdir(dirp)) == NULL)
-			break;
+	struct outbuf *ob = &outbufs[te->te_worker];
+	size_t room;
+	int n;
 
-		if (strcmp(dp->d_name, ".") == 0 ||
-			strcmp(dp->d_name, "..") == 0)
-			continue;	/* skip "." and ".." */
+	(void)arg;
+	if (quiet)
+		return 1;
 
-		if (!iscurdir)
-			printf("%s/", dirpath);
-		printf("%s\n", dp->d_name);
+	for (;;) {
+		room = OUTBUFSZ - ob->ob_len;
+		if (showsize && te->te_st != NULL)
+			n = snprintf(ob->ob_buf + ob->ob_len, room, "%jd\t%s\n",
+				(intmax_t)te->te_st->st_size, te->te_path);
+		else
+			n = snprintf(ob->ob_buf + ob->ob_len, room, "%s\n",
+				te->te_path);
+		if ((size_t)n < room)
+			break;
+		if (ob->ob_len == 0)
+			errmsg_exit1("Path too long, %s\n", te->te_path);
+		outflush(ob);
 	}
+	ob->ob_len += n;
+
+	return 1;
+}
 
-	if (errno != 0)
-		errmsg_exit1("readdir failed, %s\n", ERR_MSG);
+static void
+outflush(struct outbuf *ob)
+{
+	size_t off;
+	ssize_t n;
+
+	/* Workers share stdout, keep each buffer in one piece */
+	pthread_mutex_lock(&outmtx);
+	for (off = 0; off < ob->ob_len; off += n)
+		if ((n = write(STDOUT_FILENO, ob->ob_buf + off,
+			ob->ob_len - off)) == -1)
+			errmsg_exit1("write failed, %s\n", ERR_MSG);
+	pthread_mutex_unlock(&outmtx);
+	ob->ob_len = 0;
+}
 
-	if (closedir(dirp) == -1)
-		errmsg_exit1("closedir error, %s\n", ERR_MSG);
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-r] [-j threads] [-b bufsize] [-s] [-q] "
+		"[-v] [dir-path...]\n", pname);
+	fprintf(stderr, "-r: walk the whole tree below each directory.\n");
+	fprintf(stderr, "-j: worker threads sharing the walk (default 1).\n");
+	fprintf(stderr, "-b: bytes per getdents buffer (default 256k).\n");
+	fprintf(stderr, "-s: stat every entry and print its size.\n");
+	fprintf(stderr, "-q: print nothing, only count entries.\n");
+	fprintf(stderr, "-v: print counts and entries/sec to stderr.\n");
+	exit(EXIT_FAILURE);
 }
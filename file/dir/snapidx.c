@@ -0,0 +1,333 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* statx() */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <getopt.h>
+#include "../attr/bulkstat.h"
+#include "treewalk.h"
+#include "snapidx.h"
+
+/*
+ * A directory gets a new mtime when an entry is added, removed or renamed
+ * in it, but not when a file in it is written to.  So a directory whose
+ * inode and mtime match the old snapshot has the same entries as then,
+ * and is not read again: its files are taken from the snapshot and only
+ * its subdirectories are stat'ed to go on down.  Files rewritten in place
+ * in such directories are missed; -F stats everything to catch those.
+ */
+#define SI_FIELDS	(1U << BF_SIZE | 1U << BF_MTIME | 1U << BF_CTIME | \
+			1U << BF_MODE | 1U << BF_INO)
+#define SI_SLACK	1000000000	/* Coarse timestamps, ns */
+
+static struct {
+	struct snapidx	old;
+	struct snapidx	new;
+	bool		hasold;
+	bool		full;
+	uint64_t	nread;		/* Directories read */
+	uint64_t	nskip;		/* Directories taken from the snapshot */
+	uint64_t	nstat;
+	uint64_t	errors;
+} g;
+
+static void scan_dir(int, const char *, const struct sirec *);
+static void scan_child(int, const char *, const char *);
+static int namecmp(const void *, const void *);
+static uint64_t diff(bool);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, fd;
+	bool update = true, quiet = false, verbose = false;
+	const char *index, *root;
+	struct timespec ts;
+	struct bsrec br;
+	struct sirec sr;
+	uint64_t start, ns, nchg;
+
+	while ((op = getopt(argc, argv, "Fnqv")) != -1) {
+		switch (op) {
+		case 'F':
+			g.full = true;
+			break;
+		case 'n':
+			update = false;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage_info(argv[0]);
+	index = argv[optind];
+	root = argv[optind + 1];
+
+	if (si_open(&g.old, index) == 0)
+		g.hasold = true;
+	else if (errno != ENOENT)
+		errmsg_exit1("cannot open index '%s', %s\n", index, ERR_MSG);
+	if (g.hasold && strcmp(g.old.si_root, root) != 0)
+		errmsg_exit1("'%s' is an index of '%s', not '%s'\n", index,
+			g.old.si_root, root);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	si_init(&g.new, root, BS_NS(ts.tv_sec, ts.tv_nsec));
+	start = bench_nsec();
+
+	if ((fd = open(root, O_RDONLY | O_DIRECTORY)) == -1)
+		errmsg_exit1("cannot open '%s', %s\n", root, ERR_MSG);
+	if (bs_stat(AT_FDCWD, root, SI_FIELDS, BS_FOLLOW, &br) == -1)
+		errmsg_exit1("cannot stat '%s', %s\n", root, ERR_MSG);
+	g.nstat++;
+	sr.sr_ino = br.br_val[BF_INO];
+	sr.sr_size = br.br_val[BF_SIZE];
+	sr.sr_mtime = br.br_val[BF_MTIME];
+	sr.sr_ctime = br.br_val[BF_CTIME];
+	sr.sr_mode = br.br_val[BF_MODE];
+	si_add(&g.new, &sr, "");
+	scan_dir(fd, "", &sr);
+	close(fd);
+	ns = bench_nsec() - start;
+
+	nchg = diff(quiet);
+	if (verbose)
+		fprintf(stderr, "%zu entries, %ju changed, %ju directories read, "
+			"%ju skipped, %ju stats, %.3f s\n", g.new.si_nrec - 1,
+			(uintmax_t)nchg, (uintmax_t)g.nread,
+			(uintmax_t)g.nskip, (uintmax_t)g.nstat, bench_secs(ns));
+
+	if (update && si_write(&g.new, index) == -1)
+		errmsg_exit1("cannot write index '%s', %s\n", index, ERR_MSG);
+	si_close(&g.new);
+	if (g.hasold)
+		si_close(&g.old);
+
+	exit(g.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* Adds the entries below directory 'path', open as 'dfd', to the index */
+static void
+scan_dir(int dfd, const char *path, const struct sirec *self)
+{
+	struct tw_dirent *dp;
+	const struct sirec *o;
+	char *dbuf, *names = NULL, **sorted;
+	size_t nlen = 0, ncap = 0, cnt = 0, i, end, len;
+	long nread, pos;
+	ssize_t oi;
+
+	if (!g.full && g.hasold && (oi = si_find(&g.old, path)) != -1) {
+		o = &g.old.si_rec[oi];
+		if (S_ISDIR(o->sr_mode) && o->sr_ino == self->sr_ino &&
+			o->sr_mtime == self->sr_mtime &&
+			self->sr_mtime < g.old.si_time - SI_SLACK) {
+			/* Same entries as last time, walk the snapshot */
+			g.nskip++;
+			end = si_skip(&g.old, oi);
+			for (i = oi + 1; i < end; ) {
+				if (S_ISDIR(g.old.si_rec[i].sr_mode)) {
+					scan_child(dfd, path, SI_PATH(&g.old, i) +
+						(path[0] == '\0' ? 0 :
+						strlen(path) + 1));
+					i = si_skip(&g.old, i);
+				} else {
+					si_add(&g.new, &g.old.si_rec[i],
+						SI_PATH(&g.old, i));
+					i++;
+				}
+			}
+			return;
+		}
+	}
+
+	/* Changed or new: read it, and visit the entries in index order */
+	g.nread++;
+	dbuf = xmalloc(TW_BUFSZ);
+	while ((nread = tw_getdents(dfd, dbuf, TW_BUFSZ)) > 0) {
+		for (pos = 0; pos < nread; pos += dp->d_reclen) {
+			dp = (struct tw_dirent *)(dbuf + pos);
+			if (dp->d_name[0] == '.' && (dp->d_name[1] == '\0' ||
+				(dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+				continue;
+			len = strlen(dp->d_name) + 1;
+			if (nlen + len > ncap) {
+				ncap = MAX(ncap * 2, nlen + len + 4096);
+				if ((names = realloc(names, ncap)) == NULL)
+					errmsg_exit1("realloc failed, %s\n",
+						ERR_MSG);
+			}
+			memcpy(names + nlen, dp->d_name, len);
+			nlen += len;
+			cnt++;
+		}
+	}
+	if (nread == -1) {
+		fprintf(stderr, "getdents failed on '%s', %s\n", path, ERR_MSG);
+		g.errors++;
+	}
+	xfree(dbuf);
+
+	sorted = xmalloc((cnt + 1) * sizeof(char *));
+	for (i = 0, pos = 0; i < cnt; i++) {
+		sorted[i] = names + pos;
+		pos += strlen(names + pos) + 1;
+	}
+	qsort(sorted, cnt, sizeof(char *), namecmp);
+	for (i = 0; i < cnt; i++)
+		scan_child(dfd, path, sorted[i]);
+	xfree(sorted);
+	xfree(names);
+}
+
+/* Stats entry 'name' of directory 'dir' and descends if it is one */
+static void
+scan_child(int dfd, const char *dir, const char *name)
+{
+	struct bsrec br;
+	struct sirec sr;
+	char *path;
+	int fd;
+
+	g.nstat++;
+	if (bs_stat(dfd, name, SI_FIELDS, 0, &br) == -1) {
+		/* Gone since the directory was read, it shows as deleted */
+		if (errno != ENOENT) {
+			fprintf(stderr, "cannot stat '%s/%s', %s\n", dir, name,
+				ERR_MSG);
+			g.errors++;
+		}
+		return;
+	}
+	sr.sr_ino = br.br_val[BF_INO];
+	sr.sr_size = br.br_val[BF_SIZE];
+	sr.sr_mtime = br.br_val[BF_MTIME];
+	sr.sr_ctime = br.br_val[BF_CTIME];
+	sr.sr_mode = br.br_val[BF_MODE];
+	path = tw_join(dir, name);
+	si_add(&g.new, &sr, path);
+
+	if (S_ISDIR(sr.sr_mode)) {
+		if ((fd = openat(dfd, name, O_RDONLY | O_DIRECTORY |
+			O_NOFOLLOW)) == -1) {
+			fprintf(stderr, "cannot open '%s', %s\n", path, ERR_MSG);
+			g.errors++;
+		} else {
+			scan_dir(fd, path, &sr);
+			close(fd);
+		}
+	}
+	xfree(path);
+}
+
+static int
+namecmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Merges the old and new snapshots, both in index order, printing
+ * "A path", "M path" or "D path" for each change.  Returns the count.
+ */
+static uint64_t
+diff(bool quiet)
+{
+	const struct sirec *o, *n;
+	size_t i = 0, j = 0;
+	uint64_t nchg = 0;
+	const char *path;
+	int c;
+	char tag;
+
+	while (i < g.old.si_nrec || j < g.new.si_nrec) {
+		if (i == g.old.si_nrec)
+			c = 1;
+		else if (j == g.new.si_nrec)
+			c = -1;
+		else
+			c = si_pathcmp(SI_PATH(&g.old, i), SI_PATH(&g.new, j));
+
+		tag = '\0';
+		if (c < 0) {
+			tag = 'D';
+			i++;
+		} else if (c > 0) {
+			tag = 'A';
+			j++;
+		} else {
+			o = &g.old.si_rec[i];
+			n = &g.new.si_rec[j];
+			if (o->sr_ino != n->sr_ino || o->sr_size != n->sr_size ||
+				o->sr_mtime != n->sr_mtime ||
+				o->sr_ctime != n->sr_ctime ||
+				o->sr_mode != n->sr_mode)
+				tag = 'M';
+			i++;
+			j++;
+		}
+		if (tag == '\0')
+			continue;
+
+		nchg++;
+		path = c < 0 ? SI_PATH(&g.old, i - 1) : SI_PATH(&g.new, j - 1);
+		if (!quiet)
+			printf("%c %s\n", tag, path[0] == '\0' ? "." : path);
+	}
+
+	return nchg;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-F] [-n] [-q] [-v] index dir\n", pname);
+	fprintf(stderr, "Scans 'dir' against the snapshot in 'index', prints "
+		"A(dded), M(odified) and D(eleted) paths relative to 'dir' "
+		"and saves the new snapshot.\n");
+	fprintf(stderr, "-F: stat every entry, even in unchanged "
+		"directories.\n");
+	fprintf(stderr, "-n: leave the index as it was.\n");
+	fprintf(stderr, "-q: print no changes.\n");
+	fprintf(stderr, "-v: print counts and time to stderr.\n");
+	exit(EXIT_FAILURE);
+}
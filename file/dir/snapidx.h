@@ -0,0 +1,290 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _SNAPIDX_H_
+#define _SNAPIDX_H_
+
+/*
+ * A snapshot of a directory tree's metadata, kept on disk as one file and
+ * mapped read-only when used.  The file is a struct sihdr, an array of
+ * struct sirec and a table of NUL terminated paths relative to the root.
+ * Records are sorted by path with '/' ordering below every other byte, so
+ * each directory is followed directly by its whole subtree, children come
+ * in name order, and any subtree is one contiguous, binary searchable run.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SI_MAGIC	0x58444953	/* "SIDX" */
+#define SI_VERSION	1
+
+struct sihdr {
+	uint32_t	sh_magic;
+	uint32_t	sh_version;
+	uint64_t	sh_nrec;
+	uint64_t	sh_strsz;	/* Bytes of the path table */
+	int64_t		sh_time;	/* When the scan started, ns */
+	uint32_t	sh_root;	/* Path table offset of the root */
+	uint32_t	sh_pad;
+};
+
+struct sirec {
+	uint64_t	sr_ino;
+	uint64_t	sr_size;
+	int64_t		sr_mtime;	/* ns since the Epoch */
+	int64_t		sr_ctime;
+	uint32_t	sr_mode;
+	uint32_t	sr_path;	/* Path table offset */
+};
+
+/* An index being read, or built in memory */
+struct snapidx {
+	struct sirec	*si_rec;
+	size_t		si_nrec;
+	char		*si_str;
+	size_t		si_strsz;
+	int64_t		si_time;
+	const char	*si_root;
+
+	void		*si_map;	/* Mapped file, NULL when built */
+	size_t		si_mapsz;
+	size_t		si_reccap;
+	size_t		si_strcap;
+};
+
+#define SI_PATH(si, i)	((si)->si_str + (si)->si_rec[(i)].sr_path)
+
+/* strcmp() with '/' below any other byte, the order of the index */
+static inline int
+si_pathcmp(const char *a, const char *b)
+{
+	unsigned char ca, cb;
+
+	for (;; a++, b++) {
+		ca = *a == '/' ? 1 : (unsigned char)*a;
+		cb = *b == '/' ? 1 : (unsigned char)*b;
+		if (ca != cb || ca == '\0')
+			return ca - cb;
+	}
+}
+
+/* First record not below 'path' */
+static inline size_t
+si_lower(const struct snapidx *si, size_t lo, const char *path)
+{
+	size_t hi = si->si_nrec, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (si_pathcmp(SI_PATH(si, mid), path) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Index of the record for 'path', or -1 */
+static inline ssize_t
+si_find(const struct snapidx *si, const char *path)
+{
+	size_t i = si_lower(si, 0, path);
+
+	if (i < si->si_nrec && strcmp(SI_PATH(si, i), path) == 0)
+		return i;
+	return -1;
+}
+
+/* First record after 'i' that is not below record 'i' in the tree */
+static inline size_t
+si_skip(const struct snapidx *si, size_t i)
+{
+	const char *dir = SI_PATH(si, i);
+	size_t dl = strlen(dir), lo = i + 1, hi = si->si_nrec, mid;
+	const char *p;
+
+	/* Records of the subtree all start with "dir/" */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p = SI_PATH(si, mid);
+		if (dl == 0 || (strncmp(p, dir, dl) == 0 && p[dl] == '/'))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Maps an index file read-only; -1 with errno ENOENT if there is none */
+static inline int
+si_open(struct snapidx *si, const char *file)
+{
+	struct sihdr *sh;
+	struct stat st;
+	int fd;
+
+	memset(si, 0, sizeof(*si));
+	if ((fd = open(file, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*sh)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	si->si_mapsz = st.st_size;
+	si->si_map = mmap(NULL, si->si_mapsz, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (si->si_map == MAP_FAILED) {
+		si->si_map = NULL;
+		return -1;
+	}
+
+	sh = si->si_map;
+	if (sh->sh_magic != SI_MAGIC || sh->sh_version != SI_VERSION ||
+		sizeof(*sh) + sh->sh_nrec * sizeof(struct sirec) +
+		sh->sh_strsz != si->si_mapsz || sh->sh_strsz == 0 ||
+		sh->sh_root >= sh->sh_strsz) {
+		munmap(si->si_map, si->si_mapsz);
+		si->si_map = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+	si->si_nrec = sh->sh_nrec;
+	si->si_rec = (struct sirec *)(sh + 1);
+	si->si_str = (char *)(si->si_rec + si->si_nrec);
+	si->si_strsz = sh->sh_strsz;
+	si->si_time = sh->sh_time;
+	si->si_root = si->si_str + sh->sh_root;
+	(void)madvise(si->si_map, si->si_mapsz, MADV_RANDOM);
+
+	return 0;
+}
+
+/* Starts an empty index in memory for the tree at 'root' */
+static inline void
+si_init(struct snapidx *si, const char *root, int64_t now)
+{
+	memset(si, 0, sizeof(*si));
+	si->si_time = now;
+	si->si_strcap = 1024 * 1024;
+	si->si_str = xmalloc(si->si_strcap);
+	si->si_strsz = strlen(root) + 1;
+	memcpy(si->si_str, root, si->si_strsz);
+}
+
+/* Appends a record, which must sort after every record so far */
+static inline void
+si_add(struct snapidx *si, const struct sirec *sr, const char *path)
+{
+	size_t len = strlen(path) + 1;
+
+	if (si->si_nrec == si->si_reccap) {
+		si->si_reccap = si->si_reccap == 0 ? 4096 : si->si_reccap * 2;
+		if ((si->si_rec = realloc(si->si_rec,
+			si->si_reccap * sizeof(*sr))) == NULL)
+			errmsg_exit1("realloc failed, %s\n", ERR_MSG);
+	}
+	while (si->si_strsz + len > si->si_strcap) {
+		si->si_strcap *= 2;
+		if ((si->si_str = realloc(si->si_str, si->si_strcap)) == NULL)
+			errmsg_exit1("realloc failed, %s\n", ERR_MSG);
+	}
+	if (si->si_strsz + len > UINT32_MAX)
+		errmsg_exit1("Index path table over 4 GiB\n");
+
+	si->si_rec[si->si_nrec] = *sr;
+	si->si_rec[si->si_nrec++].sr_path = si->si_strsz;
+	memcpy(si->si_str + si->si_strsz, path, len);
+	si->si_strsz += len;
+}
+
+/* Writes a built index to 'file' through a rename, so readers see it whole */
+static inline int
+si_write(const struct snapidx *si, const char *file)
+{
+	struct sihdr sh;
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((fp = fopen(tmp, "w")) == NULL)
+		return -1;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.sh_magic = SI_MAGIC;
+	sh.sh_version = SI_VERSION;
+	sh.sh_nrec = si->si_nrec;
+	sh.sh_strsz = si->si_strsz;
+	sh.sh_time = si->si_time;
+	sh.sh_root = 0;
+	if (fwrite(&sh, sizeof(sh), 1, fp) != 1 ||
+		(si->si_nrec > 0 && fwrite(si->si_rec, sizeof(struct sirec),
+		si->si_nrec, fp) != si->si_nrec) ||
+		fwrite(si->si_str, si->si_strsz, 1, fp) != 1 ||
+		fflush(fp) == EOF || (fd = fileno(fp)) == -1 ||
+		fsync(fd) == -1) {
+		fclose(fp);
+		unlink(tmp);
+		return -1;
+	}
+	if (fclose(fp) == EOF || rename(tmp, file) == -1) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void
+si_close(struct snapidx *si)
+{
+	if (si->si_map != NULL) {
+		munmap(si->si_map, si->si_mapsz);
+	} else {
+		xfree(si->si_rec);
+		xfree(si->si_str);
+	}
+	memset(si, 0, sizeof(*si));
+}
+
+#endif	/* !_SNAPIDX_H_ */
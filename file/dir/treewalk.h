@@ -0,0 +1,425 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _TREEWALK_H_
+#define _TREEWALK_H_
+
+/*
+ * A parallel directory tree walker.  Worker threads each own a deque of
+ * directories still to be read: a worker pushes the subdirectories it finds
+ * and pops them back depth first, and when its deque runs dry it steals the
+ * oldest directory of another worker.  Directories are read with one large
+ * getdents call per buffer instead of a readdir() per entry, entries are
+ * opened and stat'ed relative to the fd of their directory, and an entry is
+ * only stat'ed when d_type cannot tell what it is or the caller wants it.
+ */
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define TW_BUFSZ	(256 * 1024)	/* Default getdents buffer */
+#define TW_MAXTHRS	256
+
+#define TW_RECURSE	0x01	/* Descend into subdirectories */
+#define TW_STAT		0x02	/* Stat every entry, not just DT_UNKNOWN */
+
+#ifdef __linux__
+/* glibc has no wrapper for getdents64 before 2.30 */
+struct tw_dirent {
+	uint64_t	d_ino;
+	int64_t		d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[];
+};
+#define tw_getdents(fd, buf, n)	syscall(SYS_getdents64, (fd), (buf), (n))
+#else
+#define tw_dirent	dirent
+#define tw_getdents(fd, buf, n)	getdents((fd), (buf), (n))
+#endif
+
+/* An entry as handed to the callback */
+struct twent {
+	const char	*te_path;	/* Path of the entry from its root */
+	const char	*te_name;	/* Last component of te_path */
+	int		te_dirfd;	/* Fd of the directory holding it */
+	int		te_type;	/* DT_* type */
+	int		te_depth;	/* 1 for entries of a root */
+	int		te_worker;	/* Index of the calling worker */
+	struct stat	*te_st;		/* NULL unless stat'ed */
+};
+
+/*
+ * Called once per entry, from any worker.  For a directory, a return of
+ * 0 skips its subtree; -1 stops the walk.
+ */
+typedef int (*tw_func_t)(struct twent *, void *);
+
+/* A directory waiting to be read */
+struct twdir {
+	char	*td_path;
+	int	td_fd;		/* Already open, or -1 to open by td_path */
+	int	td_depth;
+};
+
+struct twworker {
+	pthread_t	tw_tid;
+	int		tw_id;
+	struct treewalk	*tw_walk;
+	char		*tw_dbuf;	/* getdents buffer */
+
+	/* Deque: the owner works at the tail, thieves take the head */
+	pthread_mutex_t	tw_mtx;
+	struct twdir	*tw_dirs;
+	size_t		tw_head;
+	size_t		tw_tail;
+	size_t		tw_cap;
+
+	uint64_t	tw_entries;	/* Entries seen */
+	uint64_t	tw_ndirs;	/* Directories read */
+	uint64_t	tw_stats;	/* fstatat() calls */
+	uint64_t	tw_steals;	/* Directories taken from others */
+	uint64_t	tw_errors;	/* Directories that could not be read */
+};
+
+struct treewalk {
+	int		tw_flags;
+	int		tw_nthrs;
+	size_t		tw_bufsz;
+	tw_func_t	tw_func;
+	void		*tw_arg;
+	struct twworker	*tw_workers;
+
+	atomic_long	tw_pending;	/* Directories queued or being read */
+	atomic_long	tw_queued;	/* Directories sitting in a deque */
+	atomic_int	tw_nidle;	/* Workers waiting for work */
+	atomic_long	tw_openfds;	/* Fds held by queued directories */
+	long		tw_maxfds;	/* Above this, queue paths instead */
+	atomic_bool	tw_stop;
+	pthread_mutex_t	tw_mtx;
+	pthread_cond_t	tw_cnd;
+};
+
+static inline char *
+tw_join(const char *dir, const char *name)
+{
+	size_t dl, nl;
+	char *p;
+
+	/* Entries of "." print without the "./" prefix */
+	if (strcmp(dir, ".") == 0)
+		dir = "";
+	dl = strlen(dir);
+	nl = strlen(name);
+	p = xmalloc(dl + nl + 2);
+	memcpy(p, dir, dl);
+	if (dl > 0 && dir[dl - 1] != '/')
+		p[dl++] = '/';
+	memcpy(p + dl, name, nl + 1);
+
+	return p;
+}
+
+static void
+tw_push(struct twworker *w, const struct twdir *d)
+{
+	struct treewalk *tw = w->tw_walk;
+
+	pthread_mutex_lock(&w->tw_mtx);
+	if (w->tw_tail == w->tw_cap) {
+		if (w->tw_head > w->tw_cap / 2) {
+			/* Mostly stolen from, slide down instead of growing */
+			memmove(w->tw_dirs, w->tw_dirs + w->tw_head,
+				(w->tw_tail - w->tw_head) * sizeof(*d));
+			w->tw_tail -= w->tw_head;
+			w->tw_head = 0;
+		} else {
+			w->tw_cap = w->tw_cap == 0 ? 64 : w->tw_cap * 2;
+			if ((w->tw_dirs = realloc(w->tw_dirs,
+				w->tw_cap * sizeof(*d))) == NULL)
+				errmsg_exit1("realloc failed, %s\n", ERR_MSG);
+		}
+	}
+	w->tw_dirs[w->tw_tail++] = *d;
+	pthread_mutex_unlock(&w->tw_mtx);
+
+	atomic_fetch_add(&tw->tw_pending, 1);
+	atomic_fetch_add(&tw->tw_queued, 1);
+	if (atomic_load(&tw->tw_nidle) > 0) {
+		pthread_mutex_lock(&tw->tw_mtx);
+		pthread_cond_signal(&tw->tw_cnd);
+		pthread_mutex_unlock(&tw->tw_mtx);
+	}
+}
+
+static bool
+tw_take(struct twworker *w, struct twdir *d, bool steal)
+{
+	bool got = false;
+
+	pthread_mutex_lock(&w->tw_mtx);
+	if (w->tw_head < w->tw_tail) {
+		*d = steal ? w->tw_dirs[w->tw_head++] :
+			w->tw_dirs[--w->tw_tail];
+		if (w->tw_head == w->tw_tail)
+			w->tw_head = w->tw_tail = 0;
+		got = true;
+	}
+	pthread_mutex_unlock(&w->tw_mtx);
+
+	if (got)
+		atomic_fetch_sub(&w->tw_walk->tw_queued, 1);
+	return got;
+}
+
+static bool
+tw_next(struct twworker *w, struct twdir *d)
+{
+	struct treewalk *tw = w->tw_walk;
+	int i, v;
+
+	if (tw_take(w, d, false))
+		return true;
+	for (i = 1; i < tw->tw_nthrs; i++) {
+		v = (w->tw_id + i) % tw->tw_nthrs;
+		if (tw_take(&tw->tw_workers[v], d, true)) {
+			w->tw_steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+tw_readdir(struct twworker *w, struct twdir *d)
+{
+	struct treewalk *tw = w->tw_walk;
+	struct tw_dirent *dp;
+	struct twent te;
+	struct twdir sub;
+	struct stat st;
+	char *path;
+	long nread, pos;
+	int fd, r;
+
+	if ((fd = d->td_fd) == -1 &&
+		(fd = open(d->td_path, O_RDONLY | O_DIRECTORY)) == -1) {
+		fprintf(stderr, "cannot open '%s', %s\n", d->td_path, ERR_MSG);
+		w->tw_errors++;
+		return 0;
+	}
+	if (d->td_fd != -1)
+		atomic_fetch_sub(&tw->tw_openfds, 1);
+	w->tw_ndirs++;
+
+	te.te_dirfd = fd;
+	te.te_depth = d->td_depth + 1;
+	te.te_worker = w->tw_id;
+	r = 0;
+	while (r != -1 &&
+		(nread = tw_getdents(fd, w->tw_dbuf, tw->tw_bufsz)) > 0) {
+		for (pos = 0; pos < nread && r != -1; pos += dp->d_reclen) {
+			dp = (struct tw_dirent *)(w->tw_dbuf + pos);
+			if (dp->d_name[0] == '.' && (dp->d_name[1] == '\0' ||
+				(dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+				continue;
+			w->tw_entries++;
+
+			te.te_type = dp->d_type;
+			te.te_st = NULL;
+			if (te.te_type == DT_UNKNOWN ||
+				(tw->tw_flags & TW_STAT)) {
+				w->tw_stats++;
+				if (fstatat(fd, dp->d_name, &st,
+					AT_SYMLINK_NOFOLLOW) == 0) {
+					te.te_st = &st;
+					te.te_type = IFTODT(st.st_mode);
+				}
+			}
+
+			path = tw_join(d->td_path, dp->d_name);
+			te.te_path = path;
+			te.te_name = path + strlen(path) - strlen(dp->d_name);
+			r = tw->tw_func(&te, tw->tw_arg);
+			if (r == 1 && te.te_type == DT_DIR &&
+				(tw->tw_flags & TW_RECURSE)) {
+				sub.td_path = path;
+				sub.td_depth = te.te_depth;
+				sub.td_fd = -1;
+				if (atomic_load(&tw->tw_openfds) < tw->tw_maxfds &&
+					(sub.td_fd = openat(fd, dp->d_name,
+					O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) != -1)
+					atomic_fetch_add(&tw->tw_openfds, 1);
+				tw_push(w, &sub);
+			} else {
+				xfree(path);
+			}
+		}
+	}
+	if (nread == -1) {
+		fprintf(stderr, "getdents failed on '%s', %s\n", d->td_path,
+			ERR_MSG);
+		w->tw_errors++;
+	}
+
+	close(fd);
+	return r;
+}
+
+static void *
+tw_worker(void *arg)
+{
+	struct twworker *w = arg;
+	struct treewalk *tw = w->tw_walk;
+	struct twdir d;
+
+	w->tw_dbuf = xmalloc(tw->tw_bufsz);
+	for (;;) {
+		if (tw_next(w, &d)) {
+			if (atomic_load(&tw->tw_stop)) {
+				/* Drain the deques without reading */
+				if (d.td_fd != -1) {
+					atomic_fetch_sub(&tw->tw_openfds, 1);
+					close(d.td_fd);
+				}
+			} else if (tw_readdir(w, &d) == -1) {
+				atomic_store(&tw->tw_stop, true);
+			}
+			xfree(d.td_path);
+			if (atomic_fetch_sub(&tw->tw_pending, 1) == 1) {
+				pthread_mutex_lock(&tw->tw_mtx);
+				pthread_cond_broadcast(&tw->tw_cnd);
+				pthread_mutex_unlock(&tw->tw_mtx);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&tw->tw_mtx);
+		atomic_fetch_add(&tw->tw_nidle, 1);
+		while (atomic_load(&tw->tw_pending) > 0 &&
+			atomic_load(&tw->tw_queued) == 0)
+			pthread_cond_wait(&tw->tw_cnd, &tw->tw_mtx);
+		atomic_fetch_sub(&tw->tw_nidle, 1);
+		if (atomic_load(&tw->tw_pending) == 0) {
+			pthread_mutex_unlock(&tw->tw_mtx);
+			break;
+		}
+		pthread_mutex_unlock(&tw->tw_mtx);
+	}
+	xfree(w->tw_dbuf);
+
+	return NULL;
+}
+
+static inline void
+tw_init(struct treewalk *tw, int flags, int nthrs, size_t bufsz,
+	tw_func_t func, void *arg)
+{
+	struct rlimit rl;
+
+	memset(tw, 0, sizeof(*tw));
+	tw->tw_flags = flags;
+	tw->tw_nthrs = nthrs;
+	tw->tw_bufsz = bufsz;
+	tw->tw_func = func;
+	tw->tw_arg = arg;
+	tw->tw_workers = xcalloc(nthrs, sizeof(struct twworker));
+
+	/* Leave half the fd table to the caller and the workers */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+		tw->tw_maxfds = (long)rl.rlim_cur / 2 - nthrs;
+	else
+		tw->tw_maxfds = 512;
+	pthread_mutex_init(&tw->tw_mtx, NULL);
+	pthread_cond_init(&tw->tw_cnd, NULL);
+}
+
+/*
+ * Walks each root with tw_nthrs workers, roots going round-robin to their
+ * deques.  Returns -1 if the callback stopped the walk.
+ */
+static inline int
+tw_run(struct treewalk *tw, char *const roots[], int nroots)
+{
+	struct twworker *w;
+	struct twdir d;
+	int i, r;
+
+	for (i = 0; i < tw->tw_nthrs; i++) {
+		w = &tw->tw_workers[i];
+		w->tw_id = i;
+		w->tw_walk = tw;
+		pthread_mutex_init(&w->tw_mtx, NULL);
+	}
+	for (i = 0; i < nroots; i++) {
+		d.td_path = xmalloc(strlen(roots[i]) + 1);
+		strcpy(d.td_path, roots[i]);
+		d.td_fd = -1;
+		d.td_depth = 0;
+		tw_push(&tw->tw_workers[i % tw->tw_nthrs], &d);
+	}
+
+	for (i = 0; i < tw->tw_nthrs; i++)
+		if ((r = pthread_create(&tw->tw_workers[i].tw_tid, NULL,
+			tw_worker, &tw->tw_workers[i])) != 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+	for (i = 0; i < tw->tw_nthrs; i++)
+		if ((r = pthread_join(tw->tw_workers[i].tw_tid, NULL)) != 0)
+			errmsg_exit1("pthread_join failed, %s\n", strerror(r));
+
+	return atomic_load(&tw->tw_stop) ? -1 : 0;
+}
+
+static inline void
+tw_free(struct treewalk *tw)
+{
+	int i;
+
+	for (i = 0; i < tw->tw_nthrs; i++) {
+		pthread_mutex_destroy(&tw->tw_workers[i].tw_mtx);
+		xfree(tw->tw_workers[i].tw_dirs);
+	}
+	xfree(tw->tw_workers);
+	pthread_mutex_destroy(&tw->tw_mtx);
+	pthread_cond_destroy(&tw->tw_cnd);
+}
+
+#endif	/* !_TREEWALK_H_ */
@@ -0,0 +1,412 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _APPLOG_H_
+#define _APPLOG_H_
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "crc32c.h"
+#include "prealloc.h"
+
+/*
+ * An append-only log shared by any number of writer processes.
+ *
+ * The log is a directory of segment files, "seg-00000000" and up, plus a
+ * control file "applog.ctl" that every process maps with MAP_SHARED. A
+ * writer buffers its records and hands a whole buffer to the kernel at once,
+ * in one of two ways:
+ *
+ *	AL_RESERVE	reserve the range with an atomic add on the shared
+ *			offset counter, then pwrite(2) it there. Segments
+ *			have a fixed size; a buffer that would straddle two
+ *			segments goes to the next one, and the tail it leaves
+ *			behind is covered by a padding record.
+ *	AL_APPEND	write(2) to the segment opened with O_APPEND, which the
+ *			kernel makes atomic (see atomic_append.c). The writer
+ *			that pushes a segment past its size switches everybody
+ *			to the next one.
+ *
+ * Segments are preallocated one ahead of the writers, so rolling over does
+ * not allocate blocks on the write path. They are made in place with
+ * O_EXCL rather than taken from a segpool (prealloc.h): the pool belongs to
+ * one process, and renaming one of its segments into place could replace a
+ * segment another writer has already created and written to.
+ *
+ * Every record is length prefixed and carries the CRC-32C of its payload,
+ * and starts on an 8 byte boundary. A zero length marks the end of the data
+ * written to a segment.
+ */
+#define AL_RESERVE	0
+#define AL_APPEND	1
+
+#define AL_MAGIC	0x414c4f47U	/* "ALOG" */
+#define AL_PAD		0x80000000U	/* Record is padding, skip it */
+#define AL_ALIGN(n)	(((n) + 7) & ~(size_t)7)
+
+struct applog_rec {
+	uint32_t	ar_len;		/* Payload bytes, maybe | AL_PAD */
+	uint32_t	ar_crc;		/* CRC-32C of the payload */
+};
+
+/* The control file, shared by all the processes using the log */
+struct applog_ctl {
+	uint32_t		ac_magic;	/* AL_MAGIC */
+	uint32_t		ac_mode;	/* AL_RESERVE or AL_APPEND */
+	uint64_t		ac_segsz;	/* Bytes per segment */
+	_Atomic uint64_t	ac_next;	/* AL_RESERVE: next log offset */
+	_Atomic uint32_t	ac_seg;		/* AL_APPEND: current segment */
+};
+
+/* A writer, private to one process */
+struct applog {
+	int			al_dirfd;	/* The log directory */
+	struct applog_ctl	*al_ctl;	/* Shared control file */
+	int			al_segfd;	/* Current segment, or -1 */
+	uint32_t		al_seg;		/* Number of 'al_segfd' */
+	char			*al_buf;	/* Records not written yet */
+	size_t			al_buflen;	/* Bytes in 'al_buf' */
+	size_t			al_bufsz;	/* Size of 'al_buf' */
+};
+
+/* Create an empty log in directory 'dir', which must exist. */
+static int
+applog_create(const char *dir, uint64_t segsz, int mode)
+{
+	struct applog_ctl ctl;
+	int dfd, fd;
+
+	if ((dfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+		return -1;
+	fd = openat(dfd, "applog.ctl", O_RDWR | O_CREAT | O_TRUNC,
+		S_IRUSR | S_IWUSR);
+	close(dfd);
+	if (fd == -1)
+		return -1;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.ac_magic = AL_MAGIC;
+	ctl.ac_mode = mode;
+	ctl.ac_segsz = AL_ALIGN(segsz);
+	if (write(fd, &ctl, sizeof(ctl)) != sizeof(ctl)) {
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+/*
+ * Open segment 'seg', creating and preallocating it if need be. In append
+ * mode the blocks are reserved without changing the size of the file
+ * (FALLOC_FL_KEEP_SIZE), since O_APPEND writes at the end of file; where
+ * that is not available the segment simply grows.
+ */
+static int
+applog_openseg(struct applog *al, uint32_t seg)
+{
+	char name[32];
+	int fd, flags;
+
+	snprintf(name, sizeof(name), "seg-%08u", seg);
+	flags = O_RDWR | (al->al_ctl->ac_mode == AL_APPEND ? O_APPEND : 0);
+
+	if ((fd = openat(al->al_dirfd, name, flags | O_CREAT | O_EXCL,
+		S_IRUSR | S_IWUSR)) == -1) {
+		if (errno != EEXIST)
+			return -1;
+		return openat(al->al_dirfd, name, flags);
+	}
+
+	/* We created it: allocate its blocks, failure only costs speed */
+	(void)prealloc_range(fd, 0, al->al_ctl->ac_segsz,
+		al->al_ctl->ac_mode == AL_RESERVE ? PA_ALLOC : PA_KEEPSIZE);
+
+	return fd;
+}
+
+/* Make 'seg' the current segment, and preallocate the one after it. */
+static int
+applog_switch(struct applog *al, uint32_t seg)
+{
+	int fd;
+
+	if (al->al_segfd != -1 && al->al_seg == seg)
+		return 0;
+	if ((fd = applog_openseg(al, seg)) == -1)
+		return -1;
+	if (al->al_segfd != -1)
+		close(al->al_segfd);
+	al->al_segfd = fd;
+	al->al_seg = seg;
+
+	if ((fd = applog_openseg(al, seg + 1)) != -1)
+		close(fd);
+
+	return 0;
+}
+
+/* Open the log in 'dir' for writing, buffering up to 'bufsz' bytes. */
+static int
+applog_open(struct applog *al, const char *dir, size_t bufsz)
+{
+	void *addr;
+	int fd;
+
+	if ((al->al_dirfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+		return -1;
+	if ((fd = openat(al->al_dirfd, "applog.ctl", O_RDWR)) == -1)
+		goto fail;
+	addr = mmap(NULL, sizeof(struct applog_ctl), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		goto fail;
+	al->al_ctl = addr;
+	if (al->al_ctl->ac_magic != AL_MAGIC) {
+		munmap(addr, sizeof(struct applog_ctl));
+		errno = EINVAL;
+		goto fail;
+	}
+
+	al->al_segfd = -1;
+	al->al_bufsz = AL_ALIGN(MIN(bufsz, al->al_ctl->ac_segsz));
+	al->al_buf = xmalloc(al->al_bufsz);
+	al->al_buflen = 0;
+
+	return 0;
+
+fail:
+	close(al->al_dirfd);
+	return -1;
+}
+
+/* Reserve 'len' bytes of the log: switch to its segment, return the offset. */
+static int
+applog_reserve(struct applog *al, size_t len, off_t *off)
+{
+	struct applog_rec pad;
+	uint64_t segsz = al->al_ctl->ac_segsz, pos, start;
+
+	/*
+	 * Move the shared counter past our range with compare-and-swap. A
+	 * range that would straddle the end of a segment starts at the next
+	 * one instead; the tail skipped is ours too.
+	 */
+	pos = atomic_load(&al->al_ctl->ac_next);
+	do {
+		start = pos;
+		if (start % segsz + len > segsz)
+			start = (start / segsz + 1) * segsz;
+	} while (!atomic_compare_exchange_weak(&al->al_ctl->ac_next, &pos,
+		start + len));
+
+	/*
+	 * Cover the skipped tail with padding so the reader steps over it. A
+	 * tail shorter than a record header ends the segment by itself.
+	 */
+	if (start != pos && segsz - pos % segsz >= sizeof(pad)) {
+		if (applog_switch(al, pos / segsz) == -1)
+			return -1;
+		pad.ar_len = (segsz - pos % segsz - sizeof(pad)) | AL_PAD;
+		pad.ar_crc = 0;
+		if (pwrite(al->al_segfd, &pad, sizeof(pad), pos % segsz) == -1)
+			return -1;
+	}
+
+	if (applog_switch(al, start / segsz) == -1)
+		return -1;
+	*off = start % segsz;
+
+	return 0;
+}
+
+/* Write the buffered records to the log. */
+static int
+applog_flush(struct applog *al)
+{
+	struct stat fs;
+	uint32_t seg;
+	off_t off;
+	size_t len = al->al_buflen;
+
+	if (len == 0)
+		return 0;
+
+	if (al->al_ctl->ac_mode == AL_RESERVE) {
+		if (applog_reserve(al, len, &off) == -1)
+			return -1;
+		if (pwrite(al->al_segfd, al->al_buf, len, off) != (ssize_t)len)
+			return -1;
+	} else {
+		seg = atomic_load(&al->al_ctl->ac_seg);
+		if (applog_switch(al, seg) == -1)
+			return -1;
+		/* A single write() with O_APPEND is never interleaved */
+		if (write(al->al_segfd, al->al_buf, len) != (ssize_t)len)
+			return -1;
+
+		/* Full: move everybody on, unless somebody already did */
+		if (fstat(al->al_segfd, &fs) == -1)
+			return -1;
+		if ((uint64_t)fs.st_size >= al->al_ctl->ac_segsz)
+			atomic_compare_exchange_strong(&al->al_ctl->ac_seg,
+				&seg, seg + 1);
+	}
+
+	al->al_buflen = 0;
+	return 0;
+}
+
+/*
+ * Append one record. It goes to the buffer, which is flushed first if the
+ * record does not fit. A record must fit in the buffer.
+ */
+static int
+applog_append(struct applog *al, const void *rec, uint32_t len)
+{
+	struct applog_rec hdr;
+	size_t need = AL_ALIGN(sizeof(hdr) + len);
+
+	if (len == 0 || len >= AL_PAD || need > al->al_bufsz) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if (al->al_buflen + need > al->al_bufsz && applog_flush(al) == -1)
+		return -1;
+
+	hdr.ar_len = len;
+	hdr.ar_crc = crc32c(0, rec, len);
+	memcpy(al->al_buf + al->al_buflen, &hdr, sizeof(hdr));
+	memcpy(al->al_buf + al->al_buflen + sizeof(hdr), rec, len);
+	memset(al->al_buf + al->al_buflen + sizeof(hdr) + len, 0,
+		need - sizeof(hdr) - len);
+	al->al_buflen += need;
+
+	return 0;
+}
+
+static int
+applog_close(struct applog *al)
+{
+	int r = applog_flush(al);
+
+	xfree(al->al_buf);
+	if (al->al_segfd != -1)
+		close(al->al_segfd);
+	munmap(al->al_ctl, sizeof(struct applog_ctl));
+	close(al->al_dirfd);
+
+	return r;
+}
+
+/*
+ * Read the whole log in order, calling 'func' for every record. A record
+ * whose checksum does not match stops the scan with EBADMSG. Each segment is
+ * mapped and read sequentially, so the reader never copies a record. Return
+ * the number of records read, or -1.
+ */
+static long
+applog_read(const char *dir, int (*func)(const void *, uint32_t, void *),
+	void *arg)
+{
+	struct applog_rec hdr;
+	struct stat fs;
+	char name[32], *addr;
+	uint32_t seg, len;
+	size_t off;
+	long nrecs = 0;
+	int dfd, fd, err = 0;
+
+	if ((dfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+		return -1;
+
+	for (seg = 0; err == 0; seg++) {
+		snprintf(name, sizeof(name), "seg-%08u", seg);
+		if ((fd = openat(dfd, name, O_RDONLY)) == -1) {
+			if (errno != ENOENT)
+				err = errno;
+			break;
+		}
+		if (fstat(fd, &fs) == -1) {
+			err = errno;
+			close(fd);
+			break;
+		}
+		if (fs.st_size == 0) {
+			close(fd);
+			continue;
+		}
+		addr = mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED) {
+			err = errno;
+			break;
+		}
+		(void)madvise(addr, fs.st_size, MADV_SEQUENTIAL);
+
+		for (off = 0; off + sizeof(hdr) <= (size_t)fs.st_size;
+			off += AL_ALIGN(sizeof(hdr) + len)) {
+			memcpy(&hdr, addr + off, sizeof(hdr));
+			if ((len = hdr.ar_len & ~AL_PAD) == 0 &&
+				!(hdr.ar_len & AL_PAD))
+				break;		/* End of the data */
+			if (hdr.ar_len & AL_PAD)
+				continue;
+			if (off + sizeof(hdr) + len > (size_t)fs.st_size ||
+				crc32c(0, addr + off + sizeof(hdr), len) !=
+				hdr.ar_crc) {
+				err = EBADMSG;
+				break;
+			}
+			nrecs++;
+			if (func != NULL &&
+				func(addr + off + sizeof(hdr), len, arg) == -1) {
+				err = errno;
+				break;
+			}
+		}
+		munmap(addr, fs.st_size);
+	}
+	close(dfd);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	return nrecs;
+}
+
+#endif	/* !_APPLOG_H_ */
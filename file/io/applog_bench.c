@@ -0,0 +1,205 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* fallocate() */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/wait.h>
+#include <dirent.h>
+#include <getopt.h>
+#include "applog.h"
+
+static void clean_log(const char *);
+static void write_records(const char *, int, long, size_t, size_t);
+static int count_bytes(const void *, uint32_t, void *);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, maxw = 4, mode = AL_RESERVE, w, i, status;
+	long nrecs = 100000, nread;
+	size_t recsz = 100, bufsz = 64 * KIB, segsz = 64 * MIB;
+	uint64_t t0, wns, rns, bytes;
+	char *dir = NULL;
+	pid_t pid;
+
+	while ((op = getopt(argc, argv, "d:w:n:s:S:b:m:")) != -1) {
+		switch (op) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'w':
+			maxw = getlong(optarg, GN_GT_0);
+			break;
+		case 'n':
+			nrecs = getlong(optarg, GN_GT_0);
+			break;
+		case 's':
+			recsz = getsize(optarg);
+			break;
+		case 'S':
+			segsz = AL_ALIGN(getsize(optarg));
+			break;
+		case 'b':
+			bufsz = getsize(optarg);
+			break;
+		case 'm':
+			if (strcmp(optarg, "append") == 0)
+				mode = AL_APPEND;
+			else if (strcmp(optarg, "reserve") != 0)
+				errmsg_exit1("Unknown mode. -m %s\n", optarg);
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (dir == NULL || optind < argc)
+		usage_info(argv[0]);
+	if (recsz < sizeof(long) ||
+		AL_ALIGN(sizeof(struct applog_rec) + recsz) > MIN(bufsz, segsz))
+		errmsg_exit1("record size must be in [%zu, buffer size)\n",
+			sizeof(long));
+
+	printf("%7s %14s %10s %12s %10s\n", "writers", "records", "seconds",
+		"records/s", "read MB/s");
+	for (w = 1; w <= maxw; w *= 2) {
+		clean_log(dir);
+		if (applog_create(dir, segsz, mode) == -1)
+			errmsg_exit1("applog_create failed, %s\n", ERR_MSG);
+
+		/* Every writer is a separate process */
+		fflush(stdout);	/* Or every writer inherits what is buffered */
+		t0 = bench_nsec();
+		for (i = 0; i < w; i++) {
+			if ((pid = fork()) == -1)
+				errmsg_exit1("fork failed, %s\n", ERR_MSG);
+			if (pid == 0)
+				write_records(dir, i, nrecs, recsz, bufsz);
+		}
+		for (i = 0; i < w; i++) {
+			if (wait(&status) == -1)
+				errmsg_exit1("wait failed, %s\n", ERR_MSG);
+			if (!WIFEXITED(status) ||
+				WEXITSTATUS(status) != EXIT_SUCCESS)
+				errmsg_exit1("a writer failed\n");
+		}
+		wns = bench_nsec() - t0;
+
+		/* Read it all back, checking every record */
+		bytes = 0;
+		t0 = bench_nsec();
+		if ((nread = applog_read(dir, count_bytes, &bytes)) == -1)
+			errmsg_exit1("applog_read failed, %s\n", ERR_MSG);
+		rns = bench_nsec() - t0;
+		if (nread != w * nrecs)
+			errmsg_exit1("read %ld records, expected %ld\n", nread,
+				w * nrecs);
+
+		printf("%7d %14ld %10.3f %12.0f %10.1f\n", w, nread,
+			bench_secs(wns), (double)nread / bench_secs(wns),
+			bench_mbps(bytes, rns));
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/* Remove the files of a previous run */
+static void
+clean_log(const char *dir)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	int dfd;
+
+	if ((dirp = opendir(dir)) == NULL)
+		errmsg_exit1("opendir failed on '%s', %s\n", dir, ERR_MSG);
+	dfd = dirfd(dirp);
+	while ((dp = readdir(dirp)) != NULL)
+		if (strncmp(dp->d_name, "seg-", 4) == 0 ||
+			strcmp(dp->d_name, "applog.ctl") == 0)
+			if (unlinkat(dfd, dp->d_name, 0) == -1)
+				errmsg_exit1("unlink '%s' failed, %s\n",
+					dp->d_name, ERR_MSG);
+	closedir(dirp);
+}
+
+/* Body of a writer process */
+static void
+write_records(const char *dir, int id, long nrecs, size_t recsz, size_t bufsz)
+{
+	struct applog al;
+	char *rec;
+	long i;
+
+	if (applog_open(&al, dir, bufsz) == -1)
+		errmsg_exit2("applog_open failed, %s\n", ERR_MSG);
+
+	rec = xmalloc(recsz);
+	memset(rec, 'a' + id % 26, recsz);
+	for (i = 0; i < nrecs; i++) {
+		memcpy(rec, &i, sizeof(i));
+		if (applog_append(&al, rec, recsz) == -1)
+			errmsg_exit2("applog_append failed, %s\n", ERR_MSG);
+	}
+	if (applog_close(&al) == -1)
+		errmsg_exit2("applog_close failed, %s\n", ERR_MSG);
+
+	_exit(EXIT_SUCCESS);
+}
+
+static int
+count_bytes(const void *rec, uint32_t len, void *arg)
+{
+	(void)rec;
+	*(uint64_t *)arg += len;
+	return 0;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s -d dir [-w writers] [-n records] "
+		"[-s size] [-S segsize] [-b bufsize] [-m reserve|append]\n",
+		pname);
+	fprintf(stderr, "-d: directory of the log, must exist.\n");
+	fprintf(stderr, "-w: run with 1, 2, 4 ... up to this many writer "
+		"processes (default 4).\n");
+	fprintf(stderr, "-n: records per writer (default 100000).\n");
+	fprintf(stderr, "-s: bytes per record (default 100).\n");
+	fprintf(stderr, "-S: bytes per segment (default 64m).\n");
+	fprintf(stderr, "-b: buffer size of a writer (default 64k).\n");
+	fprintf(stderr, "-m: reserve offsets in shared memory (default) or "
+		"use O_APPEND.\n");
+	exit(EXIT_FAILURE);
+}
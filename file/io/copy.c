@@ -29,41 +29,172 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* copy_file_range(), fallocate(), SEEK_DATA, O_DIRECT */
+#endif
 #include "unibsd.h"
+#include "benchutil.h"
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include "copyeng.h"
+
+static void bench_strategies(struct copyctx *, int);
+static int open_readback(const char *);
+static void show_progress(off_t, off_t);
+static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
-	int infd, outfd, oflags;
+	int infd, outfd, rbfd = -1, oflags;
+	int op, strategy = CS_AUTO, nthrs = 0;
+	bool bench = false, verbose = false, sparse = false;
+	bool verify = false, readback = false;
+	int rdflags = 0;
 	mode_t fperms;
-	ssize_t nrd;
-	char buf[BUF_SIZE];
+	size_t bufsz = COPY_BUFSZ, chunk = 64 * MIB;
+	uint64_t t0;
+	struct copyctx cc;
+	struct sparsestat ss;
+	struct verifystat vs;
+	const char *optstr = "m:b:j:c:snHVRBv";
 
-	if (argc != 3)
-		errmsg_exit1("Usage: old-file new-file\n", argv[0]);
+	while ((op = getopt(argc, argv, optstr)) != -1) {
+		switch (op) {
+		case 'm':
+			strategy = copy_strategy_byname(optarg);
+			if (strategy == CS_NSTRATEGIES)
+				errmsg_exit1("Unknown strategy. -m %s\n",
+					optarg);
+			break;
+		case 'b':
+			if ((bufsz = getsize(optarg)) == 0)
+				errmsg_exit1("Must be greater than 0, %s\n",
+					optarg);
+			break;
+		case 'j':
+			nthrs = getint(optarg);
+			if (nthrs < 1 || nthrs > COPY_MAXTHRS)
+				usage_info(argv[0]);
+			break;
+		case 'c':
+			if ((chunk = getsize(optarg)) == 0)
+				errmsg_exit1("Must be greater than 0, %s\n",
+					optarg);
+			break;
+		case 's':
+			sparse = true;
+			break;
+		case 'n':
+			rdflags |= SR_NOCACHE;
+			break;
+		case 'H':
+			rdflags |= SR_NOHINT;
+			break;
+		case 'V':
+			verify = true;
+			break;
+		case 'R':
+			verify = readback = true;
+			break;
+		case 'B':
+			bench = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage_info(argv[0]);
 
 	/* opens the input file in read-only mode. */
-	if ((infd = open(argv[1], O_RDONLY)) == -1)
-		errmsg_exit1("open file %s failed, %s\n", argv[1], ERR_MSG);
+	if ((infd = open(argv[optind], O_RDONLY)) == -1)
+		errmsg_exit1("open file %s failed, %s\n", argv[optind],
+			ERR_MSG);
 
 	/* 
 	 * open the output file in 'rw-rw-rw-' mode.
 	 * if this file already exists, truncate it.
 	 * if this file not exists, new create it.
 	 */
-	oflags = O_CREAT | O_WRONLY | O_TRUNC;
+	oflags = O_CREAT | O_TRUNC | (verify || bench ? O_RDWR : O_WRONLY);
 	fperms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
-	if ((outfd = open(argv[2], oflags, fperms)) == -1)
-		errmsg_exit1("open file %s failed, %s\n", argv[1], ERR_MSG);
+	if ((outfd = open(argv[optind + 1], oflags, fperms)) == -1)
+		errmsg_exit1("open file %s failed, %s\n", argv[optind + 1],
+			ERR_MSG);
+
+	copy_init(&cc, infd, outfd);
+	cc.cc_bufsz = bufsz;
+	cc.cc_rdflags = rdflags;
+	if (readback || bench)
+		rbfd = open_readback(argv[optind + 1]);
 
-	/* transfer data until we encounter end of input file or an error. */
-	while ((nrd = read(infd, buf, BUF_SIZE)) > 0)
-		if (write(outfd, buf, nrd) != nrd)
-			errmsg_exit1("couldn't write whole buffer.\n");
-	if (nrd == -1)
-		errmsg_exit1("read failure.\n");
+	if (bench) {
+		bench_strategies(&cc, rbfd);
+	} else if (verify) {
+		/*
+		 * checksum the data while copying it, and with -R read the
+		 * destination back from the disk to check it landed intact.
+		 */
+		if (copy_verify(&cc, rbfd, &vs) == -1) {
+			if (errno == EBADMSG)
+				errmsg_exit1("verify failure, wrote crc32c "
+					"%08x, read back %08x\n", vs.vs_crc,
+					vs.vs_readcrc);
+			errmsg_exit1("verified copy failure, %s\n", ERR_MSG);
+		}
+		printf("crc32c %08x (%s), %jd bytes, %.3f GB/s", vs.vs_crc,
+			crc32c_impl(), (intmax_t)cc.cc_off,
+			bench_gbps(cc.cc_off, vs.vs_copyns));
+		if (vs.vs_readback)
+			printf(", read back %.3f GB/s", bench_gbps(cc.cc_off,
+				vs.vs_readns));
+		printf("\n");
+	} else if (sparse) {
+		/*
+		 * copy only the data extents of the input file, and leave its
+		 * holes as holes in the output file.
+		 */
+		t0 = bench_nsec();
+		if (copy_sparse(&cc, &ss) == -1)
+			errmsg_exit1("sparse copy failure, %s\n", ERR_MSG);
+		printf("logical size:      %14jd\n", (intmax_t)ss.ss_logical);
+		printf("physical size:     %14jd\n", (intmax_t)ss.ss_physical);
+		printf("bytes transferred: %14jd\n", (intmax_t)ss.ss_xfer);
+		printf("destination size:  %14jd\n", (intmax_t)ss.ss_dstphys);
+		printf("elapsed seconds:   %14.3f\n",
+			bench_secs(bench_nsec() - t0));
+	} else if (nthrs > 0) {
+		/*
+		 * preallocate the output file, then let 'nthrs' threads copy
+		 * aligned chunks of it concurrently.
+		 */
+		t0 = bench_nsec();
+		if (copy_parallel(&cc, nthrs, chunk, show_progress) == -1)
+			errmsg_exit1("parallel copy failure, %s\n", ERR_MSG);
+		show_progress(cc.cc_off, cc.cc_size);
+		fprintf(stderr, "\n%d threads, %jd bytes, %.3f GB/s\n", nthrs,
+			(intmax_t)cc.cc_off,
+			bench_gbps(cc.cc_off, bench_nsec() - t0));
+	} else {
+		/*
+		 * transfer data until we encounter end of input file or an
+		 * error, with the cheapest strategy that works for this pair
+		 * of files.
+		 */
+		t0 = bench_nsec();
+		if (copy_run(&cc, strategy) == -1)
+			errmsg_exit1("copy (%s) failure, %s\n",
+				copy_names[cc.cc_used], ERR_MSG);
+		if (verbose)
+			printf("%s: %jd bytes, %.3f GB/s\n",
+				copy_names[cc.cc_used], (intmax_t)cc.cc_off,
+				bench_gbps(cc.cc_off, bench_nsec() - t0));
+	}
 
 	/* 
 	 * close intput file and output file.
@@ -72,6 +203,125 @@ main(int argc, char *argv[])
 		errmsg_exit1("close input file failure, %s\n", ERR_MSG);
 	if (close(outfd) == -1)
 		errmsg_exit1("close output file failure, %s\n", ERR_MSG);
+	if (rbfd != -1 && close(rbfd) == -1)
+		errmsg_exit1("close read-back file failure, %s\n", ERR_MSG);
 	
 	return 0;
 }
+
+/*
+ * Copy the same file once with every strategy and report the throughput.
+ * The time includes an fsync() of the destination so that a strategy is not
+ * rewarded for leaving dirty pages behind. Only the first pass reads a cold
+ * source: drop the page cache between runs for cold numbers. The verified
+ * copy runs last, so its cost can be read off against rw.
+ */
+static void
+bench_strategies(struct copyctx *cc, int rbfd)
+{
+	struct verifystat vs;
+	int i;
+	uint64_t t0, ns;
+
+	if (cc->cc_size < 0)
+		errmsg_exit1("benchmark needs a regular source file\n");
+
+	printf("%-10s %14s %10s %10s\n", "strategy", "bytes", "seconds",
+		"GB/s");
+	for (i = 0; i < CS_NSTRATEGIES; i++) {
+		if (ftruncate(cc->cc_outfd, 0) == -1)
+			errmsg_exit1("ftruncate failure, %s\n", ERR_MSG);
+		cc->cc_off = 0;
+
+		t0 = bench_nsec();
+		if (copy_run(cc, i) == -1) {
+			if (!copy_fallback_errno(errno))
+				errmsg_exit1("copy (%s) failure, %s\n",
+					copy_names[i], ERR_MSG);
+			printf("%-10s %14s (%s)\n", copy_names[i], "-",
+				ERR_MSG);
+			continue;
+		}
+		if (fsync(cc->cc_outfd) == -1)
+			errmsg_exit1("fsync failure, %s\n", ERR_MSG);
+		ns = bench_nsec() - t0;
+
+		printf("%-10s %14jd %10.3f %10.3f\n", copy_names[i],
+			(intmax_t)cc->cc_off, bench_secs(ns),
+			bench_gbps(cc->cc_off, ns));
+	}
+
+	if (ftruncate(cc->cc_outfd, 0) == -1)
+		errmsg_exit1("ftruncate failure, %s\n", ERR_MSG);
+	cc->cc_off = 0;
+	t0 = bench_nsec();
+	if (copy_verify(cc, -1, &vs) == -1 || fsync(cc->cc_outfd) == -1)
+		errmsg_exit1("verified copy failure, %s\n", ERR_MSG);
+	ns = bench_nsec() - t0;
+	printf("%-10s %14jd %10.3f %10.3f\n", "rw+crc", (intmax_t)cc->cc_off,
+		bench_secs(ns), bench_gbps(cc->cc_off, ns));
+
+	/* Read-back after the fsync() of the row above */
+	t0 = bench_nsec();
+	if (copy_readback(rbfd, cc->cc_off, cc->cc_bufsz, &vs.vs_readcrc) ==
+		-1)
+		errmsg_exit1("read-back failure, %s\n", ERR_MSG);
+	ns += bench_nsec() - t0;
+	printf("%-10s %14jd %10.3f %10.3f%s\n", "+readback",
+		(intmax_t)cc->cc_off, bench_secs(ns), bench_gbps(cc->cc_off, ns),
+		vs.vs_readcrc == vs.vs_crc ? "" : " (MISMATCH)");
+}
+
+/*
+ * Open the destination a second time for reading it back, bypassing the
+ * page cache where the file system allows O_DIRECT (tmpfs does not).
+ */
+static int
+open_readback(const char *path)
+{
+	int fd;
+
+#ifdef O_DIRECT
+	if ((fd = open(path, O_RDONLY | O_DIRECT)) != -1)
+		return fd;
+	fprintf(stderr, "no O_DIRECT on %s (%s), reading back through the "
+		"page cache\n", path, ERR_MSG);
+#endif
+	if ((fd = open(path, O_RDONLY)) == -1)
+		errmsg_exit1("open file %s failed, %s\n", path, ERR_MSG);
+
+	return fd;
+}
+
+static void
+show_progress(off_t done, off_t total)
+{
+	fprintf(stderr, "\r%jd/%jd MiB (%.0f%%)", (intmax_t)(done / MIB),
+		(intmax_t)(total / MIB),
+		total == 0 ? 100.0 : (double)done * 100.0 / (double)total);
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-m strategy] [-b bufsize] [-j threads] "
+		"[-c chunk] [-s] [-n] [-H] [-V] [-R] [-B] [-v] old-file "
+		"new-file\n",
+		pname);
+	fprintf(stderr, "-m: auto (default), clone, cfr, sendfile, mmap "
+		"or rw.\n");
+	fprintf(stderr, "-b: buffer size of the rw strategy (default 1m).\n");
+	fprintf(stderr, "-j: copy in parallel with this many threads, up to "
+		"%d.\n", COPY_MAXTHRS);
+	fprintf(stderr, "-c: chunk size of the parallel copy (default 64m).\n");
+	fprintf(stderr, "-s: copy only the data, keep the holes.\n");
+	fprintf(stderr, "-n: drop the source from the page cache behind "
+		"the copy.\n");
+	fprintf(stderr, "-H: no read-ahead or cache hints on the source.\n");
+	fprintf(stderr, "-V: checksum the data (CRC32C) while copying.\n");
+	fprintf(stderr, "-R: -V, then read the copy back with O_DIRECT and "
+		"compare.\n");
+	fprintf(stderr, "-B: benchmark every strategy and report GB/s.\n");
+	fprintf(stderr, "-v: report the strategy used and the throughput.\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,972 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _COPYENG_H_
+#define _COPYENG_H_
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+#include "benchutil.h"
+#include "streamrd.h"
+#include "crc32c.h"
+
+/*
+ * The copy engine moves the bytes of one file into another using the cheapest
+ * mechanism the kernel offers for that pair of files. The strategies are
+ * tried from the cheapest to the most general one:
+ *
+ *	clone		share the extents of the source (reflink), no data moves
+ *	cfr		copy_file_range(2), the data never leaves the kernel
+ *	sendfile	sendfile(2) into a regular file (Linux only)
+ *	mmap		write(2) straight out of a mapping of the source
+ *	rw		read(2)/write(2) loop through a large user buffer
+ *
+ * When a strategy is not supported by the kernel or the file systems
+ * involved (EXDEV, EINVAL, EOPNOTSUPP, ...), the engine falls back to the
+ * next one and carries on from the offset reached so far.
+ */
+enum copy_strategy {
+	CS_AUTO = -1,
+	CS_CLONE,
+	CS_CFR,
+	CS_SENDFILE,
+	CS_MMAP,
+	CS_RW,
+	CS_NSTRATEGIES
+};
+
+static const char *copy_names[CS_NSTRATEGIES] = {
+	"clone", "cfr", "sendfile", "mmap", "rw"
+};
+
+/* Default buffer size of the read/write loop, see BUF_SIZE in unibsd.h */
+#define COPY_BUFSZ	(1024 * 1024)
+/* Size of the window mapped at once by the mmap strategy */
+#define COPY_MAPWIN	(64 * 1024 * 1024)
+/* Largest request handed to the kernel at once */
+#define COPY_CHUNK	(1024 * 1024 * 1024)
+/* Most threads copy_parallel() is asked for */
+#define COPY_MAXTHRS	256
+
+struct copyctx {
+	int	cc_infd;	/* Source file descriptor */
+	int	cc_outfd;	/* Destination file descriptor */
+	off_t	cc_size;	/* Bytes to copy, -1 means up to end-of-file */
+	off_t	cc_off;		/* Bytes copied so far */
+	size_t	cc_bufsz;	/* Buffer size of the read/write loop */
+	int	cc_used;	/* Strategy that finished the copy */
+	int	cc_rdflags;	/* SR_* hints for reading the source */
+};
+
+static inline void
+copy_init(struct copyctx *cc, int infd, int outfd)
+{
+	struct stat fs;
+
+	cc->cc_infd = infd;
+	cc->cc_outfd = outfd;
+	cc->cc_off = 0;
+	cc->cc_bufsz = COPY_BUFSZ;
+	cc->cc_used = CS_AUTO;
+	cc->cc_rdflags = 0;
+
+	/* Only a regular file has a size we can trust */
+	if (fstat(infd, &fs) == 0 && S_ISREG(fs.st_mode))
+		cc->cc_size = fs.st_size;
+	else
+		cc->cc_size = -1;
+}
+
+static inline int
+copy_strategy_byname(const char *name)
+{
+	int i;
+
+	if (strcmp(name, "auto") == 0)
+		return CS_AUTO;
+	for (i = 0; i < CS_NSTRATEGIES; i++)
+		if (strcmp(name, copy_names[i]) == 0)
+			return i;
+
+	return CS_NSTRATEGIES;
+}
+
+/*
+ * Errors that mean "this mechanism does not work for these two files" rather
+ * than "the copy failed": fall back to the next strategy.
+ */
+static inline bool
+copy_fallback_errno(int err)
+{
+	switch (err) {
+	case EXDEV:
+	case EINVAL:
+	case ENOSYS:
+	case ENOTTY:
+	case ENOTSOCK:
+	case ENODEV:
+	case EBADF:
+	case EOPNOTSUPP:
+#if defined(ENOTSUP) && ENOTSUP != EOPNOTSUPP
+	case ENOTSUP:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Write the whole of 'buf' at 'off', retrying short writes. A pipe, FIFO or
+ * terminal has no offsets: write there in sequence instead.
+ */
+static int
+copy_pwrite_all(int fd, const char *buf, size_t len, off_t off)
+{
+	ssize_t nwr;
+	bool seq = false;
+
+	while (len > 0) {
+		nwr = seq ? write(fd, buf, len) : pwrite(fd, buf, len, off);
+		if (nwr == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ESPIPE && !seq) {
+				seq = true;
+				continue;
+			}
+			return -1;
+		}
+		buf += nwr;
+		off += nwr;
+		len -= nwr;
+	}
+
+	return 0;
+}
+
+static int
+copy_clone(struct copyctx *cc)
+{
+	/* A clone always covers the whole file, so it must go first */
+	if (cc->cc_size < 0 || cc->cc_off != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+#if defined(FICLONE)
+	/*
+	 * FICLONE makes the destination share the extents of the source
+	 * (btrfs, XFS with reflink=1, bcachefs, ...). Nothing is copied
+	 * until one of the files is modified.
+	 */
+	if (ioctl(cc->cc_outfd, FICLONE, cc->cc_infd) == -1)
+		return -1;
+	cc->cc_off = cc->cc_size;
+	return 0;
+#elif defined(COPY_FILE_RANGE_CLONE)
+	{
+		off_t inoff = 0, outoff = 0;
+		ssize_t n;
+
+		/*
+		 * COPY_FILE_RANGE_CLONE asks copy_file_range(2) to clone the
+		 * blocks (ZFS block cloning), or fail with EOPNOTSUPP.
+		 */
+		while (cc->cc_off < cc->cc_size) {
+			n = copy_file_range(cc->cc_infd, &inoff, cc->cc_outfd,
+				&outoff, cc->cc_size - cc->cc_off,
+				COPY_FILE_RANGE_CLONE);
+			if (n == -1)
+				return -1;
+			if (n == 0)
+				break;
+			cc->cc_off += n;
+		}
+		return 0;
+	}
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+static int
+copy_cfr(struct copyctx *cc)
+{
+	struct streamrd sr;
+	off_t inoff, outoff;
+	ssize_t n;
+	size_t len;
+
+	if (cc->cc_size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * copy_file_range(2) copies between two file descriptors without
+	 * passing the data through user space. The file system may also
+	 * offload the copy (NFS server side copy, reflink).
+	 */
+	inoff = outoff = cc->cc_off;
+	sr_init(&sr, cc->cc_infd, cc->cc_off, cc->cc_rdflags, NULL);
+	while (cc->cc_off < cc->cc_size) {
+		len = MIN(cc->cc_size - cc->cc_off, COPY_CHUNK);
+		if (cc->cc_rdflags & SR_NOCACHE)
+			len = MIN(len, SR_DROPSZ);
+		n = copy_file_range(cc->cc_infd, &inoff, cc->cc_outfd, &outoff,
+			len, 0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)	/* Source shrank under us */
+			break;
+		cc->cc_off += n;
+		sr_advance(&sr, n);
+	}
+	sr_done(&sr);
+
+	return 0;
+}
+
+static int
+copy_sendfile(struct copyctx *cc)
+{
+#ifdef __linux__
+	struct streamrd sr;
+	off_t inoff;
+	ssize_t n;
+	size_t len;
+
+	if (cc->cc_size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * Since Linux 2.6.33 the output of sendfile(2) may be any file. It
+	 * writes at the current offset of 'out_fd', so position it first;
+	 * a pipe has no offset and takes the data in sequence.
+	 */
+	if (lseek(cc->cc_outfd, cc->cc_off, SEEK_SET) == -1 && errno != ESPIPE)
+		return -1;
+
+	inoff = cc->cc_off;
+	sr_init(&sr, cc->cc_infd, cc->cc_off, cc->cc_rdflags, NULL);
+	while (cc->cc_off < cc->cc_size) {
+		len = MIN(cc->cc_size - cc->cc_off, COPY_CHUNK);
+		if (cc->cc_rdflags & SR_NOCACHE)
+			len = MIN(len, SR_DROPSZ);
+		if ((n = sendfile(cc->cc_outfd, cc->cc_infd, &inoff, len))
+			== -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		cc->cc_off += n;
+		sr_advance(&sr, n);
+	}
+	sr_done(&sr);
+
+	return 0;
+#else
+	/* FreeBSD's sendfile(2) only writes to stream sockets */
+	(void)cc;
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+static int
+copy_mmap(struct copyctx *cc)
+{
+	struct streamrd sr;
+	char *addr;
+	off_t mapoff;
+	size_t maplen, delta;
+	long pagesz;
+
+	if (cc->cc_size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pagesz = sysconf(_SC_PAGESIZE);
+	sr_init(&sr, cc->cc_infd, cc->cc_off, cc->cc_rdflags, NULL);
+
+	/*
+	 * Map the source one window at a time and write(2) straight out of
+	 * the mapping: this saves the copy into a user buffer, and a window
+	 * keeps the address space usage bounded on huge files. The offset
+	 * handed to mmap(2) must be page aligned.
+	 */
+	while (cc->cc_off < cc->cc_size) {
+		mapoff = cc->cc_off - cc->cc_off % pagesz;
+		delta = cc->cc_off - mapoff;
+		maplen = MIN(cc->cc_size - mapoff, COPY_MAPWIN);
+
+		addr = mmap(NULL, maplen, PROT_READ, MAP_SHARED, cc->cc_infd,
+			mapoff);
+		if (addr == MAP_FAILED)
+			return -1;
+		(void)madvise(addr, maplen, MADV_SEQUENTIAL);
+
+		if (copy_pwrite_all(cc->cc_outfd, addr + delta, maplen - delta,
+			cc->cc_off) == -1) {
+			munmap(addr, maplen);
+			return -1;
+		}
+		cc->cc_off += maplen - delta;
+
+		/* Unmapped first, so SR_NOCACHE can drop the window */
+		if (munmap(addr, maplen) == -1)
+			return -1;
+		sr_advance(&sr, maplen - delta);
+	}
+	sr_done(&sr);
+
+	return 0;
+}
+
+static int
+copy_rw(struct copyctx *cc)
+{
+	struct streamrd sr;
+	char *buf;
+	ssize_t nrd;
+	size_t len;
+
+	buf = xmalloc(cc->cc_bufsz);
+	sr_init(&sr, cc->cc_infd, cc->cc_off, cc->cc_rdflags, NULL);
+
+	while (cc->cc_size < 0 || cc->cc_off < cc->cc_size) {
+		len = cc->cc_bufsz;
+		if (cc->cc_size >= 0)
+			len = MIN((off_t)len, cc->cc_size - cc->cc_off);
+
+		/* Pipes and terminals cannot be positioned, sr_read() knows */
+		nrd = sr_read(&sr, buf, len);
+		if (nrd == -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		if (nrd == 0)
+			break;
+
+		if (copy_pwrite_all(cc->cc_outfd, buf, nrd, cc->cc_off) == -1)
+			goto fail;
+		cc->cc_off += nrd;
+	}
+
+	sr_done(&sr);
+	xfree(buf);
+	return 0;
+
+fail:
+	xfree(buf);
+	return -1;
+}
+
+static int (*const copy_funcs[CS_NSTRATEGIES])(struct copyctx *) = {
+	copy_clone, copy_cfr, copy_sendfile, copy_mmap, copy_rw
+};
+
+/*
+ * Copy with the given strategy, or with the first strategy that works when
+ * 'strategy' is CS_AUTO. A forced strategy does not fall back. Return 0 on
+ * success, or -1 with errno set.
+ */
+static int
+copy_run(struct copyctx *cc, int strategy)
+{
+	int i;
+
+	if (strategy != CS_AUTO) {
+		cc->cc_used = strategy;
+		return copy_funcs[strategy](cc);
+	}
+
+	for (i = 0; i < CS_NSTRATEGIES; i++) {
+		cc->cc_used = i;
+		if (copy_funcs[i](cc) == 0)
+			return 0;
+		if (!copy_fallback_errno(errno))
+			return -1;
+	}
+
+	return -1;	/* Not reached: the rw loop never falls back */
+}
+
+/*
+ * Reserve the blocks of the destination before a parallel copy, so that the
+ * workers writing at scattered offsets neither extend the file one chunk at a
+ * time nor fragment it. Fall back to ftruncate(2), which only sets the size,
+ * when the file system cannot allocate ahead (ZFS returns EINVAL).
+ */
+static int
+copy_prealloc(int fd, off_t size)
+{
+	int r;
+
+	if (size == 0)
+		return 0;
+
+#ifdef __linux__
+	/* Unlike posix_fallocate(), fallocate() never falls back to zeroing */
+	if (fallocate(fd, 0, 0, size) == 0)
+		return 0;
+	r = errno;
+#else
+	if ((r = posix_fallocate(fd, 0, size)) == 0)
+		return 0;
+#endif
+	if (!copy_fallback_errno(r)) {
+		errno = r;
+		return -1;
+	}
+
+	return ftruncate(fd, size);
+}
+
+/* Shared state of the workers of a parallel copy */
+struct pcopy {
+	struct copyctx	*pc_cc;		/* Files being copied */
+	size_t		pc_chunk;	/* Bytes per chunk */
+	off_t		pc_next;	/* Offset of the next chunk to copy */
+	off_t		pc_done;	/* Bytes copied by all workers */
+	int		pc_live;	/* Workers still running */
+	int		pc_err;		/* First error seen by a worker */
+	pthread_mutex_t	pc_mtx;		/* Protects the fields above */
+	pthread_cond_t	pc_cnd;		/* Signaled when a chunk completes */
+};
+
+/*
+ * Copy the range [off, off + len) with copy_file_range(2), or with
+ * pread(2)/pwrite(2) through 'buf' once the kernel has refused it. '*usecfr'
+ * is cleared on the first refusal so the worker stops asking.
+ */
+static int
+copy_range(struct copyctx *cc, off_t off, size_t len, char *buf,
+	size_t bufsz, bool *usecfr)
+{
+	off_t inoff, outoff, start = off;
+	ssize_t n;
+
+	while (len > 0) {
+		if (*usecfr) {
+			inoff = outoff = off;
+			n = copy_file_range(cc->cc_infd, &inoff, cc->cc_outfd,
+				&outoff, len, 0);
+			if (n == -1 && copy_fallback_errno(errno)) {
+				*usecfr = false;
+				continue;
+			}
+		} else {
+			n = pread(cc->cc_infd, buf, MIN(len, bufsz), off);
+			if (n > 0 && copy_pwrite_all(cc->cc_outfd, buf, n, off)
+				== -1)
+				return -1;
+		}
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)	/* Source shrank under us */
+			break;
+		off += n;
+		len -= n;
+	}
+
+	/* Chunks are taken out of order, so drop each one as it is done */
+	if (cc->cc_rdflags & SR_NOCACHE)
+		(void)posix_fadvise(cc->cc_infd, start, off - start,
+			POSIX_FADV_DONTNEED);
+
+	return 0;
+}
+
+static void *
+copy_worker(void *arg)
+{
+	struct pcopy *pc = arg;
+	struct copyctx *cc = pc->pc_cc;
+	char *buf;
+	off_t off;
+	size_t len, bufsz;
+	bool usecfr = true;
+	int err = 0;
+
+	bufsz = MIN(pc->pc_chunk, cc->cc_bufsz);
+	buf = xmalloc(bufsz);
+
+	while (1) {
+		/* Grab the next chunk */
+		pthread_mutex_lock(&pc->pc_mtx);
+		if (pc->pc_err != 0 || pc->pc_next >= cc->cc_size) {
+			pthread_mutex_unlock(&pc->pc_mtx);
+			break;
+		}
+		off = pc->pc_next;
+		len = MIN((off_t)pc->pc_chunk, cc->cc_size - off);
+		pc->pc_next += len;
+		pthread_mutex_unlock(&pc->pc_mtx);
+
+		if (copy_range(cc, off, len, buf, bufsz, &usecfr) == -1)
+			err = errno;
+
+		/* Only bytes that made it count towards progress */
+		pthread_mutex_lock(&pc->pc_mtx);
+		if (err == 0)
+			pc->pc_done += len;
+		else if (pc->pc_err == 0)
+			pc->pc_err = err;
+		pthread_cond_signal(&pc->pc_cnd);
+		pthread_mutex_unlock(&pc->pc_mtx);
+	}
+
+	xfree(buf);
+
+	pthread_mutex_lock(&pc->pc_mtx);
+	pc->pc_live--;
+	pthread_cond_signal(&pc->pc_cnd);
+	pthread_mutex_unlock(&pc->pc_mtx);
+
+	return NULL;
+}
+
+/*
+ * Copy the source in 'chunk'-sized pieces with 'nthrs' threads. The chunk is
+ * rounded up to a multiple of the page size so that no two workers ever touch
+ * the same page of the destination. If 'progress' is not NULL, it is called
+ * about once a second with the bytes copied so far. Return 0 on success, or
+ * -1 with errno set.
+ */
+static int
+copy_parallel(struct copyctx *cc, int nthrs, size_t chunk,
+	void (*progress)(off_t, off_t))
+{
+	struct pcopy pc;
+	struct timespec ts;
+	pthread_t *tids;
+	long pagesz;
+	int i, r;
+
+	if (cc->cc_size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (copy_prealloc(cc->cc_outfd, cc->cc_size) == -1)
+		return -1;
+
+	pagesz = sysconf(_SC_PAGESIZE);
+	chunk = (chunk + pagesz - 1) / pagesz * pagesz;
+
+	pc.pc_cc = cc;
+	pc.pc_chunk = chunk;
+	pc.pc_next = cc->cc_off;
+	pc.pc_done = cc->cc_off;
+	pc.pc_live = nthrs;
+	pc.pc_err = 0;
+	pthread_mutex_init(&pc.pc_mtx, NULL);
+	pthread_cond_init(&pc.pc_cnd, NULL);
+
+	tids = xcalloc(nthrs, sizeof(pthread_t));
+	for (i = 0; i < nthrs; i++)
+		if ((r = pthread_create(&tids[i], NULL, copy_worker, &pc)) != 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+
+	/* Report progress until the last worker has gone */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec++;
+	pthread_mutex_lock(&pc.pc_mtx);
+	while (pc.pc_live > 0) {
+		r = pthread_cond_timedwait(&pc.pc_cnd, &pc.pc_mtx, &ts);
+		if (r == ETIMEDOUT) {
+			if (progress != NULL)
+				progress(pc.pc_done, cc->cc_size);
+			ts.tv_sec++;
+		}
+	}
+	pthread_mutex_unlock(&pc.pc_mtx);
+
+	for (i = 0; i < nthrs; i++)
+		pthread_join(tids[i], NULL);
+	xfree(tids);
+
+	pthread_mutex_destroy(&pc.pc_mtx);
+	pthread_cond_destroy(&pc.pc_cnd);
+
+	cc->cc_off = pc.pc_done;
+	if (pc.pc_err != 0) {
+		errno = pc.pc_err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Space accounting of a sparse copy */
+struct sparsestat {
+	off_t	ss_logical;	/* Size of the source */
+	off_t	ss_physical;	/* Bytes allocated to the source */
+	off_t	ss_xfer;	/* Bytes of data actually copied */
+	off_t	ss_dstphys;	/* Bytes allocated to the destination */
+};
+
+/*
+ * Turn [off, off + len) of 'fd' back into a hole. Fall back to writing zeros
+ * when the file system cannot deallocate blocks, so the contents stay right.
+ */
+static int
+copy_punch(int fd, off_t off, off_t len)
+{
+	char *zeros;
+	size_t n;
+
+#if defined(__linux__)
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len)
+		== 0)
+		return 0;
+#elif defined(SPACECTL_DEALLOC)
+	struct spacectl_range sr;
+
+	sr.r_offset = off;
+	sr.r_len = len;
+	if (fspacectl(fd, SPACECTL_DEALLOC, &sr, 0, NULL) == 0)
+		return 0;
+#else
+	errno = EOPNOTSUPP;
+#endif
+	if (!copy_fallback_errno(errno))
+		return -1;
+
+	zeros = xcalloc(1, COPY_BUFSZ);
+	while (len > 0) {
+		n = MIN(len, COPY_BUFSZ);
+		if (copy_pwrite_all(fd, zeros, n, off) == -1) {
+			xfree(zeros);
+			return -1;
+		}
+		off += n;
+		len -= n;
+	}
+	xfree(zeros);
+
+	return 0;
+}
+
+/*
+ * Copy only the data extents of the source. lseek(2) with SEEK_DATA finds
+ * the start of the next extent holding data at or after an offset, SEEK_HOLE
+ * the start of the next hole; ENXIO from SEEK_DATA means there is no data
+ * left. The holes are left unwritten in the destination (punched out if it
+ * held data there before), and ftruncate(2) restores the trailing hole. File
+ * systems without hole support report the whole file as one data extent.
+ */
+static int
+copy_sparse(struct copyctx *cc, struct sparsestat *ss)
+{
+	struct stat fs;
+	off_t off, data, hole, dstsize;
+	char *buf;
+	bool usecfr = true;
+	int save_errno;
+
+	if (cc->cc_size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (fstat(cc->cc_infd, &fs) == -1)
+		return -1;
+	ss->ss_logical = fs.st_size;
+	ss->ss_physical = (off_t)fs.st_blocks * 512;	/* See stat(2) */
+	ss->ss_xfer = 0;
+
+	if (fstat(cc->cc_outfd, &fs) == -1)
+		return -1;
+	dstsize = fs.st_size;
+
+	buf = xmalloc(cc->cc_bufsz);
+
+	for (off = cc->cc_off; off < cc->cc_size; off = hole) {
+		if ((data = lseek(cc->cc_infd, off, SEEK_DATA)) == -1) {
+			if (errno != ENXIO)
+				goto fail;
+			data = cc->cc_size;
+		}
+		data = MIN(data, cc->cc_size);
+		if (data == cc->cc_size ||
+			(hole = lseek(cc->cc_infd, data, SEEK_HOLE)) == -1)
+			hole = cc->cc_size;
+		hole = MIN(hole, cc->cc_size);
+
+		/* [off, data) is a hole: drop what the destination held there */
+		if (data > off && off < dstsize)
+			if (copy_punch(cc->cc_outfd, off, MIN(data, dstsize) -
+				off) == -1)
+				goto fail;
+
+		if (data < hole) {
+			if (copy_range(cc, data, hole - data, buf, cc->cc_bufsz,
+				&usecfr) == -1)
+				goto fail;
+			ss->ss_xfer += hole - data;
+		}
+	}
+	xfree(buf);
+
+	if (ftruncate(cc->cc_outfd, cc->cc_size) == -1)
+		return -1;
+	cc->cc_off = cc->cc_size;
+
+	if (fstat(cc->cc_outfd, &fs) == -1)
+		return -1;
+	ss->ss_dstphys = (off_t)fs.st_blocks * 512;
+
+	return 0;
+
+fail:
+	save_errno = errno;
+	xfree(buf);
+	errno = save_errno;
+	return -1;
+}
+
+/* Result of a verified copy */
+struct verifystat {
+	uint32_t	vs_crc;		/* CRC32C of the bytes copied */
+	uint32_t	vs_readcrc;	/* CRC32C of the destination read back */
+	bool		vs_readback;	/* Whether vs_readcrc was computed */
+	uint64_t	vs_copyns;	/* Copy time, checksum included */
+	uint64_t	vs_readns;	/* Read-back time */
+};
+
+/* The two buffers handed between the reader thread and the writer */
+struct vpipe {
+	struct copyctx	*vp_cc;
+	char		*vp_buf[2];
+	ssize_t		vp_len[2];	/* 0 at end of input, -1 on error */
+	bool		vp_full[2];
+	int		vp_err;
+	bool		vp_stop;
+	pthread_mutex_t	vp_mtx;
+	pthread_cond_t	vp_cnd;
+};
+
+static void *
+copy_verify_reader(void *arg)
+{
+	struct vpipe *vp = arg;
+	struct copyctx *cc = vp->vp_cc;
+	struct streamrd sr;
+	off_t off = cc->cc_off;
+	size_t len;
+	ssize_t n;
+	int i = 0;
+
+	sr_init(&sr, cc->cc_infd, off, cc->cc_rdflags, NULL);
+
+	for (;;) {
+		pthread_mutex_lock(&vp->vp_mtx);
+		while (vp->vp_full[i] && !vp->vp_stop)
+			pthread_cond_wait(&vp->vp_cnd, &vp->vp_mtx);
+		if (vp->vp_stop) {
+			pthread_mutex_unlock(&vp->vp_mtx);
+			break;
+		}
+		pthread_mutex_unlock(&vp->vp_mtx);
+
+		len = cc->cc_bufsz;
+		if (cc->cc_size >= 0)
+			len = MIN((off_t)len, cc->cc_size - off);
+		do {
+			n = len == 0 ? 0 : sr_read(&sr, vp->vp_buf[i], len);
+		} while (n == -1 && errno == EINTR);
+
+		pthread_mutex_lock(&vp->vp_mtx);
+		vp->vp_len[i] = n;
+		if (n == -1)
+			vp->vp_err = errno;
+		vp->vp_full[i] = true;
+		pthread_cond_broadcast(&vp->vp_cnd);
+		pthread_mutex_unlock(&vp->vp_mtx);
+		if (n <= 0)
+			break;
+		off += n;
+		i ^= 1;
+	}
+	sr_done(&sr);
+
+	return NULL;
+}
+
+/*
+ * Read 'len' bytes of 'fd' back and checksum them. 'fd' may be opened with
+ * O_DIRECT, so the buffer and the reads are kept block aligned.
+ */
+static int
+copy_readback(int fd, off_t len, size_t bufsz, uint32_t *crc)
+{
+	char *buf;
+	off_t off;
+	ssize_t n;
+	int r;
+
+	bufsz = (bufsz + 4095) & ~(size_t)4095;
+	if ((r = posix_memalign((void **)&buf, 4096, bufsz)) != 0) {
+		errno = r;
+		return -1;
+	}
+
+	*crc = 0;
+	for (off = 0; off < len; off += n) {
+		if ((n = pread(fd, buf, bufsz, off)) == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			r = errno;
+			free(buf);
+			errno = r;
+			return -1;
+		}
+		if (n == 0)
+			break;	/* Shorter than written, the CRC will differ */
+		*crc = crc32c(*crc, buf, MIN(n, len - off));
+	}
+	free(buf);
+
+	return 0;
+}
+
+/*
+ * Copy with read(2)/write(2), computing the CRC32C of the data on the way
+ * so the source does not have to be read twice. A reader thread fills one
+ * buffer while the other is checksummed and written. With 'rbfd' (the
+ * destination opened again, ideally with O_DIRECT so the page cache does
+ * not answer) the destination is flushed, read back and checksummed too,
+ * and a mismatch fails with EBADMSG. Pass -1 to skip the read-back.
+ */
+static int
+copy_verify(struct copyctx *cc, int rbfd, struct verifystat *vs)
+{
+	struct vpipe vp;
+	pthread_t tid;
+	ssize_t n;
+	int i = 0, r, err = 0;
+	uint64_t t0;
+
+	memset(vs, 0, sizeof(*vs));
+	memset(&vp, 0, sizeof(vp));
+	vp.vp_cc = cc;
+	vp.vp_buf[0] = xmalloc(cc->cc_bufsz);
+	vp.vp_buf[1] = xmalloc(cc->cc_bufsz);
+	pthread_mutex_init(&vp.vp_mtx, NULL);
+	pthread_cond_init(&vp.vp_cnd, NULL);
+
+	t0 = bench_nsec();
+	if ((r = pthread_create(&tid, NULL, copy_verify_reader, &vp)) != 0)
+		errmsg_exit1("pthread_create failed, %s\n", strerror(r));
+	for (;;) {
+		pthread_mutex_lock(&vp.vp_mtx);
+		while (!vp.vp_full[i])
+			pthread_cond_wait(&vp.vp_cnd, &vp.vp_mtx);
+		n = vp.vp_len[i];
+		pthread_mutex_unlock(&vp.vp_mtx);
+		if (n == -1)
+			err = vp.vp_err;
+		if (n <= 0)
+			break;
+
+		vs->vs_crc = crc32c(vs->vs_crc, vp.vp_buf[i], n);
+		if (copy_pwrite_all(cc->cc_outfd, vp.vp_buf[i], n,
+			cc->cc_off) == -1) {
+			err = errno;
+			break;
+		}
+		cc->cc_off += n;
+
+		pthread_mutex_lock(&vp.vp_mtx);
+		vp.vp_full[i] = false;
+		pthread_cond_broadcast(&vp.vp_cnd);
+		pthread_mutex_unlock(&vp.vp_mtx);
+		i ^= 1;
+	}
+	pthread_mutex_lock(&vp.vp_mtx);
+	vp.vp_stop = true;
+	pthread_cond_broadcast(&vp.vp_cnd);
+	pthread_mutex_unlock(&vp.vp_mtx);
+	pthread_join(tid, NULL);
+	vs->vs_copyns = bench_nsec() - t0;
+
+	xfree(vp.vp_buf[0]);
+	xfree(vp.vp_buf[1]);
+	pthread_mutex_destroy(&vp.vp_mtx);
+	pthread_cond_destroy(&vp.vp_cnd);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	if (rbfd != -1) {
+		t0 = bench_nsec();
+		if (fdatasync(cc->cc_outfd) == -1 ||
+			copy_readback(rbfd, cc->cc_off, cc->cc_bufsz,
+			&vs->vs_readcrc) == -1)
+			return -1;
+		vs->vs_readns = bench_nsec() - t0;
+		vs->vs_readback = true;
+		if (vs->vs_readcrc != vs->vs_crc) {
+			errno = EBADMSG;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#endif	/* !_COPYENG_H_ */
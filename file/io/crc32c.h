@@ -0,0 +1,236 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HW	1
+#define CRC32C_TARGET	__attribute__((target("sse4.2")))
+#elif defined(__aarch64__) && (defined(__linux__) || defined(__FreeBSD__))
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifdef __linux__
+#include <asm/hwcap.h>
+#endif
+#define CRC32C_HW	1
+#define CRC32C_TARGET	__attribute__((target("+crc")))
+#endif
+
+/*
+ * CRC-32C (Castagnoli), the checksum of iSCSI, ext4 and btrfs metadata.
+ * Reflected polynomial 0x82f63b78, initial value and final xor ~0.
+ *
+ * x86 (SSE4.2) and ARMv8 have an instruction for it, used when the CPU
+ * has it, else tables do eight bytes at a time.  The instruction takes a
+ * few cycles to produce its result, so long buffers are cut into three
+ * streams run side by side and their CRCs combined with a precomputed
+ * "append CRC32C_LONG zero bytes" operator.
+ */
+#define CRC32C_POLY	0x82f63b78U
+#define CRC32C_LONG	8192	/* Bytes per stream of a 3-way step */
+
+static uint32_t crc32c_table[8][256];	/* Slicing by 8 */
+static uint32_t crc32c_shift[4][256];	/* x^(8 * CRC32C_LONG) mod P */
+static uint32_t (*crc32c_raw)(uint32_t, const unsigned char *, size_t);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* The CRC register over 'len' bytes, no inversion either side */
+static uint32_t
+crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint32_t lo, hi;
+
+	/* Eight bytes per step, one table per byte position */
+	for (; len >= 8; len -= 8, p += 8) {
+		lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+			(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+		hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+			(uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+		crc = crc32c_table[7][lo & 0xff] ^
+			crc32c_table[6][(lo >> 8) & 0xff] ^
+			crc32c_table[5][(lo >> 16) & 0xff] ^
+			crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xff] ^
+			crc32c_table[2][(hi >> 8) & 0xff] ^
+			crc32c_table[1][(hi >> 16) & 0xff] ^
+			crc32c_table[0][hi >> 24];
+	}
+	while (len-- > 0)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static inline uint32_t
+crc32c_shiftlong(uint32_t crc)
+{
+	return crc32c_shift[0][crc & 0xff] ^
+		crc32c_shift[1][(crc >> 8) & 0xff] ^
+		crc32c_shift[2][(crc >> 16) & 0xff] ^ crc32c_shift[3][crc >> 24];
+}
+
+#ifdef CRC32C_HW
+#if defined(__x86_64__)
+#define CRC32C_U64(c, v)	((uint32_t)_mm_crc32_u64((c), (v)))
+#elif defined(__i386__)
+#define CRC32C_U64(c, v)	_mm_crc32_u32(_mm_crc32_u32((c), \
+	(uint32_t)(v)), (uint32_t)((v) >> 32))
+#else
+#define CRC32C_U64(c, v)	__crc32cd((c), (v))
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC32C_U8(c, v)		_mm_crc32_u8((c), (v))
+#else
+#define CRC32C_U8(c, v)		__crc32cb((c), (v))
+#endif
+
+CRC32C_TARGET static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint32_t crc1, crc2;
+	uint64_t v0, v1, v2;
+	size_t i;
+
+	for (; len > 0 && ((uintptr_t)p & 7) != 0; len--)
+		crc = CRC32C_U8(crc, *p++);
+
+	/* Three independent streams keep the unit busy */
+	for (; len >= 3 * CRC32C_LONG; len -= 3 * CRC32C_LONG) {
+		crc1 = crc2 = 0;
+		for (i = 0; i < CRC32C_LONG; i += 8) {
+			memcpy(&v0, p + i, 8);
+			memcpy(&v1, p + CRC32C_LONG + i, 8);
+			memcpy(&v2, p + 2 * CRC32C_LONG + i, 8);
+			crc = CRC32C_U64(crc, v0);
+			crc1 = CRC32C_U64(crc1, v1);
+			crc2 = CRC32C_U64(crc2, v2);
+		}
+		crc = crc32c_shiftlong(crc) ^ crc1;
+		crc = crc32c_shiftlong(crc) ^ crc2;
+		p += 3 * CRC32C_LONG;
+	}
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v0, p, 8);
+		crc = CRC32C_U64(crc, v0);
+	}
+	while (len-- > 0)
+		crc = CRC32C_U8(crc, *p++);
+
+	return crc;
+}
+
+static bool
+crc32c_hw_usable(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("sse4.2");
+#elif defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+	unsigned long hwcap = 0;
+
+	return elf_aux_info(AT_HWCAP, &hwcap, sizeof(hwcap)) == 0 &&
+		(hwcap & HWCAP_CRC32) != 0;
+#endif
+}
+#endif	/* CRC32C_HW */
+
+static void
+crc32c_init(void)
+{
+	static const unsigned char zeros[CRC32C_LONG];
+	uint32_t i, j, b, crc, col[32];
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+				crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+
+	/*
+	 * The register is linear in its bits: appending n zero bytes maps
+	 * each bit to a fixed pattern, so tabulate that per byte position.
+	 */
+	for (i = 0; i < 32; i++)
+		col[i] = crc32c_sw(1U << i, zeros, CRC32C_LONG);
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 256; j++) {
+			crc = 0;
+			for (b = 0; b < 8; b++)
+				if (j & (1U << b))
+					crc ^= col[i * 8 + b];
+			crc32c_shift[i][j] = crc;
+		}
+	}
+
+	crc32c_raw = crc32c_sw;
+#ifdef CRC32C_HW
+	if (crc32c_hw_usable())
+		crc32c_raw = crc32c_hw;
+#endif
+}
+
+/* Name of the implementation in use, for reports */
+static inline const char *
+crc32c_impl(void)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_raw == crc32c_sw ? "table" :
+#if defined(__x86_64__) || defined(__i386__)
+		"sse4.2";
+#else
+		"armv8-crc";
+#endif
+}
+
+/*
+ * Continue the checksum 'crc' over 'len' bytes of 'buf'. Start with 0:
+ * crc32c(crc32c(0, a, n), b, m) is the checksum of a followed by b.
+ */
+static inline uint32_t
+crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+
+	return ~crc32c_raw(~crc, buf, len);
+}
+
+#endif	/* !_CRC32C_H_ */
@@ -29,51 +29,612 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* O_DIRECT */
+#endif
 #include "unibsd.h"
+#include "benchutil.h"
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <aio.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+#endif
+#ifdef __FreeBSD__
+#include <sys/disk.h>
+#endif
+
+/*
+ * The engines that keep several requests in flight:
+ *
+ *	aio	POSIX aio_read(2)/aio_suspend(2). On FreeBSD the kernel serves
+ *		them asynchronously; glibc emulates them with threads.
+ *	kaio	Linux native AIO (io_submit(2)), asynchronous for O_DIRECT.
+ *	thread	'depth' threads each issuing synchronous pread(2) calls. Used
+ *		as a fallback when the other engines are unavailable.
+ */
+enum { ENG_AIO, ENG_KAIO, ENG_THREAD, ENG_NENGINES };
+static const char *engnames[ENG_NENGINES] = { "aio", "kaio", "thread" };
+
+/*
+ * A pool of aligned I/O buffers: a request takes a buffer when it is issued
+ * and gives it back when it completes, so no buffer is allocated on the I/O
+ * path and the pool bounds the memory in use.
+ */
+struct bufpool {
+	char		*bp_mem;	/* One aligned block carved into buffers */
+	char		**bp_free;	/* Stack of free buffers */
+	int		bp_nfree;	/* Buffers on the stack */
+	pthread_mutex_t	bp_mtx;		/* Protects the stack */
+};
+
+/* The workload shared by all requests */
+static struct {
+	int		w_fd;		/* File or device being read */
+	size_t		w_blksz;	/* Bytes per request */
+	off_t		w_start;	/* First byte of the region read */
+	off_t		w_nblks;	/* Blocks in the region */
+	long		w_total;	/* Requests to issue */
+	long		w_issued;	/* Requests issued so far */
+	bool		w_random;	/* Random instead of sequential */
+	uint64_t	w_rng;		/* State of the random generator */
+	pthread_mutex_t	w_mtx;		/* Protects the fields above */
+} wl = { .w_mtx = PTHREAD_MUTEX_INITIALIZER };
+
+static void pool_init(struct bufpool *, int, size_t, size_t);
+static void pool_free(struct bufpool *);
+static char * pool_get(struct bufpool *);
+static void pool_put(struct bufpool *, char *);
+static off_t next_offset(void);
+static off_t file_size(int);
+static int run_aio(int, struct bufpool *, struct latstat *, uint64_t *);
+static int run_kaio(int, struct bufpool *, struct latstat *, uint64_t *);
+static int run_thread(int, struct bufpool *, struct latstat *, uint64_t *);
+static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
-	int fd;
-	size_t len, alig;
-	ssize_t nrd;
-	off_t offset;
+	int op, depth = 32, engine = -1;
+	size_t alig = 4096;
+	long count = 0;
+	off_t offset = 0, length = 0, size;
+	uint64_t t0, ns, bytes = 0;
+	struct bufpool bp;
+	struct latstat ls;
+	const char *optstr = "e:q:b:a:p:n:o:l:";
+	static int (*const run[ENG_NENGINES])(int, struct bufpool *,
+		struct latstat *, uint64_t *) = {
+		run_aio, run_kaio, run_thread
+	};
+
+	wl.w_blksz = 4096;
+	while ((op = getopt(argc, argv, optstr)) != -1) {
+		switch (op) {
+		case 'e':
+			for (engine = 0; engine < ENG_NENGINES; engine++)
+				if (strcmp(optarg, engnames[engine]) == 0)
+					break;
+			if (engine == ENG_NENGINES)
+				errmsg_exit1("Unknown engine. -e %s\n", optarg);
+			break;
+		case 'q':
+			depth = getlong(optarg, GN_GT_0);
+			break;
+		case 'b':
+			wl.w_blksz = getsize(optarg);
+			break;
+		case 'a':
+			alig = getsize(optarg);
+			break;
+		case 'p':
+			if (strcmp(optarg, "rand") == 0)
+				wl.w_random = true;
+			else if (strcmp(optarg, "seq") != 0)
+				errmsg_exit1("Unknown pattern. -p %s\n", optarg);
+			break;
+		case 'n':
+			count = getlong(optarg, GN_GT_0);
+			break;
+		case 'o':
+			offset = getsize(optarg);
+			break;
+		case 'l':
+			length = getsize(optarg);
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+		usage_info(argv[0]);
+
+	/*
+	 * O_DIRECT transfers go straight between the device and the user
+	 * buffer, so the buffer address, the file offset and the length must
+	 * all be multiples of the device's logical block size.
+	 */
+	if (alig == 0 || (alig & (alig - 1)) != 0)
+		errmsg_exit1("alignment must be a power of 2, %zu\n", alig);
+	if (wl.w_blksz == 0 || wl.w_blksz % alig != 0 || offset % alig != 0)
+		errmsg_exit1("block size and offset must be multiples of %zu\n",
+			alig);
+
+	if ((wl.w_fd = open(argv[optind], O_RDONLY | O_DIRECT)) == -1)
+		errmsg_exit1("open file %s failure, %s.\n", argv[optind],
+			ERR_MSG);
+
+	size = file_size(wl.w_fd);
+	if (length == 0)
+		length = size - offset;
+	wl.w_start = offset;
+	wl.w_nblks = MIN(length, size - offset) / (off_t)wl.w_blksz;
+	if (wl.w_nblks <= 0)
+		errmsg_exit1("nothing to read in %s\n", argv[optind]);
+	wl.w_total = count > 0 ? count : (long)wl.w_nblks;
+	wl.w_rng = (uint64_t)getpid() * 0x9e3779b97f4a7c15ULL | 1;
+
+#ifdef __linux__
+	if (engine == -1)
+		engine = ENG_KAIO;
+#else
+	if (engine == -1)
+		engine = ENG_AIO;
+#endif
+
+	pool_init(&bp, depth, wl.w_blksz, alig);
+	latstat_init(&ls);
+
+	t0 = bench_nsec();
+	if (run[engine](depth, &bp, &ls, &bytes) == -1) {
+		/*
+		 * An engine the system does not provide fails before its
+		 * first request completes: start over with threads.
+		 */
+		if (ls.ls_cnt != 0 || engine == ENG_THREAD ||
+			(errno != ENOSYS && errno != EAGAIN &&
+			 errno != EOPNOTSUPP && errno != EINVAL))
+			errmsg_exit1("%s engine failure, %s.\n",
+				engnames[engine], ERR_MSG);
+		fprintf(stderr, "%s engine unavailable (%s), using threads\n",
+			engnames[engine], ERR_MSG);
+		engine = ENG_THREAD;
+		wl.w_issued = 0;
+		/* The engine has reaped its requests: no buffer is in use */
+		pool_free(&bp);
+		pool_init(&bp, depth, wl.w_blksz, alig);
+		t0 = bench_nsec();
+		if (run_thread(depth, &bp, &ls, &bytes) == -1)
+			errmsg_exit1("thread engine failure, %s.\n", ERR_MSG);
+	}
+	ns = bench_nsec() - t0;
+
+	printf("engine %s, depth %d, block %zu, %s\n", engnames[engine], depth,
+		wl.w_blksz, wl.w_random ? "random" : "sequential");
+	printf("%zu requests, %ju bytes in %.3f s\n", ls.ls_cnt,
+		(uintmax_t)bytes, bench_secs(ns));
+	printf("IOPS %.0f, %.1f MB/s\n", (double)ls.ls_cnt / bench_secs(ns),
+		bench_mbps(bytes, ns));
+	latstat_print(&ls, "completion");
+
+	latstat_free(&ls);
+	pool_free(&bp);
+	if (close(wl.w_fd) == -1)
+		errmsg_exit1("close failure, %s.\n", ERR_MSG);
+
+	return 0;
+}
+
+/*
+ * The aligned_alloc() function allocates size bytes of memory such that the
+ * allocation's base address is a multiple of alignment. The requested
+ * alignment must be a power of 2, and size must be an integral multiple of
+ * alignment, which holds since 'bufsz' is.
+ */
+static void
+pool_init(struct bufpool *bp, int nbufs, size_t bufsz, size_t alig)
+{
+	int i;
+
+	if ((bp->bp_mem = aligned_alloc(alig, nbufs * bufsz)) == NULL)
+		errmsg_exit1("aligned_alloc error, %s.\n", ERR_MSG);
+	bp->bp_free = xcalloc(nbufs, sizeof(char *));
+	for (i = 0; i < nbufs; i++)
+		bp->bp_free[i] = bp->bp_mem + i * bufsz;
+	bp->bp_nfree = nbufs;
+	pthread_mutex_init(&bp->bp_mtx, NULL);
+}
+
+static void
+pool_free(struct bufpool *bp)
+{
+	free(bp->bp_mem);	/* From aligned_alloc() */
+	xfree(bp->bp_free);
+	pthread_mutex_destroy(&bp->bp_mtx);
+}
+
+static char *
+pool_get(struct bufpool *bp)
+{
 	char *buf;
 
-	if (argc < 3)
-		errmsg_exit1("Usage: %s file length [offset [aligment]]\n",
-			argv[0]);
+	pthread_mutex_lock(&bp->bp_mtx);
+	assert(bp->bp_nfree > 0);
+	buf = bp->bp_free[--bp->bp_nfree];
+	pthread_mutex_unlock(&bp->bp_mtx);
+
+	return buf;
+}
+
+static void
+pool_put(struct bufpool *bp, char *buf)
+{
+	pthread_mutex_lock(&bp->bp_mtx);
+	bp->bp_free[bp->bp_nfree++] = buf;
+	pthread_mutex_unlock(&bp->bp_mtx);
+}
+
+/*
+ * Offset of the next request, or -1 when all of them have been issued. The
+ * random pattern picks uniformly among the blocks of the region
+ * (xorshift64*), the sequential one wraps around at its end.
+ */
+static off_t
+next_offset(void)
+{
+	off_t blk;
+
+	pthread_mutex_lock(&wl.w_mtx);
+	if (wl.w_issued == wl.w_total) {
+		pthread_mutex_unlock(&wl.w_mtx);
+		return -1;
+	}
+	if (wl.w_random) {
+		wl.w_rng ^= wl.w_rng >> 12;
+		wl.w_rng ^= wl.w_rng << 25;
+		wl.w_rng ^= wl.w_rng >> 27;
+		blk = (wl.w_rng * 0x2545f4914f6cdd1dULL) % wl.w_nblks;
+	} else {
+		blk = wl.w_issued % wl.w_nblks;
+	}
+	wl.w_issued++;
+	pthread_mutex_unlock(&wl.w_mtx);
+
+	return wl.w_start + blk * (off_t)wl.w_blksz;
+}
+
+/* Size of a regular file, or of a disk device */
+static off_t
+file_size(int fd)
+{
+	struct stat fs;
+
+	if (fstat(fd, &fs) == -1)
+		errmsg_exit1("fstat failure, %s.\n", ERR_MSG);
+	if (S_ISREG(fs.st_mode))
+		return fs.st_size;
+
+#if defined(DIOCGMEDIASIZE)
+	{
+		off_t sz;
+
+		if (ioctl(fd, DIOCGMEDIASIZE, &sz) == 0)
+			return sz;
+	}
+#elif defined(BLKGETSIZE64)
+	{
+		uint64_t sz;
+
+		if (ioctl(fd, BLKGETSIZE64, &sz) == 0)
+			return (off_t)sz;
+	}
+#endif
+	errmsg_exit1("cannot get the size of the device, %s.\n", ERR_MSG);
+	return -1;
+}
+
+static int
+run_aio(int depth, struct bufpool *bp, struct latstat *ls, uint64_t *bytes)
+{
+	struct aiocb *cbs, **list;
+	uint64_t *start;
+	ssize_t n;
+	off_t off;
+	int i, err, inflight = 0;
+
+	cbs = xcalloc(depth, sizeof(struct aiocb));
+	list = xcalloc(depth, sizeof(struct aiocb *));
+	start = xcalloc(depth, sizeof(uint64_t));
 
-	len = getlong(argv[2], GN_ANY_BASE);
-	offset = argc > 3 ? getlong(argv[3], GN_ANY_BASE) : 0;
-	alig = argc > 4 ? getlong(argv[4], GN_ANY_BASE) : 4096;
+	/* Fill the queue, then reissue each slot as it completes */
+	for (i = 0; i < depth; i++) {
+		if ((off = next_offset()) == -1)
+			break;
+		cbs[i].aio_fildes = wl.w_fd;
+		cbs[i].aio_offset = off;
+		cbs[i].aio_buf = pool_get(bp);
+		cbs[i].aio_nbytes = wl.w_blksz;
+		start[i] = bench_nsec();
+		if (aio_read(&cbs[i]) == -1)
+			goto fail;
+		list[i] = &cbs[i];
+		inflight++;
+	}
 
-	if ((fd = open(argv[1], O_RDONLY | O_DIRECT)) == -1)
-		errmsg_exit1("open file %s failure, %s.\n", ERR_MSG);
+	while (inflight > 0) {
+		/*
+		 * aio_suspend() sleeps until at least one request of the list
+		 * has completed. NULL entries of the list are ignored.
+		 */
+		if (aio_suspend((const struct aiocb *const *)list, depth, NULL)
+			== -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
 
+		for (i = 0; i < depth; i++) {
+			if (list[i] == NULL ||
+				(err = aio_error(&cbs[i])) == EINPROGRESS)
+				continue;
+			if ((n = aio_return(&cbs[i])) == -1) {
+				errno = err;
+				goto fail;
+			}
+			latstat_add(ls, bench_nsec() - start[i]);
+			*bytes += n;
+			list[i] = NULL;
+			inflight--;
+
+			if ((off = next_offset()) == -1) {
+				pool_put(bp, (char *)cbs[i].aio_buf);
+				continue;
+			}
+			cbs[i].aio_offset = off;
+			start[i] = bench_nsec();
+			if (aio_read(&cbs[i]) == -1)
+				goto fail;
+			list[i] = &cbs[i];
+			inflight++;
+		}
+	}
+
+	xfree(cbs);
+	xfree(list);
+	xfree(start);
+	return 0;
+
+fail:
 	/*
-	 * The aligned_alloc() function allocates size bytes of memory such that
-	 * the allocation's base address is a multiple of alignment. The
-	 * requested alignment must be a power of 2. Behavior is undefined if
-	 * size is not an integral multiple of alignment.
-	 *
-	 * we ensure that 'buf' is aligned on an odd multiple of 'alignment'.
-	 * We do this to ensure that if, for example, we ask for a 256-byte
-	 * aligned buffer, we don't accidentally get a buffer that is also
-	 * aligned on a 512-byte boundary. 
+	 * Cancel what is in flight and wait for what could not be cancelled:
+	 * the control blocks and buffers must not be freed under a request.
 	 */
-	buf = (char *)aligned_alloc(alig * 2, len + alig);
-	if (buf == NULL)
-		errmsg_exit1("aligned_alloc error, %s.\n", ERR_MSG);
-	buf += alig;
+	err = errno;
+	for (i = 0; i < depth; i++) {
+		if (list[i] == NULL)
+			continue;
+		if (aio_cancel(wl.w_fd, list[i]) == AIO_NOTCANCELED)
+			while (aio_error(list[i]) == EINPROGRESS)
+				(void)aio_suspend((const struct aiocb *const *)
+					&list[i], 1, NULL);
+		(void)aio_return(list[i]);
+	}
+	xfree(cbs);
+	xfree(list);
+	xfree(start);
+	errno = err;
+	return -1;
+}
+
+#ifdef __linux__
+/* glibc has no wrappers for the native AIO system calls */
+static long
+io_setup(unsigned nr, aio_context_t *ctxp)
+{
+	return syscall(SYS_io_setup, nr, ctxp);
+}
+
+static long
+io_destroy(aio_context_t ctx)
+{
+	return syscall(SYS_io_destroy, ctx);
+}
+
+static long
+io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static long
+io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+	struct io_event *events, struct timespec *timeout)
+{
+	return syscall(SYS_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+#endif
+
+static int
+run_kaio(int depth, struct bufpool *bp, struct latstat *ls, uint64_t *bytes)
+{
+#ifdef __linux__
+	aio_context_t ctx = 0;
+	struct iocb *cbs, **subq;
+	struct io_event *evs;
+	uint64_t *start;
+	off_t off;
+	long i, n, nsub, inflight = 0;
+
+	if (io_setup(depth, &ctx) == -1)
+		return -1;
 
-	if (lseek(fd, offset, SEEK_SET) == -1)
-		errmsg_exit1("lseek failure, %s.\n", ERR_MSG);
+	cbs = xcalloc(depth, sizeof(struct iocb));
+	subq = xcalloc(depth, sizeof(struct iocb *));
+	evs = xcalloc(depth, sizeof(struct io_event));
+	start = xcalloc(depth, sizeof(uint64_t));
 
-	if ((nrd = read(fd, buf, len)) == -1)
-		errmsg_exit1("read failure, %s.\n", ERR_MSG);
-	printf("Read %ld bytes.\n", nrd);
-	
+	/* The slot number travels with the request in 'aio_data' */
+	for (i = 0, nsub = 0; i < depth; i++) {
+		if ((off = next_offset()) == -1)
+			break;
+		cbs[i].aio_data = i;
+		cbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		cbs[i].aio_fildes = wl.w_fd;
+		cbs[i].aio_buf = (uintptr_t)pool_get(bp);
+		cbs[i].aio_nbytes = wl.w_blksz;
+		cbs[i].aio_offset = off;
+		subq[nsub++] = &cbs[i];
+	}
+
+	while (nsub > 0 || inflight > 0) {
+		/* Submit everything queued with one system call */
+		if (nsub > 0) {
+			for (i = 0; i < nsub; i++)
+				start[subq[i]->aio_data] = bench_nsec();
+			if ((n = io_submit(ctx, nsub, subq)) == -1)
+				goto fail;
+			if (n < nsub)
+				memmove(subq, subq + n, (nsub - n) *
+					sizeof(struct iocb *));
+			inflight += n;
+			nsub -= n;
+		}
+
+		if ((n = io_getevents(ctx, 1, depth, evs, NULL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		for (i = 0; i < n; i++) {
+			struct iocb *cb = &cbs[evs[i].data];
+
+			if (evs[i].res < 0) {
+				errno = -evs[i].res;
+				goto fail;
+			}
+			latstat_add(ls, bench_nsec() - start[evs[i].data]);
+			*bytes += evs[i].res;
+			inflight--;
+
+			if ((off = next_offset()) == -1) {
+				pool_put(bp, (char *)(uintptr_t)cb->aio_buf);
+				continue;
+			}
+			cb->aio_offset = off;
+			subq[nsub++] = cb;
+		}
+	}
+
+	io_destroy(ctx);
+	xfree(cbs);
+	xfree(subq);
+	xfree(evs);
+	xfree(start);
 	return 0;
+
+fail:
+	n = errno;
+	io_destroy(ctx);	/* Waits for the requests still in flight */
+	xfree(cbs);
+	xfree(subq);
+	xfree(evs);
+	xfree(start);
+	errno = n;
+	return -1;
+#else
+	(void)depth;
+	(void)bp;
+	(void)ls;
+	(void)bytes;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+struct thrarg {
+	struct bufpool	*ta_pool;
+	struct latstat	ta_lat;		/* Samples of this thread */
+	uint64_t	ta_bytes;	/* Bytes read by this thread */
+	int		ta_err;		/* errno of a failed read */
+};
+
+static void *
+read_thread(void *arg)
+{
+	struct thrarg *ta = arg;
+	char *buf;
+	off_t off;
+	ssize_t n;
+	uint64_t t0;
+
+	buf = pool_get(ta->ta_pool);
+	while ((off = next_offset()) != -1) {
+		t0 = bench_nsec();
+		if ((n = pread(wl.w_fd, buf, wl.w_blksz, off)) == -1) {
+			ta->ta_err = errno;
+			break;
+		}
+		latstat_add(&ta->ta_lat, bench_nsec() - t0);
+		ta->ta_bytes += n;
+	}
+	pool_put(ta->ta_pool, buf);
+
+	return NULL;
+}
+
+static int
+run_thread(int depth, struct bufpool *bp, struct latstat *ls, uint64_t *bytes)
+{
+	struct thrarg *ta;
+	pthread_t *tids;
+	int i, r, err = 0;
+
+	ta = xcalloc(depth, sizeof(struct thrarg));
+	tids = xcalloc(depth, sizeof(pthread_t));
+
+	for (i = 0; i < depth; i++) {
+		ta[i].ta_pool = bp;
+		latstat_init(&ta[i].ta_lat);
+		if ((r = pthread_create(&tids[i], NULL, read_thread, &ta[i]))
+			!= 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+	}
+
+	for (i = 0; i < depth; i++) {
+		if ((r = pthread_join(tids[i], NULL)) != 0)
+			errmsg_exit1("pthread_join failed, %s\n", strerror(r));
+		latstat_merge(ls, &ta[i].ta_lat);
+		latstat_free(&ta[i].ta_lat);
+		*bytes += ta[i].ta_bytes;
+		if (ta[i].ta_err != 0)
+			err = ta[i].ta_err;
+	}
+
+	xfree(ta);
+	xfree(tids);
+
+	errno = err;
+	return err == 0 ? 0 : -1;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-e engine] [-q depth] [-b block] "
+		"[-a alignment] [-p seq|rand] [-n count] [-o offset] "
+		"[-l length] file\n", pname);
+	fprintf(stderr, "-e: aio, kaio (Linux) or thread.\n");
+	fprintf(stderr, "-q: requests kept in flight (default 32).\n");
+	fprintf(stderr, "-b: bytes per request (default 4k).\n");
+	fprintf(stderr, "-a: buffer and offset alignment (default 4k).\n");
+	fprintf(stderr, "-p: sequential (default) or random offsets.\n");
+	fprintf(stderr, "-n: requests to issue (default: the whole region).\n");
+	fprintf(stderr, "-o, -l: region of the file to read.\n");
+	exit(EXIT_FAILURE);
 }
@@ -0,0 +1,200 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _GCOMMIT_H_
+#define _GCOMMIT_H_
+
+#include <pthread.h>
+#include "iovbatch.h"
+
+/*
+ * Group commit: many producer threads append records, and a single flusher
+ * thread makes them durable with one pwritev(2) and one fdatasync(2) per
+ * batch. While the flusher waits for the disk, the producers fill the next
+ * batch, so the cost of a sync is shared by every record that arrived during
+ * the previous one.
+ *
+ * A producer blocks until its record is durable, hence the batch refers to
+ * the producers' own buffers and no record is ever copied.
+ */
+struct gcommit {
+	int		gc_fd;		/* File written to */
+	off_t		gc_off;		/* Offset of the next batch */
+	struct iovec	*gc_fill;	/* Batch being filled by the producers */
+	struct iovec	*gc_flush;	/* Batch being written by the flusher */
+	int		gc_nfill;	/* Records in 'gc_fill' */
+	uint64_t	gc_appended;	/* Ticket of the last record appended */
+	uint64_t	gc_durable;	/* Ticket of the last durable record */
+	uint64_t	gc_batches;	/* Batches committed */
+	int		gc_err;		/* errno of a failed commit, sticky */
+	bool		gc_stop;	/* The flusher should exit when idle */
+	pthread_t	gc_tid;		/* The flusher */
+	pthread_mutex_t	gc_mtx;		/* Protects the fields above */
+	pthread_cond_t	gc_work;	/* Signals the flusher */
+	pthread_cond_t	gc_done;	/* Signals the producers */
+};
+
+static void *
+gc_flusher(void *arg)
+{
+	struct gcommit *gc = arg;
+	struct iovec *iov;
+	uint64_t last;
+	size_t len;
+	int i, cnt, err;
+
+	pthread_mutex_lock(&gc->gc_mtx);
+	while (1) {
+		while (gc->gc_nfill == 0 && !gc->gc_stop)
+			pthread_cond_wait(&gc->gc_work, &gc->gc_mtx);
+		if (gc->gc_nfill == 0)
+			break;
+
+		/* Take the batch, and give the producers an empty one */
+		iov = gc->gc_fill;
+		gc->gc_fill = gc->gc_flush;
+		gc->gc_flush = iov;
+		cnt = gc->gc_nfill;
+		gc->gc_nfill = 0;
+		last = gc->gc_appended;
+		pthread_cond_broadcast(&gc->gc_done);	/* Room again */
+		pthread_mutex_unlock(&gc->gc_mtx);
+
+		for (i = 0, len = 0; i < cnt; i++)
+			len += iov[i].iov_len;
+		err = 0;
+		if (iov_xfer_all(gc->gc_fd, iov, cnt, gc->gc_off, false) == -1 ||
+			fdatasync(gc->gc_fd) == -1)
+			err = errno;
+
+		pthread_mutex_lock(&gc->gc_mtx);
+		gc->gc_off += len;
+		gc->gc_batches++;
+		/*
+		 * After a failure gc_durable stays where it was, so the failed
+		 * tickets, and any flushed behind them, are never reported as
+		 * durable.
+		 */
+		if (err != 0 && gc->gc_err == 0)
+			gc->gc_err = err;
+		if (gc->gc_err == 0)
+			gc->gc_durable = last;
+		pthread_cond_broadcast(&gc->gc_done);
+	}
+	pthread_mutex_unlock(&gc->gc_mtx);
+
+	return NULL;
+}
+
+/* Start the flusher of a group commit writing to 'fd' from offset 'off'. */
+static int
+gc_init(struct gcommit *gc, int fd, off_t off)
+{
+	int r;
+
+	memset(gc, 0, sizeof(*gc));
+	gc->gc_fd = fd;
+	gc->gc_off = off;
+	gc->gc_fill = xcalloc(IOV_MAX, sizeof(struct iovec));
+	gc->gc_flush = xcalloc(IOV_MAX, sizeof(struct iovec));
+	pthread_mutex_init(&gc->gc_mtx, NULL);
+	pthread_cond_init(&gc->gc_work, NULL);
+	pthread_cond_init(&gc->gc_done, NULL);
+
+	if ((r = pthread_create(&gc->gc_tid, NULL, gc_flusher, gc)) != 0) {
+		errno = r;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Append a record and wait until it is on stable storage. 'buf' must stay
+ * untouched until then, which the wait guarantees. Return 0 once the record
+ * is durable, or -1 with errno set if a commit has failed.
+ */
+static int
+gc_append(struct gcommit *gc, const void *buf, size_t len)
+{
+	uint64_t ticket;
+
+	pthread_mutex_lock(&gc->gc_mtx);
+	while (gc->gc_nfill == IOV_MAX && gc->gc_err == 0)
+		pthread_cond_wait(&gc->gc_done, &gc->gc_mtx);
+	if (gc->gc_err != 0)
+		goto fail;
+
+	gc->gc_fill[gc->gc_nfill].iov_base = (void *)buf;
+	gc->gc_fill[gc->gc_nfill].iov_len = len;
+	gc->gc_nfill++;
+	ticket = ++gc->gc_appended;
+	pthread_cond_signal(&gc->gc_work);
+
+	while (gc->gc_durable < ticket && gc->gc_err == 0)
+		pthread_cond_wait(&gc->gc_done, &gc->gc_mtx);
+	if (gc->gc_durable < ticket)	/* Its batch failed: gc_err says why */
+		goto fail;
+	pthread_mutex_unlock(&gc->gc_mtx);
+
+	return 0;
+
+fail:
+	errno = gc->gc_err;
+	pthread_mutex_unlock(&gc->gc_mtx);
+	return -1;
+}
+
+/* Commit what is pending, stop the flusher and release the batches. */
+static int
+gc_close(struct gcommit *gc)
+{
+	pthread_mutex_lock(&gc->gc_mtx);
+	gc->gc_stop = true;
+	pthread_cond_signal(&gc->gc_work);
+	pthread_mutex_unlock(&gc->gc_mtx);
+
+	pthread_join(gc->gc_tid, NULL);
+	pthread_mutex_destroy(&gc->gc_mtx);
+	pthread_cond_destroy(&gc->gc_work);
+	pthread_cond_destroy(&gc->gc_done);
+	xfree(gc->gc_fill);
+	xfree(gc->gc_flush);
+
+	if (gc->gc_err != 0) {
+		errno = gc->gc_err;
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif	/* !_GCOMMIT_H_ */
@@ -0,0 +1,175 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _IOVBATCH_H_
+#define _IOVBATCH_H_
+
+#include <sys/uio.h>
+#include <stdint.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX		1024	/* POSIX minimum is 16, both BSD and Linux 1024 */
+#endif
+
+/*
+ * Transfer a whole iovec array with writev(2)/pwritev(2) or readv(2)/
+ * preadv(2); 'off' -1 means at the current file offset. These calls may
+ * transfer less than asked: step over the iovecs already done, trim the one
+ * cut in the middle and go on. The array is modified. Return the bytes
+ * transferred, short only at end-of-file, or -1.
+ */
+static ssize_t
+iov_xfer_all(int fd, struct iovec *iov, int cnt, off_t off, bool rd)
+{
+	ssize_t n, tot = 0;
+
+	while (cnt > 0) {
+		if (rd)
+			n = off == -1 ? readv(fd, iov, cnt) :
+				preadv(fd, iov, cnt, off + tot);
+		else
+			n = off == -1 ? writev(fd, iov, cnt) :
+				pwritev(fd, iov, cnt, off + tot);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0 && rd)
+			break;		/* End-of-file */
+		tot += n;
+
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return tot;
+}
+
+/*
+ * An iovec batch collects references to many small buffers and moves them
+ * with one system call. Nothing is copied: a buffer must stay untouched
+ * until the batch has been flushed. The batch flushes itself when IOV_MAX
+ * buffers or 'ib_thresh' bytes have been added.
+ *
+ * A write batch gathers the buffers into the file (writev); a read batch
+ * scatters the next bytes of the file into them (readv), in the order they
+ * were added.
+ */
+struct iovbatch {
+	int		ib_fd;		/* File transferred to or from */
+	off_t		ib_off;		/* File offset, -1 for the current */
+	bool		ib_read;	/* Scatter reader, else gather writer */
+	size_t		ib_thresh;	/* Flush when this many bytes pending */
+	int		ib_cnt;		/* Buffers pending */
+	size_t		ib_bytes;	/* Bytes pending */
+	uint64_t	ib_calls;	/* System calls made (flushes) */
+	uint64_t	ib_total;	/* Bytes transferred */
+	struct iovec	ib_iov[IOV_MAX];
+};
+
+static inline void
+iovb_init(struct iovbatch *ib, int fd, off_t off, size_t thresh, bool rd)
+{
+	ib->ib_fd = fd;
+	ib->ib_off = off;
+	ib->ib_read = rd;
+	ib->ib_thresh = thresh;
+	ib->ib_cnt = 0;
+	ib->ib_bytes = 0;
+	ib->ib_calls = 0;
+	ib->ib_total = 0;
+}
+
+/*
+ * Transfer the pending buffers. Return the bytes transferred, which for a
+ * read batch is less than pending at end-of-file, or -1.
+ */
+static ssize_t
+iovb_flush(struct iovbatch *ib)
+{
+	ssize_t n;
+
+	if (ib->ib_cnt == 0)
+		return 0;
+
+	n = iov_xfer_all(ib->ib_fd, ib->ib_iov, ib->ib_cnt, ib->ib_off,
+		ib->ib_read);
+	if (n == -1)
+		return -1;
+
+	if (ib->ib_off != -1)
+		ib->ib_off += n;
+	ib->ib_calls++;
+	ib->ib_total += n;
+	ib->ib_cnt = 0;
+	ib->ib_bytes = 0;
+
+	return n;
+}
+
+/*
+ * Add a buffer to the batch, flushing it when full. Return 0, or -1 if the
+ * flush failed. A read batch that hits end-of-file fails with errno 0.
+ */
+static inline int
+iovb_add(struct iovbatch *ib, void *base, size_t len)
+{
+	size_t pending;
+	ssize_t n;
+
+	ib->ib_iov[ib->ib_cnt].iov_base = base;
+	ib->ib_iov[ib->ib_cnt].iov_len = len;
+	ib->ib_cnt++;
+	ib->ib_bytes += len;
+
+	if (ib->ib_cnt < IOV_MAX && ib->ib_bytes < ib->ib_thresh)
+		return 0;
+
+	pending = ib->ib_bytes;
+	if ((n = iovb_flush(ib)) == -1)
+		return -1;
+	if ((size_t)n < pending) {
+		errno = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif	/* !_IOVBATCH_H_ */
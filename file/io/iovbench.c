@@ -0,0 +1,178 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include "iovbatch.h"
+
+/* The ways of writing the same records out */
+enum { WR_WRITE, WR_MEMCPY, WR_WRITEV, WR_NMETHODS };
+static const char *methnames[WR_NMETHODS] = { "write", "memcpy", "writev" };
+
+static uint64_t run_method(int, int, char *, size_t, long, size_t);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int fd, op, m;
+	char *fname = NULL, *tok, *arena;
+	char sizes[BUF_SIZE] = "16,64,256,1024,4096";
+	size_t total = 64 * MIB, thresh = 256 * KIB, recsz;
+	long nrecs;
+	uint64_t t0, ns, calls;
+
+	while ((op = getopt(argc, argv, "f:b:s:t:")) != -1) {
+		switch (op) {
+		case 'f':
+			fname = optarg;
+			break;
+		case 'b':
+			total = getsize(optarg);
+			break;
+		case 's':
+			strncpy(sizes, optarg, BUF_SIZE - 1);
+			break;
+		case 't':
+			thresh = getsize(optarg);
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (fname == NULL || optind < argc || total == 0 || thresh == 0)
+		usage_info(argv[0]);
+
+	fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		errmsg_exit1("open file %s error, %s.\n", fname, ERR_MSG);
+
+	/*
+	 * The records lie back to back in one buffer. Every method still takes
+	 * them one at a time by address, and writev() gets one iovec per
+	 * record, since adjacent ones are not merged.
+	 */
+	arena = xmalloc(total);
+	memset(arena, 'x', total);
+
+	printf("%8s %-8s %12s %10s %10s\n", "recsize", "method", "syscalls",
+		"seconds", "MB/s");
+	for (tok = strtok(sizes, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if ((recsz = getsize(tok)) == 0 || recsz > total)
+			errmsg_exit1("Illegal record size. %s\n", tok);
+		nrecs = total / recsz;
+
+		for (m = 0; m < WR_NMETHODS; m++) {
+			if (ftruncate(fd, 0) == -1 ||
+				lseek(fd, 0, SEEK_SET) == -1)
+				errmsg_exit1("reset file error, %s.\n",
+					ERR_MSG);
+			t0 = bench_nsec();
+			calls = run_method(m, fd, arena, recsz, nrecs, thresh);
+			ns = bench_nsec() - t0;
+			printf("%8zu %-8s %12ju %10.3f %10.1f\n", recsz,
+				methnames[m], (uintmax_t)calls, bench_secs(ns),
+				bench_mbps(nrecs * recsz, ns));
+		}
+	}
+
+	xfree(arena);
+	if (close(fd) == -1)
+		errmsg_exit1("close file error, %s\n", ERR_MSG);
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Write 'nrecs' records of 'recsz' bytes taken from 'arena' with method 'm'.
+ * Return the number of write system calls made.
+ */
+static uint64_t
+run_method(int m, int fd, char *arena, size_t recsz, long nrecs, size_t thresh)
+{
+	struct iovbatch *ib;
+	uint64_t calls = 0;
+	size_t used = 0;
+	char *buf;
+	long i;
+
+	switch (m) {
+	case WR_WRITE:		/* One system call per record */
+		for (i = 0; i < nrecs; i++, calls++)
+			if (write(fd, arena + i * recsz, recsz) != (ssize_t)recsz)
+				errmsg_exit1("write error, %s.\n", ERR_MSG);
+		break;
+	case WR_MEMCPY:		/* Copy into one buffer, write it when full */
+		buf = xmalloc(thresh + recsz);
+		for (i = 0; i < nrecs; i++) {
+			memcpy(buf + used, arena + i * recsz, recsz);
+			used += recsz;
+			if (used >= thresh || i == nrecs - 1) {
+				if (write(fd, buf, used) != (ssize_t)used)
+					errmsg_exit1("write error, %s.\n",
+						ERR_MSG);
+				used = 0;
+				calls++;
+			}
+		}
+		xfree(buf);
+		break;
+	case WR_WRITEV:		/* Gather references, no copy */
+		ib = xmalloc(sizeof(struct iovbatch));
+		iovb_init(ib, fd, -1, thresh, false);
+		for (i = 0; i < nrecs; i++)
+			if (iovb_add(ib, arena + i * recsz, recsz) == -1)
+				errmsg_exit1("writev error, %s.\n", ERR_MSG);
+		if (iovb_flush(ib) == -1)
+			errmsg_exit1("writev error, %s.\n", ERR_MSG);
+		calls = ib->ib_calls;
+		xfree(ib);
+		break;
+	}
+
+	return calls;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s -f file [-b bytes] [-s size,...] "
+		"[-t threshold]\n", pname);
+	fprintf(stderr, "-f: file written to.\n");
+	fprintf(stderr, "-b: bytes written per run (default 64m).\n");
+	fprintf(stderr, "-s: record sizes to try (default "
+		"16,64,256,1024,4096).\n");
+	fprintf(stderr, "-t: bytes gathered per system call (default 256k).\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,494 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* O_DIRECT */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <aio.h>
+#include <math.h>
+#include <pthread.h>
+
+/*
+ * A workload driver in the spirit of fio(1), grown out of seekio: every job
+ * issues reads and writes of one block size against the same file, at
+ * offsets following a pattern, for a given time. With a queue depth above
+ * one a job keeps that many requests in flight with POSIX AIO, otherwise it
+ * uses pread(2)/pwrite(2).
+ */
+enum { PAT_SEQ, PAT_RAND, PAT_ZIPF };
+static const char *patnames[] = { "seq", "rand", "zipf" };
+
+/* Results of one job. They live in shared memory so jobs may be processes */
+struct jobstat {
+	uint64_t	js_ops[2];	/* Reads and writes completed */
+	uint64_t	js_bytes[2];	/* Bytes read and written */
+	uint64_t	js_ns;		/* Run time of the job */
+	struct lathist	js_lat[2];	/* Read and write latencies */
+};
+
+/* Offset generator of one job */
+struct jobgen {
+	uint64_t	jg_rng;		/* xorshift64* state */
+	off_t		jg_next;	/* Next block of a sequential job */
+};
+
+/* The workload, identical for every job */
+static struct {
+	int		w_fd;
+	off_t		w_size;		/* File size */
+	size_t		w_blksz;	/* Bytes per request */
+	off_t		w_nblks;	/* Blocks in the file */
+	int		w_rdpct;	/* Percentage of reads */
+	int		w_pattern;	/* PAT_* */
+	int		w_depth;	/* Requests in flight per job */
+	int		w_njobs;	/* Number of jobs */
+	uint64_t	w_runns;	/* Run time per job */
+	double		w_theta;	/* Zipf skew */
+	double		w_zetan;	/* Zipf constants, see zipf_next() */
+	double		w_eta;
+	double		w_alpha;
+	double		w_zeta2;
+	struct jobstat	*w_stats;	/* w_njobs entries, shared memory */
+} wl;
+
+static void layout_file(const char *, int);
+static void zipf_init(void);
+static uint64_t rnd_next(struct jobgen *);
+static off_t next_offset(struct jobgen *);
+static bool next_is_read(struct jobgen *);
+static void run_job(int);
+static void * job_thread(void *);
+static void report(const char *, struct jobstat *);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, i, r, oflags = 0, status;
+	bool procs = false;
+	char *fname = NULL, label[32];
+	pthread_t *tids;
+	pid_t pid;
+	struct jobstat tot;
+
+	wl.w_size = GIB;
+	wl.w_blksz = 4 * KIB;
+	wl.w_rdpct = 100;
+	wl.w_depth = 1;
+	wl.w_njobs = 1;
+	wl.w_runns = 10 * 1000000000ULL;
+	wl.w_theta = 0.99;
+
+	while ((op = getopt(argc, argv, "f:S:b:r:p:z:q:j:Pdyt:")) != -1) {
+		switch (op) {
+		case 'f':
+			fname = optarg;
+			break;
+		case 'S':
+			wl.w_size = getsize(optarg);
+			break;
+		case 'b':
+			wl.w_blksz = getsize(optarg);
+			break;
+		case 'r':
+			wl.w_rdpct = getint(optarg);
+			if (wl.w_rdpct < 0 || wl.w_rdpct > 100)
+				errmsg_exit1("Illegal percentage. -r %s\n",
+					optarg);
+			break;
+		case 'p':
+			for (wl.w_pattern = PAT_SEQ; wl.w_pattern <= PAT_ZIPF;
+				wl.w_pattern++)
+				if (strcmp(optarg, patnames[wl.w_pattern]) == 0)
+					break;
+			if (wl.w_pattern > PAT_ZIPF)
+				errmsg_exit1("Unknown pattern. -p %s\n", optarg);
+			break;
+		case 'z':
+			if (sscanf(optarg, "%lf", &wl.w_theta) != 1 ||
+				wl.w_theta <= 0.0 || wl.w_theta >= 1.0)
+				errmsg_exit1("Theta must be in (0, 1). -z %s\n",
+					optarg);
+			break;
+		case 'q':
+			wl.w_depth = getlong(optarg, GN_GT_0);
+			break;
+		case 'j':
+			wl.w_njobs = getlong(optarg, GN_GT_0);
+			break;
+		case 'P':
+			procs = true;
+			break;
+		case 'd':
+			oflags |= O_DIRECT;
+			break;
+		case 'y':
+			oflags |= O_SYNC;
+			break;
+		case 't':
+			wl.w_runns = getlong(optarg, GN_GT_0) * 1000000000ULL;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (fname == NULL || optind < argc)
+		usage_info(argv[0]);
+	if (wl.w_blksz == 0 || wl.w_size < (off_t)wl.w_blksz)
+		errmsg_exit1("file size must hold at least one block\n");
+
+	wl.w_nblks = wl.w_size / wl.w_blksz;
+	layout_file(fname, oflags);
+	if (wl.w_pattern == PAT_ZIPF)
+		zipf_init();
+
+	/*
+	 * An anonymous shared mapping survives fork(), so job processes can
+	 * hand their results back through it.
+	 */
+	wl.w_stats = mmap(NULL, wl.w_njobs * sizeof(struct jobstat),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (wl.w_stats == MAP_FAILED)
+		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+
+	printf("%d %s, %s %zu-byte blocks, %d%% reads, depth %d, %.0f s\n",
+		wl.w_njobs, procs ? "processes" : "threads",
+		patnames[wl.w_pattern], wl.w_blksz, wl.w_rdpct, wl.w_depth,
+		bench_secs(wl.w_runns));
+
+	if (procs) {
+		fflush(stdout);	/* Or every job inherits what is buffered */
+		for (i = 0; i < wl.w_njobs; i++) {
+			if ((pid = fork()) == -1)
+				errmsg_exit1("fork failed, %s\n", ERR_MSG);
+			if (pid == 0) {
+				run_job(i);
+				_exit(EXIT_SUCCESS);
+			}
+		}
+		for (i = 0; i < wl.w_njobs; i++)
+			if (wait(&status) == -1 || !WIFEXITED(status) ||
+				WEXITSTATUS(status) != EXIT_SUCCESS)
+				errmsg_exit1("a job failed\n");
+	} else {
+		tids = xcalloc(wl.w_njobs, sizeof(pthread_t));
+		for (i = 0; i < wl.w_njobs; i++)
+			if ((r = pthread_create(&tids[i], NULL, job_thread,
+				(void *)(intptr_t)i)) != 0)
+				errmsg_exit1("pthread_create failed, %s\n",
+					strerror(r));
+		for (i = 0; i < wl.w_njobs; i++)
+			if ((r = pthread_join(tids[i], NULL)) != 0)
+				errmsg_exit1("pthread_join failed, %s\n",
+					strerror(r));
+		xfree(tids);
+	}
+
+	memset(&tot, 0, sizeof(tot));
+	for (i = 0; i < wl.w_njobs; i++) {
+		snprintf(label, sizeof(label), "job %d", i);
+		report(label, &wl.w_stats[i]);
+		tot.js_ops[0] += wl.w_stats[i].js_ops[0];
+		tot.js_ops[1] += wl.w_stats[i].js_ops[1];
+		tot.js_bytes[0] += wl.w_stats[i].js_bytes[0];
+		tot.js_bytes[1] += wl.w_stats[i].js_bytes[1];
+		tot.js_ns = MAX(tot.js_ns, wl.w_stats[i].js_ns);
+		lathist_merge(&tot.js_lat[0], &wl.w_stats[i].js_lat[0]);
+		lathist_merge(&tot.js_lat[1], &wl.w_stats[i].js_lat[1]);
+	}
+	report("all jobs", &tot);
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Open the file and make sure 'w_size' bytes of it really exist, so reads
+ * do not hit holes the file system answers without any I/O.
+ */
+static void
+layout_file(const char *fname, int oflags)
+{
+	struct stat fs;
+	char *buf;
+	off_t off;
+	int fd;
+
+	if ((fd = open(fname, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1)
+		errmsg_exit1("open file '%s' error, %s.\n", fname, ERR_MSG);
+	if (fstat(fd, &fs) == -1)
+		errmsg_exit1("fstat error, %s.\n", ERR_MSG);
+
+	if (fs.st_size < wl.w_size) {
+		buf = xmalloc(MIB);
+		memset(buf, 0x5a, MIB);
+		for (off = fs.st_size; off < wl.w_size; off += MIB)
+			if (pwrite(fd, buf, MIN(MIB, wl.w_size - off), off)
+				== -1)
+				errmsg_exit1("pwrite error, %s.\n", ERR_MSG);
+		xfree(buf);
+		if (fsync(fd) == -1)
+			errmsg_exit1("fsync error, %s.\n", ERR_MSG);
+	}
+	close(fd);
+
+	/* The jobs share one open file description, like fio's threads */
+	if ((wl.w_fd = open(fname, O_RDWR | oflags)) == -1)
+		errmsg_exit1("open file '%s' error, %s.\n", fname, ERR_MSG);
+}
+
+/*
+ * Zipfian block numbers, after Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases" (as used by YCSB). zeta(n) is summed
+ * once here, then every draw costs one pow().
+ */
+static void
+zipf_init(void)
+{
+	off_t i;
+
+	wl.w_zetan = 0.0;
+	for (i = 1; i <= wl.w_nblks; i++)
+		wl.w_zetan += 1.0 / pow((double)i, wl.w_theta);
+	wl.w_zeta2 = 1.0 + 1.0 / pow(2.0, wl.w_theta);
+	wl.w_alpha = 1.0 / (1.0 - wl.w_theta);
+	wl.w_eta = (1.0 - pow(2.0 / (double)wl.w_nblks, 1.0 - wl.w_theta)) /
+		(1.0 - wl.w_zeta2 / wl.w_zetan);
+}
+
+static uint64_t
+rnd_next(struct jobgen *jg)
+{
+	jg->jg_rng ^= jg->jg_rng >> 12;
+	jg->jg_rng ^= jg->jg_rng << 25;
+	jg->jg_rng ^= jg->jg_rng >> 27;
+	return jg->jg_rng * 0x2545f4914f6cdd1dULL;
+}
+
+static off_t
+next_offset(struct jobgen *jg)
+{
+	double u, uz;
+	off_t blk;
+
+	switch (wl.w_pattern) {
+	case PAT_SEQ:
+		blk = jg->jg_next;
+		jg->jg_next = (jg->jg_next + 1) % wl.w_nblks;
+		break;
+	case PAT_RAND:
+		blk = rnd_next(jg) % wl.w_nblks;
+		break;
+	default:
+		u = (double)(rnd_next(jg) >> 11) / 9007199254740992.0;
+		uz = u * wl.w_zetan;
+		if (uz < 1.0)
+			blk = 0;
+		else if (uz < wl.w_zeta2)
+			blk = 1;
+		else
+			blk = (off_t)((double)wl.w_nblks *
+				pow(wl.w_eta * u - wl.w_eta + 1.0, wl.w_alpha));
+		blk = MIN(blk, wl.w_nblks - 1);
+		break;
+	}
+
+	return blk * (off_t)wl.w_blksz;
+}
+
+static bool
+next_is_read(struct jobgen *jg)
+{
+	return wl.w_rdpct == 100 ||
+		(int)(rnd_next(jg) % 100) < wl.w_rdpct;
+}
+
+static void *
+job_thread(void *arg)
+{
+	run_job((int)(intptr_t)arg);
+	return NULL;
+}
+
+/* Body of job 'id', as a thread or as a process */
+static void
+run_job(int id)
+{
+	struct jobstat *js = &wl.w_stats[id];
+	struct jobgen jg;
+	struct aiocb *cbs, **list;
+	uint64_t t0, end, now, *start;
+	char *bufs;
+	bool *isrd;
+	ssize_t n;
+	int i, err, inflight = 0;
+
+	jg.jg_rng = (uint64_t)(id + 1) * 0x9e3779b97f4a7c15ULL ^ getpid();
+	jg.jg_rng |= 1;
+	/* Sequential jobs start spread over the file */
+	jg.jg_next = wl.w_nblks / wl.w_njobs * id;
+
+	/* O_DIRECT needs aligned buffers */
+	bufs = aligned_alloc(4096, (wl.w_blksz + 4095) / 4096 * 4096 *
+		wl.w_depth);
+	if (bufs == NULL)
+		errmsg_exit2("aligned_alloc error, %s.\n", ERR_MSG);
+	memset(bufs, 0xa5, wl.w_blksz * wl.w_depth);
+
+	t0 = bench_nsec();
+	end = t0 + wl.w_runns;
+
+	if (wl.w_depth == 1) {
+		while ((now = bench_nsec()) < end) {
+			i = next_is_read(&jg);
+			if (i)
+				n = pread(wl.w_fd, bufs, wl.w_blksz,
+					next_offset(&jg));
+			else
+				n = pwrite(wl.w_fd, bufs, wl.w_blksz,
+					next_offset(&jg));
+			if (n == -1)
+				errmsg_exit2("%s error, %s.\n",
+					i ? "pread" : "pwrite", ERR_MSG);
+			lathist_add(&js->js_lat[!i], bench_nsec() - now);
+			js->js_ops[!i]++;
+			js->js_bytes[!i] += n;
+		}
+		js->js_ns = bench_nsec() - t0;
+		free(bufs);
+		return;
+	}
+
+	cbs = xcalloc(wl.w_depth, sizeof(struct aiocb));
+	list = xcalloc(wl.w_depth, sizeof(struct aiocb *));
+	start = xcalloc(wl.w_depth, sizeof(uint64_t));
+	isrd = xcalloc(wl.w_depth, sizeof(bool));
+
+	/* Slot 'i' owns buffer 'i'; reissue it until the time is up */
+	for (i = 0; i < wl.w_depth; i++) {
+		cbs[i].aio_fildes = wl.w_fd;
+		cbs[i].aio_buf = bufs + i * ((wl.w_blksz + 4095) / 4096 * 4096);
+		cbs[i].aio_nbytes = wl.w_blksz;
+	}
+
+	now = bench_nsec();
+	do {
+		for (i = 0; i < wl.w_depth && now < end; i++) {
+			if (list[i] != NULL)
+				continue;
+			cbs[i].aio_offset = next_offset(&jg);
+			isrd[i] = next_is_read(&jg);
+			start[i] = bench_nsec();
+			if ((isrd[i] ? aio_read(&cbs[i]) : aio_write(&cbs[i]))
+				== -1)
+				errmsg_exit2("aio error, %s.\n", ERR_MSG);
+			list[i] = &cbs[i];
+			inflight++;
+		}
+
+		if (aio_suspend((const struct aiocb *const *)list, wl.w_depth,
+			NULL) == -1 && errno != EINTR)
+			errmsg_exit2("aio_suspend error, %s.\n", ERR_MSG);
+
+		now = bench_nsec();
+		for (i = 0; i < wl.w_depth; i++) {
+			if (list[i] == NULL ||
+				(err = aio_error(&cbs[i])) == EINPROGRESS)
+				continue;
+			if ((n = aio_return(&cbs[i])) == -1)
+				errmsg_exit2("aio error, %s.\n", strerror(err));
+			lathist_add(&js->js_lat[!isrd[i]], now - start[i]);
+			js->js_ops[!isrd[i]]++;
+			js->js_bytes[!isrd[i]] += n;
+			list[i] = NULL;
+			inflight--;
+		}
+	} while (inflight > 0 || now < end);
+	js->js_ns = bench_nsec() - t0;
+
+	xfree(cbs);
+	xfree(list);
+	xfree(start);
+	xfree(isrd);
+	free(bufs);
+}
+
+/* Rates and percentiles of a job, or of all of them, then the histograms */
+static void
+report(const char *label, struct jobstat *js)
+{
+	double secs = bench_secs(js->js_ns);
+	char name[64];
+
+	printf("%-8s read: IOPS=%-9.0f BW=%8.1f MB/s  p50=%.1fus "
+		"p99=%.1fus\n", label, (double)js->js_ops[0] / secs,
+		bench_mbps(js->js_bytes[0], js->js_ns),
+		(double)lathist_pctl(&js->js_lat[0], 50.0) / 1e3,
+		(double)lathist_pctl(&js->js_lat[0], 99.0) / 1e3);
+	if (wl.w_rdpct < 100)
+		printf("%-8s write: IOPS=%-8.0f BW=%8.1f MB/s  p50=%.1fus "
+			"p99=%.1fus\n", "", (double)js->js_ops[1] / secs,
+			bench_mbps(js->js_bytes[1], js->js_ns),
+			(double)lathist_pctl(&js->js_lat[1], 50.0) / 1e3,
+			(double)lathist_pctl(&js->js_lat[1], 99.0) / 1e3);
+
+	snprintf(name, sizeof(name), "%s read", label);
+	lathist_print(&js->js_lat[0], name);
+	snprintf(name, sizeof(name), "%s write", label);
+	lathist_print(&js->js_lat[1], name);
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s -f file [-S size] [-b block] [-r read%%] "
+		"[-p seq|rand|zipf] [-z theta] [-q depth] [-j jobs] [-P] "
+		"[-d] [-y] [-t seconds]\n", pname);
+	fprintf(stderr, "-S: file size, laid out first (default 1g).\n");
+	fprintf(stderr, "-b: bytes per request (default 4k).\n");
+	fprintf(stderr, "-r: percentage of reads, the rest are writes "
+		"(default 100).\n");
+	fprintf(stderr, "-p: access pattern (default seq), -z: zipf skew "
+		"(default 0.99).\n");
+	fprintf(stderr, "-q: requests in flight per job, with POSIX AIO "
+		"(default 1).\n");
+	fprintf(stderr, "-j: number of jobs, threads unless -P makes them "
+		"processes.\n");
+	fprintf(stderr, "-d: open with O_DIRECT, -y: open with O_SYNC.\n");
+	fprintf(stderr, "-t: run time of every job (default 10).\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,397 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _PREALLOC_H_
+#define _PREALLOC_H_
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Preallocation. A file grown by truncate(2) is sparse: every first write to
+ * a block has to allocate it, which costs latency on the write path and
+ * scatters the file over the disk. Allocating up front moves that cost out of
+ * the way:
+ *
+ *	PA_ALLOC	posix_fallocate(2)/fallocate(2): the blocks are
+ *			reserved as unwritten extents, cheap to create, but
+ *			the first write to each still updates metadata.
+ *	PA_KEEPSIZE	the same without changing the file size (Linux
+ *			FALLOC_FL_KEEP_SIZE), for files written with O_APPEND.
+ *	PA_ZERO		write zeros over the whole range and sync: slow to
+ *			create, but later writes are plain overwrites.
+ */
+#define PA_ALLOC	0
+#define PA_KEEPSIZE	1
+#define PA_ZERO		2
+
+#define PA_ZEROBUF	(1024 * 1024)	/* Zeros written per call by PA_ZERO */
+
+/* Preallocate [off, off + len) of 'fd'. Return 0, or -1 with errno set. */
+static int
+prealloc_range(int fd, off_t off, off_t len, int how)
+{
+	char *zeros;
+	off_t end = off + len;
+	ssize_t n;
+	int r;
+
+	switch (how) {
+	case PA_KEEPSIZE:
+#ifdef FALLOC_FL_KEEP_SIZE
+		return fallocate(fd, FALLOC_FL_KEEP_SIZE, off, len);
+#else
+		errno = EOPNOTSUPP;
+		return -1;
+#endif
+	case PA_ZERO:
+		zeros = xcalloc(1, PA_ZEROBUF);
+		for (; off < end; off += n) {
+			if ((n = pwrite(fd, zeros, MIN(PA_ZEROBUF, end - off),
+				off)) == -1) {
+				xfree(zeros);
+				return -1;
+			}
+		}
+		xfree(zeros);
+		return fdatasync(fd);
+	default:
+		/* posix_fallocate() returns the error instead of setting it */
+		if ((r = posix_fallocate(fd, off, len)) != 0) {
+			errno = r;
+			return -1;
+		}
+		return 0;
+	}
+}
+
+/*
+ * Give the range [off, off + len) back its initial zero contents, keeping
+ * the blocks allocated: Linux turns them into unwritten extents
+ * (FALLOC_FL_ZERO_RANGE), elsewhere the zeros are written.
+ */
+static int
+prealloc_rezero(int fd, off_t off, off_t len)
+{
+#ifdef FALLOC_FL_ZERO_RANGE
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, off, len)
+		== 0)
+		return 0;
+#endif
+	return prealloc_range(fd, off, len, PA_ZERO);
+}
+
+/*
+ * A pool of ready segment files. A filler thread keeps 'sp_fill' segments
+ * (at most 'sp_target', the room in the pool) of 'sp_segsz' bytes
+ * preallocated in the pool directory, named
+ * "ready.NNNNNNNN". Taking one is a rename(2) into place, so a writer rolling
+ * over to a new segment never waits for block allocation; an old segment
+ * can be recycled into the pool instead of being deleted.
+ *
+ * The pool directory must be on the same file system as the segments, since
+ * rename(2) cannot cross file systems. The pool is private to one process:
+ * segments shared by several writers (applog.h) are not taken from it.
+ */
+struct segpool {
+	int		sp_dirfd;	/* Pool directory */
+	off_t		sp_segsz;	/* Bytes per segment */
+	int		sp_how;		/* PA_ALLOC or PA_ZERO */
+	int		sp_target;	/* Ready segments to keep */
+	int		sp_fill;	/* Of which the filler makes */
+	unsigned	*sp_ready;	/* Numbers of the ready segments */
+	int		sp_nready;	/* Entries in 'sp_ready' */
+	unsigned	sp_seq;		/* Number of the next new segment */
+	uint64_t	sp_hits;	/* Segments taken ready */
+	uint64_t	sp_misses;	/* Segments created on the spot */
+	bool		sp_stop;	/* Filler thread should exit */
+	pthread_t	sp_tid;		/* Filler thread */
+	pthread_mutex_t	sp_mtx;		/* Protects the fields above */
+	pthread_cond_t	sp_cnd;		/* Wakes the filler */
+};
+
+/* Create a new preallocated segment in the pool; return its number. */
+static int
+segpool_make(struct segpool *sp, unsigned *num)
+{
+	char tmp[32], ready[32];
+	int fd;
+
+	pthread_mutex_lock(&sp->sp_mtx);
+	*num = sp->sp_seq++;
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	/* Build it under a temporary name, so it is never seen half made */
+	snprintf(tmp, sizeof(tmp), "tmp.%08u", *num);
+	snprintf(ready, sizeof(ready), "ready.%08u", *num);
+	if ((fd = openat(sp->sp_dirfd, tmp, O_RDWR | O_CREAT | O_TRUNC,
+		S_IRUSR | S_IWUSR)) == -1)
+		return -1;
+	if (prealloc_range(fd, 0, sp->sp_segsz, sp->sp_how) == -1 ||
+		fsync(fd) == -1) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	return renameat(sp->sp_dirfd, tmp, sp->sp_dirfd, ready);
+}
+
+static void *
+segpool_filler(void *arg)
+{
+	struct segpool *sp = arg;
+	char ready[32];
+	unsigned num;
+
+	pthread_mutex_lock(&sp->sp_mtx);
+	while (!sp->sp_stop) {
+		if (sp->sp_nready >= sp->sp_fill) {
+			pthread_cond_wait(&sp->sp_cnd, &sp->sp_mtx);
+			continue;
+		}
+		pthread_mutex_unlock(&sp->sp_mtx);
+
+		if (segpool_make(sp, &num) == -1) {
+			fprintf(stderr, "segpool: cannot make a segment, %s\n",
+				ERR_MSG);
+			/* Give up filling, segpool_get() makes its own */
+			pthread_mutex_lock(&sp->sp_mtx);
+			sp->sp_stop = true;
+			pthread_cond_broadcast(&sp->sp_cnd);
+			break;
+		}
+
+		/* A recycled segment may have filled the pool meanwhile */
+		pthread_mutex_lock(&sp->sp_mtx);
+		if (sp->sp_nready >= sp->sp_target) {
+			snprintf(ready, sizeof(ready), "ready.%08u", num);
+			(void)unlinkat(sp->sp_dirfd, ready, 0);
+			continue;
+		}
+		sp->sp_ready[sp->sp_nready++] = num;
+		pthread_cond_broadcast(&sp->sp_cnd);
+	}
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	return NULL;
+}
+
+/*
+ * Open the pool in 'dir' with room for 'target' segments, adopt the ready
+ * segments left there by an earlier run, and start the filler thread keeping
+ * 'fill' of them ready (see segpool_setfill()).
+ */
+static inline int
+segpool_open(struct segpool *sp, const char *dir, off_t segsz, int target,
+	int fill, int how)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	unsigned num;
+	int r;
+
+	if ((sp->sp_dirfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+		return -1;
+	sp->sp_segsz = segsz;
+	sp->sp_how = how;
+	sp->sp_target = target;
+	sp->sp_fill = MIN(fill, target);
+	sp->sp_ready = xcalloc(target, sizeof(unsigned));
+	sp->sp_nready = 0;
+	sp->sp_seq = 0;
+	sp->sp_hits = sp->sp_misses = 0;
+	sp->sp_stop = false;
+	pthread_mutex_init(&sp->sp_mtx, NULL);
+	pthread_cond_init(&sp->sp_cnd, NULL);
+
+	if ((dirp = fdopendir(dup(sp->sp_dirfd))) == NULL)
+		return -1;
+	while ((dp = readdir(dirp)) != NULL) {
+		if (sscanf(dp->d_name, "ready.%u", &num) == 1 &&
+			sp->sp_nready < target)
+			sp->sp_ready[sp->sp_nready++] = num;
+		if ((sscanf(dp->d_name, "ready.%u", &num) == 1 ||
+			sscanf(dp->d_name, "tmp.%u", &num) == 1) &&
+			num >= sp->sp_seq)
+			sp->sp_seq = num + 1;
+	}
+	closedir(dirp);
+
+	if ((r = pthread_create(&sp->sp_tid, NULL, segpool_filler, sp)) != 0) {
+		errno = r;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Move a ready segment to 'name' relative to the directory 'dirfd' and open
+ * it. When the pool is empty, a segment is made on the spot. Return the file
+ * descriptor, or -1.
+ */
+static inline int
+segpool_get(struct segpool *sp, int dirfd, const char *name)
+{
+	char ready[32];
+	unsigned num;
+	bool hit;
+
+	pthread_mutex_lock(&sp->sp_mtx);
+	if ((hit = sp->sp_nready > 0)) {
+		num = sp->sp_ready[--sp->sp_nready];
+		sp->sp_hits++;
+	} else {
+		sp->sp_misses++;
+	}
+	pthread_cond_signal(&sp->sp_cnd);	/* Time to refill */
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	if (!hit && segpool_make(sp, &num) == -1)
+		return -1;
+
+	snprintf(ready, sizeof(ready), "ready.%08u", num);
+	if (renameat(sp->sp_dirfd, ready, dirfd, name) == -1)
+		return -1;
+
+	return openat(dirfd, name, O_RDWR);
+}
+
+/*
+ * Put the segment 'name' of directory 'dirfd' back into the pool instead of
+ * deleting it. Its contents are zeroed again; the blocks stay allocated. A
+ * full pool has no room for it, and the segment is removed.
+ */
+static inline int
+segpool_recycle(struct segpool *sp, int dirfd, const char *name)
+{
+	char ready[32];
+	unsigned num;
+	int fd;
+
+	pthread_mutex_lock(&sp->sp_mtx);
+	if (sp->sp_nready >= sp->sp_target) {
+		pthread_mutex_unlock(&sp->sp_mtx);
+		return unlinkat(dirfd, name, 0);
+	}
+	num = sp->sp_seq++;
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	if ((fd = openat(dirfd, name, O_RDWR)) == -1)
+		return -1;
+	if (ftruncate(fd, sp->sp_segsz) == -1 ||
+		prealloc_rezero(fd, 0, sp->sp_segsz) == -1) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	snprintf(ready, sizeof(ready), "ready.%08u", num);
+	if (renameat(dirfd, name, sp->sp_dirfd, ready) == -1)
+		return -1;
+
+	pthread_mutex_lock(&sp->sp_mtx);
+	if (sp->sp_nready < sp->sp_target) {
+		sp->sp_ready[sp->sp_nready++] = num;
+		pthread_mutex_unlock(&sp->sp_mtx);
+		return 0;
+	}
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	/* The filler got there first */
+	return unlinkat(sp->sp_dirfd, ready, 0);
+}
+
+/* Wait until the pool holds its target of ready segments. */
+static inline void
+segpool_wait(struct segpool *sp)
+{
+	pthread_mutex_lock(&sp->sp_mtx);
+	while (sp->sp_nready < sp->sp_fill && !sp->sp_stop)
+		pthread_cond_wait(&sp->sp_cnd, &sp->sp_mtx);
+	pthread_mutex_unlock(&sp->sp_mtx);
+}
+
+/*
+ * Have the filler keep 'fill' segments ready, up to the target. With 0 the
+ * pool holds only what is recycled into it.
+ */
+static inline void
+segpool_setfill(struct segpool *sp, int fill)
+{
+	pthread_mutex_lock(&sp->sp_mtx);
+	sp->sp_fill = MIN(fill, sp->sp_target);
+	pthread_cond_broadcast(&sp->sp_cnd);
+	pthread_mutex_unlock(&sp->sp_mtx);
+}
+
+/* Delete the ready segments; the filler makes new ones if 'sp_fill' says. */
+static inline int
+segpool_purge(struct segpool *sp)
+{
+	char ready[32];
+	int r = 0;
+
+	pthread_mutex_lock(&sp->sp_mtx);
+	while (sp->sp_nready > 0) {
+		snprintf(ready, sizeof(ready), "ready.%08u",
+			sp->sp_ready[--sp->sp_nready]);
+		if (unlinkat(sp->sp_dirfd, ready, 0) == -1)
+			r = -1;
+	}
+	pthread_cond_broadcast(&sp->sp_cnd);
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	return r;
+}
+
+/* Stop the filler; the ready segments stay for the next run. */
+static inline void
+segpool_close(struct segpool *sp)
+{
+	pthread_mutex_lock(&sp->sp_mtx);
+	sp->sp_stop = true;
+	pthread_cond_broadcast(&sp->sp_cnd);
+	pthread_mutex_unlock(&sp->sp_mtx);
+
+	pthread_join(sp->sp_tid, NULL);
+	pthread_mutex_destroy(&sp->sp_mtx);
+	pthread_cond_destroy(&sp->sp_cnd);
+	xfree(sp->sp_ready);
+	close(sp->sp_dirfd);
+}
+
+#endif	/* !_PREALLOC_H_ */
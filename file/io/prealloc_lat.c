@@ -0,0 +1,174 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* fallocate() */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include "prealloc.h"
+
+/*
+ * How the segment written to was made: grown sparse by ftruncate(), with
+ * its blocks allocated, filled with zeros, or taken from a segment pool
+ * where it was recycled.
+ */
+enum { SEG_SPARSE, SEG_ALLOC, SEG_ZERO, SEG_POOL, SEG_NKINDS };
+static const char *kindnames[SEG_NKINDS] = {
+	"sparse", "fallocate", "zero-fill", "pool"
+};
+
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, kind, fd, dfd;
+	char *dir = NULL, *buf;
+	off_t segsz = 64 * MIB, off;
+	size_t recsz = 4 * KIB;
+	uint64_t t0, tget, tall;
+	struct latstat ls;
+	struct segpool sp;
+
+	while ((op = getopt(argc, argv, "d:S:s:")) != -1) {
+		switch (op) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'S':
+			segsz = getsize(optarg);
+			break;
+		case 's':
+			recsz = getsize(optarg);
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (dir == NULL || optind < argc || recsz == 0 ||
+		segsz < (off_t)recsz)
+		usage_info(argv[0]);
+
+	if ((dfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+		errmsg_exit1("open '%s' failed, %s\n", dir, ERR_MSG);
+	buf = xmalloc(recsz);
+	memset(buf, 'x', recsz);
+
+	/*
+	 * Room for one segment in the pool, and no filler: the pool row must
+	 * get the segment recycled from the zero-fill row, not a fresh one or
+	 * one left by an earlier run.
+	 */
+	if (segpool_open(&sp, dir, segsz, 1, 0, PA_ALLOC) == -1)
+		errmsg_exit1("segpool_open failed, %s\n", ERR_MSG);
+	if (segpool_purge(&sp) == -1)
+		errmsg_exit1("segpool_purge failed, %s\n", ERR_MSG);
+
+	printf("%-10s %10s %10s %10s %10s %10s %10s\n", "segment", "get(us)",
+		"p50(us)", "p99(us)", "p99.9(us)", "max(us)", "MB/s");
+	for (kind = 0; kind < SEG_NKINDS; kind++) {
+		/* Getting the segment ready is part of the cost */
+		t0 = bench_nsec();
+		if (kind == SEG_POOL) {
+			fd = segpool_get(&sp, dfd, "prealloc_lat.seg");
+		} else {
+			fd = openat(dfd, "prealloc_lat.seg", O_RDWR | O_CREAT |
+				O_TRUNC, S_IRUSR | S_IWUSR);
+			if (fd != -1 && kind == SEG_SPARSE &&
+				ftruncate(fd, segsz) == -1)
+				errmsg_exit1("ftruncate failed, %s\n", ERR_MSG);
+			if (fd != -1 && kind != SEG_SPARSE &&
+				prealloc_range(fd, 0, segsz, kind == SEG_ALLOC ?
+				PA_ALLOC : PA_ZERO) == -1)
+				errmsg_exit1("preallocation failed, %s\n",
+					ERR_MSG);
+		}
+		if (fd == -1)
+			errmsg_exit1("cannot get a segment, %s\n", ERR_MSG);
+		tget = bench_nsec() - t0;
+
+		/* Append records, each made durable before the next */
+		latstat_init(&ls);
+		tall = bench_nsec();
+		for (off = 0; off + (off_t)recsz <= segsz; off += recsz) {
+			t0 = bench_nsec();
+			if (pwrite(fd, buf, recsz, off) != (ssize_t)recsz)
+				errmsg_exit1("pwrite failed, %s\n", ERR_MSG);
+			if (fdatasync(fd) == -1)
+				errmsg_exit1("fdatasync failed, %s\n", ERR_MSG);
+			latstat_add(&ls, bench_nsec() - t0);
+		}
+		tall = bench_nsec() - tall;
+		close(fd);
+
+		printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			kindnames[kind], (double)tget / 1e3,
+			(double)latstat_pctl(&ls, 50.0) / 1e3,
+			(double)latstat_pctl(&ls, 99.0) / 1e3,
+			(double)latstat_pctl(&ls, 99.9) / 1e3,
+			(double)latstat_pctl(&ls, 100.0) / 1e3,
+			bench_mbps(ls.ls_cnt * recsz, tall));
+		latstat_free(&ls);
+
+		/* Hand the used segment to the pool for the pool run */
+		if (kind == SEG_ZERO) {
+			if (segpool_recycle(&sp, dfd, "prealloc_lat.seg") == -1)
+				errmsg_exit1("segpool_recycle failed, %s\n",
+					ERR_MSG);
+		} else if (unlinkat(dfd, "prealloc_lat.seg", 0) == -1) {
+			errmsg_exit1("unlink failed, %s\n", ERR_MSG);
+		}
+	}
+
+	if (sp.sp_hits != 1)
+		fprintf(stderr, "the pool row did not get the recycled "
+			"segment\n");
+	if (segpool_purge(&sp) == -1)
+		errmsg_exit1("segpool_purge failed, %s\n", ERR_MSG);
+	segpool_close(&sp);
+	xfree(buf);
+	close(dfd);
+
+	exit(EXIT_SUCCESS);
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s -d dir [-S segsize] [-s recsize]\n", pname);
+	fprintf(stderr, "-d: directory of the segments and of the pool.\n");
+	fprintf(stderr, "-S: bytes per segment (default 64m).\n");
+	fprintf(stderr, "-s: bytes per synchronous write (default 4k).\n");
+	exit(EXIT_FAILURE);
+}
@@ -31,9 +31,9 @@
  */
 #include "unibsd.h"
 #include <sys/stat.h>
-#include <sys/uio.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include "iovbatch.h"
 
 static void usage_info(const char *);
 
@@ -43,14 +43,13 @@ main(int argc, char *argv[])
 	int fd, oflags, num;
 	mode_t fperms;
 #define STRLEN	128
-#define IOVSZ	3
 	char *fname, *str1, str2[STRLEN];
 	ssize_t nwr, nrd;
 	struct {
 		int	i_num;
 		char	i_str[STRLEN];
 	} dat;
-	struct iovec iow[IOVSZ], ior[IOVSZ];
+	struct iovbatch ib;
 
 	int op;
 	const char *optstr = "f:i:s:";
@@ -88,21 +87,25 @@ main(int argc, char *argv[])
 	if ((fd = open(fname, oflags, fperms)) == -1)
 		errmsg_exit1("open file %s error, %s.\n", fname, ERR_MSG);
 
+	/*
+	 * gather the three buffers into one writev(), at the current file
+	 * offset. Nothing is written before the flush.
+	 */
+	iovb_init(&ib, fd, -1, SIZE_MAX, false);
+
 	/* integer number */
-	iow[0].iov_base = &num;
-	iow[0].iov_len = sizeof(num);
+	iovb_add(&ib, &num, sizeof(num));
 
 	/* struct data */
 	dat.i_num = num;
 	strncpy(dat.i_str, str1, STRLEN);
-	iow[1].iov_base = &dat;
-	iow[1].iov_len = sizeof(dat);
+	iovb_add(&ib, &dat, sizeof(dat));
 
 	/* string */
-	iow[2].iov_base = str1;
-	iow[2].iov_len = STRLEN;
+	strncpy(str2, str1, STRLEN);
+	iovb_add(&ib, str2, STRLEN);
 
-	if ((nwr = writev(fd, iow, IOVSZ)) == -1)
+	if ((nwr = iovb_flush(&ib)) == -1)
 		errmsg_exit1("writev error, %s.\n", ERR_MSG);
 	printf("Wrote %ld bytes.\n", nwr);
 
@@ -116,18 +119,19 @@ main(int argc, char *argv[])
 	if ((fd = open(fname, oflags)) == -1)
 		errmsg_exit1("open file %s error, %s.\n", fname, ERR_MSG);
 
+	/* scatter the file back into the same three buffers with readv() */
+	iovb_init(&ib, fd, -1, SIZE_MAX, true);
+
 	memset(&num, 0, sizeof(num));
-	ior[0].iov_base = &num;
-	ior[0].iov_len = sizeof(num);
+	iovb_add(&ib, &num, sizeof(num));
 
 	memset(&dat, 0, sizeof(dat));
-	ior[1].iov_base = &dat;
-	ior[1].iov_len = sizeof(dat);
+	iovb_add(&ib, &dat, sizeof(dat));
 
-	ior[2].iov_base = str2;
-	ior[2].iov_len = STRLEN;
+	memset(str2, 0, STRLEN);
+	iovb_add(&ib, str2, STRLEN);
 
-	if ((nrd = readv(fd, ior, IOVSZ)) == -1)
+	if ((nrd = iovb_flush(&ib)) == -1)
 		errmsg_exit1("readv error, %s.\n", ERR_MSG);
 	printf("Readed %ld bytes.\n", nrd);
 	
@@ -0,0 +1,212 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* readahead() */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "streamrd.h"
+
+/*
+ * Streams a file from a cold cache with each hint policy, while another
+ * thread keeps re-reading random pages of a small "hot" file, as a
+ * cache-sensitive neighbour would. Reports the stream throughput, the hot
+ * reads' latency during the stream, and how much of each file is left in
+ * the page cache afterwards.
+ */
+enum { PM_NONE, PM_HINT, PM_NOCACHE, PM_NMODES };
+static const char *pmnames[PM_NMODES] = { "none", "hint", "nocache" };
+static const int pmflags[PM_NMODES] = { SR_NOHINT, 0, SR_NOCACHE };
+
+static struct {
+	int		hotfd;
+	off_t		hotsz;
+	atomic_bool	stop;
+	struct lathist	lh;
+} hot;
+
+static void *hot_reader(void *);
+static double resident(int, off_t);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, fd, m, mfirst = 0, mlast = PM_NMODES - 1;
+	size_t bufsz = 128 * KIB;
+	struct stat st;
+	struct streamrd sr;
+	pthread_t tid;
+	uint64_t t0, ns, total;
+	ssize_t n;
+	char *buf;
+	const char *hotfile = NULL;
+
+	while ((op = getopt(argc, argv, "m:b:h:")) != -1) {
+		switch (op) {
+		case 'm':
+			for (m = 0; m < PM_NMODES; m++)
+				if (strcmp(optarg, pmnames[m]) == 0)
+					break;
+			if (m == PM_NMODES)
+				usage_info(argv[0]);
+			mfirst = mlast = m;
+			break;
+		case 'b':
+			bufsz = getsize(optarg);
+			break;
+		case 'h':
+			hotfile = optarg;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || bufsz == 0)
+		usage_info(argv[0]);
+
+	if ((fd = open(argv[optind], O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+		errmsg_exit1("open '%s' failed, %s\n", argv[optind], ERR_MSG);
+	hot.hotfd = -1;
+	if (hotfile != NULL) {
+		if ((hot.hotfd = open(hotfile, O_RDONLY)) == -1)
+			errmsg_exit1("open '%s' failed, %s\n", hotfile, ERR_MSG);
+		hot.hotsz = lseek(hot.hotfd, 0, SEEK_END);
+		if (hot.hotsz < 4096)
+			errmsg_exit1("'%s' is too small\n", hotfile);
+	}
+	buf = xmalloc(bufsz);
+
+	printf("%-8s %10s %12s %12s %12s %10s %10s\n", "policy", "MB/s",
+		"hot avg(us)", "hot p99(us)", "hot reads", "stream%", "hot%");
+	for (m = mfirst; m <= mlast; m++) {
+		/* Cold stream; the hot file starts fully cached */
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		if (hot.hotfd != -1) {
+			for (total = 0; (n = pread(hot.hotfd, buf, bufsz,
+				total)) > 0; total += n)
+				;
+			memset(&hot.lh, 0, sizeof(hot.lh));
+			atomic_store(&hot.stop, false);
+			if ((op = pthread_create(&tid, NULL, hot_reader,
+				NULL)) != 0)
+				errmsg_exit1("pthread_create failed, %s\n",
+					strerror(op));
+		}
+
+		t0 = bench_nsec();
+		sr_init(&sr, fd, 0, pmflags[m], NULL);
+		for (total = 0; (n = sr_read(&sr, buf, bufsz)) > 0; total += n)
+			;
+		if (n == -1)
+			errmsg_exit1("read failed, %s\n", ERR_MSG);
+		sr_done(&sr);
+		ns = bench_nsec() - t0;
+
+		if (hot.hotfd != -1) {
+			atomic_store(&hot.stop, true);
+			pthread_join(tid, NULL);
+		}
+		printf("%-8s %10.1f %12.2f %12.2f %12ju %9.1f%% %9.1f%%\n",
+			pmnames[m], bench_mbps(total, ns),
+			hot.lh.lh_total == 0 ? 0.0 : (double)hot.lh.lh_sum /
+			(double)hot.lh.lh_total / 1e3,
+			(double)lathist_pctl(&hot.lh, 99.0) / 1e3,
+			(uintmax_t)hot.lh.lh_total, resident(fd, st.st_size),
+			hot.hotfd == -1 ? 0.0 : resident(hot.hotfd, hot.hotsz));
+	}
+
+	xfree(buf);
+	exit(EXIT_SUCCESS);
+}
+
+static void *
+hot_reader(void *arg)
+{
+	char page[4096];
+	unsigned int seed = 1;
+	off_t npages = hot.hotsz / 4096, off;
+	uint64_t t0;
+
+	(void)arg;
+	while (!atomic_load(&hot.stop)) {
+		off = (off_t)(rand_r(&seed) % npages) * 4096;
+		t0 = bench_nsec();
+		if (pread(hot.hotfd, page, sizeof(page), off) == -1)
+			errmsg_exit1("pread failed, %s\n", ERR_MSG);
+		lathist_add(&hot.lh, bench_nsec() - t0);
+	}
+
+	return NULL;
+}
+
+/* Percent of the file's pages in the page cache */
+static double
+resident(int fd, off_t size)
+{
+	long pagesz = sysconf(_SC_PAGESIZE);
+	size_t npages = (size + pagesz - 1) / pagesz, i, in = 0;
+	unsigned char *vec;
+	void *addr;
+
+	if (size == 0)
+		return 0.0;
+	addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+	vec = xmalloc(npages);
+	if (mincore(addr, size, (void *)vec) == -1)
+		errmsg_exit1("mincore failed, %s\n", ERR_MSG);
+	for (i = 0; i < npages; i++)
+		in += vec[i] & 1;
+	xfree(vec);
+	munmap(addr, size);
+
+	return (double)in * 100.0 / (double)npages;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-m none|hint|nocache] [-b bufsize] "
+		"[-h hotfile] file\n", pname);
+	fprintf(stderr, "-m: read-ahead policy to run (default all).\n");
+	fprintf(stderr, "-b: bytes per read (default 128k).\n");
+	fprintf(stderr, "-h: file read at random pages during the stream.\n");
+	exit(EXIT_FAILURE);
+}
@@ -29,16 +29,53 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* fallocate() */
+#endif
 #include "unibsd.h"
+#include <fcntl.h>
+#include "prealloc.h"
 
 int
 main(int argc, char *argv[])
 {
-	if (argc != 3)
-		errmsg_exit1("Usage: %s <file> <bytes>\n", argv[0]);
+	int fd, how;
+	off_t len;
 
-	if (truncate(argv[1], getlong(argv[2], GN_ANY_BASE)) != 0)
-		errmsg_exit1("truncate error, %s.\n", ERR_MSG);
+	if (argc != 3 && argc != 4)
+		errmsg_exit1("Usage: %s <file> <bytes> [a|k|z]\n"
+			"\ta: allocate the blocks, k: allocate keeping the "
+			"size, z: write zeros\n", argv[0]);
+
+	len = getlong(argv[2], GN_ANY_BASE);
+
+	/* Just set the size, the file is sparse past its old end */
+	if (argc == 3) {
+		if (truncate(argv[1], len) != 0)
+			errmsg_exit1("truncate error, %s.\n", ERR_MSG);
+		return 0;
+	}
+
+	switch (argv[3][0]) {
+	case 'a':
+		how = PA_ALLOC;
+		break;
+	case 'k':
+		how = PA_KEEPSIZE;
+		break;
+	case 'z':
+		how = PA_ZERO;
+		break;
+	default:
+		errmsg_exit1("Unknown mode, %s\n", argv[3]);
+	}
+
+	if ((fd = open(argv[1], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1)
+		errmsg_exit1("open file %s error, %s.\n", argv[1], ERR_MSG);
+	if (prealloc_range(fd, 0, len, how) == -1)
+		errmsg_exit1("preallocation error, %s.\n", ERR_MSG);
+	if (close(fd) == -1)
+		errmsg_exit1("close file failure, %s\n", ERR_MSG);
 
 	return 0;
 }
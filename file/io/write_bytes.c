@@ -29,27 +29,65 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* fallocate() */
+#endif
 #include "unibsd.h"
+#include "benchutil.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include "gcommit.h"
+#include "prealloc.h"
 
+/* Modes of the threaded writers, see -F */
+#define SYNC_NONE	0
+#define SYNC_FSYNC	1
+#define SYNC_FDATASYNC	2
+#define SYNC_GROUP	3
+
+static const char *syncnames[] = {
+	"none", "fsync", "fdatasync", "group-commit"
+};
+
+/* One producer thread of a threaded run */
+struct producer {
+	pthread_t	p_tid;
+	long		p_nrecs;	/* Records to write */
+	size_t		p_tail;		/* Then one this short, if not 0 */
+	struct latstat	p_lat;		/* Commit latencies */
+	char		*p_buf;		/* Record contents */
+};
+
+/* State shared by the producers of a threaded run */
+static struct {
+	int		r_fd;		/* File written to */
+	int		r_mode;		/* One of SYNC_* */
+	size_t		r_recsz;	/* Bytes per record */
+	off_t		r_off;		/* Next offset, per-write modes */
+	pthread_mutex_t	r_mtx;		/* Protects 'r_off' */
+	struct gcommit	r_gc;		/* SYNC_GROUP only */
+} run = { .r_mtx = PTHREAD_MUTEX_INITIALIZER };
+
+static double run_producers(int, long, struct latstat *);
+static void * producer_func(void *);
 static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
 	int op;
-	const char *optstr = "f:b:s:S:F:";
+	const char *optstr = "f:b:s:S:F:P:t:B";
 	extern char *optarg;
 	extern int optind;
 
-	char *fname, *buf;
-	int bytes, sz, osync, fun;
+	char *fname = NULL, *buf;
+	int bytes = 0, sz = 0, osync = 0, fun = 0, nthrs = 0, t, pa = -1;
 	int fd, oflags, nwr = 0, cwr = 0;
+	bool bench = false;
+	double rate;
+	struct latstat ls;
 
-	if (argc != (int)strlen(optstr) + 1)
-		usage_info(argv[0]);
 	while ((op = getopt(argc, argv, optstr)) != -1) {
 		switch (op) {
 		case 'f':
@@ -79,20 +117,33 @@ main(int argc, char *argv[])
 			if (sscanf(optarg, "%d", &fun) != 1)
 				errmsg_exit1("Illegal number. -F %s\n", optarg);
 			switch (fun) {
-			case 0:
-			case 1:
-			case 2:
+			case SYNC_NONE:
+			case SYNC_FSYNC:
+			case SYNC_FDATASYNC:
+			case SYNC_GROUP:
 				break;
 			default:
 				errmsg_exit1("Illegal number. -F %s\n", optarg);
 			}
 			break;
+		case 'P':
+			if (sscanf(optarg, "%d", &pa) != 1 || pa < PA_ALLOC ||
+				pa > PA_ZERO)
+				errmsg_exit1("Illegal number. -P %s\n", optarg);
+			break;
+		case 't':
+			if (sscanf(optarg, "%d", &nthrs) != 1 || nthrs <= 0)
+				errmsg_exit1("Illegal number. -t %s\n", optarg);
+			break;
+		case 'B':
+			bench = true;
+			break;
 		default:
 			fprintf(stderr, "Parameters error, %c\n", op);
 				usage_info(argv[0]);
 		}
 	}
-	if (optind < argc)
+	if (optind < argc || fname == NULL || bytes == 0 || sz == 0)
 		usage_info(argv[0]);
 
 	/* 
@@ -103,33 +154,90 @@ main(int argc, char *argv[])
 	if ((fd = open(fname, oflags, S_IRUSR | S_IWUSR)) == -1)
 		errmsg_exit1("open file %s failuer, %s.\n", fname, ERR_MSG);
 
-	buf = xmalloc(sz);
-	while (nwr < bytes) {
-		cwr = MIN(sz, bytes - nwr);
-		if (write(fd, buf, cwr) == -1)
-			errmsg_exit1("write failure, %s.\n", ERR_MSG);
-
-		/* 
-		 * if perform an fdatasync() after each write,
-		 * so that data--and possibly metadata--changes are flushed to
-		 * the disk.
-		 *
-		 * if perform an fsync() after each write,
-		 * so that data and metadata are flushed to the disk.
+	/*
+	 * allocate the blocks to be written up front, so the writes below do
+	 * not pay for block allocation.
+	 */
+	if (pa != -1 && prealloc_range(fd, 0, bytes, pa) == -1)
+		errmsg_exit1("preallocation failure, %s.\n", ERR_MSG);
+
+	run.r_fd = fd;
+	run.r_recsz = sz;
+
+	if (bench) {
+		/*
+		 * compare fsync and fdatasync per write with group commit
+		 * at doubling numbers of producer threads, up to -t.
 		 */
-		switch (fun) {
-		case 1:
-			if (fsync(fd) == -1)
-				errmsg_exit1("fsync error, %s.\n", ERR_MSG);
-			break;
-		case 2:
-			if (fdatasync(fd) == -1)
-				errmsg_exit1("fdatasync error, %s.\n", ERR_MSG);
-			break;
+		printf("%7s %-12s %14s %10s %10s %10s\n", "threads", "mode",
+			"records/s", "p50(us)", "p99(us)", "syncs");
+		for (t = 1; t <= MAX(nthrs, 1); t *= 2) {
+			for (run.r_mode = SYNC_FSYNC;
+				run.r_mode <= SYNC_GROUP; run.r_mode++) {
+				/* Every run starts from the same file */
+				if (ftruncate(fd, 0) == -1)
+					errmsg_exit1("ftruncate failure, %s.\n",
+						ERR_MSG);
+				if (pa != -1 &&
+					prealloc_range(fd, 0, bytes, pa) == -1)
+					errmsg_exit1("preallocation failure, "
+						"%s.\n", ERR_MSG);
+				latstat_init(&ls);
+				rate = run_producers(t, bytes, &ls);
+				printf("%7d %-12s %14.0f %10.1f %10.1f %10ju\n",
+					t, syncnames[run.r_mode], rate,
+					(double)latstat_pctl(&ls, 50.0) / 1e3,
+					(double)latstat_pctl(&ls, 99.0) / 1e3,
+					(uintmax_t)(run.r_mode == SYNC_GROUP ?
+					run.r_gc.gc_batches : ls.ls_cnt));
+				latstat_free(&ls);
+			}
+		}
+	} else if (nthrs > 0 || fun == SYNC_GROUP) {
+		/* 'bytes' in records written by concurrent producers */
+		run.r_mode = fun;
+		latstat_init(&ls);
+		rate = run_producers(MAX(nthrs, 1), bytes, &ls);
+		printf("%zu records, %.0f durable-records/s (%s)\n", ls.ls_cnt,
+			rate, syncnames[fun]);
+		latstat_print(&ls, "commit");
+		if (fun == SYNC_GROUP)
+			printf("%ju batches, %.1f records per batch\n",
+				(uintmax_t)run.r_gc.gc_batches,
+				(double)ls.ls_cnt /
+				(double)MAX(run.r_gc.gc_batches, 1));
+		latstat_free(&ls);
+	} else {
+		buf = xmalloc(sz);
+		while (nwr < bytes) {
+			cwr = MIN(sz, bytes - nwr);
+			if (write(fd, buf, cwr) == -1)
+				errmsg_exit1("write failure, %s.\n", ERR_MSG);
+
+			/* 
+			 * if perform an fdatasync() after each write,
+			 * so that data--and possibly metadata--changes are
+			 * flushed to the disk.
+			 *
+			 * if perform an fsync() after each write,
+			 * so that data and metadata are flushed to the disk.
+			 */
+			switch (fun) {
+			case SYNC_FSYNC:
+				if (fsync(fd) == -1)
+					errmsg_exit1("fsync error, %s.\n",
+						ERR_MSG);
+				break;
+			case SYNC_FDATASYNC:
+				if (fdatasync(fd) == -1)
+					errmsg_exit1("fdatasync error, %s.\n",
+						ERR_MSG);
+				break;
+			}
+			nwr += cwr;
 		}
-		nwr += cwr;
+		xfree(buf);
 	}
-	xfree(buf);
 
 	if (close(fd) == -1)
 		errmsg_exit1("close file %s failure, %s.\n", fname, ERR_MSG);
@@ -137,16 +245,109 @@ main(int argc, char *argv[])
 	return 0;
 }
 
+/*
+ * Write 'bytes' in records of 'run.r_recsz' bytes, the last one short if
+ * need be, with 'nthrs' producers in mode 'run.r_mode'. The latency of every
+ * commit is added to 'ls'. Return the durable records per second.
+ */
+static double
+run_producers(int nthrs, long bytes, struct latstat *ls)
+{
+	struct producer *pr;
+	uint64_t t0, ns;
+	long nrecs = bytes / run.r_recsz;
+	int i, r;
+
+	run.r_off = 0;
+	if (run.r_mode == SYNC_GROUP && gc_init(&run.r_gc, run.r_fd, 0) == -1)
+		errmsg_exit1("gc_init failure, %s.\n", ERR_MSG);
+
+	pr = xcalloc(nthrs, sizeof(struct producer));
+	t0 = bench_nsec();
+	for (i = 0; i < nthrs; i++) {
+		pr[i].p_nrecs = nrecs / nthrs + (i < nrecs % nthrs);
+		pr[i].p_tail = i == 0 ? bytes % run.r_recsz : 0;
+		pr[i].p_buf = xmalloc(run.r_recsz);
+		memset(pr[i].p_buf, 'a' + i % 26, run.r_recsz);
+		latstat_init(&pr[i].p_lat);
+		r = pthread_create(&pr[i].p_tid, NULL, producer_func, &pr[i]);
+		if (r != 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+	}
+
+	for (i = 0; i < nthrs; i++) {
+		if ((r = pthread_join(pr[i].p_tid, NULL)) != 0)
+			errmsg_exit1("pthread_join failed, %s\n", strerror(r));
+		latstat_merge(ls, &pr[i].p_lat);
+		latstat_free(&pr[i].p_lat);
+		xfree(pr[i].p_buf);
+	}
+	ns = bench_nsec() - t0;
+	xfree(pr);
+
+	if (run.r_mode == SYNC_GROUP && gc_close(&run.r_gc) == -1)
+		errmsg_exit1("group commit failure, %s.\n", ERR_MSG);
+
+	return (double)ls->ls_cnt / bench_secs(ns);
+}
+
+static void *
+producer_func(void *arg)
+{
+	struct producer *pr = arg;
+	uint64_t t0;
+	off_t off;
+	size_t len;
+	long i;
+
+	for (i = 0; i < pr->p_nrecs + (pr->p_tail != 0); i++) {
+		len = i < pr->p_nrecs ? run.r_recsz : pr->p_tail;
+		t0 = bench_nsec();
+		if (run.r_mode == SYNC_GROUP) {
+			if (gc_append(&run.r_gc, pr->p_buf, len) == -1)
+				errmsg_exit1("group commit failure, %s.\n",
+					ERR_MSG);
+			latstat_add(&pr->p_lat, bench_nsec() - t0);
+			continue;
+		}
+
+		/* Reserve a slot of the file, then write and sync it */
+		pthread_mutex_lock(&run.r_mtx);
+		off = run.r_off;
+		run.r_off += len;
+		pthread_mutex_unlock(&run.r_mtx);
+
+		if (pwrite(run.r_fd, pr->p_buf, len, off) == -1)
+			errmsg_exit1("pwrite failure, %s.\n", ERR_MSG);
+		if (run.r_mode == SYNC_FSYNC && fsync(run.r_fd) == -1)
+			errmsg_exit1("fsync error, %s.\n", ERR_MSG);
+		if (run.r_mode == SYNC_FDATASYNC && fdatasync(run.r_fd) == -1)
+			errmsg_exit1("fdatasync error, %s.\n", ERR_MSG);
+		latstat_add(&pr->p_lat, bench_nsec() - t0);
+	}
+
+	return NULL;
+}
+
 static void 
 usage_info(const char *pname)
 {
-	fprintf(stderr, "Usage %s -f -b -s -S -F.\n", pname);
+	fprintf(stderr, "Usage %s -f -b -s [-S] [-F] [-P] [-t] [-B].\n", pname);
 	fprintf(stderr, "-f: specify a file.\n");
 	fprintf(stderr, "-b: the number of bytes will be write.\n");
 	fprintf(stderr, "-s: the size of the buffer to be used.\n");
 	fprintf(stderr, "-S: open the file with the O_SYNC flag(0 or 1).\n");
-	fprintf(stderr, "-F: 0: none; 1: perform an fdatasync(); "
-		"2: perform an fsync().\n");
+	fprintf(stderr, "-F: 0: none; 1: perform an fsync(); "
+		"2: perform an fdatasync();\n"
+		"    3: group commit, one pwritev() and fdatasync() per "
+		"batch.\n");
+	fprintf(stderr, "-P: preallocate the file first, 0: fallocate; "
+		"1: keeping its size; 2: write zeros.\n");
+	fprintf(stderr, "-t: write with this many producer threads, each "
+		"record of -s bytes.\n");
+	fprintf(stderr, "-B: compare fsync and fdatasync per write with group "
+		"commit for 1, 2, 4 ... -t threads.\n");
 
 	exit(EXIT_FAILURE);
 }
@@ -0,0 +1,368 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* F_OFD_SETLKW */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/file.h>	/* flock() */
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define MAXWORKERS	256
+
+/*
+ * Every worker opens the file itself, so flock() and OFD locks, which
+ * belong to the open file description, conflict between threads as well
+ * as processes.  fcntl() record locks belong to the process and are only
+ * run with processes.
+ */
+enum { LK_FLOCK, LK_FCNTL, LK_OFD, LK_NKINDS };
+static const char *lknames[LK_NKINDS] = { "flock", "fcntl", "ofd" };
+
+enum { LM_SHARED, LM_EXCL, LM_MIX, LM_NMODES };
+static const char *lmnames[LM_NMODES] = { "shared", "exclusive", "mixed" };
+
+/* Per worker, in memory shared with the parent */
+struct wstat {
+	uint64_t	ws_acquires;
+	struct lathist	ws_lh;		/* Time to get each lock */
+} __attribute__((aligned(64)));
+
+static struct {
+	const char	*file;
+	int		kind;
+	int		mode;
+	int		wpct;		/* Exclusive share of LM_MIX */
+	uint64_t	hold;		/* ns each lock is held */
+	int		nworkers;
+	bool		threads;
+	double		elapsed;	/* Seconds the last run took */
+	struct wstat	*stats;
+	atomic_int	*go;		/* 1 to start, 2 to stop */
+} g;
+
+static void run(int, int, double);
+static void *worker_thread(void *);
+static void worker(int);
+static int lockop(int, int, int);
+static void report(bool);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, k, m, kfirst = 0, klast = LK_NKINDS - 1, mfirst = LM_SHARED;
+	int mlast = LM_EXCL;
+	double secs = 2.0;
+	bool json = false, first = true;
+
+	g.wpct = 20;
+	g.nworkers = 4;
+	while ((op = getopt(argc, argv, "f:k:m:w:h:P:d:tj")) != -1) {
+		switch (op) {
+		case 'f':
+			g.file = optarg;
+			break;
+		case 'k':
+			for (k = 0; k < LK_NKINDS; k++)
+				if (strcmp(optarg, lknames[k]) == 0)
+					break;
+			if (k == LK_NKINDS)
+				usage_info(argv[0]);
+			kfirst = klast = k;
+			break;
+		case 'm':
+			for (m = 0; m < LM_NMODES; m++)
+				if (strcmp(optarg, lmnames[m]) == 0)
+					break;
+			if (m == LM_NMODES)
+				usage_info(argv[0]);
+			mfirst = mlast = m;
+			break;
+		case 'w':
+			g.wpct = getint(optarg);
+			break;
+		case 'h':
+			g.hold = getlong(optarg, GN_NONNEG);
+			break;
+		case 'P':
+			g.nworkers = getint(optarg);
+			break;
+		case 'd':
+			secs = (double)getlong(optarg, GN_GT_0) / 1000.0;
+			break;
+		case 't':
+			g.threads = true;
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (g.file == NULL || optind != argc || g.nworkers < 1 ||
+		g.nworkers > MAXWORKERS || g.wpct < 0 || g.wpct > 100)
+		usage_info(argv[0]);
+#ifndef F_OFD_SETLKW
+	if (klast == LK_OFD)
+		klast--;
+#endif
+
+	op = open(g.file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (op == -1)
+		errmsg_exit1("open '%s' failed, %s\n", g.file, ERR_MSG);
+	close(op);
+	g.stats = mmap(NULL, g.nworkers * sizeof(struct wstat) +
+		sizeof(atomic_int), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANON, -1, 0);
+	if (g.stats == MAP_FAILED)
+		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+	g.go = (atomic_int *)(g.stats + g.nworkers);
+
+	if (json)
+		printf("[");
+	else
+		printf("%-6s %-9s %-15s %12s %9s %9s %9s %9s %6s %9s\n",
+			"lock", "mode", "workers", "acquires/s", "avg(us)",
+			"p50(us)", "p99(us)", "max(us)", "jain", "min/max");
+	for (k = kfirst; k <= klast; k++) {
+		if (k == LK_FCNTL && g.threads)
+			continue;
+		for (m = mfirst; m <= mlast; m++) {
+			run(k, m, secs);
+			if (json && !first)
+				printf(",");
+			report(json);
+			first = false;
+		}
+	}
+	if (json)
+		printf("\n]\n");
+
+	munmap(g.stats, g.nworkers * sizeof(struct wstat) + sizeof(atomic_int));
+	exit(EXIT_SUCCESS);
+}
+
+/* One round of one kind of lock in one mode, for 'secs' */
+static void
+run(int kind, int mode, double secs)
+{
+	pthread_t tids[MAXWORKERS];
+	struct timespec ts;
+	uint64_t start;
+	pid_t pid;
+	long i;
+	int r;
+
+	g.kind = kind;
+	g.mode = mode;
+	memset(g.stats, 0, g.nworkers * sizeof(struct wstat));
+	atomic_store(g.go, 0);
+
+	fflush(stdout);		/* Or every child inherits what is buffered */
+	for (i = 0; i < g.nworkers; i++) {
+		if (g.threads) {
+			if ((r = pthread_create(&tids[i], NULL, worker_thread,
+				(void *)i)) != 0)
+				errmsg_exit1("pthread_create failed, %s\n",
+					strerror(r));
+		} else if ((pid = fork()) == -1) {
+			errmsg_exit1("fork failed, %s\n", ERR_MSG);
+		} else if (pid == 0) {
+			worker(i);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+
+	start = bench_nsec();
+	atomic_store(g.go, 1);
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - (double)ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+	atomic_store(g.go, 2);
+
+	for (i = 0; i < g.nworkers; i++) {
+		if (g.threads)
+			pthread_join(tids[i], NULL);
+		else if (wait(&r) == -1 || !WIFEXITED(r) ||
+			WEXITSTATUS(r) != EXIT_SUCCESS)
+			errmsg_exit1("a worker failed\n");
+	}
+	g.elapsed = bench_secs(bench_nsec() - start);
+}
+
+static void *
+worker_thread(void *arg)
+{
+	worker((int)(long)arg);
+	return NULL;
+}
+
+static void
+worker(int id)
+{
+	struct wstat *ws = &g.stats[id];
+	unsigned int seed = id + 1;
+	uint64_t t0, t1;
+	int fd, excl;
+
+	/* Its own open file description */
+	if ((fd = open(g.file, O_RDWR)) == -1)
+		errmsg_exit2("open '%s' failed, %s\n", g.file, ERR_MSG);
+
+	while (atomic_load(g.go) == 0)
+		sched_yield();
+	while (atomic_load(g.go) == 1) {
+		excl = g.mode == LM_EXCL || (g.mode == LM_MIX &&
+			rand_r(&seed) % 100 < g.wpct);
+		t0 = bench_nsec();
+		if (lockop(fd, excl ? F_WRLCK : F_RDLCK, 1) == -1)
+			errmsg_exit2("%s lock failed, %s\n", lknames[g.kind],
+				ERR_MSG);
+		t1 = bench_nsec();
+		lathist_add(&ws->ws_lh, t1 - t0);
+		ws->ws_acquires++;
+		while (bench_nsec() - t1 < g.hold)
+			;	/* Critical section */
+		if (lockop(fd, F_UNLCK, 0) == -1)
+			errmsg_exit2("%s unlock failed, %s\n", lknames[g.kind],
+				ERR_MSG);
+	}
+	close(fd);
+}
+
+/* Locks the whole file, 'type' as for fcntl() */
+static int
+lockop(int fd, int type, int wait)
+{
+	struct flock fl;
+	int cmd;
+
+	if (g.kind == LK_FLOCK)
+		return flock(fd, type == F_UNLCK ? LOCK_UN : type == F_WRLCK ?
+			LOCK_EX : LOCK_SH);
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0;
+	cmd = wait ? F_SETLKW : F_SETLK;
+#ifdef F_OFD_SETLKW
+	if (g.kind == LK_OFD)
+		cmd = wait ? F_OFD_SETLKW : F_OFD_SETLK;
+#endif
+	return fcntl(fd, cmd, &fl);
+}
+
+static void
+report(bool json)
+{
+	struct lathist lh;
+	uint64_t total = 0, min = UINT64_MAX, max = 0, n;
+	double sq = 0.0, jain;
+	int i;
+
+	memset(&lh, 0, sizeof(lh));
+	for (i = 0; i < g.nworkers; i++) {
+		n = g.stats[i].ws_acquires;
+		lathist_merge(&lh, &g.stats[i].ws_lh);
+		total += n;
+		min = MIN(min, n);
+		max = MAX(max, n);
+		sq += (double)n * (double)n;
+	}
+	/* Jain's index: 1 when all workers got the same share */
+	jain = total == 0 ? 0.0 : (double)total * (double)total /
+		((double)g.nworkers * sq);
+
+	if (!json) {
+		printf("%-6s %-9s %7d %-7s %12.0f %9.2f %9.2f %9.2f %9.1f "
+			"%6.3f %ju/%ju\n", lknames[g.kind], lmnames[g.mode],
+			g.nworkers, g.threads ? "threads" : "procs",
+			(double)total / g.elapsed, lh.lh_total == 0 ? 0.0 :
+			(double)lh.lh_sum / (double)lh.lh_total / 1e3,
+			(double)lathist_pctl(&lh, 50.0) / 1e3,
+			(double)lathist_pctl(&lh, 99.0) / 1e3,
+			(double)lh.lh_max / 1e3, jain, (uintmax_t)min,
+			(uintmax_t)max);
+		return;
+	}
+
+	printf("\n  {\"lock\": \"%s\", \"mode\": \"%s\", ", lknames[g.kind],
+		lmnames[g.mode]);
+	printf("\"workers\": %d, \"kind\": \"%s\", \"seconds\": %.3f, ",
+		g.nworkers, g.threads ? "thread" : "process", g.elapsed);
+	printf("\"hold_ns\": %ju, \"acquires\": %ju, "
+		"\"acquires_per_sec\": %.0f,\n", (uintmax_t)g.hold,
+		(uintmax_t)total, (double)total / g.elapsed);
+	printf("   \"latency_ns\": {\"avg\": %.0f, \"p50\": %ju, "
+		"\"p90\": %ju, \"p99\": %ju, \"p99.9\": %ju, \"max\": %ju},\n",
+		lh.lh_total == 0 ? 0.0 : (double)lh.lh_sum /
+		(double)lh.lh_total, (uintmax_t)lathist_pctl(&lh, 50.0),
+		(uintmax_t)lathist_pctl(&lh, 90.0),
+		(uintmax_t)lathist_pctl(&lh, 99.0),
+		(uintmax_t)lathist_pctl(&lh, 99.9), (uintmax_t)lh.lh_max);
+	printf("   \"fairness\": {\"jain\": %.4f, \"min\": %ju, \"max\": %ju, "
+		"\"per_worker\": [", jain, (uintmax_t)min, (uintmax_t)max);
+	for (i = 0; i < g.nworkers; i++)
+		printf("%s%ju", i == 0 ? "" : ", ",
+			(uintmax_t)g.stats[i].ws_acquires);
+	printf("]}}");
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s -f file [-k flock|fcntl|ofd] "
+		"[-m shared|exclusive|mixed] [-w pct] [-h holdns] [-P workers] "
+		"[-d msecs] [-t] [-j]\n", pname);
+	fprintf(stderr, "-k: lock kind to run (default all).\n");
+	fprintf(stderr, "-m: lock mode to run (default shared and "
+		"exclusive).\n");
+	fprintf(stderr, "-w: percent of exclusive locks when mixed "
+		"(default 20).\n");
+	fprintf(stderr, "-h: ns each lock is held (default 0).\n");
+	fprintf(stderr, "-P: workers locking the file (default 4).\n");
+	fprintf(stderr, "-d: msecs per run (default 2000).\n");
+	fprintf(stderr, "-t: threads instead of processes; fcntl is "
+		"skipped.\n");
+	fprintf(stderr, "-j: JSON output.\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,492 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _RANGELOCK_H_
+#define _RANGELOCK_H_
+
+/*
+ * Byte-range locks for threads.  fcntl() record locks belong to the
+ * process (or, for OFD locks, to the open file description), so threads
+ * sharing an fd never conflict with each other.  A rangelock arbitrates
+ * between the threads of a process with an interval tree of granted
+ * ranges, and when it has an fd it also holds the matching fcntl() lock
+ * so other processes see the ranges too: OFD locks where there are some,
+ * classic record locks otherwise.
+ *
+ * Waiters queue in arrival order and a request also waits behind earlier
+ * waiters it conflicts with, so a steady stream of readers cannot starve
+ * a writer.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "benchutil.h"
+#include "objpool.h"
+
+#define RL_SHARED	0
+#define RL_EXCL		1
+
+#define RL_FOREVER	(-1)	/* Timeout that never expires */
+#define RL_EOF		UINT64_MAX
+
+/* A granted range, a node of a treap ordered by start */
+struct rlnode {
+	uint64_t	rn_start;
+	uint64_t	rn_end;		/* Exclusive, RL_EOF for to EOF */
+	uint64_t	rn_max;		/* Largest rn_end in the subtree */
+	uint32_t	rn_prio;
+	int		rn_mode;
+	struct rlnode	*rn_left;
+	struct rlnode	*rn_right;
+};
+
+/* A thread waiting for a range */
+struct rlwaiter {
+	uint64_t	rw_start;
+	uint64_t	rw_end;
+	int		rw_mode;
+	bool		rw_woken;
+	pthread_cond_t	rw_cnd;
+	struct rlwaiter	*rw_next;
+};
+
+struct rlstats {
+	uint64_t	rs_acquired;
+	uint64_t	rs_contended;	/* Acquired after waiting */
+	uint64_t	rs_timeouts;
+	uint64_t	rs_waitns;	/* Total time spent waiting */
+	uint64_t	rs_maxwaitns;
+	uint64_t	rs_fcntlretries; /* Held off by another process */
+};
+
+struct rangelock {
+	pthread_mutex_t	rl_mtx;
+	struct rlnode	*rl_root;
+	struct rlwaiter	*rl_whead;	/* Oldest waiter first */
+	struct rlwaiter	*rl_wtail;
+	uint32_t	rl_seed;
+	int		rl_fd;		/* -1 for threads only */
+	int		rl_setlk;	/* F_OFD_SETLK or F_SETLK */
+	struct rlstats	rl_stats;
+	struct objpool	rl_nodes;	/* Of struct rlnode */
+};
+
+static inline uint64_t
+rl_maxof(const struct rlnode *n)
+{
+	return n == NULL ? 0 : n->rn_max;
+}
+
+static inline void
+rl_fix(struct rlnode *n)
+{
+	n->rn_max = MAX(n->rn_end, MAX(rl_maxof(n->rn_left),
+		rl_maxof(n->rn_right)));
+}
+
+/* Total order on nodes, ties on start broken by address */
+static inline bool
+rl_before(const struct rlnode *a, const struct rlnode *b)
+{
+	return a->rn_start < b->rn_start ||
+		(a->rn_start == b->rn_start && (uintptr_t)a < (uintptr_t)b);
+}
+
+static struct rlnode *
+rl_insert(struct rlnode *t, struct rlnode *n)
+{
+	struct rlnode *c;
+
+	if (t == NULL) {
+		rl_fix(n);
+		return n;
+	}
+	if (rl_before(n, t)) {
+		t->rn_left = rl_insert(t->rn_left, n);
+		if (t->rn_left->rn_prio > t->rn_prio) {
+			c = t->rn_left;
+			t->rn_left = c->rn_right;
+			c->rn_right = t;
+			rl_fix(t);
+			t = c;
+		}
+	} else {
+		t->rn_right = rl_insert(t->rn_right, n);
+		if (t->rn_right->rn_prio > t->rn_prio) {
+			c = t->rn_right;
+			t->rn_right = c->rn_left;
+			c->rn_left = t;
+			rl_fix(t);
+			t = c;
+		}
+	}
+	rl_fix(t);
+	return t;
+}
+
+static struct rlnode *
+rl_join(struct rlnode *a, struct rlnode *b)
+{
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (a->rn_prio > b->rn_prio) {
+		a->rn_right = rl_join(a->rn_right, b);
+		rl_fix(a);
+		return a;
+	}
+	b->rn_left = rl_join(a, b->rn_left);
+	rl_fix(b);
+	return b;
+}
+
+static struct rlnode *
+rl_remove(struct rlnode *t, struct rlnode *n)
+{
+	if (t == n)
+		return rl_join(n->rn_left, n->rn_right);
+	if (rl_before(n, t))
+		t->rn_left = rl_remove(t->rn_left, n);
+	else
+		t->rn_right = rl_remove(t->rn_right, n);
+	rl_fix(t);
+	return t;
+}
+
+static inline bool
+rl_conflicts(uint64_t s1, uint64_t e1, int m1, uint64_t s2, uint64_t e2,
+	int m2)
+{
+	return s1 < e2 && s2 < e1 && (m1 == RL_EXCL || m2 == RL_EXCL);
+}
+
+/* Whether any granted range in 't' conflicts with [s, e) in mode 'm' */
+static bool
+rl_granted_conflict(const struct rlnode *t, uint64_t s, uint64_t e, int m)
+{
+	while (t != NULL && t->rn_max > s) {
+		if (rl_conflicts(t->rn_start, t->rn_end, t->rn_mode, s, e, m))
+			return true;
+		if (rl_granted_conflict(t->rn_left, s, e, m))
+			return true;
+		if (t->rn_start >= e)
+			return false;
+		t = t->rn_right;
+	}
+	return false;
+}
+
+static inline bool
+rl_can_grant(const struct rangelock *rl, uint64_t s, uint64_t e, int m,
+	const struct rlwaiter *self)
+{
+	const struct rlwaiter *w;
+
+	if (rl_granted_conflict(rl->rl_root, s, e, m))
+		return false;
+	for (w = rl->rl_whead; w != NULL && w != self; w = w->rw_next)
+		if (rl_conflicts(w->rw_start, w->rw_end, w->rw_mode, s, e, m))
+			return false;
+	return true;
+}
+
+/* Wakes the waiters overlapping [s, e), which may be able to go now */
+static inline void
+rl_wake(struct rangelock *rl, uint64_t s, uint64_t e)
+{
+	struct rlwaiter *w;
+
+	for (w = rl->rl_whead; w != NULL; w = w->rw_next) {
+		if (w->rw_start < e && s < w->rw_end) {
+			w->rw_woken = true;
+			pthread_cond_signal(&w->rw_cnd);
+		}
+	}
+}
+
+static inline int
+rl_fcntl(const struct rangelock *rl, short type, uint64_t s, uint64_t e)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (off_t)s;
+	fl.l_len = e == RL_EOF ? 0 : (off_t)(e - s);
+	return fcntl(rl->rl_fd, rl->rl_setlk, &fl);
+}
+
+/*
+ * Drops the process lock on the parts of [s, e) that no granted range in
+ * 't' still covers.  Only shared ranges can overlap once granted, so the
+ * parts still covered keep their read lock.  '*from' walks left to right.
+ */
+static void
+rl_unlock_gaps(const struct rangelock *rl, const struct rlnode *t,
+	uint64_t *from, uint64_t e)
+{
+	if (t == NULL || t->rn_max <= *from || *from >= e)
+		return;
+	rl_unlock_gaps(rl, t->rn_left, from, e);
+	if (t->rn_start < e && t->rn_end > *from) {
+		if (t->rn_start > *from)
+			(void)rl_fcntl(rl, F_UNLCK, *from, t->rn_start);
+		*from = t->rn_end;
+	}
+	if (t->rn_start < e)
+		rl_unlock_gaps(rl, t->rn_right, from, e);
+}
+
+/* Takes 'n' out of the tree, with its process lock */
+static inline void
+rl_drop(struct rangelock *rl, struct rlnode *n)
+{
+	uint64_t from = n->rn_start;
+
+	rl->rl_root = rl_remove(rl->rl_root, n);
+	if (rl->rl_fd != -1) {
+		rl_unlock_gaps(rl, rl->rl_root, &from, n->rn_end);
+		if (from < n->rn_end)
+			(void)rl_fcntl(rl, F_UNLCK, from, n->rn_end);
+	}
+	rl_wake(rl, n->rn_start, n->rn_end);
+}
+
+/*
+ * 'fd' is the file whose ranges other processes should see locked, or -1
+ * when only the threads of this process take part.
+ */
+static inline int
+rl_init(struct rangelock *rl, int fd)
+{
+	int r;
+#ifdef F_OFD_SETLK
+	struct flock fl;
+#endif
+
+	memset(rl, 0, sizeof(*rl));
+	if ((r = pthread_mutex_init(&rl->rl_mtx, NULL)) != 0) {
+		errno = r;
+		return -1;
+	}
+	op_init(&rl->rl_nodes, sizeof(struct rlnode), 0);
+	rl->rl_fd = fd;
+	rl->rl_seed = (uint32_t)bench_nsec() | 1;
+	rl->rl_setlk = F_SETLK;
+#ifdef F_OFD_SETLK
+	/* Kernels before Linux 3.15 reject the OFD commands */
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	if (fd != -1 && fcntl(fd, F_OFD_GETLK, &fl) == 0)
+		rl->rl_setlk = F_OFD_SETLK;
+#endif
+
+	return 0;
+}
+
+/*
+ * Locks 'len' bytes (0 for up to EOF and beyond) from 'start' in mode
+ * RL_SHARED or RL_EXCL.  Gives up after 'timeout' nanoseconds with
+ * ETIMEDOUT, or at once with EAGAIN if 'timeout' is 0; RL_FOREVER waits
+ * as long as it takes.  Returns the handle to unlock with, or NULL.
+ */
+static struct rlnode *
+rl_lock(struct rangelock *rl, uint64_t start, uint64_t len, int mode,
+	int64_t timeout)
+{
+	struct rlnode *n;
+	struct rlwaiter w;
+	struct timespec ts;
+	pthread_condattr_t ca;
+	uint64_t t0 = 0, deadline = 0, now, waited;
+	unsigned int backoff = 1;
+	bool waiting = false;
+	int r = 0;
+
+	if (len == 0)
+		len = RL_EOF - start;
+	if (len > RL_EOF - start || (mode != RL_SHARED && mode != RL_EXCL)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (timeout > 0) {
+		t0 = bench_nsec();
+		deadline = t0 + (uint64_t)timeout;
+	}
+
+	n = op_alloc(&rl->rl_nodes);
+	n->rn_start = start;
+	n->rn_end = start + len;
+	n->rn_mode = mode;
+	n->rn_left = n->rn_right = NULL;
+
+	pthread_mutex_lock(&rl->rl_mtx);
+	n->rn_prio = rand_r(&rl->rl_seed);
+	if (!rl_can_grant(rl, n->rn_start, n->rn_end, mode, NULL)) {
+		if (timeout == 0) {
+			pthread_mutex_unlock(&rl->rl_mtx);
+			op_free(&rl->rl_nodes, n);
+			errno = EAGAIN;
+			return NULL;
+		}
+		if (t0 == 0)
+			t0 = bench_nsec();
+
+		/* Queue up, and sleep until a release overlaps our range */
+		w.rw_start = n->rn_start;
+		w.rw_end = n->rn_end;
+		w.rw_mode = mode;
+		w.rw_next = NULL;
+		pthread_condattr_init(&ca);
+		pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+		pthread_cond_init(&w.rw_cnd, &ca);
+		pthread_condattr_destroy(&ca);
+		if (rl->rl_wtail == NULL)
+			rl->rl_whead = &w;
+		else
+			rl->rl_wtail->rw_next = &w;
+		rl->rl_wtail = &w;
+		waiting = true;
+
+		ts.tv_sec = deadline / 1000000000;
+		ts.tv_nsec = deadline % 1000000000;
+		while (!rl_can_grant(rl, n->rn_start, n->rn_end, mode, &w)) {
+			w.rw_woken = false;
+			if (timeout < 0)
+				r = pthread_cond_wait(&w.rw_cnd, &rl->rl_mtx);
+			else
+				r = pthread_cond_timedwait(&w.rw_cnd,
+					&rl->rl_mtx, &ts);
+			if (r == ETIMEDOUT && !w.rw_woken)
+				break;
+			r = 0;
+		}
+
+		/* Off the queue; those behind us may now go */
+		if (rl->rl_whead == &w) {
+			rl->rl_whead = w.rw_next;
+		} else {
+			struct rlwaiter *p = rl->rl_whead;
+
+			while (p->rw_next != &w)
+				p = p->rw_next;
+			p->rw_next = w.rw_next;
+			if (rl->rl_wtail == &w)
+				rl->rl_wtail = p;
+		}
+		if (rl->rl_wtail == &w)
+			rl->rl_wtail = NULL;
+		pthread_cond_destroy(&w.rw_cnd);
+		rl_wake(rl, n->rn_start, n->rn_end);
+
+		if (r == ETIMEDOUT) {
+			rl->rl_stats.rs_timeouts++;
+			pthread_mutex_unlock(&rl->rl_mtx);
+			op_free(&rl->rl_nodes, n);
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+	}
+	rl->rl_root = rl_insert(rl->rl_root, n);
+
+	/*
+	 * Granted among our threads.  Now the other processes, polling with
+	 * the table unlocked since F_SETLKW cannot be given a deadline.
+	 */
+	while (rl->rl_fd != -1 && rl_fcntl(rl, mode == RL_EXCL ? F_WRLCK :
+		F_RDLCK, n->rn_start, n->rn_end) == -1) {
+		if ((errno != EAGAIN && errno != EACCES) || timeout == 0 ||
+			(timeout > 0 && bench_nsec() >= deadline)) {
+			r = (errno == EAGAIN || errno == EACCES) ?
+				(timeout == 0 ? EAGAIN : ETIMEDOUT) : errno;
+			if (r == ETIMEDOUT)
+				rl->rl_stats.rs_timeouts++;
+			rl_drop(rl, n);
+			pthread_mutex_unlock(&rl->rl_mtx);
+			op_free(&rl->rl_nodes, n);
+			errno = r;
+			return NULL;
+		}
+		rl->rl_stats.rs_fcntlretries++;
+		if (t0 == 0)
+			t0 = bench_nsec();
+		waiting = true;
+		pthread_mutex_unlock(&rl->rl_mtx);
+		usleep(backoff);
+		backoff = MIN(backoff * 2, 10000);
+		pthread_mutex_lock(&rl->rl_mtx);
+	}
+
+	rl->rl_stats.rs_acquired++;
+	if (waiting) {
+		now = bench_nsec();
+		waited = now - t0;
+		rl->rl_stats.rs_contended++;
+		rl->rl_stats.rs_waitns += waited;
+		rl->rl_stats.rs_maxwaitns = MAX(rl->rl_stats.rs_maxwaitns,
+			waited);
+	}
+	pthread_mutex_unlock(&rl->rl_mtx);
+
+	return n;
+}
+
+static inline void
+rl_unlock(struct rangelock *rl, struct rlnode *n)
+{
+	pthread_mutex_lock(&rl->rl_mtx);
+	rl_drop(rl, n);
+	pthread_mutex_unlock(&rl->rl_mtx);
+	op_free(&rl->rl_nodes, n);
+}
+
+static inline void
+rl_getstats(struct rangelock *rl, struct rlstats *rs)
+{
+	pthread_mutex_lock(&rl->rl_mtx);
+	*rs = rl->rl_stats;
+	pthread_mutex_unlock(&rl->rl_mtx);
+}
+
+/* Every range must have been unlocked */
+static inline void
+rl_destroy(struct rangelock *rl)
+{
+	op_destroy(&rl->rl_nodes);
+	pthread_mutex_destroy(&rl->rl_mtx);
+}
+
+#endif	/* !_RANGELOCK_H_ */
@@ -0,0 +1,253 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* F_OFD_SETLK */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <getopt.h>
+#include "rangelock.h"
+
+#define MAXTHRS		64
+#define MAXRUNS		16
+
+/*
+ * Threads lock random 'range' byte ranges aligned within 'span' bytes,
+ * hold each for 'hold' ns and let go.  The smaller the span, the more
+ * the ranges overlap: with range == span every lock contends.
+ */
+static struct {
+	struct rangelock rl;
+	uint64_t	span;
+	uint64_t	range;
+	uint64_t	hold;
+	int		wpct;		/* Percent of exclusive locks */
+	long		nops;
+	int64_t		timeout;
+	pthread_barrier_t bar;
+} g;
+
+struct worker {
+	pthread_t	tid;
+	unsigned int	seed;
+	long		timeouts;
+	struct lathist	lh;		/* Time to get each lock */
+};
+
+static void *worker_func(void *);
+static int parse_list(const char *, uint64_t *, bool);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, fd = -1, i, t, s, nthr, nspan;
+	uint64_t thrs[MAXRUNS], spans[MAXRUNS], start, ns;
+	const char *file = NULL, *tlist = "1,2,4,8", *slist = "1m,64k,4k";
+	struct worker *wk;
+	struct lathist lh;
+	struct rlstats rs;
+	long timeouts;
+
+	g.range = 4096;
+	g.hold = 1000;
+	g.wpct = 50;
+	g.nops = 100000;
+	g.timeout = RL_FOREVER;
+	while ((op = getopt(argc, argv, "t:s:r:h:w:n:T:f:")) != -1) {
+		switch (op) {
+		case 't':
+			tlist = optarg;
+			break;
+		case 's':
+			slist = optarg;
+			break;
+		case 'r':
+			g.range = getsize(optarg);
+			break;
+		case 'h':
+			g.hold = getlong(optarg, GN_NONNEG);
+			break;
+		case 'w':
+			g.wpct = getint(optarg);
+			break;
+		case 'n':
+			g.nops = getlong(optarg, GN_GT_0);
+			break;
+		case 'T':
+			g.timeout = getlong(optarg, GN_NONNEG) * 1000;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if ((nthr = parse_list(tlist, thrs, false)) <= 0 ||
+		(nspan = parse_list(slist, spans, true)) <= 0 ||
+		g.range == 0 || g.wpct < 0 || g.wpct > 100 || optind != argc)
+		usage_info(argv[0]);
+	for (i = 0; i < nthr; i++)
+		if (thrs[i] < 1 || thrs[i] > MAXTHRS)
+			usage_info(argv[0]);
+
+	if (file != NULL && (fd = open(file, O_RDWR | O_CREAT,
+		S_IRUSR | S_IWUSR)) == -1)
+		errmsg_exit1("open '%s' failed, %s\n", file, ERR_MSG);
+	if (rl_init(&g.rl, fd) == -1)
+		errmsg_exit1("rl_init failed, %s\n", ERR_MSG);
+	if (fd != -1)
+		printf("process locks: %s\n", g.rl.rl_setlk == F_SETLK ?
+			"fcntl F_SETLK" : "OFD");
+	wk = xcalloc(MAXTHRS, sizeof(struct worker));
+
+	printf("%7s %8s %7s %12s %9s %9s %10s %10s %9s\n", "threads",
+		"span", "overlap", "ops/s", "contend%", "timeouts", "avg(us)",
+		"p99(us)", "max(us)");
+	for (s = 0; s < nspan; s++) {
+		g.span = MAX(spans[s], g.range);
+		for (t = 0; t < nthr; t++) {
+			memset(&g.rl.rl_stats, 0, sizeof(g.rl.rl_stats));
+			pthread_barrier_init(&g.bar, NULL, thrs[t] + 1);
+			for (i = 0; i < (int)thrs[t]; i++) {
+				memset(&wk[i], 0, sizeof(wk[i]));
+				wk[i].seed = i + 1;
+				if ((op = pthread_create(&wk[i].tid, NULL,
+					worker_func, &wk[i])) != 0)
+					errmsg_exit1("pthread_create failed, "
+						"%s\n", strerror(op));
+			}
+			pthread_barrier_wait(&g.bar);
+			start = bench_nsec();
+			memset(&lh, 0, sizeof(lh));
+			timeouts = 0;
+			for (i = 0; i < (int)thrs[t]; i++) {
+				pthread_join(wk[i].tid, NULL);
+				lathist_merge(&lh, &wk[i].lh);
+				timeouts += wk[i].timeouts;
+			}
+			ns = bench_nsec() - start;
+			pthread_barrier_destroy(&g.bar);
+			rl_getstats(&g.rl, &rs);
+
+			printf("%7ju %8ju %6.2f%% %12.0f %8.2f%% %9ld %10.2f "
+				"%10.2f %9.1f\n", (uintmax_t)thrs[t],
+				(uintmax_t)g.span,
+				(double)g.range * 100.0 / (double)g.span,
+				(double)rs.rs_acquired / bench_secs(ns),
+				rs.rs_acquired == 0 ? 0.0 :
+				(double)rs.rs_contended * 100.0 /
+				(double)rs.rs_acquired, timeouts,
+				lh.lh_total == 0 ? 0.0 : (double)lh.lh_sum /
+				(double)lh.lh_total / 1e3,
+				(double)lathist_pctl(&lh, 99.0) / 1e3,
+				(double)lh.lh_max / 1e3);
+		}
+	}
+
+	rl_destroy(&g.rl);
+	xfree(wk);
+	if (fd != -1)
+		close(fd);
+
+	exit(EXIT_SUCCESS);
+}
+
+static void *
+worker_func(void *arg)
+{
+	struct worker *w = arg;
+	struct rlnode *n;
+	uint64_t off, t0, t1;
+	long i;
+	int mode;
+
+	pthread_barrier_wait(&g.bar);
+	for (i = 0; i < g.nops; i++) {
+		off = (uint64_t)rand_r(&w->seed) % (g.span / g.range) *
+			g.range;
+		mode = rand_r(&w->seed) % 100 < g.wpct ? RL_EXCL : RL_SHARED;
+		t0 = bench_nsec();
+		if ((n = rl_lock(&g.rl, off, g.range, mode, g.timeout)) ==
+			NULL) {
+			/* A timeout of 0 is a try-lock, which fails with EAGAIN */
+			if (errno != ETIMEDOUT && errno != EAGAIN)
+				errmsg_exit1("rl_lock failed, %s\n", ERR_MSG);
+			w->timeouts++;
+			continue;
+		}
+		/* The hold starts once the range is ours, however long that took */
+		t1 = bench_nsec();
+		lathist_add(&w->lh, t1 - t0);
+		while (bench_nsec() - t1 < g.hold)
+			;	/* Work inside the range */
+		rl_unlock(&g.rl, n);
+	}
+
+	return NULL;
+}
+
+/* Parses "1,2,4" into 'vals', sizes like "64k" if 'sizes' */
+static int
+parse_list(const char *list, uint64_t *vals, bool sizes)
+{
+	char buf[BUF_SIZE], *tok, *save;
+	int n = 0;
+
+	if (strlen(list) >= sizeof(buf))
+		return -1;
+	strcpy(buf, list);
+	for (tok = strtok_r(buf, ",", &save); tok != NULL && n < MAXRUNS;
+		tok = strtok_r(NULL, ",", &save))
+		vals[n++] = sizes ? (uint64_t)getsize(tok) :
+			(uint64_t)getlong(tok, GN_GT_0);
+
+	return n;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-t threads,...] [-s span,...] [-r range] "
+		"[-h holdns] [-w pct] [-n ops] [-T timeout] [-f file]\n",
+		pname);
+	fprintf(stderr, "-t: thread counts to run (default 1,2,4,8).\n");
+	fprintf(stderr, "-s: bytes the ranges fall in (default 1m,64k,4k).\n");
+	fprintf(stderr, "-r: bytes per range (default 4k).\n");
+	fprintf(stderr, "-h: ns each range is held (default 1000).\n");
+	fprintf(stderr, "-w: percent of exclusive locks (default 50).\n");
+	fprintf(stderr, "-n: locks per thread (default 100000).\n");
+	fprintf(stderr, "-T: give up on a lock after this many us.\n");
+	fprintf(stderr, "-f: also hold fcntl() locks on this file.\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,381 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/*
+ * Region allocation out of anonymous memory.
+ *
+ * An arena hands out memory by bumping a pointer through a run of chunks and
+ * never frees an allocation by itself: everything allocated from it goes at
+ * once with arena_reset() or arena_free(). That suits memory that lives as
+ * long as a request, a batch or a pass, and costs a compare and an add per
+ * allocation.
+ *
+ * Runs are whole multiples of ARENA_CHUNK carved from one PROT_NONE
+ * reservation made on first use, and mapped writable as they are handed out.
+ * A run given back goes on a process-wide free list for the next arena to
+ * take; arena_trim() returns the pages of the free runs to the system. With
+ * ARENA_HUGETLB the runs are backed by explicit huge pages when the system
+ * has some to give, and with ARENA_THP they are advised MADV_HUGEPAGE.
+ *
+ * Every thread has an arena of its own, arena_self(), given back when the
+ * thread exits. Since all arena memory lies in the one reservation,
+ * arena_owns() tells an arena pointer from a malloc(3) one; that is what
+ * lets unibsd.h back xmalloc() with arenas when UNIBSD_ARENA is defined.
+ *
+ * Include "unibsd.h" first.
+ */
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#define ARENA_CHUNK	(2 * 1024 * 1024)	/* Also a huge page on x86 */
+#define ARENA_ALIGN	16
+#define ARENA_RESERVE	(sizeof(void *) == 8 ? (size_t)64 << 30 : \
+	(size_t)512 << 20)
+
+#define ARENA_HUGETLB	0x01	/* Back the runs with huge pages */
+#define ARENA_THP	0x02	/* Advise the runs MADV_HUGEPAGE */
+
+/* Header of a run of chunks */
+struct arrun {
+	struct arrun	*ar_next;
+	size_t		ar_size;	/* Bytes, header included */
+};
+
+#define ARENA_HDR	((sizeof(struct arrun) + ARENA_ALIGN - 1) & \
+	~(size_t)(ARENA_ALIGN - 1))
+
+struct arena {
+	struct arrun	*a_runs;	/* Newest first */
+	char		*a_ptr;		/* Next free byte of a_runs */
+	char		*a_end;
+	size_t		a_used;		/* Bytes handed out */
+	size_t		a_size;		/* Bytes of runs held */
+};
+
+#define ARENA_INITIALIZER	{ NULL, NULL, NULL, 0, 0 }
+
+struct arenastat {
+	size_t		as_reserved;	/* Address space set aside */
+	size_t		as_mapped;	/* Ever made writable */
+	size_t		as_idle;	/* On the free list */
+	size_t		as_huge;	/* Backed by explicit huge pages */
+};
+
+static struct {
+	pthread_once_t	once;
+	pthread_mutex_t	mtx;
+	pthread_key_t	key;
+	int		flags;
+	char		*base;		/* The reservation */
+	char		*end;
+	char		*brk;		/* Carved up to here */
+	struct arrun	*idle;		/* Runs given back */
+	size_t		nidle;
+	size_t		huge;
+} arena_vm = {
+	.once = PTHREAD_ONCE_INIT,
+	.mtx = PTHREAD_MUTEX_INITIALIZER
+};
+
+static _Thread_local struct arena *arena_cur;
+
+static inline void arena_free(struct arena *);
+
+static void
+arena_exit(void *arg)
+{
+	arena_free(arg);
+	free(arg);
+}
+
+static void
+arena_vminit(void)
+{
+	size_t size;
+	char *p;
+	int r;
+
+	/* Ask for less if the address space is limited */
+	for (size = ARENA_RESERVE; size >= 64 * ARENA_CHUNK; size /= 2) {
+		p = mmap(NULL, size + ARENA_CHUNK, PROT_NONE,
+			MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (p != MAP_FAILED)
+			break;
+	}
+	if (p == MAP_FAILED)
+		errmsg_exit1("arena: mmap failed, %s\n", ERR_MSG);
+
+	/* Align the runs to the chunk size, so huge pages can back them */
+	arena_vm.base = (char *)(((uintptr_t)p + ARENA_CHUNK - 1) &
+		~(uintptr_t)(ARENA_CHUNK - 1));
+	arena_vm.end = arena_vm.base + size;
+	arena_vm.brk = arena_vm.base;
+
+	if ((r = pthread_key_create(&arena_vm.key, arena_exit)) != 0)
+		errmsg_exit1("arena: pthread_key_create failed, %s\n",
+			strerror(r));
+}
+
+/* Must come before the first allocation to have an effect */
+static inline void
+arena_setflags(int flags)
+{
+	arena_vm.flags = flags;
+}
+
+static inline bool
+arena_owns(const void *ptr)
+{
+	return (const char *)ptr >= arena_vm.base &&
+		(const char *)ptr < arena_vm.end;
+}
+
+/* A run of at least 'size' bytes: an idle one if it fits, else a new one */
+static struct arrun *
+arena_getrun(size_t size)
+{
+	struct arrun *run, **prev;
+	char *p;
+
+	size = (size + ARENA_CHUNK - 1) & ~(size_t)(ARENA_CHUNK - 1);
+
+	pthread_once(&arena_vm.once, arena_vminit);
+	pthread_mutex_lock(&arena_vm.mtx);
+	for (prev = &arena_vm.idle; (run = *prev) != NULL;
+		prev = &run->ar_next)
+		if (run->ar_size >= size) {
+			*prev = run->ar_next;
+			arena_vm.nidle -= run->ar_size;
+			pthread_mutex_unlock(&arena_vm.mtx);
+			return run;
+		}
+	if ((size_t)(arena_vm.end - arena_vm.brk) < size)
+		errmsg_exit1("arena: out of address space\n");
+	p = arena_vm.brk;
+	arena_vm.brk += size;
+	pthread_mutex_unlock(&arena_vm.mtx);
+
+#ifdef MAP_HUGETLB
+	if ((arena_vm.flags & ARENA_HUGETLB) &&
+		mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON |
+		MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED) {
+		pthread_mutex_lock(&arena_vm.mtx);
+		arena_vm.huge += size;
+		pthread_mutex_unlock(&arena_vm.mtx);
+		run = (struct arrun *)p;
+		run->ar_size = size;
+		return run;
+	}
+	if (arena_vm.flags & ARENA_HUGETLB) {
+		/* None to be had: stop asking, ordinary pages from now on */
+		pthread_mutex_lock(&arena_vm.mtx);
+		arena_vm.flags &= ~ARENA_HUGETLB;
+		pthread_mutex_unlock(&arena_vm.mtx);
+	}
+#endif
+	/*
+	 * Map over the reservation rather than mprotect() it: a failed
+	 * MAP_FIXED above may already have unmapped the range.
+	 */
+	if (mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON |
+		MAP_FIXED, -1, 0) == MAP_FAILED)
+		errmsg_exit1("arena: mmap failed, %s\n", ERR_MSG);
+#ifdef MADV_HUGEPAGE
+	if (arena_vm.flags & ARENA_THP)
+		(void)madvise(p, size, MADV_HUGEPAGE);
+#endif
+
+	run = (struct arrun *)p;
+	run->ar_size = size;
+	return run;
+}
+
+static void
+arena_putruns(struct arrun *first, struct arrun *last, size_t size)
+{
+	pthread_mutex_lock(&arena_vm.mtx);
+	last->ar_next = arena_vm.idle;
+	arena_vm.idle = first;
+	arena_vm.nidle += size;
+	pthread_mutex_unlock(&arena_vm.mtx);
+}
+
+static inline void
+arena_init(struct arena *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+static void *
+arena_grow(struct arena *a, size_t size)
+{
+	struct arrun *run;
+
+	run = arena_getrun(ARENA_HDR + size);
+	run->ar_next = a->a_runs;
+	a->a_runs = run;
+	a->a_size += run->ar_size;
+	a->a_ptr = (char *)run + ARENA_HDR + size;
+	a->a_end = (char *)run + run->ar_size;
+	a->a_used += size;
+
+	return (char *)run + ARENA_HDR;
+}
+
+static inline void *
+arena_alloc(struct arena *a, size_t size)
+{
+	char *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ((size_t)(a->a_end - a->a_ptr) < size)
+		return arena_grow(a, size);
+	p = a->a_ptr;
+	a->a_ptr += size;
+	a->a_used += size;
+
+	return p;
+}
+
+static inline void *
+arena_calloc(struct arena *a, size_t numb, size_t size)
+{
+	void *p;
+
+	if (size != 0 && numb > SIZE_MAX / size)
+		errmsg_exit1("arena: calloc overflow, %zu * %zu\n", numb,
+			size);
+	p = arena_alloc(a, numb * size);
+	memset(p, 0, numb * size);	/* Runs are reused dirty */
+
+	return p;
+}
+
+static inline char *
+arena_strdup(struct arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	return memcpy(arena_alloc(a, len), s, len);
+}
+
+/*
+ * Frees everything allocated from 'a' but keeps its newest run, so an arena
+ * reset once per request allocates from warm memory the next time.
+ */
+static inline void
+arena_reset(struct arena *a)
+{
+	struct arrun *keep, *last;
+
+	if ((keep = a->a_runs) == NULL)
+		return;
+	if (keep->ar_next != NULL) {
+		for (last = keep->ar_next; last->ar_next != NULL;
+			last = last->ar_next)
+			;
+		arena_putruns(keep->ar_next, last, a->a_size - keep->ar_size);
+		keep->ar_next = NULL;
+	}
+	a->a_size = keep->ar_size;
+	a->a_ptr = (char *)keep + ARENA_HDR;
+	a->a_end = (char *)keep + keep->ar_size;
+	a->a_used = 0;
+}
+
+/* Frees everything allocated from 'a', and its runs */
+static inline void
+arena_free(struct arena *a)
+{
+	struct arrun *last;
+
+	if (a->a_runs != NULL) {
+		for (last = a->a_runs; last->ar_next != NULL;
+			last = last->ar_next)
+			;
+		arena_putruns(a->a_runs, last, a->a_size);
+	}
+	arena_init(a);
+}
+
+/* The calling thread's arena */
+static inline struct arena *
+arena_self(void)
+{
+	struct arena *a;
+	int r;
+
+	if ((a = arena_cur) != NULL)
+		return a;
+
+	pthread_once(&arena_vm.once, arena_vminit);
+	if ((a = calloc(1, sizeof(*a))) == NULL)
+		errmsg_exit1("arena: calloc failed, %s\n", ERR_MSG);
+	if ((r = pthread_setspecific(arena_vm.key, a)) != 0)
+		errmsg_exit1("arena: pthread_setspecific failed, %s\n",
+			strerror(r));
+	arena_cur = a;
+
+	return a;
+}
+
+/* Gives the pages of the idle runs back to the system */
+static inline void
+arena_trim(void)
+{
+	struct arrun *run;
+	long pagesz = sysconf(_SC_PAGESIZE);
+
+	/* The first page holds the header, which keeps the list */
+	pthread_mutex_lock(&arena_vm.mtx);
+	for (run = arena_vm.idle; run != NULL; run = run->ar_next)
+		(void)madvise((char *)run + pagesz, run->ar_size - pagesz,
+			MADV_DONTNEED);
+	pthread_mutex_unlock(&arena_vm.mtx);
+}
+
+static inline void
+arena_getstat(struct arenastat *as)
+{
+	pthread_mutex_lock(&arena_vm.mtx);
+	as->as_reserved = arena_vm.end - arena_vm.base;
+	as->as_mapped = arena_vm.brk - arena_vm.base;
+	as->as_idle = arena_vm.nidle;
+	as->as_huge = arena_vm.huge;
+	pthread_mutex_unlock(&arena_vm.mtx);
+}
+
+#endif	/* !_ARENA_H_ */
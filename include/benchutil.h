@@ -0,0 +1,337 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _BENCHUTIL_H_
+#define _BENCHUTIL_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define KIB		(1024L)
+#define MIB		(1024L * KIB)
+#define GIB		(1024L * MIB)
+
+/*
+ * Read the monotonic clock in nanoseconds. CLOCK_MONOTONIC is not affected by
+ * settimeofday(2), so it is the right clock for measuring intervals.
+ */
+static inline uint64_t
+bench_nsec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		errmsg_exit1("clock_gettime failed, %s\n", ERR_MSG);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Convert an interval in nanoseconds to seconds. */
+static inline double
+bench_secs(uint64_t ns)
+{
+	return (double)ns / 1e9;
+}
+
+/* Throughput in GB/s (10^9 bytes per second) of 'bytes' moved in 'ns'. */
+static inline double
+bench_gbps(uint64_t bytes, uint64_t ns)
+{
+	return ns == 0 ? 0.0 : (double)bytes / (double)ns;
+}
+
+/* Throughput in MB/s (10^6 bytes per second) of 'bytes' moved in 'ns'. */
+static inline double
+bench_mbps(uint64_t bytes, uint64_t ns)
+{
+	return ns == 0 ? 0.0 : (double)bytes * 1e3 / (double)ns;
+}
+
+/*
+ * Parse a size such as "4096", "64k", "256m" or "2g". The suffixes are
+ * binary multiples (KiB, MiB, GiB).
+ */
+static inline long
+getsize(const char *arg)
+{
+	char *ep;
+	long val, mul = 1;
+
+	errno = 0;
+	val = strtol(arg, &ep, 0);
+	if (errno != 0 || ep == arg)
+		errmsg_exit1("Illegal size. %s\n", arg);
+
+	switch (*ep) {
+	case 'k':
+	case 'K':
+		mul = KIB;
+		ep++;
+		break;
+	case 'm':
+	case 'M':
+		mul = MIB;
+		ep++;
+		break;
+	case 'g':
+	case 'G':
+		mul = GIB;
+		ep++;
+		break;
+	}
+	if (*ep != '\0')
+		errmsg_exit1("nonnumeric characters. %s\n", arg);
+	if (val < 0 || val > LONG_MAX / mul)
+		errmsg_exit1("size out of range. %s\n", arg);
+
+	return val * mul;
+}
+
+/*
+ * Latency samples of a benchmark, in nanoseconds. Every sample is kept so the
+ * percentiles are exact; the samples are sorted the first time a percentile
+ * is asked for.
+ */
+struct latstat {
+	uint64_t	*ls_ns;		/* Samples */
+	size_t		ls_cnt;		/* Number of samples */
+	size_t		ls_cap;		/* Room in 'ls_ns' */
+	bool		ls_sorted;	/* 'ls_ns' is in ascending order */
+};
+
+static inline void
+latstat_init(struct latstat *ls)
+{
+	ls->ls_ns = NULL;
+	ls->ls_cnt = ls->ls_cap = 0;
+	ls->ls_sorted = true;
+}
+
+static inline void
+latstat_add(struct latstat *ls, uint64_t ns)
+{
+	if (ls->ls_cnt == ls->ls_cap) {
+		ls->ls_cap = ls->ls_cap == 0 ? 4096 : ls->ls_cap * 2;
+		ls->ls_ns = realloc(ls->ls_ns, ls->ls_cap * sizeof(uint64_t));
+		if (ls->ls_ns == NULL)
+			errmsg_exit1("Memory allocated failure, %s\n",
+				ERR_MSG);
+	}
+	ls->ls_ns[ls->ls_cnt++] = ns;
+	ls->ls_sorted = false;
+}
+
+/* Append the samples of 'src' to 'dst', e.g. to aggregate per-thread stats */
+static inline void
+latstat_merge(struct latstat *dst, const struct latstat *src)
+{
+	size_t i;
+
+	for (i = 0; i < src->ls_cnt; i++)
+		latstat_add(dst, src->ls_ns[i]);
+}
+
+static inline void
+latstat_free(struct latstat *ls)
+{
+	xfree(ls->ls_ns);
+	latstat_init(ls);
+}
+
+static inline int
+latstat_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The 'pct' percentile (0 - 100) of the samples, 0 if there are none. */
+static inline uint64_t
+latstat_pctl(struct latstat *ls, double pct)
+{
+	size_t i;
+
+	if (ls->ls_cnt == 0)
+		return 0;
+	if (!ls->ls_sorted) {
+		qsort(ls->ls_ns, ls->ls_cnt, sizeof(uint64_t), latstat_cmp);
+		ls->ls_sorted = true;
+	}
+
+	i = (size_t)(pct / 100.0 * (double)(ls->ls_cnt - 1) + 0.5);
+	return ls->ls_ns[MIN(i, ls->ls_cnt - 1)];
+}
+
+static inline double
+latstat_mean(const struct latstat *ls)
+{
+	size_t i;
+	double sum = 0.0;
+
+	for (i = 0; i < ls->ls_cnt; i++)
+		sum += (double)ls->ls_ns[i];
+
+	return ls->ls_cnt == 0 ? 0.0 : sum / (double)ls->ls_cnt;
+}
+
+/* Print a one line summary, in microseconds, prefixed by 'label'. */
+static inline void
+latstat_print(struct latstat *ls, const char *label)
+{
+	printf("%s lat(us): avg=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f "
+		"max=%.1f\n", label, latstat_mean(ls) / 1e3,
+		(double)latstat_pctl(ls, 50.0) / 1e3,
+		(double)latstat_pctl(ls, 90.0) / 1e3,
+		(double)latstat_pctl(ls, 99.0) / 1e3,
+		(double)latstat_pctl(ls, 99.9) / 1e3,
+		(double)latstat_pctl(ls, 100.0) / 1e3);
+}
+
+/*
+ * A latency histogram with a fixed footprint, for runs too long to keep
+ * every sample or for results shared between processes. Each power of two
+ * is split into LH_SUB linear buckets, so a percentile read from it is off
+ * by at most 1/LH_SUB (about 6%).
+ */
+#define LH_SUB		16
+#define LH_SUBBITS	4
+#define LH_NBUCKETS	(64 * LH_SUB)
+
+struct lathist {
+	uint64_t	lh_cnt[LH_NBUCKETS];	/* Samples per bucket */
+	uint64_t	lh_total;		/* Number of samples */
+	uint64_t	lh_sum;			/* Sum of the samples */
+	uint64_t	lh_max;			/* Largest sample */
+};
+
+static inline int
+lathist_index(uint64_t ns)
+{
+	int msb;
+
+	if (ns < LH_SUB)
+		return (int)ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - LH_SUBBITS + 1) * LH_SUB +
+		(int)((ns >> (msb - LH_SUBBITS)) & (LH_SUB - 1));
+}
+
+/* Largest value that falls in bucket 'idx' */
+static inline uint64_t
+lathist_upper(int idx)
+{
+	int msb, sub;
+
+	if (idx < LH_SUB)
+		return idx;
+	msb = idx / LH_SUB + LH_SUBBITS - 1;
+	sub = idx % LH_SUB;
+	return ((uint64_t)(LH_SUB + sub + 1) << (msb - LH_SUBBITS)) - 1;
+}
+
+static inline void
+lathist_add(struct lathist *lh, uint64_t ns)
+{
+	lh->lh_cnt[lathist_index(ns)]++;
+	lh->lh_total++;
+	lh->lh_sum += ns;
+	lh->lh_max = MAX(lh->lh_max, ns);
+}
+
+static inline void
+lathist_merge(struct lathist *dst, const struct lathist *src)
+{
+	int i;
+
+	for (i = 0; i < LH_NBUCKETS; i++)
+		dst->lh_cnt[i] += src->lh_cnt[i];
+	dst->lh_total += src->lh_total;
+	dst->lh_sum += src->lh_sum;
+	dst->lh_max = MAX(dst->lh_max, src->lh_max);
+}
+
+/* The 'pct' percentile (0 - 100), as the upper bound of its bucket */
+static inline uint64_t
+lathist_pctl(const struct lathist *lh, double pct)
+{
+	uint64_t want, seen = 0;
+	int i;
+
+	if (lh->lh_total == 0)
+		return 0;
+	want = (uint64_t)(pct / 100.0 * (double)lh->lh_total + 0.5);
+	want = MAX(want, 1);
+	for (i = 0; i < LH_NBUCKETS; i++)
+		if ((seen += lh->lh_cnt[i]) >= want)
+			return MIN(lathist_upper(i), lh->lh_max);
+
+	return lh->lh_max;
+}
+
+/*
+ * Print the distribution with one line per power of two of microseconds,
+ * followed by the usual percentiles.
+ */
+static inline void
+lathist_print(const struct lathist *lh, const char *label)
+{
+	uint64_t cnt, lo = 0, hi = 1000;
+	int i = 0;
+
+	if (lh->lh_total == 0)
+		return;
+
+	printf("%s lat(us): avg=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f "
+		"max=%.1f\n", label,
+		(double)lh->lh_sum / (double)lh->lh_total / 1e3,
+		(double)lathist_pctl(lh, 50.0) / 1e3,
+		(double)lathist_pctl(lh, 90.0) / 1e3,
+		(double)lathist_pctl(lh, 99.0) / 1e3,
+		(double)lathist_pctl(lh, 99.9) / 1e3,
+		(double)lh->lh_max / 1e3);
+
+	while (i < LH_NBUCKETS) {
+		for (cnt = 0; i < LH_NBUCKETS && lathist_upper(i) < hi; i++)
+			cnt += lh->lh_cnt[i];
+		if (cnt != 0)
+			printf("  %8ju - %8ju us: %12ju %6.2f%%\n",
+				(uintmax_t)(lo / 1000), (uintmax_t)(hi / 1000),
+				(uintmax_t)cnt, (double)cnt * 100.0 /
+				(double)lh->lh_total);
+		lo = hi;
+		if (hi > UINT64_MAX / 2)
+			break;
+		hi *= 2;
+	}
+}
+
+#endif	/* !_BENCHUTIL_H_ */
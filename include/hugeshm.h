@@ -0,0 +1,303 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _HUGESHM_H_
+#define _HUGESHM_H_
+
+/*
+ * Shared memory on huge pages. A table of gigabytes mapped with 4 KiB pages
+ * needs hundreds of thousands of TLB entries; with 2 MiB pages it needs a
+ * few hundred. There are three ways to get there, and any of them may be
+ * refused, so each falls back to ordinary pages and says so:
+ *
+ *  - Explicit huge pages, from the pool the administrator has set aside
+ *    (vm.nr_hugepages on Linux): shmget() with SHM_HUGETLB, or a memfd
+ *    created with MFD_HUGETLB, which is handed to unrelated processes over
+ *    a Unix domain socket with hs_sendfd() and hs_recvfd(). The pages are
+ *    reserved when the object is first mapped, so that is where a short
+ *    pool shows up.
+ *  - Transparent huge pages on a shmem object, asked for with
+ *    madvise(MADV_HUGEPAGE) before the pages are touched. On Linux a memfd
+ *    or a System V segment gets them when shmem_enabled allows "advise";
+ *    an object from shm_open() lives on the /dev/shm mount and gets them
+ *    only if that is mounted with huge=advise (or better).
+ *  - On FreeBSD, largepage objects from shm_create_largepage().
+ *
+ * hs_pages() reports what a mapping actually got. memfd_create() needs
+ * _GNU_SOURCE on Linux; without it hs_memfd() fails with ENOSYS.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdint.h>
+
+#define HS_HUGESZ	(2 * 1024 * 1024)	/* When the system won't say */
+
+/* Where the bytes of a mapping live */
+struct hspages {
+	size_t		hp_pagesz;	/* Page size of the mapping */
+	size_t		hp_rss;		/* Bytes resident */
+	size_t		hp_huge;	/* Bytes resident in huge pages */
+};
+
+/* The system's default huge page size */
+static inline size_t
+hs_hugesize(void)
+{
+	size_t sz = 0;
+#if defined(__linux__)
+	char line[128];
+	unsigned long kb;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/meminfo", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+				sz = kb * 1024;
+				break;
+			}
+		fclose(fp);
+	}
+#elif defined(__FreeBSD__)
+	size_t ps[2];
+
+	if (getpagesizes(ps, 2) == 2)
+		sz = ps[1];
+#endif
+	return sz == 0 ? HS_HUGESZ : sz;
+}
+
+static inline size_t
+hs_roundup(size_t len, size_t align)
+{
+	return (len + align - 1) / align * align;
+}
+
+/*
+ * Creates an anonymous memory file of 'size' bytes, to be shared by mapping
+ * it or passing it on. With '*huge' set it tries explicit huge pages first,
+ * and 'size' must then be a multiple of hs_hugesize(); '*huge' is left
+ * telling whether it got them.
+ */
+static inline int
+hs_memfd(const char *name, size_t size, bool *huge)
+{
+	int fd;
+#ifdef MFD_HUGETLB
+	void *p;
+
+	/* A trial mapping makes the kernel reserve the pages, or refuse */
+	if (*huge && (fd = memfd_create(name, MFD_CLOEXEC | MFD_HUGETLB)) !=
+		-1) {
+		if (ftruncate(fd, size) == 0 && (p = mmap(NULL, size,
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) !=
+			MAP_FAILED) {
+			(void)munmap(p, size);
+			return fd;
+		}
+		(void)close(fd);
+	}
+#endif
+	*huge = false;
+#ifdef MFD_CLOEXEC
+	if ((fd = memfd_create(name, MFD_CLOEXEC)) == -1)
+		return -1;
+#elif defined(SHM_ANON)
+	(void)name;
+	if ((fd = shm_open(SHM_ANON, O_RDWR, S_IRUSR | S_IWUSR)) == -1)
+		return -1;
+#else
+	(void)name;
+	errno = ENOSYS;
+	return -1;
+#endif
+	if (ftruncate(fd, size) == -1) {
+		(void)close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Sends the descriptor 'fd' over the Unix domain socket 'sock' */
+static inline int
+hs_sendfd(int sock, int fd)
+{
+	union {
+		struct cmsghdr	cm;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	char byte = 0;		/* Some systems won't pass ancillary data alone */
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+	return sendmsg(sock, &msg, 0) == 1 ? 0 : -1;
+}
+
+/* Receives a descriptor sent with hs_sendfd(); -1 with EBADMSG if none */
+static inline int
+hs_recvfd(int sock)
+{
+	union {
+		struct cmsghdr	cm;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	char byte;
+	int fd;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	if (recvmsg(sock, &msg, 0) != 1)
+		return -1;
+	cm = CMSG_FIRSTHDR(&msg);
+	if (cm == NULL || cm->cmsg_level != SOL_SOCKET ||
+		cm->cmsg_type != SCM_RIGHTS ||
+		cm->cmsg_len != CMSG_LEN(sizeof(int))) {
+		errno = EBADMSG;
+		return -1;
+	}
+	memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+	return fd;
+}
+
+/* Asks for transparent huge pages over a mapping not yet touched */
+static inline int
+hs_thp(void *addr, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+	return madvise(addr, len, MADV_HUGEPAGE);
+#else
+	(void)addr;
+	(void)len;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/* Fills in 'hp' for the mapping of 'len' bytes at 'addr' */
+static inline int
+hs_pages(void *addr, size_t len, struct hspages *hp)
+{
+#if defined(__linux__)
+	/* The mapping's entry in smaps, and the counters under it */
+	static const char *const huge[] = {
+		"AnonHugePages:", "ShmemPmdMapped:", "FilePmdMapped:",
+		"Shared_Hugetlb:", "Private_Hugetlb:"
+	};
+	char line[256];
+	unsigned long lo, hi, kb;
+	bool in = false;
+	FILE *fp;
+	size_t i;
+
+	(void)len;
+	memset(hp, 0, sizeof(*hp));
+	if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+			if (in)
+				break;
+			in = (uintptr_t)addr >= lo && (uintptr_t)addr < hi;
+			continue;
+		}
+		if (!in)
+			continue;
+		if (sscanf(line, "KernelPageSize: %lu kB", &kb) == 1)
+			hp->hp_pagesz = kb * 1024;
+		else if (sscanf(line, "Rss: %lu kB", &kb) == 1)
+			hp->hp_rss = kb * 1024;
+		else
+			for (i = 0; i < sizeof(huge) / sizeof(huge[0]); i++)
+				if (strncmp(line, huge[i], strlen(huge[i])) ==
+					0 && sscanf(line + strlen(huge[i]),
+					"%lu", &kb) == 1)
+					hp->hp_huge += kb * 1024;
+	}
+	fclose(fp);
+	if (!in) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (hp->hp_huge > hp->hp_rss)	/* Hugetlb isn't counted in Rss */
+		hp->hp_rss = hp->hp_huge;
+	return 0;
+#else
+	size_t pgsz = getpagesize(), n = (len + pgsz - 1) / pgsz, i;
+	char *vec;
+
+	memset(hp, 0, sizeof(*hp));
+	hp->hp_pagesz = pgsz;
+	if ((vec = malloc(n)) == NULL)
+		return -1;
+	if (mincore(addr, len, vec) == -1) {
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (vec[i] & MINCORE_INCORE)
+			hp->hp_rss += pgsz;
+#ifdef MINCORE_SUPER
+		if (vec[i] & MINCORE_SUPER)
+			hp->hp_huge += pgsz;
+#endif
+	}
+	free(vec);
+	return 0;
+#endif
+}
+
+#endif /* !_HUGESHM_H_ */
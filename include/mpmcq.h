@@ -0,0 +1,367 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _MPMCQ_H_
+#define _MPMCQ_H_
+
+/*
+ * A bounded multi-producer, multi-consumer queue of messages in a block of
+ * memory shared by any number of processes, after Dmitry Vyukov's bounded
+ * MPMC queue.
+ *
+ * Every slot carries a sequence number. A producer at enqueue position
+ * 'pos' may take the slot when its sequence is 'pos', claims it by moving
+ * mq_enq from 'pos' to 'pos + 1' with a compare-and-swap, copies the message
+ * in and sets the sequence to 'pos + 1'. A consumer at dequeue position
+ * 'pos' may take the slot when its sequence is 'pos + 1', claims it the same
+ * way on mq_deq, copies the message out and sets the sequence to
+ * 'pos + nslots', which is what the producer one lap later waits for. The
+ * only shared writes are one CAS and one store per message.
+ *
+ * Blocking calls spin for a while, yielding now and then in case the other
+ * side shares the CPU, then sleep on an event count with
+ * shm_timedwait(); the other side bumps the count and wakes a sleeper only
+ * when the waiter count says someone sleeps.
+ *
+ * A process that dies between claiming a slot and finishing with it would
+ * leave the slot claimed forever and stall the queue a lap later. The pid of
+ * the claimer is kept in the slot, and mpq_recover() releases slots whose
+ * claimer no longer exists: a half-written message is turned into a hole the
+ * consumers skip, and a half-read one is given back to the producers (its
+ * message is lost). Blocking calls run it whenever they have slept for
+ * MPQ_PROBENS. A claimer that dies before it has stored its pid, a window of
+ * a few instructions, cannot be told from a slow one and is not recovered.
+ *
+ * Each process calls mpq_attach() once it has mapped the queue.
+ */
+
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "shmwait.h"
+
+#define MPQ_MAGIC	0x4d504d43	/* "MPMC" */
+#define MPQ_LINE	64
+#define MPQ_SPIN	100		/* Tries before sleeping */
+#define MPQ_YIELD	16		/* Tries between yields */
+#define MPQ_PROBENS	100000000	/* Look for dead claimers after */
+
+#define MPQ_NONBLOCK	0x01
+
+#define MPQ_HOLE	UINT32_MAX	/* ms_len of a recovered slot */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define mpq_relax()	__builtin_ia32_pause()
+#else
+#define mpq_relax()	((void)0)
+#endif
+
+struct mpqslot {
+	_Atomic uint64_t ms_seq;
+	_Atomic int32_t	ms_owner;	/* Pid of the claimer, 0 if none */
+	uint32_t	ms_len;
+	char		ms_data[];
+};
+
+struct mpmcq {
+	uint32_t	mq_magic;
+	uint32_t	mq_nslots;	/* A power of 2 */
+	uint32_t	mq_msgsz;	/* Largest message */
+	uint32_t	mq_stride;	/* Bytes from slot to slot */
+
+	_Atomic uint64_t mq_enq __attribute__((aligned(MPQ_LINE)));
+	_Atomic uint64_t mq_deq __attribute__((aligned(MPQ_LINE)));
+
+	/* Event counts to sleep on, and the number of sleepers */
+	_Atomic uint32_t mq_cevent __attribute__((aligned(MPQ_LINE)));
+	_Atomic uint32_t mq_cwaiters;
+	_Atomic uint32_t mq_pevent __attribute__((aligned(MPQ_LINE)));
+	_Atomic uint32_t mq_pwaiters;
+
+	/* Statistics */
+	_Atomic uint64_t mq_sleeps __attribute__((aligned(MPQ_LINE)));
+	_Atomic uint64_t mq_recovered;
+
+	char		mq_slots[] __attribute__((aligned(MPQ_LINE)));
+};
+
+static pid_t mpq_pid;		/* Of this process, set by mpq_attach() */
+
+static inline size_t
+mpq_stride(uint32_t msgsz)
+{
+	return (sizeof(struct mpqslot) + msgsz + MPQ_LINE - 1) &
+		~(size_t)(MPQ_LINE - 1);
+}
+
+/* Bytes of shared memory a queue of this geometry takes */
+static inline size_t
+mpq_size(uint32_t nslots, uint32_t msgsz)
+{
+	return sizeof(struct mpmcq) + (size_t)nslots * mpq_stride(msgsz);
+}
+
+static inline struct mpqslot *
+mpq_slot(struct mpmcq *q, uint64_t pos)
+{
+	return (struct mpqslot *)(q->mq_slots +
+		(size_t)(pos & (q->mq_nslots - 1)) * q->mq_stride);
+}
+
+/* 'nslots' must be a power of 2 */
+static inline int
+mpq_init(struct mpmcq *q, uint32_t nslots, uint32_t msgsz)
+{
+	uint32_t i;
+
+	if (nslots < 2 || (nslots & (nslots - 1)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(q, 0, sizeof(*q));
+	q->mq_nslots = nslots;
+	q->mq_msgsz = msgsz;
+	q->mq_stride = mpq_stride(msgsz);
+	for (i = 0; i < nslots; i++) {
+		atomic_init(&mpq_slot(q, i)->ms_seq, i);
+		atomic_init(&mpq_slot(q, i)->ms_owner, 0);
+	}
+	atomic_thread_fence(memory_order_release);
+	q->mq_magic = MPQ_MAGIC;
+
+	return 0;
+}
+
+static inline int
+mpq_attach(struct mpmcq *q)
+{
+	if (q->mq_magic != MPQ_MAGIC) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	mpq_pid = getpid();
+
+	return 0;
+}
+
+static inline bool
+mpq_dead(pid_t pid)
+{
+	return pid != 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+/*
+ * Releases the slots at the heads of the queue whose claimers have died.
+ * Returns how many it released.
+ */
+static inline int
+mpq_recover(struct mpmcq *q)
+{
+	struct mpqslot *s;
+	uint64_t pos, seq;
+	int n = 0;
+
+	/* A producer died filling the oldest slot: make it a hole */
+	pos = atomic_load(&q->mq_deq);
+	s = mpq_slot(q, pos);
+	seq = atomic_load(&s->ms_seq);
+	if (seq == pos && atomic_load(&q->mq_enq) > pos &&
+		mpq_dead(atomic_load(&s->ms_owner))) {
+		s->ms_len = MPQ_HOLE;
+		if (atomic_compare_exchange_strong(&s->ms_seq, &seq, pos + 1)) {
+			atomic_store(&s->ms_owner, 0);
+			n++;
+		}
+	}
+
+	/* A consumer died emptying the slot producers need next */
+	pos = atomic_load(&q->mq_enq);
+	s = mpq_slot(q, pos);
+	seq = atomic_load(&s->ms_seq);
+	if (seq == pos - q->mq_nslots + 1 && mpq_dead(atomic_load(
+		&s->ms_owner)) && atomic_compare_exchange_strong(&s->ms_seq,
+		&seq, pos)) {
+		atomic_store(&s->ms_owner, 0);
+		n++;
+	}
+
+	if (n > 0) {
+		atomic_fetch_add(&q->mq_recovered, n);
+		atomic_fetch_add(&q->mq_cevent, 1);
+		shm_wake(&q->mq_cevent, SHM_WAKEALL);
+		atomic_fetch_add(&q->mq_pevent, 1);
+		shm_wake(&q->mq_pevent, SHM_WAKEALL);
+	}
+	return n;
+}
+
+/*
+ * Claims the slot for the next message. Returns NULL if the queue is full,
+ * or, when 'deq' is true, the slot of the oldest message or NULL if it is
+ * empty.
+ */
+static inline struct mpqslot *
+mpq_claim(struct mpmcq *q, bool deq)
+{
+	_Atomic uint64_t *cursor = deq ? &q->mq_deq : &q->mq_enq;
+	struct mpqslot *s;
+	uint64_t pos, seq;
+	int64_t dif;
+
+	pos = atomic_load_explicit(cursor, memory_order_relaxed);
+	for (;;) {
+		s = mpq_slot(q, pos);
+		seq = atomic_load_explicit(&s->ms_seq, memory_order_acquire);
+		dif = (int64_t)(seq - (deq ? pos + 1 : pos));
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_explicit(cursor, &pos,
+				pos + 1, memory_order_relaxed,
+				memory_order_relaxed)) {
+				atomic_store_explicit(&s->ms_owner, mpq_pid,
+					memory_order_relaxed);
+				return s;
+			}
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(cursor,
+				memory_order_relaxed);
+		}
+	}
+}
+
+/* Hands a claimed slot on and wakes a sleeper of the other side */
+static inline void
+mpq_release(struct mpmcq *q, struct mpqslot *s, uint64_t seq, bool deq)
+{
+	_Atomic uint32_t *waiters = deq ? &q->mq_pwaiters : &q->mq_cwaiters;
+	_Atomic uint32_t *event = deq ? &q->mq_pevent : &q->mq_cevent;
+
+	atomic_store_explicit(&s->ms_owner, 0, memory_order_relaxed);
+	atomic_store_explicit(&s->ms_seq, seq, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+		atomic_fetch_add(event, 1);
+		shm_wake(event, 1);
+	}
+}
+
+/* Claims a slot, sleeping while there is none unless MPQ_NONBLOCK */
+static inline struct mpqslot *
+mpq_claimwait(struct mpmcq *q, bool deq, int flags)
+{
+	_Atomic uint32_t *waiters = deq ? &q->mq_cwaiters : &q->mq_pwaiters;
+	_Atomic uint32_t *event = deq ? &q->mq_cevent : &q->mq_pevent;
+	struct mpqslot *s;
+	uint32_t ev;
+	int i;
+
+	for (i = 0; i < MPQ_SPIN; i++) {
+		if ((s = mpq_claim(q, deq)) != NULL)
+			return s;
+		if (flags & MPQ_NONBLOCK) {
+			errno = EAGAIN;
+			return NULL;
+		}
+		if (i % MPQ_YIELD == MPQ_YIELD - 1)
+			sched_yield();	/* The other side may share our CPU */
+		else
+			mpq_relax();
+	}
+
+	atomic_fetch_add(waiters, 1);
+	for (;;) {
+		ev = atomic_load(event);
+		if ((s = mpq_claim(q, deq)) != NULL)
+			break;
+		atomic_fetch_add_explicit(&q->mq_sleeps, 1,
+			memory_order_relaxed);
+		shm_timedwait(event, ev, MPQ_PROBENS);
+		if (atomic_load(event) == ev)	/* Timed out: anyone dead? */
+			(void)mpq_recover(q);
+	}
+	atomic_fetch_sub(waiters, 1);
+
+	return s;
+}
+
+/*
+ * Queues the 'len' bytes at 'msg'. Returns -1 with EAGAIN if MPQ_NONBLOCK
+ * is set and the queue is full, or with EMSGSIZE if the message is too big.
+ */
+static inline int
+mpq_put(struct mpmcq *q, const void *msg, size_t len, int flags)
+{
+	struct mpqslot *s;
+	uint64_t pos;
+
+	if (len > q->mq_msgsz) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if ((s = mpq_claimwait(q, false, flags)) == NULL)
+		return -1;
+	pos = atomic_load_explicit(&s->ms_seq, memory_order_relaxed);
+	s->ms_len = len;
+	memcpy(s->ms_data, msg, len);
+	mpq_release(q, s, pos + 1, false);
+
+	return 0;
+}
+
+/*
+ * Takes the oldest message into 'buf', of 'bufsz' bytes, and returns its
+ * length. Returns -1 with EAGAIN if MPQ_NONBLOCK is set and the queue is
+ * empty. A message longer than 'bufsz' is cut short.
+ */
+static inline ssize_t
+mpq_get(struct mpmcq *q, void *buf, size_t bufsz, int flags)
+{
+	struct mpqslot *s;
+	uint64_t seq;
+	uint32_t len;
+
+	for (;;) {
+		if ((s = mpq_claimwait(q, true, flags)) == NULL)
+			return -1;
+		seq = atomic_load_explicit(&s->ms_seq, memory_order_relaxed);
+		len = s->ms_len;
+		if (len != MPQ_HOLE)
+			memcpy(buf, s->ms_data, MIN(len, bufsz));
+		mpq_release(q, s, seq - 1 + q->mq_nslots, true);
+		if (len != MPQ_HOLE)
+			return MIN(len, bufsz);
+	}
+}
+
+#endif	/* !_MPMCQ_H_ */
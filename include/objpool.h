@@ -0,0 +1,398 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _OBJPOOL_H_
+#define _OBJPOOL_H_
+
+/*
+ * A pool of objects of one size, for code that allocates and frees the same
+ * struct over and over from several threads.
+ *
+ * Every thread keeps two magazines of free objects, OP_MAGSZ each, and
+ * allocates from and frees to them without taking a lock. Only when both
+ * are empty (or both full) does it go to the pool's depot, under its mutex,
+ * and trade a whole magazine for a full (or an empty) one; if the depot has
+ * no full magazine, a magazine's worth of objects is carved from a slab.
+ * Objects are never given back to the system until op_destroy(), so the
+ * pool stays at its high-water mark. An object may be freed by another
+ * thread than the one that allocated it.
+ *
+ * op_getstats() reports the allocations, the frees and the objects carved,
+ * from which the allocation rate and the occupancy follow.
+ *
+ * Include "unibsd.h" first.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define OP_MAGSZ	32		/* Objects per magazine */
+#define OP_SLABSZ	(64 * 1024)	/* Bytes carved from malloc at once */
+#define OP_CACHELINE	64
+
+#define OP_CACHEALIGN	0x01	/* Give each object cache lines of its own */
+
+struct opmag {
+	struct opmag	*om_next;
+	int		om_rounds;	/* Objects held */
+	void		*om_objs[OP_MAGSZ];
+};
+
+/* A thread's magazines, on cache lines of their own */
+struct opcache {
+	struct objpool	*oc_pool;
+	struct opmag	*oc_loaded;
+	struct opmag	*oc_prev;
+	_Atomic uint64_t oc_allocs;	/* Written by the owner only */
+	_Atomic uint64_t oc_frees;
+	struct opcache	*oc_next;	/* Of the pool's caches */
+	struct opcache	*oc_prevc;
+} __attribute__((aligned(OP_CACHELINE)));
+
+struct opslab {
+	struct opslab	*os_next;
+};
+
+struct objpool {
+	size_t		op_size;	/* Of an object, rounded up */
+	uint64_t	op_gen;		/* Tells a pool from an earlier one */
+	pthread_key_t	op_key;
+	pthread_mutex_t	op_mtx;		/* Everything below */
+	struct opmag	*op_full;	/* Magazines holding objects */
+	struct opmag	*op_empty;
+	struct opslab	*op_slabs;
+	char		*op_next;	/* Carve from here */
+	char		*op_end;
+	struct opcache	*op_caches;
+	uint64_t	op_carved;	/* Objects carved from slabs */
+	uint64_t	op_nslabs;
+	uint64_t	op_depotgets;	/* Full magazines taken */
+	uint64_t	op_depotputs;	/* Full magazines given */
+	uint64_t	op_gone_allocs;	/* Of caches of exited threads */
+	uint64_t	op_gone_frees;
+};
+
+struct opstats {
+	uint64_t	os_allocs;
+	uint64_t	os_frees;
+	uint64_t	os_live;	/* Allocated and not freed */
+	uint64_t	os_carved;	/* Objects the pool holds in all */
+	uint64_t	os_bytes;	/* Bytes of slabs */
+	uint64_t	os_depotgets;
+	uint64_t	os_depotputs;
+};
+
+static _Atomic uint64_t op_gens;
+
+/* The cache of the pool this thread used last, skipping the TSD lookup */
+static _Thread_local struct {
+	uint64_t	gen;
+	struct opcache	*cache;
+} op_last;
+
+static inline void *
+op_xcalloc(size_t size)
+{
+	void *p;
+
+	/* Not xcalloc(): with UNIBSD_ARENA that memory would not outlive us */
+	if ((p = calloc(1, size)) == NULL)
+		errmsg_exit1("objpool: calloc failed, %s\n", ERR_MSG);
+	return p;
+}
+
+static inline void
+op_putmag(struct opmag **list, struct opmag *m)
+{
+	m->om_next = *list;
+	*list = m;
+}
+
+/* Hands a departing cache's objects to the depot; op_mtx held */
+static inline void
+op_retire(struct objpool *op, struct opcache *c)
+{
+	struct opmag *m[2] = { c->oc_loaded, c->oc_prev };
+	int i;
+
+	for (i = 0; i < 2; i++)
+		op_putmag(m[i]->om_rounds > 0 ? &op->op_full : &op->op_empty,
+			m[i]);
+	op->op_gone_allocs += atomic_load_explicit(&c->oc_allocs,
+		memory_order_relaxed);
+	op->op_gone_frees += atomic_load_explicit(&c->oc_frees,
+		memory_order_relaxed);
+	if (c->oc_prevc != NULL)
+		c->oc_prevc->oc_next = c->oc_next;
+	else
+		op->op_caches = c->oc_next;
+	if (c->oc_next != NULL)
+		c->oc_next->oc_prevc = c->oc_prevc;
+}
+
+static void
+op_exit(void *arg)
+{
+	struct opcache *c = arg;
+	struct objpool *op = c->oc_pool;
+
+	pthread_mutex_lock(&op->op_mtx);
+	op_retire(op, c);
+	pthread_mutex_unlock(&op->op_mtx);
+	free(c);
+}
+
+/*
+ * Objects of 'size' bytes, aligned to 16 bytes, or to OP_CACHELINE with
+ * OP_CACHEALIGN so that two objects never share a cache line.
+ */
+static inline void
+op_init(struct objpool *op, size_t size, int flags)
+{
+	size_t align = (flags & OP_CACHEALIGN) ? OP_CACHELINE : 16;
+	int r;
+
+	memset(op, 0, sizeof(*op));
+	op->op_gen = atomic_fetch_add(&op_gens, 1) + 1;
+	op->op_size = (MAX(size, 1) + align - 1) & ~(align - 1);
+	if (op->op_size > OP_SLABSZ - OP_CACHELINE)
+		errmsg_exit1("objpool: objects of %zu bytes are too big\n",
+			size);
+	if ((r = pthread_mutex_init(&op->op_mtx, NULL)) != 0)
+		errmsg_exit1("objpool: pthread_mutex_init failed, %s\n",
+			strerror(r));
+	if ((r = pthread_key_create(&op->op_key, op_exit)) != 0)
+		errmsg_exit1("objpool: pthread_key_create failed, %s\n",
+			strerror(r));
+}
+
+static struct opcache *
+op_newcache(struct objpool *op)
+{
+	struct opcache *c;
+	int r;
+
+	if ((r = posix_memalign((void **)&c, OP_CACHELINE, sizeof(*c))) != 0)
+		errmsg_exit1("objpool: posix_memalign failed, %s\n",
+			strerror(r));
+	memset(c, 0, sizeof(*c));
+	c->oc_pool = op;
+	c->oc_loaded = op_xcalloc(sizeof(struct opmag));
+	c->oc_prev = op_xcalloc(sizeof(struct opmag));
+
+	pthread_mutex_lock(&op->op_mtx);
+	c->oc_next = op->op_caches;
+	if (op->op_caches != NULL)
+		op->op_caches->oc_prevc = c;
+	op->op_caches = c;
+	pthread_mutex_unlock(&op->op_mtx);
+
+	if ((r = pthread_setspecific(op->op_key, c)) != 0)
+		errmsg_exit1("objpool: pthread_setspecific failed, %s\n",
+			strerror(r));
+	return c;
+}
+
+static inline struct opcache *
+op_cache(struct objpool *op)
+{
+	struct opcache *c;
+
+	if (op_last.gen == op->op_gen)
+		return op_last.cache;
+	if ((c = pthread_getspecific(op->op_key)) == NULL)
+		c = op_newcache(op);
+	op_last.gen = op->op_gen;
+	op_last.cache = c;
+	return c;
+}
+
+/* Both magazines are empty: trade one for a full one, or fill it */
+static void
+op_refill(struct objpool *op, struct opcache *c)
+{
+	struct opmag *m = c->oc_loaded;
+	struct opslab *s;
+	int r;
+
+	pthread_mutex_lock(&op->op_mtx);
+	if (op->op_full != NULL) {
+		c->oc_loaded = op->op_full;
+		op->op_full = c->oc_loaded->om_next;
+		op_putmag(&op->op_empty, m);
+		op->op_depotgets++;
+		pthread_mutex_unlock(&op->op_mtx);
+		return;
+	}
+
+	while (m->om_rounds < OP_MAGSZ) {
+		if ((size_t)(op->op_end - op->op_next) < op->op_size) {
+			/* The slab header gets a cache line to itself */
+			if ((r = posix_memalign((void **)&s, OP_CACHELINE,
+				OP_SLABSZ)) != 0)
+				errmsg_exit1("objpool: posix_memalign failed, "
+					"%s\n", strerror(r));
+			s->os_next = op->op_slabs;
+			op->op_slabs = s;
+			op->op_nslabs++;
+			op->op_next = (char *)s + OP_CACHELINE;
+			op->op_end = (char *)s + OP_SLABSZ;
+		}
+		m->om_objs[m->om_rounds++] = op->op_next;
+		op->op_next += op->op_size;
+		op->op_carved++;
+	}
+	pthread_mutex_unlock(&op->op_mtx);
+}
+
+/* Both magazines are full: trade one for an empty one */
+static void
+op_spill(struct objpool *op, struct opcache *c)
+{
+	struct opmag *m;
+
+	pthread_mutex_lock(&op->op_mtx);
+	op_putmag(&op->op_full, c->oc_prev);
+	op->op_depotputs++;
+	c->oc_prev = c->oc_loaded;
+	if ((m = op->op_empty) != NULL) {
+		op->op_empty = m->om_next;
+		c->oc_loaded = m;
+	} else {
+		c->oc_loaded = NULL;
+	}
+	pthread_mutex_unlock(&op->op_mtx);
+	if (c->oc_loaded == NULL)
+		c->oc_loaded = op_xcalloc(sizeof(struct opmag));
+}
+
+static inline void *
+op_alloc(struct objpool *op)
+{
+	struct opcache *c = op_cache(op);
+	struct opmag *m;
+
+	if (c->oc_loaded->om_rounds == 0) {
+		if (c->oc_prev->om_rounds > 0) {
+			m = c->oc_loaded;
+			c->oc_loaded = c->oc_prev;
+			c->oc_prev = m;
+		} else {
+			op_refill(op, c);
+		}
+	}
+	m = c->oc_loaded;
+	atomic_store_explicit(&c->oc_allocs, atomic_load_explicit(
+		&c->oc_allocs, memory_order_relaxed) + 1, memory_order_relaxed);
+
+	return m->om_objs[--m->om_rounds];
+}
+
+static inline void
+op_free(struct objpool *op, void *obj)
+{
+	struct opcache *c;
+	struct opmag *m;
+
+	if (obj == NULL)
+		return;
+	c = op_cache(op);
+	if (c->oc_loaded->om_rounds == OP_MAGSZ) {
+		if (c->oc_prev->om_rounds == 0) {
+			m = c->oc_loaded;
+			c->oc_loaded = c->oc_prev;
+			c->oc_prev = m;
+		} else {
+			op_spill(op, c);
+		}
+	}
+	m = c->oc_loaded;
+	m->om_objs[m->om_rounds++] = obj;
+	atomic_store_explicit(&c->oc_frees, atomic_load_explicit(
+		&c->oc_frees, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static inline void
+op_getstats(struct objpool *op, struct opstats *st)
+{
+	struct opcache *c;
+
+	pthread_mutex_lock(&op->op_mtx);
+	st->os_allocs = op->op_gone_allocs;
+	st->os_frees = op->op_gone_frees;
+	for (c = op->op_caches; c != NULL; c = c->oc_next) {
+		st->os_allocs += atomic_load_explicit(&c->oc_allocs,
+			memory_order_relaxed);
+		st->os_frees += atomic_load_explicit(&c->oc_frees,
+			memory_order_relaxed);
+	}
+	st->os_carved = op->op_carved;
+	st->os_bytes = op->op_nslabs * OP_SLABSZ;
+	st->os_depotgets = op->op_depotgets;
+	st->os_depotputs = op->op_depotputs;
+	pthread_mutex_unlock(&op->op_mtx);
+	st->os_live = st->os_allocs >= st->os_frees ?
+		st->os_allocs - st->os_frees : 0;
+}
+
+/*
+ * Frees the pool and every object in it. No thread may use the pool any
+ * more, and the caches of threads still running go with it.
+ */
+static inline void
+op_destroy(struct objpool *op)
+{
+	struct opcache *c;
+	struct opmag *m;
+	struct opslab *s;
+
+	pthread_key_delete(op->op_key);
+	while ((c = op->op_caches) != NULL) {
+		op_retire(op, c);
+		free(c);
+	}
+	while ((m = op->op_full) != NULL) {
+		op->op_full = m->om_next;
+		free(m);
+	}
+	while ((m = op->op_empty) != NULL) {
+		op->op_empty = m->om_next;
+		free(m);
+	}
+	while ((s = op->op_slabs) != NULL) {
+		op->op_slabs = s->os_next;
+		free(s);
+	}
+	pthread_mutex_destroy(&op->op_mtx);
+}
+
+#endif	/* !_OBJPOOL_H_ */
@@ -0,0 +1,216 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _SEQBCAST_H_
+#define _SEQBCAST_H_
+
+/*
+ * A blob of state that one writer broadcasts to any number of reader
+ * processes through shared memory, under a sequence lock.
+ *
+ * The region holds sb_nbufs buffers, each with a sequence count that is odd
+ * while the buffer is being written. The writer fills the buffer after the
+ * current one, making its count odd before and even again after, and then
+ * bumps sb_gen, the count of blobs published so far; the current blob is in
+ * buffer 'sb_gen % sb_nbufs'. A reader picks the buffer sb_gen names, notes
+ * its count, copies the blob out and checks the count again: if the count
+ * was odd or has moved, the writer came round to that buffer meanwhile and
+ * the reader tries again.
+ *
+ * With one buffer this is a plain seqlock, and a reader copying a large
+ * blob is disturbed by every update. With two or more, the writer fills a
+ * buffer no reader has been sent to since the last update, so a reader is
+ * disturbed only if sb_nbufs updates land during one copy.
+ *
+ * Readers only load from the region, so it may be mapped read-only, and
+ * they never block, take a lock or make a system call. There must be a
+ * single writer at a time.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SB_MAGIC	0x53424341	/* "SBCA" */
+#define SB_LINE		64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define sb_relax()	__builtin_ia32_pause()
+#else
+#define sb_relax()	((void)0)
+#endif
+
+struct sbcast {
+	uint32_t	sb_magic;
+	uint32_t	sb_nbufs;
+	uint32_t	sb_bufsz;	/* Largest blob */
+	uint32_t	sb_stride;	/* Bytes from buffer to buffer */
+
+	_Atomic uint64_t sb_gen __attribute__((aligned(SB_LINE)));
+
+	char		sb_bufs[] __attribute__((aligned(SB_LINE)));
+};
+
+struct sbbuf {
+	_Atomic uint64_t bb_seq;	/* Odd while being written */
+	uint32_t	bb_len;
+	uint32_t	bb_pad;
+	char		bb_data[];
+};
+
+/* A reader's private state */
+struct sbreader {
+	const struct sbcast *sr_sb;
+	uint64_t	sr_gen;		/* Of the last blob read */
+	uint64_t	sr_reads;
+	uint64_t	sr_retries;	/* Copies spoilt by the writer */
+};
+
+static inline size_t
+sb_stride(uint32_t bufsz)
+{
+	return (sizeof(struct sbbuf) + bufsz + SB_LINE - 1) &
+		~(size_t)(SB_LINE - 1);
+}
+
+/* Bytes of shared memory a region of this geometry takes */
+static inline size_t
+sb_size(uint32_t nbufs, uint32_t bufsz)
+{
+	return sizeof(struct sbcast) + (size_t)nbufs * sb_stride(bufsz);
+}
+
+static inline void
+sb_init(struct sbcast *sb, uint32_t nbufs, uint32_t bufsz)
+{
+	memset(sb, 0, sb_size(nbufs, bufsz));
+	sb->sb_nbufs = nbufs;
+	sb->sb_bufsz = bufsz;
+	sb->sb_stride = sb_stride(bufsz);
+	atomic_thread_fence(memory_order_release);
+	sb->sb_magic = SB_MAGIC;
+}
+
+static inline const struct sbbuf *
+sb_buf(const struct sbcast *sb, uint64_t gen)
+{
+	return (const struct sbbuf *)(sb->sb_bufs +
+		(size_t)(gen % sb->sb_nbufs) * sb->sb_stride);
+}
+
+/* Replaces the blob with the 'len' bytes at 'data'; single writer only */
+static inline int
+sb_publish(struct sbcast *sb, const void *data, size_t len)
+{
+	struct sbbuf *b;
+	uint64_t gen, seq;
+
+	if (len > sb->sb_bufsz) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	gen = atomic_load_explicit(&sb->sb_gen, memory_order_relaxed) + 1;
+	b = (struct sbbuf *)sb_buf(sb, gen);
+
+	seq = atomic_load_explicit(&b->bb_seq, memory_order_relaxed);
+	atomic_store_explicit(&b->bb_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);	/* Odd before data */
+	b->bb_len = len;
+	memcpy(b->bb_data, data, len);
+	atomic_store_explicit(&b->bb_seq, seq + 2, memory_order_release);
+
+	atomic_store_explicit(&sb->sb_gen, gen, memory_order_release);
+	return 0;
+}
+
+/* Sets up 'sr' to read 'sb' */
+static inline int
+sb_open(struct sbreader *sr, const struct sbcast *sb)
+{
+	if (sb->sb_magic != SB_MAGIC) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	memset(sr, 0, sizeof(*sr));
+	sr->sr_sb = sb;
+	return 0;
+}
+
+/* Whether a blob newer than the last one read has been published */
+static inline bool
+sb_changed(const struct sbreader *sr)
+{
+	return atomic_load_explicit(&sr->sr_sb->sb_gen,
+		memory_order_relaxed) != sr->sr_gen;
+}
+
+/*
+ * Copies the current blob into the 'len' bytes at 'buf' and returns its
+ * length: 0 if nothing has been published, or -1 with EMSGSIZE if the blob
+ * does not fit.
+ */
+static inline ssize_t
+sb_read(struct sbreader *sr, void *buf, size_t len)
+{
+	const struct sbcast *sb = sr->sr_sb;
+	const struct sbbuf *b;
+	uint64_t gen, seq;
+	uint32_t n;
+
+	for (;; sr->sr_retries++, sb_relax()) {
+		gen = atomic_load_explicit(&sb->sb_gen, memory_order_acquire);
+		if (gen == 0)
+			return 0;
+		b = sb_buf(sb, gen);
+		seq = atomic_load_explicit(&b->bb_seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		n = b->bb_len;
+		if (n > sb->sb_bufsz)	/* Torn: the count will have moved */
+			n = 0;
+		else if (n <= len)
+			memcpy(buf, b->bb_data, n);
+		atomic_thread_fence(memory_order_acquire);  /* Data before seq */
+		if (atomic_load_explicit(&b->bb_seq,
+			memory_order_relaxed) != seq)
+			continue;
+		break;
+	}
+	sr->sr_gen = gen;
+	sr->sr_reads++;
+	if (n > len) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return n;
+}
+
+#endif /* !_SEQBCAST_H_ */
@@ -0,0 +1,113 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _SHMWAIT_H_
+#define _SHMWAIT_H_
+
+/*
+ * Sleeping on a 32-bit word of shared memory until another process changes
+ * it: futex(2) on Linux, _umtx_op(2) on FreeBSD. Neither uses the private
+ * variant, since the word is shared between processes. Elsewhere a waiter
+ * polls with a short sleep.
+ *
+ * shm_wait() returns once the word no longer holds 'val', or on a wakeup,
+ * a signal or a spurious return, so the caller re-checks its condition in a
+ * loop. shm_timedwait() also returns after 'ns' nanoseconds. shm_wake()
+ * wakes up to 'n' waiters.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#elif defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/umtx.h>
+#endif
+
+#define SHM_WAKEALL	INT32_MAX
+
+static inline void
+shm_wait(_Atomic uint32_t *addr, uint32_t val)
+{
+#ifdef __linux__
+	(void)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, NULL,
+		NULL, 0);
+#elif defined(__FreeBSD__)
+	(void)_umtx_op((void *)addr, UMTX_OP_WAIT_UINT, val, NULL, NULL);
+#else
+	struct timespec ts = { 0, 50000 };
+
+	if (atomic_load(addr) == val)
+		nanosleep(&ts, NULL);
+#endif
+}
+
+static inline void
+shm_timedwait(_Atomic uint32_t *addr, uint32_t val, uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+#ifdef __linux__
+	(void)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, &ts,
+		NULL, 0);
+#elif defined(__FreeBSD__)
+	/* A struct timespec in uaddr2 is a relative timeout */
+	(void)_umtx_op((void *)addr, UMTX_OP_WAIT_UINT, val, NULL, &ts);
+#else
+	if (ns > 50000) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 50000;
+	}
+	if (atomic_load(addr) == val)
+		nanosleep(&ts, NULL);
+#endif
+}
+
+static inline void
+shm_wake(_Atomic uint32_t *addr, int n)
+{
+#ifdef __linux__
+	(void)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, n, NULL,
+		NULL, 0);
+#elif defined(__FreeBSD__)
+	(void)_umtx_op((void *)addr, UMTX_OP_WAKE, n, NULL, NULL);
+#else
+	(void)addr;
+	(void)n;
+#endif
+}
+
+#endif	/* !_SHMWAIT_H_ */
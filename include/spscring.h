@@ -0,0 +1,257 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _SPSCRING_H_
+#define _SPSCRING_H_
+
+/*
+ * A single-producer, single-consumer ring of fixed-size slots, laid out in
+ * a block of memory shared by two processes (or threads).
+ *
+ * The producer fills the slot at sp_head and publishes it by advancing
+ * sp_head; the consumer drains the slot at sp_tail and hands it back by
+ * advancing sp_tail. Both indices run freely and are taken modulo the slot
+ * count. Each side keeps its own index and a cached copy of the other one
+ * in private memory, and sp_head and sp_tail live on cache lines of their
+ * own, so while the ring is neither empty nor full the two sides touch each
+ * other's line only when the cached copy runs out.
+ *
+ * A side that finds the ring empty (or full) spins briefly, then raises its
+ * wait flag and sleeps on the other side's index with shm_wait(). The other
+ * side checks the flag after every advance and calls shm_wake() only when it
+ * is raised, so no system call is made while data flows.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "shmwait.h"
+
+#define SPSC_MAGIC	0x53505343	/* "SPSC" */
+#define SPSC_LINE	64
+#define SPSC_SPIN	200	/* Polls before going to sleep */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define spsc_relax()	__builtin_ia32_pause()
+#else
+#define spsc_relax()	((void)0)
+#endif
+
+struct spsc {
+	uint32_t	sp_magic;
+	uint32_t	sp_nslots;	/* A power of 2 */
+	uint32_t	sp_slotsz;	/* Bytes of data a slot holds */
+	uint32_t	sp_stride;	/* Bytes from slot to slot */
+
+	_Atomic uint32_t sp_head __attribute__((aligned(SPSC_LINE)));
+	_Atomic uint32_t sp_tail __attribute__((aligned(SPSC_LINE)));
+	_Atomic uint32_t sp_pwait __attribute__((aligned(SPSC_LINE)));
+	_Atomic uint32_t sp_cwait __attribute__((aligned(SPSC_LINE)));
+
+	char		sp_slots[] __attribute__((aligned(SPSC_LINE)));
+};
+
+/* A slot: the length of its data, then the data */
+struct spslot {
+	uint32_t	ss_len;
+	uint32_t	ss_pad[3];
+	char		ss_data[];
+};
+
+/* One side's private view of the ring */
+struct spscend {
+	struct spsc	*se_ring;
+	uint32_t	se_pos;		/* Our index */
+	uint32_t	se_other;	/* Last seen index of the other side */
+	uint64_t	se_sleeps;	/* Times we slept */
+};
+
+static inline size_t
+spsc_stride(uint32_t slotsz)
+{
+	return (sizeof(struct spslot) + slotsz + SPSC_LINE - 1) &
+		~(size_t)(SPSC_LINE - 1);
+}
+
+/* Bytes of shared memory a ring of this geometry takes */
+static inline size_t
+spsc_size(uint32_t nslots, uint32_t slotsz)
+{
+	return sizeof(struct spsc) + (size_t)nslots * spsc_stride(slotsz);
+}
+
+/*
+ * The slot count must be a power of 2: the indices wrap at 2^32, and only
+ * then does the slot they name carry on in sequence across the wrap.
+ */
+static inline int
+spsc_init(struct spsc *sp, uint32_t nslots, uint32_t slotsz)
+{
+	if (nslots == 0 || (nslots & (nslots - 1)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(sp, 0, sizeof(*sp));
+	sp->sp_nslots = nslots;
+	sp->sp_slotsz = slotsz;
+	sp->sp_stride = spsc_stride(slotsz);
+	atomic_thread_fence(memory_order_release);
+	sp->sp_magic = SPSC_MAGIC;
+	return 0;
+}
+
+static inline struct spslot *
+spsc_slot(const struct spscend *se, uint32_t idx)
+{
+	struct spsc *sp = se->se_ring;
+
+	return (struct spslot *)(sp->sp_slots +
+		(size_t)(idx & (sp->sp_nslots - 1)) * sp->sp_stride);
+}
+
+/* Sets up 'se' as the producer (or the consumer) of 'sp' */
+static inline int
+spsc_open(struct spscend *se, struct spsc *sp, bool producer)
+{
+	if (sp->sp_magic != SPSC_MAGIC) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	se->se_ring = sp;
+	se->se_pos = atomic_load(producer ? &sp->sp_head : &sp->sp_tail);
+	se->se_other = atomic_load(producer ? &sp->sp_tail : &sp->sp_head);
+	se->se_sleeps = 0;
+	return 0;
+}
+
+/*
+ * Waits until '*idx' differs from 'seen', sleeping with 'flag' raised when
+ * polling did not do it. Returns the new value.
+ */
+static inline uint32_t
+spsc_await(struct spscend *se, _Atomic uint32_t *idx, _Atomic uint32_t *flag,
+	uint32_t seen)
+{
+	uint32_t v;
+	int i;
+
+	for (i = 0; i < SPSC_SPIN; i++) {
+		if ((v = atomic_load_explicit(idx, memory_order_acquire)) !=
+			seen)
+			return v;
+		spsc_relax();
+	}
+	for (;;) {
+		atomic_store(flag, 1);
+		if ((v = atomic_load(idx)) != seen)
+			break;
+		se->se_sleeps++;
+		shm_wait(idx, seen);
+	}
+	atomic_store_explicit(flag, 0, memory_order_relaxed);
+
+	return v;
+}
+
+/* Producer: the data of the next free slot, waiting while the ring is full */
+static inline char *
+spsc_wslot(struct spscend *se)
+{
+	struct spsc *sp = se->se_ring;
+
+	while (se->se_pos - se->se_other >= sp->sp_nslots) {
+		se->se_other = atomic_load_explicit(&sp->sp_tail,
+			memory_order_acquire);
+		if (se->se_pos - se->se_other >= sp->sp_nslots)
+			se->se_other = spsc_await(se, &sp->sp_tail,
+				&sp->sp_pwait, se->se_other);
+	}
+	return spsc_slot(se, se->se_pos)->ss_data;
+}
+
+/* Producer: publishes the slot of spsc_wslot() with 'len' bytes in it */
+static inline void
+spsc_push(struct spscend *se, uint32_t len)
+{
+	struct spsc *sp = se->se_ring;
+
+	spsc_slot(se, se->se_pos)->ss_len = len;
+	atomic_store_explicit(&sp->sp_head, ++se->se_pos,
+		memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&sp->sp_cwait, memory_order_relaxed))
+		shm_wake(&sp->sp_head, 1);
+}
+
+/* Consumer: the data of the next full slot, waiting while the ring is empty */
+static inline char *
+spsc_rslot(struct spscend *se, uint32_t *len)
+{
+	struct spsc *sp = se->se_ring;
+	struct spslot *ss;
+
+	while (se->se_other == se->se_pos) {
+		se->se_other = atomic_load_explicit(&sp->sp_head,
+			memory_order_acquire);
+		if (se->se_other == se->se_pos)
+			se->se_other = spsc_await(se, &sp->sp_head,
+				&sp->sp_cwait, se->se_pos);
+	}
+	ss = spsc_slot(se, se->se_pos);
+	*len = ss->ss_len;
+	return ss->ss_data;
+}
+
+/* Consumer: hands the slot of spsc_rslot() back to the producer */
+static inline void
+spsc_pop(struct spscend *se)
+{
+	struct spsc *sp = se->se_ring;
+
+	atomic_store_explicit(&sp->sp_tail, ++se->se_pos,
+		memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&sp->sp_pwait, memory_order_relaxed))
+		shm_wake(&sp->sp_tail, 1);
+}
+
+/* Producer: waits until the consumer has taken every slot */
+static inline void
+spsc_drain(struct spscend *se)
+{
+	struct spsc *sp = se->se_ring;
+
+	while ((se->se_other = atomic_load(&sp->sp_tail)) != se->se_pos)
+		(void)spsc_await(se, &sp->sp_tail, &sp->sp_pwait,
+			se->se_other);
+}
+
+#endif	/* !_SPSCRING_H_ */
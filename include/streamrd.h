@@ -0,0 +1,212 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef _STREAMRD_H_
+#define _STREAMRD_H_
+
+/*
+ * Page cache hints for a file read once from front to back.
+ *
+ * At the start the kernel is told the access is sequential, which on Linux
+ * doubles its read-ahead, and the first window is asked for at once. As the
+ * reader moves on, the next window is requested before the current one runs
+ * out, with readahead(2) on Linux and POSIX_FADV_WILLNEED elsewhere, and
+ * the window follows the throughput: about SR_LEADNS worth of data is kept
+ * in flight, between SR_MINWIN and SR_MAXWIN. With SR_NOCACHE the pages
+ * behind the reader are dropped as it goes, so a large stream does not push
+ * other processes' hot data out of the cache.
+ *
+ * The reader either reads through sr_read(), or consumes the file some
+ * other way (a mapping, sendfile(2), ...) and reports its progress with
+ * sr_advance().
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SR_NOCACHE	0x01	/* Drop the pages behind the reader */
+#define SR_NOHINT	0x02	/* Give no hints at all, for comparisons */
+
+#define SR_MINWIN	(256 * 1024)
+#define SR_MAXWIN	(64 * 1024 * 1024)
+#define SR_LEADNS	100000000	/* Read ahead 100 ms of data */
+#define SR_DROPSZ	(8 * 1024 * 1024)	/* Drop behind in these steps */
+
+struct streamrd {
+	int		sr_fd;
+	int		sr_flags;
+	off_t		sr_off;		/* Next byte the reader takes */
+	off_t		sr_size;	/* -1 if not a regular file */
+	off_t		sr_ahead;	/* Asked for up to here */
+	off_t		sr_dropped;	/* Dropped from the cache up to here */
+	size_t		sr_win;		/* Current read-ahead window */
+	off_t		sr_mark;	/* Offset when sr_markns was taken */
+	uint64_t	sr_markns;
+	char		*sr_map;	/* Mapping of the file at 0, or NULL */
+};
+
+static inline uint64_t
+sr_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Ask for [off, off + len) to be read in the background */
+static inline void
+sr_prefetch(struct streamrd *sr, off_t off, size_t len)
+{
+#ifdef __linux__
+	if (readahead(sr->sr_fd, off, len) == 0)
+		return;
+#endif
+	(void)posix_fadvise(sr->sr_fd, off, len, POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Starts a stream on 'fd' at offset 'off'. 'map', if not NULL, is a shared
+ * or private mapping of the whole file, whose pages SR_NOCACHE must unmap
+ * before the cache can let them go.
+ */
+static inline void
+sr_init(struct streamrd *sr, int fd, off_t off, int flags, void *map)
+{
+	struct stat st;
+
+	memset(sr, 0, sizeof(*sr));
+	sr->sr_fd = fd;
+	sr->sr_flags = flags;
+	sr->sr_off = sr->sr_ahead = sr->sr_mark = off;
+	sr->sr_dropped = off - off % sysconf(_SC_PAGESIZE);
+	sr->sr_size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ?
+		st.st_size : -1;
+	sr->sr_win = SR_MINWIN;
+	sr->sr_map = map;
+	sr->sr_markns = sr_nsec();
+
+	/* Pipes and sockets have no cache to hint at */
+	if (sr->sr_size < 0 || (flags & SR_NOHINT))
+		return;
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (map != NULL)
+		(void)madvise(map, sr->sr_size, MADV_SEQUENTIAL);
+	sr_prefetch(sr, off, sr->sr_win);
+	sr->sr_ahead = off + sr->sr_win;
+}
+
+/* Hints for a reader about to take the bytes at sr_off */
+static inline void
+sr_hint(struct streamrd *sr)
+{
+	uint64_t now, ns;
+	double rate;
+	off_t drop;
+
+	if (sr->sr_size < 0 || (sr->sr_flags & SR_NOHINT))
+		return;
+
+	/* A window went by: size the next ones to the rate it went at */
+	if (sr->sr_off - sr->sr_mark >= (off_t)sr->sr_win) {
+		now = sr_nsec();
+		ns = MAX(now - sr->sr_markns, 1);
+		rate = (double)(sr->sr_off - sr->sr_mark) * 1e9 / (double)ns;
+		sr->sr_win = MIN(MAX((size_t)(rate * SR_LEADNS / 1e9),
+			SR_MINWIN), SR_MAXWIN);
+		sr->sr_mark = sr->sr_off;
+		sr->sr_markns = now;
+	}
+
+	/* Keep a window ahead, topping it up once half of it is used */
+	if (sr->sr_ahead < sr->sr_size &&
+		sr->sr_ahead - sr->sr_off < (off_t)sr->sr_win / 2) {
+		sr->sr_ahead = MAX(sr->sr_ahead, sr->sr_off);
+		sr_prefetch(sr, sr->sr_ahead, sr->sr_win);
+		sr->sr_ahead += sr->sr_win;
+	}
+
+	if ((sr->sr_flags & SR_NOCACHE) &&
+		sr->sr_off - sr->sr_dropped >= SR_DROPSZ) {
+		drop = sr->sr_off - sr->sr_off % SR_DROPSZ;
+		if (sr->sr_map != NULL)
+			(void)madvise(sr->sr_map + sr->sr_dropped,
+				drop - sr->sr_dropped, MADV_DONTNEED);
+		(void)posix_fadvise(sr->sr_fd, sr->sr_dropped,
+			drop - sr->sr_dropped, POSIX_FADV_DONTNEED);
+		sr->sr_dropped = drop;
+	}
+}
+
+/* read(2) through the stream, from its offset when the file has one */
+static inline ssize_t
+sr_read(struct streamrd *sr, void *buf, size_t len)
+{
+	ssize_t n;
+
+	sr_hint(sr);
+	if (sr->sr_size < 0)
+		n = read(sr->sr_fd, buf, len);
+	else
+		n = pread(sr->sr_fd, buf, len, sr->sr_off);
+	if (n > 0)
+		sr->sr_off += n;
+
+	return n;
+}
+
+/* The reader took 'len' more bytes by itself */
+static inline void
+sr_advance(struct streamrd *sr, size_t len)
+{
+	sr->sr_off += len;
+	sr_hint(sr);
+}
+
+/* End of the stream: with SR_NOCACHE, drop what is left behind */
+static inline void
+sr_done(struct streamrd *sr)
+{
+	if (sr->sr_size < 0 || !(sr->sr_flags & SR_NOCACHE) ||
+		sr->sr_off <= sr->sr_dropped)
+		return;
+	if (sr->sr_map != NULL)
+		(void)madvise(sr->sr_map + sr->sr_dropped,
+			sr->sr_off - sr->sr_dropped, MADV_DONTNEED);
+	(void)posix_fadvise(sr->sr_fd, sr->sr_dropped,
+		sr->sr_off - sr->sr_dropped, POSIX_FADV_DONTNEED);
+	sr->sr_dropped = sr->sr_off;
+}
+
+#endif	/* !_STREAMRD_H_ */
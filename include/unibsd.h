@@ -148,13 +148,28 @@ getint(const char *arg)
 	return (int)val;
 }
 
+/*
+ * A program that defines UNIBSD_ARENA before including this header takes
+ * xmalloc() and xcalloc() from the calling thread's arena (see arena.h).
+ * xfree() then ignores arena memory, which goes all at once when the program
+ * calls arena_reset(arena_self()); such memory must not be passed to
+ * realloc(3) or free(3).
+ */
+#ifdef UNIBSD_ARENA
+#include "arena.h"
+#endif
+
 static inline void *
 xmalloc(size_t sz)
 {
 	void *ptr;
 
+#ifdef UNIBSD_ARENA
+	ptr = arena_alloc(arena_self(), sz);
+#else
 	if ((ptr = malloc(sz)) == NULL)
 		errmsg_exit1("Memory allocated failure, %s\n", ERR_MSG);
+#endif
 
 	return ptr;
 }
@@ -164,8 +179,12 @@ xcalloc(size_t numb, size_t sz)
 {
 	void *ptr;
 
+#ifdef UNIBSD_ARENA
+	ptr = arena_calloc(arena_self(), numb, sz);
+#else
 	if ((ptr = calloc(numb, sz)) == NULL)
 		errmsg_exit1("Memory allocated failure, %s\n", ERR_MSG);
+#endif
 
 	return ptr;
 }
@@ -173,6 +192,10 @@ xcalloc(size_t numb, size_t sz)
 static inline void
 xfree(void *ptr)
 {
+#ifdef UNIBSD_ARENA
+	if (arena_owns(ptr))
+		return;		/* Goes with arena_reset() */
+#endif
 	if (ptr != NULL) {
 		free(ptr);
 		ptr = NULL;
@@ -39,7 +39,12 @@
  *
  * Please see the mqueuefs(5) man page for instructions on loading the module
  * or compiling the service into the kernel.
+ *
+ * Every notification runs on a new thread that only needs a receive buffer
+ * until the queue is empty, so the buffers come from the thread's arena
+ * (UNIBSD_ARENA) and are dropped together once the queue is drained.
  */
+#define UNIBSD_ARENA
 #include "unibsd.h"
 #include <mqueue.h>
 #include <fcntl.h>
@@ -95,7 +100,7 @@ drain_queue(mqd_t mqd)
 		errmsg_exit1("mq_getattr failed, %s\n", ERR_MSG);
 	msgsz = attr.mq_msgsize;
 	buf = xmalloc(msgsz);
-	
+
 	while ((nrd = mq_receive(mqd, buf, msgsz, &prio)) >= 0)
 		printf("Read %ld bytes; priority = %u\n", nrd, prio);
 
@@ -103,6 +108,7 @@ drain_queue(mqd_t mqd)
 		errmsg_exit1("mq_receive failed, %s\n", ERR_MSG);
 
 	xfree(buf);
+	arena_reset(arena_self());
 }
 
 /* Thread notification function */
@@ -29,6 +29,9 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* readahead() */
+#endif
 #include "unibsd.h"
 #include <sys/msg.h>
 #include <sys/wait.h>
@@ -36,6 +39,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <syslog.h>
+#include "streamrd.h"
 #include "sysvmq_file.h"
 
 static void sig_handler(int);
@@ -128,6 +132,7 @@ req_handler(const struct svmq_request *req)
 	const int loglvl = LOG_USER | LOG_WARNING;
 	ssize_t nrd;
 	struct svmq_response resp;
+	struct streamrd sr;
 
 	if ((fd = open(req->pathname, O_RDONLY)) == -1) {
 		/* Open failed: send error text */
@@ -140,9 +145,13 @@ req_handler(const struct svmq_request *req)
 		exit(EXIT_FAILURE);
 	}
 
-	/* Transmit file contents in messages with type SVMQ_RESP_DATA. */
+	/*
+	 * Transmit file contents in messages with type SVMQ_RESP_DATA. The
+	 * messages are small, so have the kernel read ahead of them.
+	 */
 	resp.mtype = SVMQ_RESP_DATA;
-	while ((nrd = read(fd, resp.data, SVMQ_RESP_SIZE)) > 0)
+	sr_init(&sr, fd, 0, 0, NULL);
+	while ((nrd = sr_read(&sr, resp.data, SVMQ_RESP_SIZE)) > 0)
 		if (msgsnd(req->clientid, &resp, nrd, 0) == -1) {
 			syslog(loglvl, "Server failed to send a %ld bytes "
 				"response, %s", nrd, ERR_MSG);
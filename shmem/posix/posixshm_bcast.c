@@ -0,0 +1,282 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include "seqbcast.h"
+
+/*
+ * One writer publishing a blob through a seqlocked broadcast region
+ * (seqbcast.h) in a POSIX shared memory object, and reader processes that
+ * map the object read-only and read the blob in a loop for as long as the
+ * writer runs. Every word of a blob holds its number, so a reader can tell
+ * a torn copy; it reports its counts back through a pipe, as it cannot
+ * write to the object.
+ *
+ * Without -n and -b, a set of buffer counts and blob sizes is run in turn.
+ * The writer updates flat out unless -u caps the rate.
+ */
+#define NUMBUFS_MAX	16
+
+struct rdres {
+	uint64_t	rr_reads;
+	uint64_t	rr_retries;
+	uint64_t	rr_bytes;
+	uint64_t	rr_ns;
+};
+
+static struct {
+	const char	*name;
+	int		nreaders;
+	long		rate;		/* Updates per second, 0 for no cap */
+	uint64_t	runns;
+} g = {
+	.name = "/seqbcast_bench",
+	.nreaders = 4,
+	.runns = 2000000000
+};
+
+static void run(uint32_t, uint32_t);
+static void reader(size_t, uint32_t, int);
+static void * attach(size_t, int);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	static const uint32_t sets[][2] = {
+		{ 1, 64 }, { 2, 64 }, { 1, 4096 }, { 2, 4096 },
+		{ 1, 65536 }, { 2, 65536 }
+	};
+	uint32_t nbufs = 0, blobsz = 0;
+	int op, i;
+
+	while ((op = getopt(argc, argv, "r:n:b:u:t:f:")) != -1) {
+		switch (op) {
+		case 'r':
+			g.nreaders = getlong(optarg, GN_GT_0);
+			break;
+		case 'n':
+			nbufs = getlong(optarg, GN_GT_0);
+			break;
+		case 'b':
+			blobsz = getlong(optarg, GN_GT_0);
+			break;
+		case 'u':
+			g.rate = getlong(optarg, GN_NONNEG);
+			break;
+		case 't':
+			g.runns = getlong(optarg, GN_GT_0) * 1000000000ULL;
+			break;
+		case 'f':
+			g.name = optarg;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind != argc || nbufs > NUMBUFS_MAX)
+		usage_info(argv[0]);
+	if (nbufs == 0)
+		nbufs = blobsz == 0 ? 0 : 2;
+	if (blobsz != 0 && (blobsz < sizeof(uint64_t) ||
+		blobsz % sizeof(uint64_t) != 0))
+		errmsg_exit1("blob size must be a multiple of 8\n");
+
+	printf("%d readers, %s updates\n", g.nreaders,
+		g.rate == 0 ? "flat-out" : "capped");
+	printf("%5s %7s %10s %11s %9s %10s %6s\n", "bufs", "blob",
+		"updates/s", "reads/s", "MB/s", "retries", "pct");
+	if (nbufs != 0)
+		run(nbufs, blobsz == 0 ? 4096 : blobsz);
+	else
+		for (i = 0; i < (int)(sizeof(sets) / sizeof(sets[0])); i++)
+			run(sets[i][0], sets[i][1]);
+	exit(EXIT_SUCCESS);
+}
+
+static void
+run(uint32_t nbufs, uint32_t blobsz)
+{
+	struct sbcast *sb;
+	struct rdres r, tot;
+	uint64_t *blob, t0, now, nupd, ns;
+	size_t size, i;
+	ssize_t n;
+	pid_t pid;
+	int fd, pfd[2], status;
+
+	size = sb_size(nbufs, blobsz);
+	if ((fd = shm_open(g.name, O_RDWR | O_CREAT | O_EXCL,
+		S_IRUSR | S_IWUSR)) == -1)
+		errmsg_exit1("shm_open (%s) failed, %s\n", g.name, ERR_MSG);
+	if (ftruncate(fd, size) == -1)
+		errmsg_exit1("ftruncate failed, %s\n", ERR_MSG);
+	if (close(fd) == -1)
+		errmsg_exit1("close failed, %s\n", ERR_MSG);
+	sb = attach(size, O_RDWR);
+	sb_init(sb, nbufs, blobsz);
+
+	if (pipe(pfd) == -1)
+		errmsg_exit1("pipe failed, %s\n", ERR_MSG);
+	fflush(stdout);		/* Or every reader inherits what is buffered */
+	for (i = 0; i < (size_t)g.nreaders; i++) {
+		if ((pid = fork()) == -1)
+			errmsg_exit1("fork failed, %s\n", ERR_MSG);
+		if (pid == 0) {
+			(void)close(pfd[0]);
+			reader(size, blobsz, pfd[1]);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	if (close(pfd[1]) == -1)
+		errmsg_exit1("close failed, %s\n", ERR_MSG);
+
+	/* Blob number 'nupd' in every word; an empty blob says stop */
+	blob = xmalloc(blobsz);
+	t0 = bench_nsec();
+	for (nupd = 1; (now = bench_nsec()) - t0 < g.runns; nupd++) {
+		if (g.rate != 0)
+			while ((now = bench_nsec()) - t0 <
+				nupd * 1000000000ULL / g.rate)
+				sb_relax();
+		for (i = 0; i < blobsz / sizeof(uint64_t); i++)
+			blob[i] = nupd;
+		(void)sb_publish(sb, blob, blobsz);
+	}
+	ns = now - t0;
+	(void)sb_publish(sb, blob, 0);
+	xfree(blob);
+
+	memset(&tot, 0, sizeof(tot));
+	while ((n = read(pfd[0], &r, sizeof(r))) == sizeof(r)) {
+		tot.rr_reads += r.rr_reads;
+		tot.rr_retries += r.rr_retries;
+		tot.rr_bytes += r.rr_bytes;
+	}
+	if (n == -1)
+		errmsg_exit1("read failed, %s\n", ERR_MSG);
+	(void)close(pfd[0]);
+	while (wait(&status) != -1)
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			errmsg_exit1("a reader failed\n");
+
+	printf("%5u %7u %10.0f %11.0f %9.1f %10ju %6.2f\n", nbufs, blobsz,
+		(double)(nupd - 1) / bench_secs(ns),
+		(double)tot.rr_reads / bench_secs(ns),
+		bench_mbps(tot.rr_bytes, ns), (uintmax_t)tot.rr_retries,
+		tot.rr_reads == 0 ? 0.0 : 100.0 * tot.rr_retries /
+		(tot.rr_reads + tot.rr_retries));
+	fflush(stdout);
+
+	if (munmap(sb, size) == -1)
+		errmsg_exit1("munmap failed, %s\n", ERR_MSG);
+	if (shm_unlink(g.name) == -1)
+		errmsg_exit1("shm_unlink failed, %s\n", ERR_MSG);
+}
+
+/* Reads until the empty blob; checks every copy for tearing */
+static void
+reader(size_t size, uint32_t blobsz, int wfd)
+{
+	struct sbreader sr;
+	struct rdres r;
+	uint64_t *blob;
+	size_t i;
+	ssize_t n;
+
+	if (sb_open(&sr, attach(size, O_RDONLY)) == -1)
+		errmsg_exit2("sb_open failed, %s\n", ERR_MSG);
+	blob = xmalloc(blobsz);
+	memset(&r, 0, sizeof(r));
+
+	/*
+	 * sb_read() returns 0 for the empty stop blob too: wait for the first
+	 * blob by its generation, or a late reader would wait forever.
+	 */
+	while (!sb_changed(&sr))
+		sb_relax();
+	while ((n = sb_read(&sr, blob, blobsz)) > 0) {
+		for (i = 1; i < (size_t)n / sizeof(uint64_t); i++)
+			if (blob[i] != blob[0])
+				errmsg_exit2("torn blob %ju: word %zu is "
+					"%ju\n", (uintmax_t)blob[0], i,
+					(uintmax_t)blob[i]);
+		r.rr_bytes += n;
+	}
+	if (n == -1)
+		errmsg_exit2("sb_read failed, %s\n", ERR_MSG);
+
+	r.rr_reads = sr.sr_reads;
+	r.rr_retries = sr.sr_retries;
+	if (write(wfd, &r, sizeof(r)) != sizeof(r))
+		errmsg_exit2("write failed, %s\n", ERR_MSG);
+	xfree(blob);
+}
+
+/* Opens and maps the object by name, read-only for O_RDONLY */
+static void *
+attach(size_t size, int oflag)
+{
+	void *addr;
+	int fd;
+
+	if ((fd = shm_open(g.name, oflag, 0)) == -1)
+		errmsg_exit2("shm_open (%s) failed, %s\n", g.name, ERR_MSG);
+	addr = mmap(NULL, size, oflag == O_RDONLY ? PROT_READ :
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		errmsg_exit2("mmap failed, %s\n", ERR_MSG);
+	if (close(fd) == -1)
+		errmsg_exit2("close failed, %s\n", ERR_MSG);
+	return addr;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-r readers] [-n buffers] [-b blob-size] "
+		"[-u updates/s] [-t secs] [-f shm-name]\n", pname);
+	fprintf(stderr, "-r: reader processes (default 4).\n");
+	fprintf(stderr, "-n: buffers, up to %d (default 2 with -b, "
+		"else a set).\n", NUMBUFS_MAX);
+	fprintf(stderr, "-b: bytes per blob, a multiple of 8 (default 4096 "
+		"with -n, else a set).\n");
+	fprintf(stderr, "-u: cap on updates per second (default none).\n");
+	fprintf(stderr, "-t: seconds per run (default 2).\n");
+	fprintf(stderr, "-f: name of the shared memory object.\n");
+	exit(EXIT_FAILURE);
+}
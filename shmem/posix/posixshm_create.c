@@ -33,14 +33,17 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include "hugeshm.h"
 
 static void usage_info(const char *);
+static void huge_report(void *, long);
 
 int
 main(int argc, char *argv[])
 {
 	int opt, flags, fd;
-	long sz;
+	bool huge = false;
+	long sz, i;
 	mode_t perms;
 	void *addr;
 
@@ -48,11 +51,14 @@ main(int argc, char *argv[])
 	extern char *optarg;
 
 	flags = O_RDWR;
-	while ((opt = getopt(argc, argv, "cx")) != -1)
+	while ((opt = getopt(argc, argv, "cxH")) != -1)
 		switch (opt) {
 		case 'c':
 			flags |= O_CREAT;
 			break;
+		case 'H':
+			huge = true;
+			break;
 		case 'x':
 			flags |= O_EXCL;
 			break;
@@ -88,7 +94,25 @@ main(int argc, char *argv[])
 	 * of zero. The size of the object can be adjusted via ftruncate(2) and
 	 * queried via fstat(2).
 	 */
+#ifdef SHM_LARGEPAGE_ALLOC_DEFAULT
+	/*
+	 * FreeBSD has objects made of large pages only. Without enough of them
+	 * to be had, make an ordinary object and say so.
+	 */
+	fd = -1;
+	if (huge && (flags & O_CREAT) && (fd = shm_create_largepage(
+		argv[optind], flags, 1, SHM_LARGEPAGE_ALLOC_DEFAULT, perms)) ==
+		-1)
+		fprintf(stderr, "shm_create_largepage failed, %s; using "
+			"ordinary pages\n", ERR_MSG);
+	/* Such an object only grows by whole large pages */
+	if (fd != -1)
+		sz = hs_roundup(sz, hs_hugesize());
+	if (fd == -1 &&
+		(fd = shm_open(argv[optind], flags, perms)) == -1)
+#else
 	if ((fd = shm_open(argv[optind], flags, perms)) == -1)
+#endif
 		errmsg_exit1("shm_open (%s) failed, %s\n", argv[optind],
 			ERR_MSG);
 
@@ -132,6 +156,17 @@ main(int argc, char *argv[])
 	if (addr == MAP_FAILED)
 		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
 
+	/*
+	 * Elsewhere, ask for transparent huge pages and touch every page: the
+	 * object keeps whatever pages it was given for later mappings.
+	 */
+	if (huge) {
+		(void)hs_thp(addr, sz);
+		for (i = 0; i < sz; i += getpagesize())
+			((volatile char *)addr)[i] = ((volatile char *)addr)[i];
+		huge_report(addr, sz);
+	}
+
 unmmap:
 
 	exit(EXIT_SUCCESS);
@@ -140,9 +175,26 @@ unmmap:
 static void
 usage_info(const char *pname)
 {
-	fprintf(stderr, "Usage: %s [-cx] shm-name size [octal-perms]\n", pname);
+	fprintf(stderr, "Usage: %s [-cxH] shm-name size [octal-perms]\n", pname);
 	fprintf(stderr, "\t-c\tCreate semaphore (O_CREAT)\n");
 	fprintf(stderr, "\t-x\tCreate exclusively (O_EXCL)\n");
+	fprintf(stderr, "\t-H\tBack with huge pages if possible\n");
 
 	exit(EXIT_FAILURE);
 }
+
+/* Tells what the mapping at 'addr' got */
+static void
+huge_report(void *addr, long sz)
+{
+	struct hspages hp;
+
+	if (hs_pages(addr, sz, &hp) == -1)
+		errmsg_exit1("hs_pages failed, %s\n", ERR_MSG);
+	if (hp.hp_huge == 0)
+		printf("No huge pages, %zu KiB pages (on Linux, /dev/shm must "
+			"be mounted with huge=advise)\n", hp.hp_pagesz / 1024);
+	else
+		printf("%zu of %zu KiB in huge pages\n", hp.hp_huge / 1024,
+			hp.hp_rss / 1024);
+}
@@ -0,0 +1,416 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* memfd_create() */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <getopt.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "hugeshm.h"
+
+/*
+ * Random reads over a shared segment, with and without huge pages. For each
+ * kind of segment the parent creates it, touches every page and hands it
+ * to a child: a POSIX object by name, a memfd over a Unix domain socket, a
+ * System V segment by id. The child maps it and does a chain of dependent
+ * reads at random offsets, so each read pays for its TLB miss, and reports
+ * the page size it got, the time per read, the dTLB misses per read when
+ * the hardware counters can be had, and the page faults it took to map the
+ * segment in, one per page table entry.
+ */
+enum { SEG_SHM, SEG_MEMFD, SEG_SYSV };
+
+#define SEG_HUGE	0x01	/* Explicit huge pages */
+#define SEG_THP		0x02	/* madvise(MADV_HUGEPAGE) */
+
+static const struct segkind {
+	const char	*sk_name;
+	int		sk_type;
+	int		sk_flags;
+} kinds[] = {
+	{ "shm",	SEG_SHM,	0 },
+	{ "shm-thp",	SEG_SHM,	SEG_THP },
+	{ "memfd",	SEG_MEMFD,	0 },
+	{ "memfd-thp",	SEG_MEMFD,	SEG_THP },
+	{ "memfd-huge",	SEG_MEMFD,	SEG_HUGE },
+	{ "sysv",	SEG_SYSV,	0 },
+	{ "sysv-huge",	SEG_SYSV,	SEG_HUGE }
+};
+
+#define NKINDS	(sizeof(kinds) / sizeof(kinds[0]))
+
+struct seg {
+	const struct segkind *sg_kind;
+	size_t		sg_size;
+	bool		sg_huge;	/* Got explicit huge pages */
+	int		sg_fd;		/* SEG_SHM, SEG_MEMFD */
+	int		sg_shmid;	/* SEG_SYSV */
+};
+
+static struct {
+	const char	*name;
+	size_t		size;
+	long		nreads;
+} g = {
+	.name = "/hugeshm_bench",
+	.size = 512 * MIB,
+	.nreads = 10000000
+};
+
+static volatile uint64_t sink;	/* Keeps the reads from being optimized out */
+
+static void run(const struct segkind *);
+static void create(struct seg *);
+static void * attach(const struct seg *);
+static void destroy(struct seg *);
+static void reader(struct seg *, int, double);
+static uint64_t chase(const uint64_t *, size_t, long);
+static int tlb_open(void);
+static uint64_t tlb_read(int);
+static long minflt(void);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	char *list = NULL, *tok;
+	size_t i;
+	int op;
+
+	while ((op = getopt(argc, argv, "s:n:m:f:")) != -1) {
+		switch (op) {
+		case 's':
+			g.size = getsize(optarg);
+			break;
+		case 'n':
+			g.nreads = getlong(optarg, GN_GT_0);
+			break;
+		case 'm':
+			list = optarg;
+			break;
+		case 'f':
+			g.name = optarg;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind != argc || g.size == 0)
+		usage_info(argv[0]);
+
+	/* The same size for every kind, so the rows compare */
+	g.size = hs_roundup(g.size, hs_hugesize());
+	printf("%zu MiB segments, %ld dependent random reads, huge pages of "
+		"%zu KiB\n", g.size / MIB, g.nreads, hs_hugesize() / KIB);
+	printf("%-11s %-6s %8s %9s %9s %8s %10s %8s\n", "segment", "huge",
+		"page", "huge MiB", "touch ms", "ns/read", "dTLB/read",
+		"faults");
+
+	if (list == NULL) {
+		for (i = 0; i < NKINDS; i++)
+			run(&kinds[i]);
+	} else {
+		for (tok = strtok(list, ","); tok != NULL;
+			tok = strtok(NULL, ",")) {
+			for (i = 0; i < NKINDS; i++)
+				if (strcmp(tok, kinds[i].sk_name) == 0)
+					break;
+			if (i == NKINDS)
+				usage_info(argv[0]);
+			run(&kinds[i]);
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
+
+static void
+run(const struct segkind *sk)
+{
+	struct seg sg;
+	uint64_t t0;
+	double touchms;
+	char *addr;
+	size_t i, pgsz = getpagesize();
+	int sv[2], status;
+	pid_t pid;
+
+	memset(&sg, 0, sizeof(sg));
+	sg.sg_kind = sk;
+	create(&sg);
+
+	/* Fault the whole segment in here, so the child only maps it */
+	addr = attach(&sg);
+	t0 = bench_nsec();
+	for (i = 0; i < sg.sg_size; i += pgsz)
+		addr[i] = 0;
+	touchms = (double)(bench_nsec() - t0) / 1e6;
+	if (sk->sk_type == SEG_SYSV ? shmdt(addr) == -1 :
+		munmap(addr, sg.sg_size) == -1)
+		errmsg_exit1("unmapping failed, %s\n", ERR_MSG);
+
+	fflush(stdout);		/* Or the child prints it again */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		errmsg_exit1("socketpair failed, %s\n", ERR_MSG);
+	if ((pid = fork()) == -1)
+		errmsg_exit1("fork failed, %s\n", ERR_MSG);
+	if (pid == 0) {
+		(void)close(sv[0]);
+		reader(&sg, sv[1], touchms);
+		_exit(EXIT_SUCCESS);
+	}
+	(void)close(sv[1]);
+	if (sk->sk_type == SEG_MEMFD && hs_sendfd(sv[0], sg.sg_fd) == -1)
+		errmsg_exit1("sendmsg failed, %s\n", ERR_MSG);
+	if (waitpid(pid, &status, 0) == -1)
+		errmsg_exit1("waitpid failed, %s\n", ERR_MSG);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errmsg_exit1("the reader failed\n");
+	(void)close(sv[0]);
+	destroy(&sg);
+}
+
+/* Makes the segment, falling back to ordinary pages if huge ones are refused */
+static void
+create(struct seg *sg)
+{
+	const struct segkind *sk = sg->sg_kind;
+	int flags = IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR;
+
+	sg->sg_size = g.size;
+	sg->sg_huge = (sk->sk_flags & SEG_HUGE) != 0;
+	switch (sk->sk_type) {
+	case SEG_SHM:
+		if ((sg->sg_fd = shm_open(g.name, O_RDWR | O_CREAT | O_EXCL,
+			S_IRUSR | S_IWUSR)) == -1)
+			errmsg_exit1("shm_open (%s) failed, %s\n", g.name,
+				ERR_MSG);
+		if (ftruncate(sg->sg_fd, sg->sg_size) == -1)
+			errmsg_exit1("ftruncate failed, %s\n", ERR_MSG);
+		break;
+	case SEG_MEMFD:
+		if ((sg->sg_fd = hs_memfd("hugeshm", sg->sg_size,
+			&sg->sg_huge)) == -1)
+			errmsg_exit1("memfd failed, %s\n", ERR_MSG);
+		break;
+	case SEG_SYSV:
+#ifdef SHM_HUGETLB
+		if (sg->sg_huge && (sg->sg_shmid = shmget(IPC_PRIVATE,
+			sg->sg_size, flags | SHM_HUGETLB)) != -1)
+			break;
+#endif
+		sg->sg_huge = false;
+		if ((sg->sg_shmid = shmget(IPC_PRIVATE, sg->sg_size,
+			flags)) == -1)
+			errmsg_exit1("shmget failed, %s\n", ERR_MSG);
+		break;
+	}
+}
+
+static void *
+attach(const struct seg *sg)
+{
+	void *addr;
+
+	if (sg->sg_kind->sk_type == SEG_SYSV) {
+		if ((addr = shmat(sg->sg_shmid, NULL, 0)) == (void *)-1)
+			errmsg_exit1("shmat failed, %s\n", ERR_MSG);
+	} else {
+		addr = mmap(NULL, sg->sg_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, sg->sg_fd, 0);
+		if (addr == MAP_FAILED)
+			errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+	}
+	/* Before any page is touched, or it is too late */
+	if (sg->sg_kind->sk_flags & SEG_THP)
+		(void)hs_thp(addr, sg->sg_size);
+	return addr;
+}
+
+static void
+destroy(struct seg *sg)
+{
+	if (sg->sg_kind->sk_type == SEG_SYSV) {
+		if (shmctl(sg->sg_shmid, IPC_RMID, NULL) == -1)
+			errmsg_exit1("shmctl failed, %s\n", ERR_MSG);
+		return;
+	}
+	if (close(sg->sg_fd) == -1)
+		errmsg_exit1("close failed, %s\n", ERR_MSG);
+	if (sg->sg_kind->sk_type == SEG_SHM && shm_unlink(g.name) == -1)
+		errmsg_exit1("shm_unlink failed, %s\n", ERR_MSG);
+}
+
+/* The child: gets hold of the segment the way an unrelated process would */
+static void
+reader(struct seg *sg, int sock, double touchms)
+{
+	const struct segkind *sk = sg->sg_kind;
+	struct hspages hp;
+	uint64_t t0, ns, misses = 0;
+	long flt;
+	void *addr;
+	int tfd;
+
+	switch (sk->sk_type) {
+	case SEG_SHM:
+		(void)close(sg->sg_fd);
+		if ((sg->sg_fd = shm_open(g.name, O_RDWR, 0)) == -1)
+			errmsg_exit1("shm_open (%s) failed, %s\n", g.name,
+				ERR_MSG);
+		break;
+	case SEG_MEMFD:
+		(void)close(sg->sg_fd);
+		if ((sg->sg_fd = hs_recvfd(sock)) == -1)
+			errmsg_exit1("recvmsg failed, %s\n", ERR_MSG);
+		break;
+	}
+
+	addr = attach(sg);
+	flt = minflt();
+	sink = chase(addr, sg->sg_size, g.nreads / 10);	/* Map it in */
+	flt = minflt() - flt;
+
+	tfd = tlb_open();
+	if (tfd != -1)
+		misses = tlb_read(tfd);
+	t0 = bench_nsec();
+	sink = chase(addr, sg->sg_size, g.nreads);
+	ns = bench_nsec() - t0;
+	if (tfd != -1)
+		misses = tlb_read(tfd) - misses;
+
+	if (hs_pages(addr, sg->sg_size, &hp) == -1)
+		errmsg_exit1("hs_pages failed, %s\n", ERR_MSG);
+	printf("%-11s %-6s %7zuK %9zu %9.1f %8.1f ", sk->sk_name,
+		!(sk->sk_flags & SEG_HUGE) ? "-" : sg->sg_huge ? "yes" : "no",
+		hp.hp_pagesz / KIB, hp.hp_huge / MIB, touchms,
+		(double)ns / g.nreads);
+	if (tfd == -1)
+		printf("%10s", "n/a");
+	else
+		printf("%10.3f", (double)misses / g.nreads);
+	printf(" %8ld\n", flt);
+	fflush(stdout);
+}
+
+/*
+ * 'n' reads at random offsets, each depending on the one before, so they
+ * can't overlap. The segment holds zeroes, but the compiler can't know.
+ */
+static uint64_t
+chase(const uint64_t *p, size_t size, long n)
+{
+	uint64_t x = 88172645463325252ULL, nwords = size / sizeof(uint64_t);
+
+	while (n-- > 0) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		x += p[(unsigned __int128)x * nwords >> 64];
+	}
+	return x;
+}
+
+/* A counter of dTLB read misses in this process, or -1 if there is none */
+static int
+tlb_open(void)
+{
+#ifdef __linux__
+	struct perf_event_attr pa;
+	int fd;
+
+	memset(&pa, 0, sizeof(pa));
+	pa.type = PERF_TYPE_HW_CACHE;
+	pa.size = sizeof(pa);
+	pa.config = PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	pa.exclude_kernel = 1;
+	pa.exclude_hv = 1;
+	if ((fd = syscall(SYS_perf_event_open, &pa, 0, -1, -1, 0)) == -1)
+		return -1;
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+static uint64_t
+tlb_read(int fd)
+{
+	uint64_t val;
+
+	if (read(fd, &val, sizeof(val)) != sizeof(val))
+		errmsg_exit1("reading the TLB counter failed, %s\n", ERR_MSG);
+	return val;
+}
+
+static long
+minflt(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		errmsg_exit1("getrusage failed, %s\n", ERR_MSG);
+	return ru.ru_minflt;
+}
+
+static void
+usage_info(const char *pname)
+{
+	size_t i;
+
+	fprintf(stderr, "Usage: %s [-s size] [-n reads] [-m kind[,kind...]] "
+		"[-f shm-name]\n", pname);
+	fprintf(stderr, "-s: segment size, rounded up to a huge page "
+		"(default 512m).\n");
+	fprintf(stderr, "-n: random reads per segment (default 10000000).\n");
+	fprintf(stderr, "-m: kinds of segment (default all):");
+	for (i = 0; i < NKINDS; i++)
+		fprintf(stderr, " %s", kinds[i].sk_name);
+	fprintf(stderr, ".\n");
+	fprintf(stderr, "-f: name of the POSIX shared memory object.\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,392 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include "mpmcq.h"
+
+/*
+ * Producer and consumer processes passing messages through an MPMC queue
+ * (mpmcq.h) in a POSIX shared memory object. Every child opens and maps the
+ * object by name on its own, as an unrelated process would. The producers
+ * each send 'nmsgs' numbered messages; once they are done, the parent sends
+ * one empty message per consumer to stop it. The consumers check that each
+ * producer's messages reach them in order and report what they got in the
+ * result area at the start of the object.
+ *
+ * Without -p and -c, a set of producer and consumer counts is run in turn.
+ * With -k, a producer and a consumer are killed holding a slot before the
+ * run, which stalls the queue unless their slots are recovered.
+ */
+#define MAXPROCS	64
+
+struct mpmsg {
+	uint32_t	mm_producer;
+	uint32_t	mm_pad;
+	uint64_t	mm_seq;
+};
+
+/* What a consumer got, on a cache line of its own */
+struct mpres {
+	uint64_t	mr_msgs;
+	uint64_t	mr_seqsum;
+	uint64_t	mr_bytes;
+	uint64_t	mr_disorder;	/* Messages out of a producer's order */
+} __attribute__((aligned(64)));
+
+#define RESSZ	(MAXPROCS * sizeof(struct mpres))
+
+static struct {
+	const char	*name;
+	uint32_t	nslots;
+	uint32_t	msgsz;
+	long		nmsgs;
+	int		flags;		/* MPQ_NONBLOCK */
+	bool		kill;
+	size_t		size;		/* Of the object */
+} g = {
+	.name = "/mpmcq_bench",
+	.nslots = 1024,
+	.msgsz = 64,
+	.nmsgs = 200000
+};
+
+static void run(int, int);
+static void * attach(struct mpmcq **);
+static void put(struct mpmcq *, const void *, size_t);
+static ssize_t get(struct mpmcq *, void *, size_t);
+static void producer(int);
+static void consumer(int, int);
+static void victims(struct mpmcq *);
+static void waitall(int);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	static const int sets[][2] = {
+		{ 1, 1 }, { 1, 4 }, { 4, 1 }, { 2, 2 }, { 4, 4 }, { 8, 8 }
+	};
+	int op, nprod = 0, ncons = 0, fd, i;
+	void *addr;
+
+	while ((op = getopt(argc, argv, "p:c:n:s:m:Nkf:")) != -1) {
+		switch (op) {
+		case 'p':
+			nprod = getlong(optarg, GN_GT_0);
+			break;
+		case 'c':
+			ncons = getlong(optarg, GN_GT_0);
+			break;
+		case 'n':
+			g.nmsgs = getlong(optarg, GN_GT_0);
+			break;
+		case 's':
+			g.nslots = getlong(optarg, GN_GT_0);
+			break;
+		case 'm':
+			g.msgsz = getlong(optarg, GN_GT_0);
+			break;
+		case 'N':
+			g.flags |= MPQ_NONBLOCK;
+			break;
+		case 'k':
+			g.kill = true;
+			break;
+		case 'f':
+			g.name = optarg;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind != argc || nprod > MAXPROCS || ncons > MAXPROCS ||
+		(nprod == 0) != (ncons == 0) ||
+		g.msgsz < sizeof(struct mpmsg))
+		usage_info(argv[0]);
+
+	/* The consumers' results, then the queue */
+	g.size = RESSZ + mpq_size(g.nslots, g.msgsz);
+	if ((fd = shm_open(g.name, O_RDWR | O_CREAT | O_EXCL,
+		S_IRUSR | S_IWUSR)) == -1)
+		errmsg_exit1("shm_open (%s) failed, %s\n", g.name, ERR_MSG);
+	if (ftruncate(fd, g.size) == -1)
+		errmsg_exit1("ftruncate failed, %s\n", ERR_MSG);
+	addr = mmap(NULL, g.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+	if (close(fd) == -1)
+		errmsg_exit1("close failed, %s\n", ERR_MSG);
+	if (munmap(addr, g.size) == -1)
+		errmsg_exit1("munmap failed, %s\n", ERR_MSG);
+
+	printf("%u slots, %u-byte messages, %ld per producer%s\n", g.nslots,
+		g.msgsz, g.nmsgs, (g.flags & MPQ_NONBLOCK) ?
+		", non-blocking" : "");
+	printf("%5s %5s %10s %8s %10s %9s %8s %9s\n", "prod", "cons", "msgs",
+		"secs", "Mmsg/s", "MB/s", "sleeps", "recovered");
+	if (nprod > 0)
+		run(nprod, ncons);
+	else
+		for (i = 0; i < (int)(sizeof(sets) / sizeof(sets[0])); i++)
+			run(sets[i][0], sets[i][1]);
+
+	if (shm_unlink(g.name) == -1)
+		errmsg_exit1("shm_unlink failed, %s\n", ERR_MSG);
+	exit(EXIT_SUCCESS);
+}
+
+static void
+run(int nprod, int ncons)
+{
+	struct mpmcq *q;
+	struct mpres *res, tot;
+	struct mpmsg stop;
+	uint64_t t0, ns, want;
+	pid_t pid;
+	int i;
+
+	res = attach(&q);
+	memset(res, 0, RESSZ);
+	if (mpq_init(q, g.nslots, g.msgsz) == -1)
+		errmsg_exit1("mpq_init failed, %s\n", ERR_MSG);
+	if (mpq_attach(q) == -1)
+		errmsg_exit1("mpq_attach failed, %s\n", ERR_MSG);
+	if (g.kill)
+		victims(q);
+
+	fflush(stdout);		/* Or every child inherits what is buffered */
+	t0 = bench_nsec();
+	for (i = 0; i < ncons + nprod; i++) {
+		if ((pid = fork()) == -1)
+			errmsg_exit1("fork failed, %s\n", ERR_MSG);
+		if (pid == 0) {
+			if (i < ncons)
+				consumer(i, nprod);
+			else
+				producer(i - ncons);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+
+	waitall(nprod);		/* Producers finish first */
+	memset(&stop, 0, sizeof(stop));
+	for (i = 0; i < ncons; i++)
+		put(q, &stop, 0);
+	waitall(ncons);
+	ns = bench_nsec() - t0;
+
+	memset(&tot, 0, sizeof(tot));
+	for (i = 0; i < ncons; i++) {
+		tot.mr_msgs += res[i].mr_msgs;
+		tot.mr_seqsum += res[i].mr_seqsum;
+		tot.mr_bytes += res[i].mr_bytes;
+		tot.mr_disorder += res[i].mr_disorder;
+	}
+	want = (uint64_t)nprod * g.nmsgs;
+	if (tot.mr_msgs != want || tot.mr_disorder != 0 || tot.mr_seqsum !=
+		(uint64_t)nprod * (uint64_t)g.nmsgs * (g.nmsgs - 1) / 2)
+		errmsg_exit1("%ju of %ju messages, %ju out of order\n",
+			(uintmax_t)tot.mr_msgs, (uintmax_t)want,
+			(uintmax_t)tot.mr_disorder);
+
+	printf("%5d %5d %10ju %8.3f %10.2f %9.1f %8ju %9ju\n", nprod, ncons,
+		(uintmax_t)tot.mr_msgs, bench_secs(ns),
+		(double)tot.mr_msgs / bench_secs(ns) / 1e6,
+		bench_mbps(tot.mr_bytes, ns), (uintmax_t)atomic_load(
+		&q->mq_sleeps), (uintmax_t)atomic_load(&q->mq_recovered));
+	fflush(stdout);
+
+	if (munmap(res, g.size) == -1)
+		errmsg_exit1("munmap failed, %s\n", ERR_MSG);
+}
+
+/* Opens and maps the object by name; returns the results, and the queue */
+static void *
+attach(struct mpmcq **q)
+{
+	int fd;
+	char *addr;
+
+	if ((fd = shm_open(g.name, O_RDWR, 0)) == -1)
+		errmsg_exit2("shm_open (%s) failed, %s\n", g.name, ERR_MSG);
+	addr = mmap(NULL, g.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		errmsg_exit2("mmap failed, %s\n", ERR_MSG);
+	if (close(fd) == -1)
+		errmsg_exit2("close failed, %s\n", ERR_MSG);
+
+	*q = (struct mpmcq *)(addr + RESSZ);
+	return addr;
+}
+
+/* With -N, retry on a full queue, looking for dead claimers now and then */
+static void
+put(struct mpmcq *q, const void *msg, size_t len)
+{
+	long tries = 0;
+
+	while (mpq_put(q, msg, len, g.flags) == -1) {
+		if (errno != EAGAIN)
+			errmsg_exit2("mpq_put failed, %s\n", ERR_MSG);
+		if (++tries % 1000 == 0)
+			(void)mpq_recover(q);
+		sched_yield();
+	}
+}
+
+static ssize_t
+get(struct mpmcq *q, void *buf, size_t len)
+{
+	long tries = 0;
+	ssize_t n;
+
+	while ((n = mpq_get(q, buf, len, g.flags)) == -1) {
+		if (errno != EAGAIN)
+			errmsg_exit2("mpq_get failed, %s\n", ERR_MSG);
+		if (++tries % 1000 == 0)
+			(void)mpq_recover(q);
+		sched_yield();
+	}
+	return n;
+}
+
+static void
+producer(int id)
+{
+	struct mpmcq *q;
+	struct mpmsg *m;
+	long i;
+
+	(void)attach(&q);
+	if (mpq_attach(q) == -1)
+		errmsg_exit2("mpq_attach failed, %s\n", ERR_MSG);
+
+	m = xcalloc(1, g.msgsz);
+	m->mm_producer = id;
+	for (i = 0; i < g.nmsgs; i++) {
+		m->mm_seq = i;
+		put(q, m, g.msgsz);
+	}
+	xfree(m);
+}
+
+static void
+consumer(int id, int nprod)
+{
+	struct mpmcq *q;
+	struct mpres *res, r;
+	struct mpmsg *m;
+	uint64_t *next;
+	ssize_t n;
+
+	res = attach(&q);
+	if (mpq_attach(q) == -1)
+		errmsg_exit2("mpq_attach failed, %s\n", ERR_MSG);
+
+	m = xmalloc(g.msgsz);
+	next = xcalloc(nprod, sizeof(uint64_t));
+	memset(&r, 0, sizeof(r));
+	while ((n = get(q, m, g.msgsz)) > 0) {
+		if (m->mm_producer >= (uint32_t)nprod ||
+			m->mm_seq < next[m->mm_producer])
+			r.mr_disorder++;
+		else
+			next[m->mm_producer] = m->mm_seq + 1;
+		r.mr_msgs++;
+		r.mr_seqsum += m->mm_seq;
+		r.mr_bytes += n;
+	}
+	res[id] = r;
+	xfree(next);
+	xfree(m);
+}
+
+/*
+ * A producer that dies after claiming a slot, and a consumer that dies
+ * after claiming the slot of a message. Both slots come round again once
+ * the queue has wrapped.
+ */
+static void
+victims(struct mpmcq *q)
+{
+	struct mpmsg m;
+	pid_t pid;
+	int i;
+
+	memset(&m, 0, sizeof(m));
+	put(q, &m, sizeof(m));	/* For the consumer to die holding */
+	for (i = 0; i < 2; i++) {
+		if ((pid = fork()) == -1)
+			errmsg_exit1("fork failed, %s\n", ERR_MSG);
+		if (pid == 0) {
+			if (mpq_attach(q) == -1 || mpq_claim(q, i == 1) == NULL)
+				_exit(EXIT_FAILURE);
+			_exit(EXIT_SUCCESS);	/* Holding the slot */
+		}
+		if (waitpid(pid, NULL, 0) == -1)
+			errmsg_exit1("waitpid failed, %s\n", ERR_MSG);
+	}
+}
+
+static void
+waitall(int n)
+{
+	int status;
+
+	while (n-- > 0) {
+		if (wait(&status) == -1)
+			errmsg_exit1("wait failed, %s\n", ERR_MSG);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			errmsg_exit1("a child failed\n");
+	}
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-p producers -c consumers] [-n msgs] "
+		"[-s slots] [-m msgsize] [-N] [-k] [-f shm-name]\n", pname);
+	fprintf(stderr, "-p, -c: processes of each kind (default a set).\n");
+	fprintf(stderr, "-n: messages per producer (default 200000).\n");
+	fprintf(stderr, "-s: slots, a power of 2 (default 1024).\n");
+	fprintf(stderr, "-m: bytes per message (default 64).\n");
+	fprintf(stderr, "-N: non-blocking calls, retried.\n");
+	fprintf(stderr, "-k: kill a producer and a consumer holding slots.\n");
+	fprintf(stderr, "-f: name of the shared memory object.\n");
+	exit(EXIT_FAILURE);
+}
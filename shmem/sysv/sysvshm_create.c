@@ -34,17 +34,22 @@
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include <getopt.h>
+#include "hugeshm.h"
 
 static void usage_info(const char *, const char *);
 
 int
 main(int argc, char *argv[])
 {
-	const char *optstr = "cf:k:px";
+	const char *optstr = "cf:Hk:px";
 	int opt, flags = 0, kcnt = 0, shmid;
+	bool huge = false;
 	mode_t perms;
 	key_t key;
 	long ukey, segsz;
+#ifdef SHM_HUGETLB
+	size_t hugesz;		/* 'segsz' rounded up to whole huge pages */
+#endif
 
 	extern char *optarg;
 	extern int optind;
@@ -59,6 +64,9 @@ main(int argc, char *argv[])
 				errmsg_exit1("ftok failed\n");
 			kcnt++;
 			break;
+		case 'H':
+			huge = true;
+			break;
 		case 'k':
 			if (sscanf(optarg, "%ld", &ukey) != 1)
 				errmsg_exit1("-k option requires a numeric "
@@ -122,7 +130,28 @@ main(int argc, char *argv[])
 	 * rounded up to a multiple convenient to the kernel (i.e., the page
 	 * size).
 	 */
-	if ((shmid = shmget(key, segsz, flags)) == -1)
+	shmid = -1;
+#ifdef SHM_HUGETLB
+	/*
+	 * SHM_HUGETLB takes the segment from the pool of huge pages set aside
+	 * by vm.nr_hugepages, and needs the privilege or the group named in
+	 * vm.hugetlb_shm_group. If the pool is short or the caller lacks the
+	 * right, make an ordinary segment and say so.
+	 */
+	if (huge) {
+		hugesz = hs_roundup(segsz, hs_hugesize());
+		if ((shmid = shmget(key, hugesz, flags | SHM_HUGETLB)) == -1)
+			fprintf(stderr, "shmget with SHM_HUGETLB failed, %s; "
+				"using ordinary pages\n", ERR_MSG);
+		else
+			printf("Huge pages of %zu KiB\n",
+				hs_hugesize() / 1024);
+	}
+#else
+	if (huge)
+		fprintf(stderr, "No SHM_HUGETLB here; using ordinary pages\n");
+#endif
+	if (shmid == -1 && (shmid = shmget(key, segsz, flags)) == -1)
 		errmsg_exit1("shmget (%ld) failed, %s\n", segsz, ERR_MSG);
 	printf("shmid = %d\n", shmid);
 
@@ -135,10 +164,11 @@ usage_info(const char *pname, const char *msg)
 	if (msg != NULL)
 		fprintf(stderr, "%s\n", msg);
 
-	fprintf(stderr, "Usage: %s [-cx] {-f pathname | -k key | -p} "
+	fprintf(stderr, "Usage: %s [-cxH] {-f pathname | -k key | -p} "
 		"seg-size [octal-perms]\n", pname);
 	fprintf(stderr, "\t-c\t\tUse IPC_CREAT flag\n");
 	fprintf(stderr, "\t-x\t\tUse IPC_EXCl flag\n");
+	fprintf(stderr, "\t-H\t\tUse huge pages if possible\n");
 	fprintf(stderr, "\t-f pathname Generate key using ftok\n");
 	fprintf(stderr, "\t-k key\tUse 'key' as key\n");
 	fprintf(stderr, "\t-p\t\tUse IPC_PRIVATE key\n");
@@ -33,75 +33,17 @@
 #define _SYSVSHM_TSFR_H_
 
 #define SYSV_SHM_KEY	0x1234		/* Key for shared memory segment */
-#define SYSV_SEM_KEY	0x2345		/* Key for semaphore set */
 
 /* Permissions for our IPC objects */
 #define IPC_OBJ_PERMS	(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
 
 /*
- * Two semaphores are used to ensure exclusive, alternating access to the
- * shared memory segment
+ * The segment holds a single-producer, single-consumer ring (spscring.h):
+ * the writer reads stdin straight into its free slots and the reader writes
+ * its full slots to stdout, each side sleeping only when the ring is full or
+ * empty. A slot with no data marks the end of the input.
  */
-#define SYSV_WRITE_SEM	0	/* Writer has access to shared memory */
-#define SYSV_READ_SEM	1	/* Reader has access to shared memory */
-
-union semun {
-	int		val;	/* value for SETVAL */
-        struct semid_ds	*buf;	/* buffer for IPC_STAT & IPC_SET */
-        unsigned short	*array; /* array for GETALL & SETALL */
-};
-
-struct shmseg {
-	long	shms_cnt;		/* # bytes used in 'shms_buf' */
-	char	shms_buf[BUF_SIZE];	/* Data being transferred */
-};
-
-
-static inline int
-svsem_avai_init(int semid, int semnum)
-{
-	union semun arg;
-
-	arg.val = 1;
-	return semctl(semid, semnum, SETVAL, arg);
-}
-
-static inline int
-svsem_inuse_init(int semid, int semnum)
-{
-	union semun arg;
-
-	arg.val = 0;
-	return semctl(semid, semnum, SETVAL, arg);
-}
-
-static int
-svsem_wait(int semid, int semnum)
-{
-	struct sembuf sops;
-
-	sops.sem_num = semnum;
-	sops.sem_op = -1;
-	sops.sem_flg = 0;
-
-	while (semop(semid, &sops, 1) == -1)
-		if (errno != EINTR)
-			return -1;
-
-	return 0;
-}
-
-static int
-svsem_post(int semid, int semnum)
-{
-	struct sembuf sops;
-
-	sops.sem_num = semnum;
-	sops.sem_op = 1;
-	sops.sem_flg = 0;
-
-	return semop(semid, &sops, 1);
-}
-
+#define TSFR_NSLOTS	64		/* Default number of slots */
+#define TSFR_SLOTSZ	(64 * 1024)	/* Default bytes per slot */
 
 #endif	/* !_SYSVSHM_TSFR_H_ */
@@ -30,60 +30,62 @@
  *
  */
 #include "unibsd.h"
+#include "benchutil.h"
 #include <sys/shm.h>
-#include <sys/sem.h>
 #include <sys/stat.h>
+#include "spscring.h"
 #include "sysvshm_tsfr.h"
 
 int
 main(void)
 {
-	int semid, shmid;
+	int shmid;
 	long tsfrs = 0, bytes = 0, cnt;
-	struct shmseg *seg;
+	struct spsc *ring;
+	struct spscend se;
+	uint64_t t0, ns;
+	uint32_t len;
+	char *buf;
 
-	/* Get IDs for semaphore set and shared memory created by writer */
-
-	if ((semid = semget(SYSV_SEM_KEY, 0, 0)) == -1)
-		errmsg_exit1("semget failed, %s\n", ERR_MSG);
+	/* Get ID for shared memory created by writer */
 
 	if ((shmid = shmget(SYSV_SHM_KEY, 0, 0)) == -1)
 		errmsg_exit1("shmget failed, %s\n", ERR_MSG);
 
-	/* Attach shared memory read-only, as we will only read */
+	/* Attach shared memory read-write, as we move the tail of the ring */
 
-	seg = (struct shmseg *)shmat(shmid, NULL, SHM_RDONLY);
-	if (seg == (void *)-1)
+	if ((ring = shmat(shmid, NULL, 0)) == (void *)-1)
 		errmsg_exit1("shmat failed, %s\n", ERR_MSG);
+	if (spsc_open(&se, ring, false) == -1)
+		errmsg_exit1("spsc_open failed, %s\n", ERR_MSG);
 
-	/* Transfer blocks of data from shared memory to stdout */
+	/* Transfer full slots of the ring to stdout */
 
+	t0 = bench_nsec();
 	while (1) {
-		if (svsem_wait(semid, SYSV_READ_SEM) == -1)
-			errmsg_exit1("svsem_wait failed\n");
+		buf = spsc_rslot(&se, &len);	/* Waits while it is empty */
 
-		if (seg->shms_cnt == 0)		/* Writer encountered EOF */
+		if (len == 0) {			/* Writer encountered EOF */
+			spsc_pop(&se);
 			break;
+		}
 
-		cnt = write(STDOUT_FILENO, seg->shms_buf, seg->shms_cnt);
-		if (cnt != seg->shms_cnt)
+		if ((cnt = write(STDOUT_FILENO, buf, len)) != (long)len)
 			errmsg_exit1("write (%ld) failed, %s\n", cnt, ERR_MSG);
 
-		if (svsem_post(semid, SYSV_WRITE_SEM) == -1)
-			errmsg_exit1("svsem_post failed\n");
+		spsc_pop(&se);			/* Gives the slot back */
 
-		bytes += seg->shms_cnt;
+		bytes += len;
 		tsfrs++;
 	}
-	
-	if (shmdt(seg) == -1)
-		errmsg_exit1("shmdt failed, %s\n", ERR_MSG);
+	ns = bench_nsec() - t0;
 
-	/* Give writer one more turn, so it can clean up */
-	if (svsem_post(semid, SYSV_WRITE_SEM) == -1)
-		errmsg_exit1("svsem_post failed\n");
+	if (shmdt(ring) == -1)
+		errmsg_exit1("shmdt failed, %s\n", ERR_MSG);
 
-	fprintf(stderr, "Received %ld bytes (%ld transfers)\n", bytes, tsfrs);
+	fprintf(stderr, "Received %ld bytes (%ld transfers), %.3f GB/s, "
+		"slept %ju times\n", bytes, tsfrs, bench_gbps(bytes, ns),
+		(uintmax_t)se.se_sleeps);
 
 	exit(EXIT_SUCCESS);
 }
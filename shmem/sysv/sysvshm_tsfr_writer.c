@@ -30,34 +30,48 @@
  *
  */
 #include "unibsd.h"
+#include "benchutil.h"
 #include <sys/shm.h>
-#include <sys/sem.h>
 #include <sys/stat.h>
+#include <getopt.h>
+#include "spscring.h"
 #include "sysvshm_tsfr.h"
 
+static void usage_info(const char *);
+
 int
-main(void)
+main(int argc, char *argv[])
 {
-	int semid, shmid;
-	long tsfrs = 0, bytes = 0;
-	struct shmseg *seg;
-
-	/*
-	 * Create set containing two semaphores; initialize so that writer has
-	 * first access to shared memory.
-	 */
-
-	if ((semid = semget(SYSV_SEM_KEY, 2, IPC_CREAT | IPC_OBJ_PERMS)) == -1)
-		errmsg_exit1("semget failed, %s\n", ERR_MSG);
-
-	if (svsem_avai_init(semid, SYSV_WRITE_SEM) == -1)
-		errmsg_exit1("svsem_avai_init failed\n");
-	if (svsem_inuse_init(semid, SYSV_READ_SEM) == -1)
-		errmsg_exit1("svsem_inuse_init failed\n");
+	int shmid, op;
+	long tsfrs = 0, bytes = 0, nslots = TSFR_NSLOTS;
+	size_t slotsz = TSFR_SLOTSZ;
+	ssize_t cnt;
+	struct spsc *ring;
+	struct spscend se;
+	uint64_t t0, ns;
+	char *buf;
+
+	while ((op = getopt(argc, argv, "n:s:")) != -1) {
+		switch (op) {
+		case 'n':
+			nslots = getlong(optarg, GN_GT_0);
+			break;
+		case 's':
+			slotsz = getsize(optarg);
+			if (slotsz == 0 || slotsz > UINT32_MAX / 2)
+				usage_info(argv[0]);
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind != argc || nslots > UINT32_MAX / 2 ||
+		(nslots & (nslots - 1)) != 0)
+		usage_info(argv[0]);
 
 	/* Create shared memory; attach at address chosen by system */
 
-	shmid = shmget(SYSV_SHM_KEY, sizeof(struct shmseg),
+	shmid = shmget(SYSV_SHM_KEY, spsc_size(nslots, slotsz),
 		IPC_CREAT | IPC_OBJ_PERMS);
 	if (shmid == -1)
 		errmsg_exit1("shmget failed, %s\n", ERR_MSG);
@@ -84,46 +98,58 @@ main(void)
 	 *
 	 *
 	 */
-	if ((seg = (struct shmseg *)shmat(shmid, NULL, 0)) == (void *)-1)
+	if ((ring = shmat(shmid, NULL, 0)) == (void *)-1)
 		errmsg_exit1("shmat failed, %s\n", ERR_MSG);
 
-	/* Transfer blocks of data from stdin to shared memory */
+	if (spsc_init(ring, nslots, slotsz) == -1)
+		errmsg_exit1("spsc_init failed, %s\n", ERR_MSG);
+	if (spsc_open(&se, ring, true) == -1)
+		errmsg_exit1("spsc_open failed, %s\n", ERR_MSG);
+
+	/* Read stdin straight into the free slots of the ring */
 
+	t0 = bench_nsec();
 	while (1) {
-		/* Wait for our turn */
-		if (svsem_wait(semid, SYSV_WRITE_SEM) == -1)
-			errmsg_exit1("svsem_wait (1) failed\n");
+		buf = spsc_wslot(&se);	/* Waits while the ring is full */
 
-		seg->shms_cnt = read(STDIN_FILENO, seg->shms_buf, BUF_SIZE);
-		if (seg->shms_cnt == -1)
+		if ((cnt = read(STDIN_FILENO, buf, slotsz)) == -1)
 			errmsg_exit1("read failed, %s\n", ERR_MSG);
 
-		/* Give reader a turn */
-		if (svsem_post(semid, SYSV_READ_SEM) == -1)
-			errmsg_exit1("svsem_post failed\n");
+		spsc_push(&se, cnt);	/* Hands the slot to the reader */
 
-		if (seg->shms_cnt == 0)
+		if (cnt == 0)
 			break;
 
 		tsfrs++;
-		bytes += seg->shms_cnt;
+		bytes += cnt;
 	}
 
 	/*
-	 * Wait until reader has let us have one more turn. We then know reader
-	 * has finished, and so we can delete the IPC objects.
+	 * Wait until the reader has taken the last slot. We then know reader
+	 * has finished, and so we can delete the segment.
 	 */
-	if (svsem_wait(semid, SYSV_WRITE_SEM) == -1)
-		errmsg_exit1("svsem_wait (2) failed\n");
+	spsc_drain(&se);
+	ns = bench_nsec() - t0;
 
-	if (semctl(semid, 0, IPC_RMID) == -1)
-		errmsg_exit1("semctl - IPC_RMID failed, %s\n", ERR_MSG);
-	if (shmdt(seg) == -1)
+	if (shmdt(ring) == -1)
 		errmsg_exit1("shmdt failed, %s\n", ERR_MSG);
 	if (shmctl(shmid, IPC_RMID, NULL))
 		errmsg_exit1("shmctl - IPC_RMID failed, %s\n", ERR_MSG);
 
-	fprintf(stderr, "Send %ld bytes (%ld transfers)\n", bytes, tsfrs);
+	fprintf(stderr, "Send %ld bytes (%ld transfers), %.3f GB/s, "
+		"slept %ju times\n", bytes, tsfrs, bench_gbps(bytes, ns),
+		(uintmax_t)se.se_sleeps);
 
 	exit(EXIT_SUCCESS);
 }
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-n slots] [-s slot-size]\n", pname);
+	fprintf(stderr, "-n: slots in the ring, a power of 2 (default %d).\n",
+		TSFR_NSLOTS);
+	fprintf(stderr, "-s: bytes per slot (default %dk).\n",
+		TSFR_SLOTSZ / 1024);
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,284 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "arena.h"
+
+/*
+ * Short-lived allocations, malloc(3) against arenas. Each thread runs rounds
+ * of 'nalloc' allocations of random sizes, touches them, and frees them all
+ * at the end of the round, as a server does per request: one free() each
+ * with malloc, one arena_reset() with an arena. With -k, one allocation in
+ * 'keep' outlives its round, which is what fragments a malloc heap; with
+ * arenas those go to a second, long-lived arena of the thread.
+ *
+ * Each allocator runs in a child process of its own, so the resident set
+ * reported after the run, with the survivors still allocated, is its own.
+ */
+enum { AB_MALLOC, AB_ARENA, AB_NMODES };
+static const char *abnames[AB_NMODES] = { "malloc", "arena" };
+
+static struct {
+	int		mode;
+	int		nalloc;
+	int		rounds;
+	int		keep;
+	size_t		minsz;
+	size_t		maxsz;
+} g = {
+	.nalloc = 1000,
+	.rounds = 2000,
+	.minsz = 16,
+	.maxsz = 512
+};
+
+struct abthr {
+	pthread_t	at_tid;
+	unsigned int	at_seed;
+	uint64_t	at_live;	/* Bytes of the survivors */
+	void		**at_kept;	/* The survivors, for malloc */
+	size_t		at_nkept;
+} __attribute__((aligned(64)));
+
+static void run(int, int);
+static void * bench_thread(void *);
+static long rss_now(void);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, nthrs = 1, flags = 0, m, status;
+	char *sep;
+	pid_t pid;
+
+	while ((op = getopt(argc, argv, "j:n:r:s:k:HT")) != -1) {
+		switch (op) {
+		case 'j':
+			nthrs = getlong(optarg, GN_GT_0);
+			break;
+		case 'n':
+			g.nalloc = getlong(optarg, GN_GT_0);
+			break;
+		case 'r':
+			g.rounds = getlong(optarg, GN_GT_0);
+			break;
+		case 's':
+			if ((sep = strchr(optarg, '-')) == NULL)
+				usage_info(argv[0]);
+			*sep = '\0';
+			g.minsz = getsize(optarg);
+			g.maxsz = getsize(sep + 1);
+			if (g.minsz == 0 || g.maxsz < g.minsz)
+				usage_info(argv[0]);
+			break;
+		case 'k':
+			g.keep = getlong(optarg, GN_GT_0);
+			break;
+		case 'H':
+			flags |= ARENA_HUGETLB;
+			break;
+		case 'T':
+			flags |= ARENA_THP;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage_info(argv[0]);
+
+	printf("%d threads x %d rounds x %d allocations of %zu-%zu bytes",
+		nthrs, g.rounds, g.nalloc, g.minsz, g.maxsz);
+	if (g.keep > 0)
+		printf(", 1 in %d kept", g.keep);
+	printf("\n%-8s %10s %12s %10s %10s %10s\n", "", "ns/alloc",
+		"allocs/s", "live MiB", "RSS MiB", "peak MiB");
+	fflush(stdout);
+
+	for (m = 0; m < AB_NMODES; m++) {
+		if ((pid = fork()) == -1)
+			errmsg_exit1("fork failed, %s\n", ERR_MSG);
+		if (pid == 0) {
+			g.mode = m;
+			arena_setflags(flags);
+			run(nthrs, flags);
+			_exit(EXIT_SUCCESS);
+		}
+		if (waitpid(pid, &status, 0) == -1)
+			errmsg_exit1("waitpid failed, %s\n", ERR_MSG);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			errmsg_exit1("%s run failed\n", abnames[m]);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/* One allocator, in the child */
+static void
+run(int nthrs, int flags)
+{
+	struct abthr *ta;
+	struct arenastat as;
+	struct rusage ru;
+	uint64_t t0, ns, live = 0, total;
+	int i, r;
+
+	ta = xcalloc(nthrs, sizeof(struct abthr));
+	t0 = bench_nsec();
+	for (i = 0; i < nthrs; i++) {
+		ta[i].at_seed = i + 1;
+		if ((r = pthread_create(&ta[i].at_tid, NULL, bench_thread,
+			&ta[i])) != 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+	}
+	for (i = 0; i < nthrs; i++)
+		if ((r = pthread_join(ta[i].at_tid, NULL)) != 0)
+			errmsg_exit1("pthread_join failed, %s\n", strerror(r));
+	ns = bench_nsec() - t0;
+
+	/* The threads have exited: their round arenas are idle runs now */
+	if (g.mode == AB_ARENA)
+		arena_trim();
+
+	for (i = 0; i < nthrs; i++)
+		live += ta[i].at_live;
+	total = (uint64_t)nthrs * g.rounds * g.nalloc;
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		errmsg_exit1("getrusage failed, %s\n", ERR_MSG);
+	printf("%-8s %10.1f %12.0f %10.1f %10.1f %10.1f\n", abnames[g.mode],
+		(double)ns / (double)total,
+		(double)total / bench_secs(ns), (double)live / MIB,
+		(double)rss_now() / MIB, (double)ru.ru_maxrss / 1024);
+	if (g.mode == AB_ARENA && (flags & ARENA_HUGETLB)) {
+		arena_getstat(&as);
+		printf("%-8s %zu of %zu MiB on huge pages\n", "", as.as_huge /
+			MIB, as.as_mapped / MIB);
+	}
+	fflush(stdout);
+}
+
+static void *
+bench_thread(void *arg)
+{
+	struct abthr *ta = arg;
+	struct arena round = ARENA_INITIALIZER, kept = ARENA_INITIALIZER;
+	void **ptrs;
+	size_t sz, cap = 0;
+	int rnd, i;
+	char *p;
+
+	ptrs = xcalloc(g.nalloc, sizeof(void *));
+	for (rnd = 0; rnd < g.rounds; rnd++) {
+		for (i = 0; i < g.nalloc; i++) {
+			sz = g.minsz + rand_r(&ta->at_seed) %
+				(g.maxsz - g.minsz + 1);
+			if (g.keep > 0 && rand_r(&ta->at_seed) % g.keep == 0) {
+				if (g.mode == AB_ARENA) {
+					p = arena_alloc(&kept, sz);
+				} else {
+					p = xmalloc(sz);
+					if (ta->at_nkept == cap) {
+						cap = cap == 0 ? 1024 : cap * 2;
+						ta->at_kept = realloc(ta->at_kept,
+							cap * sizeof(void *));
+						if (ta->at_kept == NULL)
+							errmsg_exit1("realloc "
+								"failed, %s\n",
+								ERR_MSG);
+					}
+					ta->at_kept[ta->at_nkept++] = p;
+				}
+				ta->at_live += sz;
+				ptrs[i] = NULL;
+			} else {
+				p = g.mode == AB_ARENA ?
+					arena_alloc(&round, sz) : xmalloc(sz);
+				ptrs[i] = p;
+			}
+			memset(p, i, sz);	/* Use it */
+		}
+		if (g.mode == AB_ARENA)
+			arena_reset(&round);
+		else
+			for (i = 0; i < g.nalloc; i++)
+				xfree(ptrs[i]);
+	}
+
+	/* The survivors stay allocated until the process exits */
+	arena_free(&round);
+	xfree(ptrs);
+
+	return NULL;
+}
+
+/* Current resident set in bytes; the peak where it cannot be had */
+static long
+rss_now(void)
+{
+#ifdef __linux__
+	FILE *fp;
+	long size, rss;
+
+	if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(fp, "%ld %ld", &size, &rss) != 2)
+			rss = 0;
+		fclose(fp);
+		return rss * sysconf(_SC_PAGESIZE);
+	}
+#endif
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		errmsg_exit1("getrusage failed, %s\n", ERR_MSG);
+	return ru.ru_maxrss * 1024;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-n allocs] [-r rounds] "
+		"[-s min-max] [-k keep] [-H] [-T]\n", pname);
+	fprintf(stderr, "-j: threads allocating (default 1).\n");
+	fprintf(stderr, "-n: allocations per round (default 1000).\n");
+	fprintf(stderr, "-r: rounds per thread (default 2000).\n");
+	fprintf(stderr, "-s: range of allocation sizes (default 16-512).\n");
+	fprintf(stderr, "-k: keep one allocation in this many to the end.\n");
+	fprintf(stderr, "-H: back the arenas with explicit huge pages.\n");
+	fprintf(stderr, "-T: advise the arenas MADV_HUGEPAGE.\n");
+	exit(EXIT_FAILURE);
+}
@@ -29,29 +29,80 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* readahead(), splice() */
+#endif
 #include "unibsd.h"
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <getopt.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+#include "benchutil.h"
+#include "streamrd.h"
+
+#define CHUNK	(1024 * 1024)	/* Bytes written per write() */
+#define WINDOW	(8 * CHUNK)	/* Bytes of the file mapped at a time */
+
+/*
+ * How the file gets to standard output. With 'auto' the kind of stdout picks
+ * one: sendfile(2) for a socket, splice(2) for a pipe, and write(2) out of a
+ * window of the mapping for anything else. The first two move the pages of
+ * the page cache into the socket or pipe without copying them through user
+ * space; they fall back to write(2) when the kernel refuses.
+ */
+enum { CAT_AUTO, CAT_SENDFILE, CAT_SPLICE, CAT_WRITE };
+
+static const char *cat_names[] = { "auto", "sendfile", "splice", "write" };
+
+static int cat_sendfile(int, struct streamrd *, off_t);
+static int cat_splice(int, struct streamrd *, off_t);
+static void cat_write(int, struct streamrd *, off_t);
+static void report(int, off_t, uint64_t);
+static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
-	int fd;
-	struct stat fs;
-	char *addr;
+	int fd, op, flags = 0, mode = CAT_AUTO, r;
+	bool verbose = false;
+	struct stat fs, os;
+	struct streamrd sr;
+	uint64_t t0;
 
-	if (argc < 2 || strcmp(argv[1], "--help") == 0)
-		errmsg_exit1("Usage: %s file\n", argv[0]);
+	while ((op = getopt(argc, argv, "nm:v")) != -1) {
+		switch (op) {
+		case 'n':
+			flags = SR_NOCACHE;	/* Leave the cache as it was */
+			break;
+		case 'm':
+			for (mode = 0; mode <= CAT_WRITE; mode++)
+				if (strcmp(optarg, cat_names[mode]) == 0)
+					break;
+			if (mode > CAT_WRITE)
+				usage_info(argv[0]);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+		usage_info(argv[0]);
 
-	if ((fd = open(argv[1], O_RDONLY)) == -1)
-		errmsg_exit1("open file '%s' failed, %s\n", argv[1], ERR_MSG);
-
-	/*
-	 * Obtain the size of the file and use it to specify the size of the
-	 * mapping and the size of the buffer to be written 
-	 */
+	if ((fd = open(argv[optind], O_RDONLY)) == -1)
+		errmsg_exit1("open file '%s' failed, %s\n", argv[optind],
+			ERR_MSG);
 
+	/* Obtain the size of the file, the number of bytes to be written */
 	if (fstat(fd, &fs) == -1)
 		errmsg_exit1("fstat failed, %s\n", ERR_MSG);
 
@@ -63,27 +114,189 @@ main(int argc, char *argv[])
 	if (fs.st_size == 0)
 		exit(EXIT_SUCCESS);
 
-	/*
-	 * MAP_PRIVATE	Modifications are private.
-	 *
-	 * Upon successful completion, mmap() returns a pointer to the mapped
-	 * region. Otherwise, a value of MAP_FAILED is returned and errno is set
-	 * to indicate the error.
-	 */
-	addr = mmap(NULL, fs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (addr == MAP_FAILED)
-		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
-
-	if (write(STDOUT_FILENO, addr, fs.st_size) != fs.st_size)
-		errmsg_exit1("write failed, %s\n", ERR_MSG);
+	if (mode == CAT_AUTO) {
+		if (fstat(STDOUT_FILENO, &os) == -1)
+			errmsg_exit1("fstat failed, %s\n", ERR_MSG);
+		if (S_ISSOCK(os.st_mode))
+			mode = CAT_SENDFILE;
+		else if (S_ISFIFO(os.st_mode))
+			mode = CAT_SPLICE;
+		else
+			mode = CAT_WRITE;
+	}
 
 	/*
-	 * The munmap() system call deletes the mappings and guards for the
-	 * specified address range, and causes further references to addresses
-	 * within the range to generate invalid memory references.
+	 * The window of the mapping moves along the file, so the stream does
+	 * not hold a mapping for sr_map; with -n the pages behind the cursor
+	 * are dropped from the cache only.
 	 */
-	if (munmap(addr, fs.st_size) == -1)
-		errmsg_exit1("munmap failed, %s\n", ERR_MSG);
+	t0 = bench_nsec();
+	sr_init(&sr, fd, 0, flags, NULL);
+	r = 0;
+	if (mode == CAT_SENDFILE)
+		r = cat_sendfile(fd, &sr, fs.st_size);
+	else if (mode == CAT_SPLICE)
+		r = cat_splice(fd, &sr, fs.st_size);
+	if (r == -1) {
+		/* Refused before it moved anything: do it the plain way */
+		if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP &&
+			errno != ENOTSOCK)
+			errmsg_exit1("%s failed, %s\n", cat_names[mode],
+				ERR_MSG);
+		mode = CAT_WRITE;
+	}
+	if (mode == CAT_WRITE)
+		cat_write(fd, &sr, fs.st_size);
+	sr_done(&sr);
 
+	if (verbose)
+		report(mode, fs.st_size, bench_nsec() - t0);
 	exit(EXIT_SUCCESS);
 }
+
+/*
+ * sendfile(2) from the file to a stream socket on stdout. Linux takes any
+ * output since 2.6.33; FreeBSD's writes to stream sockets only.
+ */
+static int
+cat_sendfile(int fd, struct streamrd *sr, off_t size)
+{
+	off_t off;
+	size_t len;
+	ssize_t n;
+#ifndef __linux__
+	off_t sbytes;
+#endif
+
+	for (off = sr->sr_off; off < size; off = sr->sr_off) {
+		len = MIN(size - off, CHUNK);
+#ifdef __linux__
+		n = sendfile(STDOUT_FILENO, fd, &off, len);
+#else
+		sbytes = 0;
+		n = sendfile(fd, STDOUT_FILENO, off, len, NULL, &sbytes, 0);
+		if (n == 0 || sbytes > 0)
+			n = sbytes;
+#endif
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (sr->sr_off > 0)
+				errmsg_exit1("sendfile failed, %s\n", ERR_MSG);
+			return -1;
+		}
+		if (n == 0)
+			break;		/* The file shrank */
+		sr_advance(sr, n);
+	}
+
+	return 0;
+}
+
+/*
+ * splice(2) the file into the pipe on stdout: the pipe buffers take
+ * references to the pages of the page cache instead of copies of them.
+ */
+static int
+cat_splice(int fd, struct streamrd *sr, off_t size)
+{
+#ifdef __linux__
+	off_t off;
+	size_t len;
+	ssize_t n;
+
+	for (off = sr->sr_off; off < size; off = sr->sr_off) {
+		len = MIN(size - off, CHUNK);
+		n = splice(fd, &off, STDOUT_FILENO, NULL, len,
+			SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (sr->sr_off > 0)
+				errmsg_exit1("splice failed, %s\n", ERR_MSG);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		sr_advance(sr, n);
+	}
+
+	return 0;
+#else
+	(void)fd;
+	(void)sr;
+	(void)size;
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/*
+ * Map WINDOW bytes of the file at a time and write them out a chunk at a
+ * time, so only a window of the file is ever mapped, however big it is.
+ */
+static void
+cat_write(int fd, struct streamrd *sr, off_t size)
+{
+	off_t off, base;
+	size_t len, wlen;
+	char *addr;
+
+	for (base = sr->sr_off - sr->sr_off % WINDOW; base < size;
+		base += WINDOW) {
+		wlen = MIN(size - base, WINDOW);
+
+		/*
+		 * MAP_PRIVATE	Modifications are private.
+		 *
+		 * Upon successful completion, mmap() returns a pointer to the
+		 * mapped region. Otherwise, a value of MAP_FAILED is returned
+		 * and errno is set to indicate the error.
+		 */
+		addr = mmap(NULL, wlen, PROT_READ, MAP_PRIVATE, fd, base);
+		if (addr == MAP_FAILED)
+			errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+
+		for (off = sr->sr_off - base; off < (off_t)wlen; off += len) {
+			len = MIN(wlen - off, CHUNK);
+			if (write(STDOUT_FILENO, addr + off, len) !=
+				(ssize_t)len)
+				errmsg_exit1("write failed, %s\n", ERR_MSG);
+			sr_advance(sr, len);
+		}
+
+		/*
+		 * The munmap() system call deletes the mappings and guards for
+		 * the specified address range, and causes further references
+		 * to addresses within the range to generate invalid memory
+		 * references.
+		 */
+		if (munmap(addr, wlen) == -1)
+			errmsg_exit1("munmap failed, %s\n", ERR_MSG);
+	}
+}
+
+/* Print the throughput and the CPU time the copy took */
+static void
+report(int mode, off_t size, uint64_t ns)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		errmsg_exit1("getrusage failed, %s\n", ERR_MSG);
+	fprintf(stderr, "%s: %jd bytes, %.3f s, %.1f MB/s, "
+		"user %ld.%03lds sys %ld.%03lds\n", cat_names[mode],
+		(intmax_t)size, bench_secs(ns), bench_mbps(size, ns),
+		(long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec / 1000,
+		(long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec / 1000);
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-n] [-m mode] [-v] file\n", pname);
+	fprintf(stderr, "-n: drop the file from the page cache as it goes.\n");
+	fprintf(stderr, "-m: auto (default), sendfile, splice or write.\n");
+	fprintf(stderr, "-v: print the throughput and the CPU time.\n");
+	exit(EXIT_FAILURE);
+}
@@ -29,23 +29,95 @@
  * SUCH DAMAGE.
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* SEEK_DATA, SEEK_HOLE */
+#endif
 #include "unibsd.h"
+#include "benchutil.h"
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/resource.h>
+#include <getopt.h>
+#include <pthread.h>
+
+/*
+ * MAP_POPULATE prefaults a mapping at mmap() time; where it is missing, ask
+ * for the pages with MADV_WILLNEED instead.
+ */
+#ifdef MAP_POPULATE
+#define MM_POPULATE	MAP_POPULATE
+#else
+#define MM_POPULATE	0
+#endif
+
+#define MM_MAXTHRS	256	/* Most threads of a parallel copy */
+
+/* State shared by the threads of a parallel copy */
+static struct {
+	char		*pm_src;	/* Source mapping */
+	char		*pm_dst;	/* Destination mapping */
+	off_t		pm_size;	/* Size of both mappings */
+	size_t		pm_chunk;	/* Bytes per chunk */
+	off_t		pm_next;	/* Offset of the next chunk to copy */
+	off_t		pm_done;	/* Bytes copied so far */
+	int		pm_live;	/* Threads still running */
+	pthread_mutex_t	pm_mtx;
+	pthread_cond_t	pm_cnd;
+} pm = {
+	.pm_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.pm_cnd = PTHREAD_COND_INITIALIZER
+};
+
+static void parallel_copy(int, size_t);
+static void sparse_copy(int, int, const char *, char *, off_t);
+static void window_copy(int, int, off_t, size_t);
+static void report(const char *, off_t, uint64_t);
+static void * copy_thread(void *);
+static void usage_info(const char *);
 
 int
 main(int argc, char *argv[])
 {
-	int fdsrc, fddst;
+	int fdsrc, fddst, op, nthrs = 0, r;
+	bool sparse = false, verbose = false;
+	size_t chunk = 64 * MIB, win = 0;
+	uint64_t t0;
 	char *src, *dst;
 	struct stat fs;
 
-	if (argc != 3)
-		errmsg_exit1("Usage: %s source-file dest-file\n", argv[0]);
+	while ((op = getopt(argc, argv, "j:c:sw:v")) != -1) {
+		switch (op) {
+		case 'j':
+			nthrs = getint(optarg);
+			if (nthrs < 1 || nthrs > MM_MAXTHRS)
+				usage_info(argv[0]);
+			break;
+		case 'c':
+			if ((chunk = getsize(optarg)) == 0)
+				errmsg_exit1("Must be greater than 0, %s\n",
+					optarg);
+			break;
+		case 's':
+			sparse = true;
+			break;
+		case 'w':
+			if ((win = getsize(optarg)) == 0)
+				errmsg_exit1("Must be greater than 0, %s\n",
+					optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || (win > 0 && (nthrs > 0 || sparse)))
+		usage_info(argv[0]);
 
-	if ((fdsrc = open(argv[1], O_RDONLY)) == -1)
-		errmsg_exit1("open '%s' failed, %s\n", argv[1], ERR_MSG);
+	if ((fdsrc = open(argv[optind], O_RDONLY)) == -1)
+		errmsg_exit1("open '%s' failed, %s\n", argv[optind], ERR_MSG);
 
 	/*
 	 * Use fstat() to obtain size of file: we use this to specify the size
@@ -63,27 +135,276 @@ main(int argc, char *argv[])
 	if (fs.st_size == 0)
 		exit(EXIT_SUCCESS);
 
-	src = mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fdsrc, 0);
-	if (src == MAP_FAILED)
-		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
-
-	
-	fddst = open(argv[2], O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	fddst = open(argv[optind + 1], O_RDWR | O_CREAT | O_TRUNC,
+		S_IRUSR | S_IWUSR);
 	if (fddst == -1)
-		errmsg_exit1("open '%s' failed, %s\n", argv[2], ERR_MSG);
+		errmsg_exit1("open '%s' failed, %s\n", argv[optind + 1],
+			ERR_MSG);
+
+	/*
+	 * In parallel and windowed mode, allocate the blocks of the destination
+	 * up front: threads storing into a sparse mapping at scattered offsets
+	 * would otherwise allocate (and fragment) it one page fault at a time,
+	 * and a full file system would show up as SIGBUS instead of an error
+	 * here. posix_fallocate() returns the error number instead of setting
+	 * errno.
+	 */
+	if ((nthrs > 0 || win > 0) && !sparse &&
+		(r = posix_fallocate(fddst, 0, fs.st_size)) != 0 &&
+		r != EINVAL && r != EOPNOTSUPP)
+		errmsg_exit1("posix_fallocate failed, %s\n", strerror(r));
 
 	if (ftruncate(fddst, fs.st_size) == -1)
 		errmsg_exit1("ftruncate failed, %s\n", ERR_MSG);
 
+	t0 = bench_nsec();
+	if (win > 0) {
+		window_copy(fdsrc, fddst, fs.st_size, win);
+		if (verbose)
+			report("windowed", fs.st_size, bench_nsec() - t0);
+		exit(EXIT_SUCCESS);
+	}
+
+	src = mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fdsrc, 0);
+	if (src == MAP_FAILED)
+		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+
 	dst = mmap(NULL, fs.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
 		fddst, 0);
 	if (dst == MAP_FAILED)
 		errmsg_exit1("mmap failed, %s\n", ERR_MSG);
 
+	if (sparse) {
+		sparse_copy(fdsrc, fddst, src, dst, fs.st_size);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (nthrs > 0) {
+		pm.pm_src = src;
+		pm.pm_dst = dst;
+		pm.pm_size = fs.st_size;
+
+		parallel_copy(nthrs, chunk);
+		fprintf(stderr, "\n%d threads, %jd bytes, %.3f GB/s\n", nthrs,
+			(intmax_t)fs.st_size,
+			bench_gbps(fs.st_size, bench_nsec() - t0));
+		exit(EXIT_SUCCESS);
+	}
+
 	memcpy(dst, src, fs.st_size);	/* Copy bytes between mappings */
 
 	if (msync(dst, fs.st_size, MS_SYNC) == -1)
 		errmsg_exit1("msync failed, %s\n", ERR_MSG);
 
+	if (verbose)
+		report("whole file", fs.st_size, bench_nsec() - t0);
 	exit(EXIT_SUCCESS);
 }
+
+/*
+ * Copy through a pair of mappings of 'win' bytes that slide along the files,
+ * so the address space and the resident set stay bounded by the window
+ * instead of growing with the file. The source is read sequentially, so the
+ * kernel may read ahead aggressively and reclaim what is behind; the
+ * destination window is prefaulted so memcpy() does not stop on every page.
+ * Each window is flushed asynchronously and unmapped; one fsync() at the end
+ * waits for the writeback, as the MS_SYNC of the whole-file copy does.
+ */
+static void
+window_copy(int fdsrc, int fddst, off_t size, size_t win)
+{
+	off_t off;
+	size_t len;
+	long pagesz;
+	char *src, *dst;
+
+	pagesz = sysconf(_SC_PAGESIZE);
+	win = (win + pagesz - 1) / pagesz * pagesz;
+
+	for (off = 0; off < size; off += len) {
+		len = MIN((off_t)win, size - off);
+
+		src = mmap(NULL, len, PROT_READ, MAP_SHARED, fdsrc, off);
+		if (src == MAP_FAILED)
+			errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+		if (madvise(src, len, MADV_SEQUENTIAL) == -1)
+			errmsg_exit1("madvise failed, %s\n", ERR_MSG);
+		if (madvise(src, len, MADV_WILLNEED) == -1)
+			errmsg_exit1("madvise failed, %s\n", ERR_MSG);
+#ifdef MADV_HUGEPAGE
+		/* Only honoured where the page cache can use huge pages */
+		(void)madvise(src, len, MADV_HUGEPAGE);
+#endif
+
+		dst = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MM_POPULATE, fddst, off);
+		if (dst == MAP_FAILED)
+			errmsg_exit1("mmap failed, %s\n", ERR_MSG);
+		if (MM_POPULATE == 0 && madvise(dst, len, MADV_WILLNEED) == -1)
+			errmsg_exit1("madvise failed, %s\n", ERR_MSG);
+
+		memcpy(dst, src, len);
+
+		if (msync(dst, len, MS_ASYNC) == -1)
+			errmsg_exit1("msync failed, %s\n", ERR_MSG);
+		if (munmap(dst, len) == -1 || munmap(src, len) == -1)
+			errmsg_exit1("munmap failed, %s\n", ERR_MSG);
+	}
+
+	if (fsync(fddst) == -1)
+		errmsg_exit1("fsync failed, %s\n", ERR_MSG);
+}
+
+/* Print the throughput and the peak resident set size of the process */
+static void
+report(const char *label, off_t size, uint64_t ns)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		errmsg_exit1("getrusage failed, %s\n", ERR_MSG);
+	fprintf(stderr, "%s: %jd bytes, %.3f GB/s, peak RSS %ld MiB\n",
+		label, (intmax_t)size, bench_gbps(size, ns),
+		ru.ru_maxrss / 1024);	/* ru_maxrss is in KiB */
+}
+
+/*
+ * Start 'nthrs' threads that copy page aligned chunks between the two
+ * mappings, and print the progress about once a second until they are done.
+ */
+static void
+parallel_copy(int nthrs, size_t chunk)
+{
+	int i, r;
+	long pagesz;
+	pthread_t *tids;
+	struct timespec ts;
+
+	pagesz = sysconf(_SC_PAGESIZE);
+	pm.pm_chunk = (chunk + pagesz - 1) / pagesz * pagesz;
+	pm.pm_live = nthrs;
+
+	tids = xcalloc(nthrs, sizeof(pthread_t));
+	for (i = 0; i < nthrs; i++)
+		if ((r = pthread_create(&tids[i], NULL, copy_thread, NULL))
+			!= 0)
+			errmsg_exit1("pthread_create failed, %s\n",
+				strerror(r));
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec++;
+	if ((r = pthread_mutex_lock(&pm.pm_mtx)) != 0)
+		errmsg_exit1("pthread_mutex_lock failed, %d\n", r);
+	while (pm.pm_live > 0) {
+		r = pthread_cond_timedwait(&pm.pm_cnd, &pm.pm_mtx, &ts);
+		if (r == ETIMEDOUT) {
+			fprintf(stderr, "\r%jd/%jd MiB",
+				(intmax_t)(pm.pm_done / MIB),
+				(intmax_t)(pm.pm_size / MIB));
+			ts.tv_sec++;
+		}
+	}
+	if ((r = pthread_mutex_unlock(&pm.pm_mtx)) != 0)
+		errmsg_exit1("pthread_mutex_unlock failed, %d\n", r);
+	fprintf(stderr, "\r%jd/%jd MiB", (intmax_t)(pm.pm_done / MIB),
+		(intmax_t)(pm.pm_size / MIB));
+
+	for (i = 0; i < nthrs; i++)
+		if ((r = pthread_join(tids[i], NULL)) != 0)
+			errmsg_exit1("pthread_join failed, %d\n", r);
+	xfree(tids);
+}
+
+static void *
+copy_thread(void *arg)
+{
+	off_t off;
+	size_t len;
+
+	(void)arg;
+
+	while (1) {
+		pthread_mutex_lock(&pm.pm_mtx);
+		if (pm.pm_next >= pm.pm_size) {
+			pm.pm_live--;
+			pthread_cond_signal(&pm.pm_cnd);
+			pthread_mutex_unlock(&pm.pm_mtx);
+			break;
+		}
+		off = pm.pm_next;
+		len = MIN((off_t)pm.pm_chunk, pm.pm_size - off);
+		pm.pm_next += len;
+		pthread_mutex_unlock(&pm.pm_mtx);
+
+		/*
+		 * Each thread flushes its own chunk, so the writeback is
+		 * spread over the threads as well.
+		 */
+		memcpy(pm.pm_dst + off, pm.pm_src + off, len);
+		if (msync(pm.pm_dst + off, len, MS_SYNC) == -1)
+			errmsg_exit1("msync failed, %s\n", ERR_MSG);
+
+		pthread_mutex_lock(&pm.pm_mtx);
+		pm.pm_done += len;
+		pthread_mutex_unlock(&pm.pm_mtx);
+	}
+
+	return NULL;
+}
+
+/*
+ * Copy only the extents of the source that hold data. lseek(2) with SEEK_DATA
+ * and SEEK_HOLE walks the extents; the pages of the destination mapping that
+ * fall in a hole are never touched, so the hole left by ftruncate() stays a
+ * hole. Report the logical and physical sizes and the bytes copied.
+ */
+static void
+sparse_copy(int fdsrc, int fddst, const char *src, char *dst, off_t size)
+{
+	off_t off, data, hole, xfer = 0;
+	struct stat fs;
+
+	for (off = 0; off < size; off = hole) {
+		if ((data = lseek(fdsrc, off, SEEK_DATA)) == -1) {
+			if (errno != ENXIO)
+				errmsg_exit1("lseek SEEK_DATA failed, %s\n",
+					ERR_MSG);
+			break;		/* Only a hole is left */
+		}
+		if (data >= size)
+			break;
+		if ((hole = lseek(fdsrc, data, SEEK_HOLE)) == -1)
+			errmsg_exit1("lseek SEEK_HOLE failed, %s\n", ERR_MSG);
+		hole = MIN(hole, size);
+
+		memcpy(dst + data, src + data, hole - data);
+		if (msync(dst + data, hole - data, MS_SYNC) == -1)
+			errmsg_exit1("msync failed, %s\n", ERR_MSG);
+		xfer += hole - data;
+	}
+
+	if (fstat(fdsrc, &fs) == -1)
+		errmsg_exit1("fstat failed, %s\n", ERR_MSG);
+	printf("logical size:      %14jd\n", (intmax_t)fs.st_size);
+	printf("physical size:     %14jd\n", (intmax_t)fs.st_blocks * 512);
+	printf("bytes transferred: %14jd\n", (intmax_t)xfer);
+
+	if (fstat(fddst, &fs) == -1)
+		errmsg_exit1("fstat failed, %s\n", ERR_MSG);
+	printf("destination size:  %14jd\n", (intmax_t)fs.st_blocks * 512);
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-c chunk] [-s] [-w window] "
+		"[-v] source-file dest-file\n", pname);
+	fprintf(stderr, "-j: copy in parallel with this many threads, up to "
+		"%d.\n", MM_MAXTHRS);
+	fprintf(stderr, "-c: chunk size of the parallel copy (default 64m).\n");
+	fprintf(stderr, "-s: copy only the data, keep the holes.\n");
+	fprintf(stderr, "-w: copy through sliding windows of this size "
+		"(e.g. 64m-256m)\n    instead of mapping the whole files.\n");
+	fprintf(stderr, "-v: print the throughput and the peak RSS.\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,358 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifdef __linux__
+#define _GNU_SOURCE	/* O_NOATIME */
+#endif
+#include "unibsd.h"
+#include "benchutil.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include "../file/dir/treewalk.h"
+
+/*
+ * Reports how much of a set of files is in the page cache, and optionally
+ * changes that first, in the manner of vmtouch(8). Directories are walked in
+ * parallel; every regular file is mapped a window at a time and mincore(2)
+ * tells which of its pages are resident.
+ *
+ *	-t	warm: MADV_WILLNEED on the window, then touch a byte of each
+ *		page, so the file is read in before the residency is taken
+ *	-l	lock: map the whole file and mlock(2) it, then stay until a
+ *		signal arrives, keeping the files in memory meanwhile
+ *	-e	evict: posix_fadvise(POSIX_FADV_DONTNEED) the file first
+ *
+ * Dirty or mapped pages may survive an eviction, so the counts after -e show
+ * what the kernel actually let go.
+ */
+#define PT_WARM		0x01
+#define PT_LOCK		0x02
+#define PT_EVICT	0x04
+
+#define PT_WINDOW	(64 * MIB)	/* Bytes of a file mapped at a time */
+
+/* Per-thread counters, each on its own cache line */
+struct ptstat {
+	uint64_t	ps_files;
+	uint64_t	ps_pages;
+	uint64_t	ps_resident;
+	uint64_t	ps_bytes;
+	uint64_t	ps_errors;
+	unsigned char	*ps_vec;	/* mincore() vector of a window */
+} __attribute__((aligned(64)));
+
+static struct {
+	int		flags;
+	bool		verbose;
+	long		pagesz;
+	int		nfiles;		/* File operands */
+	char		**files;
+	atomic_int	next;		/* Next file operand to take */
+	struct ptstat	*stats;
+} g;
+
+static void * file_thread(void *);
+static int walk_entry(struct twent *, void *);
+static void touch_file(struct ptstat *, int, const char *, const char *);
+static void onsig(int);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, nthrs = 1, ndirs = 0, i, r;
+	char **dirs;
+	pthread_t *tids;
+	struct treewalk tw;
+	struct ptstat tot;
+	struct stat st;
+	uint64_t start, ns;
+
+	while ((op = getopt(argc, argv, "tlej:v")) != -1) {
+		switch (op) {
+		case 't':
+			g.flags |= PT_WARM;
+			break;
+		case 'l':
+			g.flags |= PT_LOCK;
+			break;
+		case 'e':
+			g.flags |= PT_EVICT;
+			break;
+		case 'j':
+			nthrs = getint(optarg);
+			if (nthrs < 1 || nthrs > TW_MAXTHRS)
+				errmsg_exit1("Threads must be in [1, %d], %s\n",
+					TW_MAXTHRS, optarg);
+			break;
+		case 'v':
+			g.verbose = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind >= argc || ((g.flags & PT_EVICT) &&
+		(g.flags & (PT_WARM | PT_LOCK))))
+		usage_info(argv[0]);
+
+	g.pagesz = sysconf(_SC_PAGESIZE);
+	g.stats = xcalloc(nthrs, sizeof(struct ptstat));
+	for (i = 0; i < nthrs; i++)
+		g.stats[i].ps_vec = xmalloc(PT_WINDOW / g.pagesz);
+
+	/* Directories go to the tree walker, the rest to a pool of threads */
+	g.files = xcalloc(argc - optind, sizeof(char *));
+	dirs = xcalloc(argc - optind, sizeof(char *));
+	for (i = optind; i < argc; i++) {
+		if (stat(argv[i], &st) == -1) {
+			fprintf(stderr, "stat '%s' failed, %s\n", argv[i],
+				ERR_MSG);
+			g.stats[0].ps_errors++;
+		} else if (S_ISDIR(st.st_mode)) {
+			dirs[ndirs++] = argv[i];
+		} else {
+			g.files[g.nfiles++] = argv[i];
+		}
+	}
+
+	start = bench_nsec();
+	if (g.nfiles > 0) {
+		tids = xcalloc(nthrs, sizeof(pthread_t));
+		for (i = 0; i < nthrs; i++)
+			if ((r = pthread_create(&tids[i], NULL, file_thread,
+				&g.stats[i])) != 0)
+				errmsg_exit1("pthread_create failed, %s\n",
+					strerror(r));
+		for (i = 0; i < nthrs; i++)
+			if ((r = pthread_join(tids[i], NULL)) != 0)
+				errmsg_exit1("pthread_join failed, %s\n",
+					strerror(r));
+		xfree(tids);
+	}
+	if (ndirs > 0) {
+		tw_init(&tw, TW_RECURSE, nthrs, TW_BUFSZ, walk_entry, NULL);
+		tw_run(&tw, dirs, ndirs);
+		for (i = 0; i < nthrs; i++)
+			g.stats[0].ps_errors += tw.tw_workers[i].tw_errors;
+		tw_free(&tw);
+	}
+	ns = bench_nsec() - start;
+
+	memset(&tot, 0, sizeof(tot));
+	for (i = 0; i < nthrs; i++) {
+		tot.ps_files += g.stats[i].ps_files;
+		tot.ps_pages += g.stats[i].ps_pages;
+		tot.ps_resident += g.stats[i].ps_resident;
+		tot.ps_bytes += g.stats[i].ps_bytes;
+		tot.ps_errors += g.stats[i].ps_errors;
+		xfree(g.stats[i].ps_vec);
+	}
+	printf("%10s %ju\n", "Files:", (uintmax_t)tot.ps_files);
+	printf("%10s %ju pages, %.1f MiB\n", "Size:", (uintmax_t)tot.ps_pages,
+		(double)tot.ps_bytes / MIB);
+	printf("%10s %ju pages, %.1f MiB, %.1f%%\n", "Resident:",
+		(uintmax_t)tot.ps_resident,
+		(double)tot.ps_resident * (double)g.pagesz / MIB,
+		tot.ps_pages == 0 ? 0.0 :
+		(double)tot.ps_resident * 100.0 / (double)tot.ps_pages);
+	if (tot.ps_errors > 0)
+		printf("%10s %ju\n", "Errors:", (uintmax_t)tot.ps_errors);
+	printf("%10s %.3f s\n", "Elapsed:", bench_secs(ns));
+	fflush(stdout);
+
+	if (g.flags & PT_LOCK) {
+		printf("Locked, waiting for a signal\n");
+		fflush(stdout);
+		signal(SIGINT, onsig);
+		signal(SIGTERM, onsig);
+		signal(SIGHUP, onsig);
+		pause();
+	}
+
+	xfree(g.files);
+	xfree(dirs);
+	xfree(g.stats);
+	exit(tot.ps_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static void *
+file_thread(void *arg)
+{
+	struct ptstat *ps = arg;
+	int i;
+
+	while ((i = atomic_fetch_add(&g.next, 1)) < g.nfiles)
+		touch_file(ps, AT_FDCWD, g.files[i], g.files[i]);
+
+	return NULL;
+}
+
+static int
+walk_entry(struct twent *te, void *arg)
+{
+	(void)arg;
+	if (te->te_type == DT_REG)
+		touch_file(&g.stats[te->te_worker], te->te_dirfd, te->te_name,
+			te->te_path);
+
+	return 1;
+}
+
+/*
+ * Applies the -t, -l or -e action to 'name' relative to 'dirfd' and counts
+ * its resident pages.
+ */
+static void
+touch_file(struct ptstat *ps, int dirfd, const char *name, const char *path)
+{
+	int fd, flags;
+	off_t off;
+	size_t len, npages, i, in = 0;
+	struct stat st;
+	char *addr = NULL;
+	volatile char sink;
+
+	/*
+	 * The walker does not follow links, so neither does opening what it
+	 * found; an operand (dirfd is AT_FDCWD) was classified with stat() and
+	 * a link to a file is followed like the file.
+	 */
+	flags = O_RDONLY | (dirfd != AT_FDCWD ? O_NOFOLLOW : 0);
+
+	/* Inspecting the cache should not update the access times */
+#ifdef O_NOATIME
+	fd = openat(dirfd, name, flags | O_NOATIME);
+	if (fd == -1 && errno == EPERM)
+#endif
+		fd = openat(dirfd, name, flags);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "open '%s' failed, %s\n", path, ERR_MSG);
+		ps->ps_errors++;
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		close(fd);
+		return;
+	}
+	ps->ps_files++;
+	ps->ps_bytes += st.st_size;
+	ps->ps_pages += (st.st_size + g.pagesz - 1) / g.pagesz;
+
+	if ((g.flags & PT_EVICT) &&
+		(errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) != 0) {
+		fprintf(stderr, "posix_fadvise '%s' failed, %s\n", path,
+			ERR_MSG);
+		ps->ps_errors++;
+	}
+
+	/* A locked file stays mapped as a whole until the process exits */
+	if ((g.flags & PT_LOCK) && st.st_size > 0) {
+		addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			fprintf(stderr, "mmap '%s' failed, %s\n", path,
+				ERR_MSG);
+			ps->ps_errors++;
+			close(fd);
+			return;
+		}
+		if (mlock(addr, st.st_size) == -1) {
+			fprintf(stderr, "mlock '%s' failed, %s\n", path,
+				ERR_MSG);
+			ps->ps_errors++;
+		}
+	}
+
+	for (off = 0; off < st.st_size; off += len) {
+		len = MIN(st.st_size - off, PT_WINDOW);
+		npages = (len + g.pagesz - 1) / g.pagesz;
+
+		if (g.flags & PT_LOCK) {
+			if (mincore(addr + off, len, (void *)ps->ps_vec) == -1)
+				errmsg_exit1("mincore failed, %s\n", ERR_MSG);
+		} else {
+			addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off);
+			if (addr == MAP_FAILED) {
+				fprintf(stderr, "mmap '%s' failed, %s\n", path,
+					ERR_MSG);
+				ps->ps_errors++;
+				break;
+			}
+			if (g.flags & PT_WARM) {
+				(void)madvise(addr, len, MADV_WILLNEED);
+				for (i = 0; i < npages; i++)
+					sink = addr[i * g.pagesz];
+				(void)sink;
+			}
+			if (mincore(addr, len, (void *)ps->ps_vec) == -1)
+				errmsg_exit1("mincore failed, %s\n", ERR_MSG);
+			munmap(addr, len);
+		}
+
+		for (i = 0; i < npages; i++)
+			in += ps->ps_vec[i] & 1;
+	}
+	ps->ps_resident += in;
+	close(fd);
+
+	if (g.verbose)
+		printf("%s %zu/%jd %.1f%%\n", path, in,
+			(intmax_t)(st.st_size + g.pagesz - 1) / g.pagesz,
+			st.st_size == 0 ? 0.0 : (double)in * 100.0 /
+			(double)((st.st_size + g.pagesz - 1) / g.pagesz));
+}
+
+static void
+onsig(int sig)
+{
+	(void)sig;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-t | -l | -e] [-j threads] [-v] "
+		"file|dir ...\n", pname);
+	fprintf(stderr, "-t: read the files into the page cache.\n");
+	fprintf(stderr, "-l: read and mlock the files, then wait for a "
+		"signal.\n");
+	fprintf(stderr, "-e: evict the files from the page cache.\n");
+	fprintf(stderr, "-j: threads to scan with (default 1).\n");
+	fprintf(stderr, "-v: print the residency of each file.\n");
+	exit(EXIT_FAILURE);
+}
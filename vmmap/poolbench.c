@@ -0,0 +1,207 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2025 Jianping Duan <static.integer@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#include "unibsd.h"
+#include "benchutil.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "objpool.h"
+
+/*
+ * Fixed-size allocation churn, malloc(3) against an object pool. Each thread
+ * does 'nops' operations on a set of slots: allocate an object into a slot,
+ * write it, and free what the slot held before. With -x the slots are shared
+ * by all the threads and swapped atomically, so most objects are freed by
+ * another thread than the one that allocated them.
+ */
+enum { PB_MALLOC, PB_POOL, PB_NMODES };
+static const char *pbnames[PB_NMODES] = { "malloc", "pool" };
+
+static struct {
+	int		mode;
+	long		nops;
+	int		nslots;		/* Per thread */
+	size_t		size;
+	bool		shared;
+	void *_Atomic	*slots;
+	struct objpool	pool;
+} g = {
+	.nops = 2000000,
+	.nslots = 1024,
+	.size = 64
+};
+
+struct pbthr {
+	pthread_t	pt_tid;
+	int		pt_id;
+	int		pt_nthrs;
+} __attribute__((aligned(64)));
+
+static void * churn(void *);
+static void usage_info(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int op, nthrs = 1, i, r, m;
+	long nslots;
+	struct pbthr *ta;
+	struct opstats st;
+	uint64_t t0, ns, total;
+
+	while ((op = getopt(argc, argv, "j:n:w:s:x")) != -1) {
+		switch (op) {
+		case 'j':
+			nthrs = getlong(optarg, GN_GT_0);
+			break;
+		case 'n':
+			g.nops = getlong(optarg, GN_GT_0);
+			break;
+		case 'w':
+			g.nslots = getlong(optarg, GN_GT_0);
+			break;
+		case 's':
+			if ((g.size = getsize(optarg)) == 0)
+				usage_info(argv[0]);
+			break;
+		case 'x':
+			g.shared = true;
+			break;
+		default:
+			usage_info(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage_info(argv[0]);
+
+	nslots = (long)nthrs * g.nslots;
+	ta = xcalloc(nthrs, sizeof(struct pbthr));
+	total = (uint64_t)nthrs * g.nops;
+	printf("%d threads x %ld ops, %zu-byte objects, %d slots per thread%s\n",
+		nthrs, g.nops, g.size, g.nslots, g.shared ?
+		", shared" : "");
+	printf("%-8s %10s %12s\n", "", "ns/op", "ops/s");
+
+	for (m = 0; m < PB_NMODES; m++) {
+		g.mode = m;
+		g.slots = xcalloc(nslots, sizeof(void *));
+		if (m == PB_POOL)
+			op_init(&g.pool, g.size, OP_CACHEALIGN);
+
+		t0 = bench_nsec();
+		for (i = 0; i < nthrs; i++) {
+			ta[i].pt_id = i;
+			ta[i].pt_nthrs = nthrs;
+			if ((r = pthread_create(&ta[i].pt_tid, NULL, churn,
+				&ta[i])) != 0)
+				errmsg_exit1("pthread_create failed, %s\n",
+					strerror(r));
+		}
+		for (i = 0; i < nthrs; i++)
+			if ((r = pthread_join(ta[i].pt_tid, NULL)) != 0)
+				errmsg_exit1("pthread_join failed, %s\n",
+					strerror(r));
+		ns = bench_nsec() - t0;
+
+		printf("%-8s %10.1f %12.0f\n", pbnames[m],
+			(double)ns / (double)total,
+			(double)total / bench_secs(ns));
+
+		if (m == PB_POOL) {
+			/* The objects still in the slots are live */
+			op_getstats(&g.pool, &st);
+			printf("%-8s %ju allocs (%.0f/s), %ju live, %ju carved "
+				"(%.1f%% occupied), %.1f MiB of slabs\n", "",
+				(uintmax_t)st.os_allocs,
+				(double)st.os_allocs / bench_secs(ns),
+				(uintmax_t)st.os_live, (uintmax_t)st.os_carved,
+				st.os_carved == 0 ? 0.0 : (double)st.os_live *
+				100.0 / (double)st.os_carved,
+				(double)st.os_bytes / MIB);
+			printf("%-8s depot: %ju magazines taken, %ju given\n",
+				"", (uintmax_t)st.os_depotgets,
+				(uintmax_t)st.os_depotputs);
+			op_destroy(&g.pool);
+		} else {
+			for (i = 0; i < nslots; i++)
+				free(g.slots[i]);
+		}
+		xfree(g.slots);
+	}
+
+	xfree(ta);
+	exit(EXIT_SUCCESS);
+}
+
+static void *
+churn(void *arg)
+{
+	struct pbthr *pt = arg;
+	unsigned int seed = pt->pt_id + 1;
+	long i, n, base, span;
+	void *obj, *old;
+
+	/* Own slots, or all of them */
+	span = g.shared ? (long)pt->pt_nthrs * g.nslots : g.nslots;
+	base = g.shared ? 0 : (long)pt->pt_id * g.nslots;
+
+	for (i = 0; i < g.nops; i++) {
+		n = base + rand_r(&seed) % span;
+		if (g.mode == PB_POOL)
+			obj = op_alloc(&g.pool);
+		else if ((obj = malloc(g.size)) == NULL)
+			errmsg_exit1("malloc failed, %s\n", ERR_MSG);
+		memset(obj, (int)i, g.size);
+
+		old = atomic_exchange_explicit(&g.slots[n], obj,
+			memory_order_acq_rel);
+		if (g.mode == PB_POOL)
+			op_free(&g.pool, old);
+		else
+			free(old);
+	}
+
+	return NULL;
+}
+
+static void
+usage_info(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-n ops] [-w slots] "
+		"[-s size] [-x]\n", pname);
+	fprintf(stderr, "-j: threads (default 1).\n");
+	fprintf(stderr, "-n: operations per thread (default 2000000).\n");
+	fprintf(stderr, "-w: slots per thread (default 1024).\n");
+	fprintf(stderr, "-s: object size (default 64).\n");
+	fprintf(stderr, "-x: share the slots, so objects change threads.\n");
+	exit(EXIT_FAILURE);
+}